@@ -0,0 +1,47 @@
+#!/bin/bash
+# Times a full build of N small independent modules with one compiler call per
+# file and with batched calls (build.batch = true).
+#
+# Usage: scripts/bench_batch.sh [N] [fortean] [build args, e.g. -j]
+
+YELLOW='\033[0;33m'
+GREEN='\033[0;32m'
+RESET='\033[0m'
+
+N=${1:-5000}
+FORTEAN=$(realpath "${2:-$(command -v fortean)}")
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+ARGS="$*"
+
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+"$FORTEAN" new bench >/dev/null || exit 1
+cd bench || exit 1
+chmod +x bin/* 2>/dev/null
+
+echo -e "${YELLOW}Generating:${RESET} $N modules in $DIR/bench"
+for ((i = 0; i < N; i++)); do
+    printf 'module m%d\ncontains\nsubroutine s%d(x)\nreal, intent(inout) :: x\nx = x + %d.0\nend subroutine\nend module\n' \
+        "$i" "$i" "$i" > "src/m$i.f90"
+done
+{
+    echo "program main"
+    for ((i = 0; i < N; i++)); do echo "use m$i"; done
+    echo "real :: x"
+    echo "x = 0.0"
+    echo 'print *, "bench", x'
+    echo "end program"
+} > src/main.f90
+
+sed -i 's/^\[build\]$/[build]\nbatch = false/' Fortean.toml
+
+for mode in false true; do
+    sed -i "s/^batch = .*/batch = $mode/" Fortean.toml
+    start=$(date +%s.%N)
+    "$FORTEAN" build -r $ARGS > build_$mode.log 2>&1 || { echo "Build failed, see $DIR/bench/build_$mode.log"; exit 1; }
+    end=$(date +%s.%N)
+    echo -e "${GREEN}batch = $mode:${RESET} $(awk "BEGIN { printf \"%.2f\", $end - $start }") s"
+done
+
+rm -rf "$DIR"
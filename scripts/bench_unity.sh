@@ -0,0 +1,82 @@
+#!/bin/bash
+# Compares the build time and the run time of a normal build, a --unity build
+# and an -flto build of a generated project whose hot loop calls small accessor
+# functions living in other modules.
+#
+# Usage: scripts/bench_unity.sh [modules] [fortean] [build args, e.g. -j]
+
+YELLOW='\033[0;33m'
+GREEN='\033[0;32m'
+RESET='\033[0m'
+
+N=${1:-200}
+FORTEAN=$(realpath "${2:-$(command -v fortean)}")
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+ARGS="$*"
+
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+"$FORTEAN" new bench >/dev/null || exit 1
+cd bench || exit 1
+chmod +x bin/* 2>/dev/null
+
+echo -e "${YELLOW}Generating:${RESET} $N accessor modules in $DIR/bench"
+for ((i = 0; i < N; i++)); do
+    cat > "src/acc$i.f90" <<FORTRAN
+module acc$i
+  implicit none
+  type :: box$i
+    real(8) :: v = $i.0d0
+  end type
+contains
+  pure function get$i(b) result(x)
+    type(box$i), intent(in) :: b
+    real(8) :: x
+    x = b%v
+  end function
+  pure function step$i(x) result(y)
+    real(8), intent(in) :: x
+    real(8) :: y
+    y = x * 0.999999d0 + 1.0d-3
+  end function
+end module
+FORTRAN
+done
+{
+    echo "program main"
+    for ((i = 0; i < N; i++)); do echo "  use acc$i"; done
+    echo "  implicit none"
+    for ((i = 0; i < N; i++)); do echo "  type(box$i) :: b$i"; done
+    echo "  real(8) :: s"
+    echo "  integer :: k"
+    echo "  s = 0.0d0"
+    echo "  do k = 1, 200000"
+    for ((i = 0; i < N; i++)); do echo "    s = step$i(s) + get$i(b$i) * 1.0d-9"; done
+    echo "  end do"
+    echo '  print *, "bench", s'
+    echo "end program"
+} > src/main.f90
+
+cat >> Fortean.toml <<TOML
+
+[profile.lto]
+add = ["-flto"]
+TOML
+
+run_case() {
+    local name=$1
+    shift
+    start=$(date +%s.%N)
+    "$FORTEAN" build -r "$@" $ARGS > "build_$name.log" 2>&1 || { echo "Build failed, see $DIR/bench/build_$name.log"; exit 1; }
+    mid=$(date +%s.%N)
+    ./bench > "run_$name.log" || { echo "Run failed"; exit 1; }
+    end=$(date +%s.%N)
+    echo -e "${GREEN}$name:${RESET} build $(awk "BEGIN { printf \"%.2f\", $mid - $start }") s, run $(awk "BEGIN { printf \"%.2f\", $end - $mid }") s"
+}
+
+run_case normal
+run_case unity --unity
+run_case lto --profile lto
+
+rm -rf "$DIR"
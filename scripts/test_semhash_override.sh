@@ -0,0 +1,70 @@
+#!/bin/bash
+# Regression test for semantic-hash with [[build.override]] flags: a directory
+# that only gets -cpp from an override must keep the case of its macros, so
+# switching BUMP for bump recompiles it and changes what the program prints.
+#
+# Usage: scripts/test_semhash_override.sh [fortean]
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+RESET='\033[0m'
+
+FORTEAN=$(realpath "${1:-$(command -v fortean)}")
+
+DIR=$(mktemp -d)
+cd "$DIR" || exit 1
+"$FORTEAN" new app >/dev/null || exit 1
+cd app || exit 1
+chmod +x bin/* 2>/dev/null
+
+fail() {
+    echo -e "${RED}FAIL:${RESET} $1, see $DIR/app"
+    exit 1
+}
+
+#-cpp only for src/sub/, and sources hashed by their tokens.
+sed -i 's/"-cpp", //; s/^compiler = "gfortran"$/&\nsemantic-hash = true/' Fortean.toml
+cat >> Fortean.toml <<TOML
+
+[[build.override]]
+files = ["src/sub/"]
+add   = ["-cpp"]
+TOML
+
+mkdir -p src/sub
+cat > src/sub/geom.f90 <<FORTRAN
+#define BUMP 1.0_dp
+#define bump 100.0_dp
+module geom
+  implicit none
+  integer, parameter :: dp = kind(1.0d0)
+contains
+  pure function area(x) result(a)
+    real(dp), intent(in) :: x
+    real(dp) :: a
+    a = x * x
+  end function
+  pure function shifted(x) result(s)
+    real(dp), intent(in) :: x
+    real(dp) :: s
+    s = area(x) + BUMP
+  end function
+end module
+FORTRAN
+cat > src/main.f90 <<FORTRAN
+program main
+  use geom
+  implicit none
+  print '(f6.1)', shifted(2.0_dp)
+end program
+FORTRAN
+
+"$FORTEAN" build > build_1.log 2>&1 || fail "the first build failed"
+[ "$(./app | tr -d ' ')" = "5.0" ] || fail "the first build printed $(./app)"
+
+sed -i 's/area(x) + BUMP/area(x) + bump/' src/sub/geom.f90
+"$FORTEAN" build > build_2.log 2>&1 || fail "the second build failed"
+[ "$(./app | tr -d ' ')" = "104.0" ] || fail "BUMP -> bump did not recompile, the program printed $(./app)"
+
+echo -e "${GREEN}PASS:${RESET} semantic-hash follows the -cpp of [[build.override]]"
+rm -rf "$DIR"
@@ -7,9 +7,18 @@
 //Fortean files
 #include "fortean_levenshtein.h"
 #include "fortean_build.h"
+#include "fortean_pgo.h"
+#include "fortean_tune.h"
+#include "fortean_compare.h"
+#include "fortean_worker.h"
+#include "fortean_daemon.h"
+#include "fortean_watch.h"
+#include "fortean_cas.h"
+#include "fortean_stats.h"
 #include "fortean_cli_args.h"
 #include "fortean_helper_fn.h"
 #include "fortean_toml.h"
+#include "fortean_cmd.h"
 
 #ifdef _WIN32
     #define MKDIR(path) _mkdir(path)
@@ -206,6 +215,11 @@ int generate_project_toml(const char *project_name) {
         "]\n\n"
         "obj_dir = \"obj\"\n"
         "mod_dir = \"mod\"\n\n"
+        "#Per-file flags. Entries apply in order to sources matching the globs.\n"
+        "#[[build.override]]\n"
+        "#files  = [\"src/generated/\", \"*_table.f90\"]\n"
+        "#remove = [\"-O*\"]\n"
+        "#add    = [\"-O0\"]\n\n"
         "[search]\n"
         "deep = [\"src\"]\n"
         "#shallow = [\"lib\", \"include\"]\n\n"
@@ -349,6 +363,29 @@ int create_main_f90(const char *project_dir) {
 //     return 0;
 // }
 
+//Find the [[bin]] table with this name. Returns its index or -1.
+static int find_bin(fortean_toml_t *cfg, const char *name, int *bin_count) {
+    toml_array_t *arr = fortean_toml_get_table_array(cfg, "bin");
+    int n = arr ? toml_array_nelem(arr) : 0;
+    if (bin_count) *bin_count = n;
+    for (int i = 0; name && i < n; i++) {
+        toml_datum_t bin_name = toml_string_in(toml_table_at(arr, i), "name");
+        if (!bin_name.ok) continue;
+        int match = strcmp(bin_name.u.s, name) == 0;
+        free(bin_name.u.s);
+        if (match) return i;
+    }
+    return -1;
+}
+
+//Name of the [[bin]] at index idx (caller must free)
+static char *bin_name_at(fortean_toml_t *cfg, int idx) {
+    toml_array_t *arr = fortean_toml_get_table_array(cfg, "bin");
+    if (!arr) return NULL;
+    toml_datum_t bin_name = toml_string_in(toml_table_at(arr, idx), "name");
+    return bin_name.ok ? bin_name.u.s : NULL;
+}
+
 int main(int argc, char *argv[]) {
 
     //parse the cli arguments into the table.
@@ -365,14 +402,29 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    //Parallel build flag.
-    int parallel_build = 0;
+    //Build options. Incremental by default, serial unless -j is given.
+    fortean_build_opts_t opts = {0};
+    opts.incremental_build = 1;
 
-    //Incremental build flag
-    int incremental_build = 1;
+    //Named profile from --profile <name>
+    if(hashmap_contains(&args.args_map, "--profile")){
+        int profile_index = return_index_for_key(&args.args_map, "--profile");
+        opts.profile      = return_key_for_index(&args.args_map, profile_index+1);
+        if(opts.profile == NULL){
+            print_error("No profile name given. Syntax is \"fortean build --profile release\"");
+            return 1;
+        }
+    }
 
-    //Build only a library flag
-    int lib_only = 0;
+    //Chrome trace of the builds from --trace <file>
+    if(hashmap_contains(&args.args_map, "--trace")){
+        int trace_index = return_index_for_key(&args.args_map, "--trace");
+        opts.trace_file = return_key_for_index(&args.args_map, trace_index+1);
+        if(opts.trace_file == NULL){
+            print_error("No trace file given. Syntax is \"fortean build --trace build.json\"");
+            return 1;
+        }
+    }
 
     //Project dir
     const char *project_dir;
@@ -422,19 +474,36 @@ int main(int argc, char *argv[]) {
     if (hashmap_contains_key_and_index(&args.args_map, "build", 1)) {
 
         //Check if we are doing a parallel build.
-        if(hashmap_contains(&args.args_map, "-j")) parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
 
         //Check if we are allowing an incremental build.
         if(hashmap_contains(&args.args_map, "-r") || hashmap_contains(&args.args_map, "--rebuild") ){
-            incremental_build = 0;
+            opts.incremental_build = 0;
         }
 
         //Check if we are building a lib only
-        if(hashmap_contains(&args.args_map, "--lib")) lib_only = 1;
+        if(hashmap_contains(&args.args_map, "--lib")) opts.lib_only = 1;
+
+        //Compile the sources as a few concatenated units
+        if(hashmap_contains(&args.args_map, "--unity")) opts.unity = 1;
+
+        //Print why every source is compiled, and with --dry-run only that
+        if(hashmap_contains(&args.args_map, "--explain")) opts.explain = 1;
+        if(hashmap_contains(&args.args_map, "--dry-run")) opts.dry_run = 1;
+
+        //Build a single [[bin]] target
+        if(hashmap_contains(&args.args_map, "--bin")){
+            int bin_index = return_index_for_key(&args.args_map, "--bin");
+            opts.bin      = return_key_for_index(&args.args_map, bin_index+1);
+            if(opts.bin == NULL){
+                print_error("No binary name given. Syntax is \"fortean build --bin name\"");
+                return 1;
+            }
+        }
 
 
         //Run the build
-        fortean_build_project_incremental(parallel_build,incremental_build,lib_only);
+        fortean_build_project_incremental(&opts);
 
         //Check if we want to go through a makefile. This is deprecated now that everything works? 
         // if(hashmap_contains(&args.args_map, "-m")){
@@ -448,6 +517,220 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    //Profile guided optimisation: instrumented build, training runs, optimised build.
+    if (hashmap_contains_key_and_index(&args.args_map, "pgo", 1)) {
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "-r") || hashmap_contains(&args.args_map, "--rebuild") ){
+            opts.incremental_build = 0;
+        }
+        if(hashmap_contains(&args.args_map, "--unity")) opts.unity = 1;
+        if(hashmap_contains(&args.args_map, "--bin")){
+            int bin_index = return_index_for_key(&args.args_map, "--bin");
+            opts.bin      = return_key_for_index(&args.args_map, bin_index+1);
+            if(opts.bin == NULL){
+                print_error("No binary name given. Syntax is \"fortean pgo --bin name\"");
+                return 1;
+            }
+        }
+
+        //--use rebuilds with the recorded profile without training again.
+        return fortean_pgo_run(&opts, hashmap_contains(&args.args_map, "--use")) == 0 ? 0 : 1;
+    }
+
+    //Flag autotuner: build and time every [tune] candidate.
+    if (hashmap_contains_key_and_index(&args.args_map, "tune", 1)) {
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "--bin")){
+            int bin_index = return_index_for_key(&args.args_map, "--bin");
+            opts.bin      = return_key_for_index(&args.args_map, bin_index+1);
+            if(opts.bin == NULL){
+                print_error("No binary name given. Syntax is \"fortean tune --bin name\"");
+                return 1;
+            }
+        }
+        return fortean_tune_run(&opts) == 0 ? 0 : 1;
+    }
+
+    //Compilation cache shared between projects.
+    if (hashmap_contains_key_and_index(&args.args_map, "cache", 1)) {
+        if (hashmap_contains_key_and_index(&args.args_map, "stats", 2)) return fortean_cas_stats() == 0 ? 0 : 1;
+        print_error("Unknown cache command. Syntax is \"fortean cache stats\"");
+        return 1;
+    }
+
+    //Slowest files, memory use and build time trends from the history.log of the profile.
+    if (hashmap_contains_key_and_index(&args.args_map, "stats", 1)) {
+        if(hashmap_contains(&args.args_map, "--unity")) opts.unity = 1;
+        int builds = 10;
+        if(hashmap_contains(&args.args_map, "--builds")){
+            int builds_index = return_index_for_key(&args.args_map, "--builds");
+            const char *n    = return_key_for_index(&args.args_map, builds_index+1);
+            builds           = n ? atoi(n) : 0;
+            if(builds < 1){
+                print_error("No build count given. Syntax is \"fortean stats --builds 20\"");
+                return 1;
+            }
+        }
+        return fortean_stats_run(&opts, builds) == 0 ? 0 : 1;
+    }
+
+    //HTTP server for [cache] remote, backed by a directory.
+    if (hashmap_contains_key_and_index(&args.args_map, "cache-server", 1)) {
+        const char *listen_on = "127.0.0.1:8080";
+        const char *dir       = NULL;
+        if(hashmap_contains(&args.args_map, "--listen")){
+            int listen_index = return_index_for_key(&args.args_map, "--listen");
+            listen_on        = return_key_for_index(&args.args_map, listen_index+1);
+            if(listen_on == NULL){
+                print_error("No address given. Syntax is \"fortean cache-server --listen host:port\"");
+                return 1;
+            }
+        }
+        if(hashmap_contains(&args.args_map, "--dir")){
+            int dir_index = return_index_for_key(&args.args_map, "--dir");
+            dir           = return_key_for_index(&args.args_map, dir_index+1);
+            if(dir == NULL){
+                print_error("No directory given. Syntax is \"fortean cache-server --dir path\"");
+                return 1;
+            }
+        }
+        return fortean_cas_serve(listen_on, dir) == 0 ? 0 : 1;
+    }
+
+    //Compile server for the [[worker]] tables of other machines.
+    if (hashmap_contains_key_and_index(&args.args_map, "worker", 1)) {
+        const char *listen_on = "127.0.0.1:7070";
+        int slots             = fortean_cpu_count();
+        const char *compilers = "gfortran";
+        if(hashmap_contains(&args.args_map, "--listen")){
+            int listen_index = return_index_for_key(&args.args_map, "--listen");
+            listen_on        = return_key_for_index(&args.args_map, listen_index+1);
+            if(listen_on == NULL){
+                print_error("No address given. Syntax is \"fortean worker --listen host:port\"");
+                return 1;
+            }
+        }
+        if(hashmap_contains(&args.args_map, "--jobs")){
+            int jobs_index = return_index_for_key(&args.args_map, "--jobs");
+            const char *n  = return_key_for_index(&args.args_map, jobs_index+1);
+            slots          = n ? atoi(n) : 0;
+            if(slots < 1){
+                print_error("No job count given. Syntax is \"fortean worker --jobs 8\"");
+                return 1;
+            }
+        }
+        if(hashmap_contains(&args.args_map, "--compiler")){
+            int compiler_index = return_index_for_key(&args.args_map, "--compiler");
+            compilers          = return_key_for_index(&args.args_map, compiler_index+1);
+            if(compilers == NULL){
+                print_error("No compiler given. Syntax is \"fortean worker --compiler gfortran,ifx\"");
+                return 1;
+            }
+        }
+        return fortean_worker_serve(listen_on, slots, compilers) == 0 ? 0 : 1;
+    }
+
+    //Background server that answers up to date builds from its file watches.
+    if (hashmap_contains_key_and_index(&args.args_map, "daemon", 1)) {
+        const char *command = return_key_for_index(&args.args_map, 2);
+        if(command == NULL){
+            print_error("No daemon command given. Syntax is \"fortean daemon start|stop|status|run\"");
+            return 1;
+        }
+        return fortean_daemon_command(command) == 0 ? 0 : 1;
+    }
+
+    //Write the build as a build.ninja or Makefile for runners that only have ninja or make.
+    if (hashmap_contains_key_and_index(&args.args_map, "gen", 1)) {
+        opts.gen_format = return_key_for_index(&args.args_map, 2);
+        if(opts.gen_format == NULL || (strcmp(opts.gen_format, "ninja") != 0 && strcmp(opts.gen_format, "make") != 0)){
+            print_error("No build file format given. Syntax is \"fortean gen ninja|make\"");
+            return 1;
+        }
+        opts.gen_path = strcmp(opts.gen_format, "ninja") == 0 ? "build.ninja" : "Makefile";
+        if(hashmap_contains(&args.args_map, "--out")){
+            int out_index = return_index_for_key(&args.args_map, "--out");
+            opts.gen_path = return_key_for_index(&args.args_map, out_index+1);
+            if(opts.gen_path == NULL){
+                print_error("No file name given. Syntax is \"fortean gen ninja --out build.ninja\"");
+                return 1;
+            }
+        }
+        if(hashmap_contains(&args.args_map, "--bin")){
+            int bin_index = return_index_for_key(&args.args_map, "--bin");
+            opts.bin      = return_key_for_index(&args.args_map, bin_index+1);
+            if(opts.bin == NULL){
+                print_error("No binary name given. Syntax is \"fortean gen make --bin name\"");
+                return 1;
+            }
+        }
+        if(hashmap_contains(&args.args_map, "--unity")){
+            print_error("Unity builds can't be written as a build file.");
+            return 1;
+        }
+        if(hashmap_contains(&args.args_map, "--lib")) opts.lib_only = 1;
+        return fortean_build_project_incremental(&opts) == 0 ? 0 : 1;
+    }
+
+    //Build on every change, optionally running the target or [watch] command afterwards.
+    if (hashmap_contains_key_and_index(&args.args_map, "watch", 1)) {
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "--unity")) opts.unity = 1;
+        if(hashmap_contains(&args.args_map, "--bin")){
+            int bin_index = return_index_for_key(&args.args_map, "--bin");
+            opts.bin      = return_key_for_index(&args.args_map, bin_index+1);
+            if(opts.bin == NULL){
+                print_error("No binary name given. Syntax is \"fortean watch --bin name\"");
+                return 1;
+            }
+        }
+        char run_cmd[512];
+        const char *command = NULL;
+        if(hashmap_contains(&args.args_map, "--run")){
+            fortean_toml_t cfg = {0};
+            if (fortean_toml_load(TOML_NAME, &cfg) != 0) {
+                print_error("Failed to load project.toml.");
+                return 1;
+            }
+            char *first   = opts.bin ? NULL : bin_name_at(&cfg, 0);
+            const char *target = opts.bin ? opts.bin : fortean_toml_get_profile_string(&cfg, opts.profile, "target");
+            if (!target) target = first;
+            if (target) snprintf(run_cmd, sizeof(run_cmd), "./%s", target);
+            free(first);
+            fortean_toml_free(&cfg);
+            if (!target) {
+                print_error("Missing 'build.target' in config.");
+                return 1;
+            }
+            command = run_cmd;
+        }
+        return fortean_watch_run(&opts, command) == 0 ? 0 : 1;
+    }
+
+    //Build with several compilers and compare build time, size and run time.
+    if (hashmap_contains_key_and_index(&args.args_map, "compare", 1)) {
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "--unity")) opts.unity = 1;
+        if(hashmap_contains(&args.args_map, "--bin")){
+            int bin_index = return_index_for_key(&args.args_map, "--bin");
+            opts.bin      = return_key_for_index(&args.args_map, bin_index+1);
+            if(opts.bin == NULL){
+                print_error("No binary name given. Syntax is \"fortean compare --bin name\"");
+                return 1;
+            }
+        }
+        const char *compilers = NULL;
+        if(hashmap_contains(&args.args_map, "--compilers")){
+            int index = return_index_for_key(&args.args_map, "--compilers");
+            compilers = return_key_for_index(&args.args_map, index+1);
+        }
+        if(compilers == NULL){
+            print_error("No compilers given. Syntax is \"fortean compare --compilers gfortran,flang-new\"");
+            return 1;
+        }
+        return fortean_compare_run(&opts, compilers) == 0 ? 0 : 1;
+    }
+
     //Run command
     if (hashmap_contains_key_and_index(&args.args_map, "run", 1)) {
 
@@ -459,62 +742,89 @@ int main(int argc, char *argv[]) {
             return -1;
         }
 
-        const char *target = fortean_toml_get_string(&cfg, "build.target");
-        if (!target) {
-            print_error("Missing 'build.target' in config.");
-            fortean_toml_free(&cfg);
-            return -1;
+        const char *target = fortean_toml_get_profile_string(&cfg, opts.profile, "target");
+        int bin_count      = 0;
+        find_bin(&cfg, NULL, &bin_count);
+        if (!target && !hashmap_contains(&args.args_map, "--bin")) {
+            if (bin_count == 1) {
+                target = bin_name_at(&cfg, 0);
+            } else if (bin_count > 1) {
+                print_error("Several [[bin]] targets in config, choose one with --bin name.");
+                fortean_toml_free(&cfg);
+                return -1;
+            } else {
+                print_error("Missing 'build.target' in config.");
+                fortean_toml_free(&cfg);
+                return -1;
+            }
         }
 
         //Check if we are doing a parallel build.
-        if(hashmap_contains(&args.args_map, "-j")) parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
 
         //Check if we are allowing an incremental build or forcing a full rebuild.
         if(hashmap_contains(&args.args_map, "-r") || hashmap_contains(&args.args_map, "--rebuild") ){
-            incremental_build = 0;
+            opts.incremental_build = 0;
         }
 
+        //Compile the sources as a few concatenated units
+        if(hashmap_contains(&args.args_map, "--unity")) opts.unity = 1;
+
         if(!hashmap_contains(&args.args_map, "--bin")){
 
-            //Then we may need a rebuild. The --bin flag JUST runs the current binary. 
-            //it does not rebuild or even consider if we need to. 
-            fortean_build_project_incremental(parallel_build,incremental_build,lib_only);
+            //Then we may need a rebuild.
+            fortean_build_project_incremental(&opts);
         }else{
 
             //Target a specific binary name in the top level directory of the project. 
-            //Might be the bin folder later on. 
+            //A [[bin]] target is built first (only what it needs), any other name
+            //JUST runs that binary without considering a rebuild.
             int bin_index         = return_index_for_key(&args.args_map, "--bin");
             const char* exe_name  = return_key_for_index(&args.args_map, bin_index+1);
             if(exe_name != NULL) target = exe_name;
+            if(exe_name != NULL && find_bin(&cfg, exe_name, NULL) >= 0){
+                opts.bin = exe_name;
+                fortean_build_project_incremental(&opts);
+            }
+        }
+        if(target == NULL){
+            print_error("No binary name given. Syntax is \"fortean run --bin name\"");
+            fortean_toml_free(&cfg);
+            return -1;
         }
 
         char exe[512];
         #ifdef _WIN32
             snprintf(exe,sizeof(exe),"%s.exe",target);
         #else
-            snprintf(exe,sizeof(exe),"%s",target);
+            snprintf(exe,sizeof(exe),"./%s",target);
         #endif
 
+        fortean_cmd_t run_cmd;
+        fortean_cmd_init(&run_cmd, exe);
+
         //Check if file exists first
         if(file_exists_generic(exe)) {
-            system(exe);
+            fortean_cmd_run(&run_cmd);
         }else{
 
             //Rebuild the project from scratch.
-            incremental_build = 0;
-            parallel_build    = 1;
-            fortean_build_project_incremental(parallel_build,incremental_build,lib_only);
+            opts.incremental_build = 0;
+            opts.parallel_build    = 1;
+            fortean_build_project_incremental(&opts);
 
             //Then check if the executable exists. If it does not, then print an error message. 
             if(file_exists_generic(exe)){
-                system(exe);
+                fortean_cmd_run(&run_cmd);
             }else{
                 char msg[256];
                 snprintf(msg,sizeof(msg),"Executable named %s not found",exe);
                 print_error(msg);
+                fortean_cmd_free(&run_cmd);
                 return -1;
             }
         }
+        fortean_cmd_free(&run_cmd);
     }
     return 0;
 }
@@ -0,0 +1,202 @@
+#include "fortean_archive.h"
+#include "fortean_hash.h"
+#include "fortean_cmd.h"
+#include "fortean_objcache.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+//First manifest line, so changing the archive or the thin setting rewrites it
+static void manifest_header(const fortean_archive_t *ar, char *buf, size_t size) {
+    snprintf(buf, size, "%s %s\n", ar->lib_path, ar->thin ? "thin" : "full");
+}
+
+//Load "<signature> <object>" lines into map (signature strings are hashed).
+//Returns 0 when the manifest matches this archive.
+static int load_manifest(const fortean_archive_t *ar, HashEntry *map[]) {
+    FILE *fp = fopen(ar->manifest, "r");
+    if (!fp) return -1;
+
+    char line[2048];
+    char header[1024];
+    manifest_header(ar, header, sizeof(header));
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, header) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *space = strchr(line, ' ');
+        if (!space) continue;
+        *space = '\0';
+        hash_entry_put(map, space + 1, hash_str_fnv1a(line, FNV_SEED));
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int save_manifest(const fortean_archive_t *ar) {
+    FILE *fp = fopen(ar->manifest, "w");
+    if (!fp) {
+        print_error("Failed to save the archive manifest.");
+        return -1;
+    }
+    char header[1024];
+    manifest_header(ar, header, sizeof(header));
+    fputs(header, fp);
+    for (int i = 0; i < ar->object_count; i++) {
+        char sig[64];
+        fortean_file_signature(ar->objects[i], sig, sizeof(sig));
+        fprintf(fp, "%s %s\n", sig, ar->objects[i]);
+    }
+    fclose(fp);
+    return 0;
+}
+
+//Sort the objects into changed (new or different) and removed (in the manifest only).
+//Returns -1 when the archive has to be written from scratch.
+static int diff_members(const fortean_archive_t *ar, unsigned char *changed, int *changed_count,
+                        char ***removed, int *removed_count) {
+    HashEntry *prev[HASH_TABLE_SIZE] = {NULL};
+    *changed_count = 0;
+    *removed       = NULL;
+    *removed_count = 0;
+
+    struct stat st;
+    if (stat(ar->lib_path, &st) != 0 || load_manifest(ar, prev) != 0) {
+        free_prev_hash_table(prev);
+        return -1;
+    }
+
+    HashEntry *current[HASH_TABLE_SIZE] = {NULL};
+    for (int i = 0; i < ar->object_count; i++) {
+        char sig[64];
+        fortean_file_signature(ar->objects[i], sig, sizeof(sig));
+        HashEntry *entry = hash_entry_get(prev, ar->objects[i]);
+        changed[i] = !entry || entry->file_hash != hash_str_fnv1a(sig, FNV_SEED);
+        *changed_count += changed[i];
+        hash_entry_put(current, ar->objects[i], 1);
+    }
+
+    int res = 0;
+    for (int i = 0; i < HASH_TABLE_SIZE && res == 0; i++) {
+        for (HashEntry *entry = prev[i]; entry; entry = entry->next) {
+            if (hash_entry_get(current, entry->filename)) continue;
+            char **tmp = realloc(*removed, (*removed_count + 1) * sizeof(char *));
+            if (!tmp) {
+                res = -1;
+                break;
+            }
+            *removed = tmp;
+            (*removed)[(*removed_count)++] = strdup(entry->filename);
+        }
+    }
+    free_prev_hash_table(prev);
+    free_prev_hash_table(current);
+    return res;
+}
+
+static void free_list(char **list, int count) {
+    for (int i = 0; i < count; i++) free(list[i]);
+    free(list);
+}
+
+int fortean_archive_is_current(const fortean_archive_t *ar) {
+    unsigned char *changed = calloc(ar->object_count > 0 ? ar->object_count : 1, 1);
+    if (!changed) return 0;
+    char **removed    = NULL;
+    int changed_count = 0;
+    int removed_count = 0;
+    int res = diff_members(ar, changed, &changed_count, &removed, &removed_count);
+    free(changed);
+    free_list(removed, removed_count);
+    return res == 0 && changed_count == 0 && removed_count == 0;
+}
+
+//Run and print one ar command
+static int run_ar(fortean_cmd_t *cmd) {
+    char *str = fortean_cmd_string(cmd);
+    if (str) print_info(str);
+    free(str);
+    int ret = fortean_cmd_run(cmd);
+    fortean_cmd_free(cmd);
+    return ret;
+}
+
+//Member name of an object inside a regular archive
+static const char *member_name(const char *path) {
+    const char *name = path + strlen(path);
+    while (name > path && name[-1] != '/' && name[-1] != '\\') name--;
+    return name;
+}
+
+int fortean_archive_update(fortean_archive_t *ar) {
+    unsigned char *changed = calloc(ar->object_count > 0 ? ar->object_count : 1, 1);
+    if (!changed) {
+        print_error("Memory allocation error.");
+        return -1;
+    }
+    char **removed    = NULL;
+    int changed_count = 0;
+    int removed_count = 0;
+    int full = diff_members(ar, changed, &changed_count, &removed, &removed_count) != 0;
+
+    if (!full && changed_count == 0 && removed_count == 0) {
+        free(changed);
+        return 0;
+    }
+
+    //A thin archive only stores paths, so rewriting it costs no more than editing it.
+    if (!full && ar->thin && (changed_count > 0 || removed_count > 0)) full = 1;
+
+    int ret = 0;
+    fortean_cmd_t cmd;
+    if (full) {
+        remove(ar->lib_path);
+        fortean_cmd_init(&cmd, ar->archiver ? ar->archiver : "ar");
+        cmd.response_file = 1;
+        if (ar->thin) fortean_cmd_add(&cmd, "--thin");
+        fortean_cmd_add(&cmd, "rcs");
+        fortean_cmd_add(&cmd, ar->lib_path);
+        for (int i = 0; i < ar->object_count; i++) fortean_cmd_add(&cmd, ar->objects[i]);
+        ret = run_ar(&cmd);
+    } else {
+        if (removed_count > 0) {
+            fortean_cmd_init(&cmd, ar->archiver ? ar->archiver : "ar");
+            cmd.response_file = 1;
+            fortean_cmd_add(&cmd, "d");
+            fortean_cmd_add(&cmd, ar->lib_path);
+            for (int i = 0; i < removed_count; i++) fortean_cmd_add(&cmd, member_name(removed[i]));
+            ret = run_ar(&cmd);
+        }
+        if (ret == 0 && changed_count > 0) {
+            //"r" replaces the members with the same name and "s" refreshes the symbol index.
+            fortean_cmd_init(&cmd, ar->archiver ? ar->archiver : "ar");
+            cmd.response_file = 1;
+            fortean_cmd_add(&cmd, "rcs");
+            fortean_cmd_add(&cmd, ar->lib_path);
+            for (int i = 0; i < ar->object_count; i++) {
+                if (changed[i]) fortean_cmd_add(&cmd, ar->objects[i]);
+            }
+            ret = run_ar(&cmd);
+        }
+    }
+    free(changed);
+    free_list(removed, removed_count);
+
+    if (ret != 0) {
+        //Make sure the next build starts over instead of trusting a half written archive.
+        remove(ar->manifest);
+        return -1;
+    }
+    return save_manifest(ar);
+}
+
+void fortean_archive_free_objects(fortean_archive_t *ar) {
+    free_list(ar->objects, ar->object_count);
+    ar->objects      = NULL;
+    ar->object_count = 0;
+}
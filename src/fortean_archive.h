@@ -0,0 +1,26 @@
+#ifndef FORTEAN_ARCHIVE_H
+#define FORTEAN_ARCHIVE_H
+
+//Static library built from the project objects. The members and their file
+//signatures are kept in a manifest so later builds only touch what changed.
+typedef struct {
+    const char *lib_path;   // lib/<lib.target>
+    const char *manifest;   // .cache[/<profile>]/archive.dep
+    char **objects;         // Member objects in link order
+    int object_count;
+    int thin;               // Reference the objects in place instead of copying them
+    const char *archiver;   // ar program, e.g. gcc-ar for LTO objects (NULL for ar)
+    int status;             // Result of fortean_archive_update when run on a thread
+} fortean_archive_t;
+
+//Returns 1 if the archive holds exactly the current objects.
+int fortean_archive_is_current(const fortean_archive_t *ar);
+
+//Bring the archive up to date: removed members are deleted and changed ones replaced.
+//A missing archive, a switch of the thin setting or a thin archive with changes is
+//written from scratch. Returns 0 on success.
+int fortean_archive_update(fortean_archive_t *ar);
+
+void fortean_archive_free_objects(fortean_archive_t *ar);
+
+#endif // FORTEAN_ARCHIVE_H
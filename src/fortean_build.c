@@ -3,6 +3,23 @@
 #include "fortean_hash.h"
 #include "fortean_threads.h"
 #include "fortean_helper_fn.h"
+#include "fortean_flags.h"
+#include "fortean_graph.h"
+#include "fortean_fscan.h"
+#include "fortean_cmd.h"
+#include "fortean_archive.h"
+#include "fortean_objcache.h"
+#include "fortean_unity.h"
+#include "fortean_lto.h"
+#include "fortean_compiler.h"
+#include "fortean_cas.h"
+#include "fortean_worker.h"
+#include "fortean_daemon.h"
+#include "fortean_gen.h"
+#include "fortean_trace.h"
+#include "fortean_semhash.h"
+#include "fortean_scratch.h"
+#include "fortean_timeline.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,11 +29,10 @@
 
 #ifdef _WIN32
 #include <windows.h>
-#define popen _popen
-#define pclose _pclose
 #else
 #include <unistd.h>
 #include <limits.h>
+#include <dirent.h>
 #endif
 
 
@@ -32,80 +48,172 @@ static int dir_exists(const char *path) {
 }
 
 
+int file_exists(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (file) {
+        fclose(file);
+        return 1;  // File exists
+    }
+    return 0;  // File does not exist
+}
+
 //Figure out the path options.
 #ifdef _WIN32
     #define PATH_SEP '\\'
-    //Generate the hash file cache. 
-    const char* hash_cache_file = ".cache\\hash.dep";
-
-    //Depenency list 
-    const char* deps_file = ".cache\\topo.dep";
+    #define MAKE_DIR(path) _mkdir(path)
+    #include <direct.h>
 #else
     #define PATH_SEP '/'
-    //Generate the hash file cache. 
-    const char* hash_cache_file = ".cache/hash.dep";
+    #define MAKE_DIR(path) mkdir(path, 0755)
+#endif
 
-    //Depenency list 
-    const char* deps_file = ".cache/topo.dep";
+//Cache files (hash.dep, topo.dep, flags.dep) live in .cache, or in .cache/<profile>
+//for a named profile so switching profiles does not invalidate the other profile.
+static void cache_file_path(char *buf, size_t size, const char *profile, const char *name) {
+    if (profile) snprintf(buf, size, ".cache%c%s%c%s", PATH_SEP, profile, PATH_SEP, name);
+    else         snprintf(buf, size, ".cache%c%s", PATH_SEP, name);
+}
+
+//Profiles share the executable unless they set their own target, so remember
+//which profile linked it last and relink when switching. The manifest is a hash of
+//the link command and the contents of everything it links, so a rebuild that
+//reproduces the same objects does not relink.
+//The stamp file has one "<executable> <profile> <manifest>" line per linked executable.
+//A build linking into its own out_dir (fortean compare) keeps the stamp under stamp_key,
+//so builds running at the same time never write the same file.
+static int target_is_current(const char *target, const char *profile, const char *stamp_key, unsigned int manifest) {
+    char exe[1024];
+#ifdef _WIN32
+    snprintf(exe, sizeof(exe), "%s.exe", target);
+    if (!file_exists(exe) && !file_exists(target)) return 0;
+#else
+    snprintf(exe, sizeof(exe), "%s", target);
+    if (!file_exists(exe)) return 0;
 #endif
 
+    char link_stamp_file[512];
+    cache_file_path(link_stamp_file, sizeof(link_stamp_file), stamp_key, "target.dep");
+    FILE *fp = fopen(link_stamp_file, "r");
+    if (!fp) return 0;
+    char line[1024];
+    char expected[1024];
+    snprintf(expected, sizeof(expected), "%s %s %u\n", target, profile ? profile : "-", manifest);
+    int same = 0;
+    while (!same && fgets(line, sizeof(line), fp)) same = (strcmp(line, expected) == 0);
+    fclose(fp);
+    return same;
+}
 
-//This allows for nested src files in any number of directories
-//to be parsed into just the filename and thus we can put them in the
-//object directory. We only rebuild if the src changes, not the obj. 
-char *get_last_path_segment(const char *path) {
-    const char *end = path + strlen(path);
-    const char *p = end;
-    while (p > path && *(p - 1) != '/' && *(p - 1) != '\\') p--;
-    return strdup(p); 
+static void record_target_link(const char *target, const char *profile, const char *stamp_key, unsigned int manifest) {
+    char link_stamp_file[512];
+    cache_file_path(link_stamp_file, sizeof(link_stamp_file), stamp_key, "target.dep");
+
+    //Keep the lines of the other executables.
+    char *kept = NULL;
+    size_t kept_len = 0;
+    size_t name_len = strlen(target);
+    FILE *fp = fopen(link_stamp_file, "r");
+    if (fp) {
+        char line[1024];
+        while (fgets(line, sizeof(line), fp)) {
+            if (strncmp(line, target, name_len) == 0 && line[name_len] == ' ') continue;
+            size_t len = strlen(line);
+            char *tmp = realloc(kept, kept_len + len + 1);
+            if (!tmp) break;
+            kept = tmp;
+            memcpy(kept + kept_len, line, len + 1);
+            kept_len += len;
+        }
+        fclose(fp);
+    }
+
+    fp = fopen(link_stamp_file, "w");
+    if (fp) {
+        if (kept) fputs(kept, fp);
+        fprintf(fp, "%s %s %u\n", target, profile ? profile : "-", manifest);
+        fclose(fp);
+    }
+    free(kept);
 }
 
-// Worker thread: runs system() on a single command string
-void compile_system_worker(void *arg) {
-    char *cmd = (char *)arg;
-    int ret = system(cmd);
-    if (ret != 0) {
-        print_error("Compilation failed: %s\n");
+static int ensure_dir(const char *path) {
+    if (dir_exists(path)) return 0;
+    if (MAKE_DIR(path) == 0 || errno == EEXIST) return 0;
+    char msg[1300];
+    snprintf(msg, sizeof(msg), "Failed to create directory %s", path);
+    print_error(msg);
+    return -1;
+}
+
+//dir under the scratch directory of the project, or dir itself without one
+static void scratch_path(const char *scratch_root, const char *dir, char *buf, size_t size) {
+    if (!scratch_root) {
+        snprintf(buf, size, "%s", dir);
         return;
     }
-    return;
+    while (dir[0] == '.' && (dir[1] == '/' || dir[1] == '\\')) dir += 2;
+    while (dir[0] == '/' || dir[0] == '\\') dir++;
+    snprintf(buf, size, "%s%c%s", scratch_root, PATH_SEP, dir);
 }
 
-int file_exists(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file) {
-        fclose(file);
-        return 1;  // File exists
+static int copy_one_file(const char *src, const char *dest) {
+    FILE *in = fopen(src, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(dest, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
     }
-    return 0;  // File does not exist
+    char buf[65536];
+    size_t n;
+    int ok = 1;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) ok = fwrite(buf, 1, n, out) == n;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    return ok ? 0 : -1;
 }
 
-static char *run_command_capture(const char *cmd) {
-    FILE *pipe = popen(cmd, "r");
-    if (!pipe) {
-        print_error("Failed to run command.");
-        return NULL;
+//Copy the files (not the sub directories) of one directory into another. Objects are
+//copied rather than linked because the compiler rewrites them in place.
+static void copy_dir_files(const char *from, const char *to) {
+    char src[1024], dest[1024];
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", from);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return;
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        snprintf(src, sizeof(src), "%s%c%s", from, PATH_SEP, fd.cFileName);
+        snprintf(dest, sizeof(dest), "%s%c%s", to, PATH_SEP, fd.cFileName);
+        copy_one_file(src, dest);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(from);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        snprintf(src, sizeof(src), "%s%c%s", from, PATH_SEP, entry->d_name);
+        struct stat st;
+        if (stat(src, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        snprintf(dest, sizeof(dest), "%s%c%s", to, PATH_SEP, entry->d_name);
+        copy_one_file(src, dest);
     }
-    char *buffer = NULL;
-    size_t size = 0;
-    char chunk[512];
+    closedir(d);
+#endif
+}
 
-    while (fgets(chunk, sizeof(chunk), pipe)) {
-        size_t len = strlen(chunk);
-        char *newbuf = realloc(buffer, size + len + 1);
-        if (!newbuf) {
-            free(buffer);
-            pclose(pipe);
-            print_error("Memory allocation error.");
-            return NULL;
-        }
-        buffer = newbuf;
-        memcpy(buffer + size, chunk, len);
-        size += len;
-        buffer[size] = '\0';
-    }
-    pclose(pipe);
-    return buffer;
+
+//This allows for nested src files in any number of directories
+//to be parsed into just the filename and thus we can put them in the
+//object directory. We only rebuild if the src changes, not the obj. 
+char *get_last_path_segment(const char *path) {
+    const char *end = path + strlen(path);
+    const char *p = end;
+    while (p > path && *(p - 1) != '/' && *(p - 1) != '\\') p--;
+    return strdup(p); 
 }
 
 // Add flag to unique list if not already there
@@ -136,55 +244,1456 @@ int strcmp_case_insensitive(const char *ext, const char *target) {
     return (*ext == '\0' && *target == '\0') ? 0 : 1;
 }
 
-// Free a list of strings
-static void free_string_list(char **list, int count) {
-    if (!list) return;
-    for (int i = 0; i < count; i++) free(list[i]);
-    free(list);
+//Whole file in memory (caller must free), NULL when it cannot be read
+static char *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = len >= 0 ? malloc((size_t)len + 1) : NULL;
+    if (data && fread(data, 1, (size_t)len, fp) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (!data) return NULL;
+    data[len] = '\0';
+    *size = (size_t)len;
+    return data;
+}
+
+//The previous scanner output still describes the sources when every changed Fortran
+//source is one of its files and still exists.
+static int graph_covers(const char *topo_make, char **changed) {
+    for (int i = 0; changed[i]; i++) {
+        size_t len    = strlen(changed[i]);
+        const char *e = strrchr(changed[i], '.');
+        if (!e || (strcmp_case_insensitive(e, ".f90") != 0 && strcmp_case_insensitive(e, ".for") != 0)) continue;
+        if (!file_exists(changed[i])) return 0;
+        int listed = 0;
+        for (const char *p = topo_make; p && *p && !listed; p = strchr(p, '\n'), p = p ? p + 1 : NULL) {
+            listed = strncmp(p, changed[i], len) == 0 && p[len] == ':';
+        }
+        if (!listed) return 0;
+    }
+    return 1;
+}
+
+//The scanner takes its search directories as one comma separated argument (caller must free)
+static char *join_dir_list(char **dirs) {
+    size_t len = 1;
+    for (int i = 0; dirs[i]; i++) len += strlen(dirs[i]) + 1;
+    char *str = malloc(len);
+    if (!str) return NULL;
+    str[0] = '\0';
+    for (int i = 0; dirs[i]; i++) {
+        strcat(str, dirs[i]);
+        if (dirs[i + 1]) strcat(str, ",");
+    }
+    return str;
+}
+
+// Free a list of strings
+static void free_string_list(char **list, int count) {
+    if (!list) return;
+    for (int i = 0; i < count; i++) free(list[i]);
+    free(list);
+}
+
+//Fingerprint of the compiler and effective flags for one source.
+static unsigned int fingerprint_for_source(const char *compiler, char **base, int base_count,
+                                           const fortean_overrides_t *overrides, const char *src) {
+    int count    = 0;
+    char **flags = fortean_flags_for_file(base, base_count, overrides, src, &count);
+    unsigned int fp = fortean_flags_fingerprint(compiler, flags, count);
+    fortean_flags_free(flags, count);
+    return fp;
+}
+
+//Save the fingerprints of every file in the graph in the same format as the hash cache.
+static int save_fingerprints(const char *filename, FileNode *hash_table[], const char *compiler,
+                             char **base, int base_count, const fortean_overrides_t *overrides) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        print_error("Failed to open file for saving flag fingerprints");
+        return 0;
+    }
+    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+        for (FileNode *curr = hash_table[i]; curr; curr = curr->next) {
+            fprintf(fp, "%s %u\n", curr->filename,
+                    fingerprint_for_source(compiler, base, base_count, overrides, curr->filename));
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+//Save the last compile time of every source still in the graph, in ms.
+static int save_compile_times(const char *filename, HashEntry *times[], FileNode *hash_table[]) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        print_error("Failed to open file for saving compile times");
+        return 0;
+    }
+    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+        for (HashEntry *curr = times[i]; curr; curr = curr->next) {
+            if (!find_file_node(curr->filename, hash_table)) continue;
+            fprintf(fp, "%s %u\n", curr->filename, curr->file_hash);
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+//Extensions replaced by .o in the object name, the rest keep theirs (e.g. x.f95.o)
+static int is_object_extension(const char *ext) {
+    return ext && (strcmp_case_insensitive(ext, ".f90") == 0
+               ||  strcmp_case_insensitive(ext, ".for") == 0
+               ||  strcmp_case_insensitive(ext, ".f")   == 0
+               ||  strcmp_case_insensitive(ext, ".f77") == 0);
+}
+
+//Object file for a source: <obj_dir>/<file name without extension>.o (caller must free)
+static char *object_path_for_source(const char *obj_dir, const char *src) {
+    char *rel_path = get_last_path_segment(src);
+    char *ext = strrchr(rel_path, '.');
+    if (is_object_extension(ext)) *ext = '\0';
+    size_t len = strlen(obj_dir) + strlen(rel_path) + 4;
+    char *obj_path = malloc(len);
+    if (obj_path) snprintf(obj_path, len, "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+    free(rel_path);
+    return obj_path;
+}
+
+//One executable of the project. main is the source holding its program unit,
+//NULL when the executable is the single build.target and links every object.
+typedef struct {
+    char *name;
+    char *main;
+} fortean_bin_t;
+
+//Read the [[bin]] tables, or fall back to build.target as the only executable.
+static int load_bins(fortean_toml_t *cfg, const char *target, fortean_bin_t **bins, int *bin_count) {
+    *bins      = NULL;
+    *bin_count = 0;
+
+    toml_array_t *arr = fortean_toml_get_table_array(cfg, "bin");
+    int n = arr ? toml_array_nelem(arr) : 0;
+    *bins = calloc(n > 0 ? n : 1, sizeof(fortean_bin_t));
+    if (!*bins) return -1;
+
+    for (int i = 0; i < n; i++) {
+        toml_table_t *tbl = toml_table_at(arr, i);
+        toml_datum_t name = toml_string_in(tbl, "name");
+        toml_datum_t main = toml_string_in(tbl, "main");
+        if (!name.ok || !main.ok) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "[[bin]] entry %d needs both 'name' and 'main'.", i + 1);
+            print_error(msg);
+            if (name.ok) free(name.u.s);
+            if (main.ok) free(main.u.s);
+            return -1;
+        }
+        (*bins)[*bin_count].name = name.u.s;
+        (*bins)[*bin_count].main = main.u.s;
+        (*bin_count)++;
+    }
+
+    if (*bin_count == 0) {
+        if (!target) {
+            print_error("Missing 'build.target' or [[bin]] tables in config.");
+            return -1;
+        }
+        (*bins)[0].name = strdup(target);
+        (*bins)[0].main = NULL;
+        *bin_count = 1;
+    }
+    return 0;
+}
+
+static void free_bins(fortean_bin_t *bins, int bin_count) {
+    if (!bins) return;
+    for (int i = 0; i < bin_count; i++) {
+        free(bins[i].name);
+        free(bins[i].main);
+    }
+    free(bins);
+}
+
+//Is src the main program of a [[bin]] other than bins[self] (self < 0 checks all of them)?
+static int is_other_main(const char *src, const fortean_bin_t *bins, int bin_count, int self) {
+    for (int i = 0; i < bin_count; i++) {
+        if (i == self || !bins[i].main) continue;
+        if (fortean_path_equal(bins[i].main, src)) return 1;
+    }
+    return 0;
+}
+
+//Everything needed to link one executable, so several can be linked on threads.
+typedef struct {
+    const char *compiler;
+    char **flags;
+    int flag_count;
+    char **link_flags;             // Linker selection and the like, NULL-terminated
+    const char *obj_dir;
+    char **sources;
+    int src_count;
+    const unsigned char *member;   // Sources in the executable's use closure, NULL for all of them
+    char **source_libs;
+    const fortean_bin_t *bins;
+    int bin_count;
+    int self;
+    fortean_cmd_t cmd;             // Filled in by prepare_link
+    unsigned int manifest;
+    char *missing;                 // First object that does not exist
+    int linked;                    // The link ran instead of being skipped
+    int status;
+    double start;
+    double end;
+    fortean_cmd_usage_t usage;     // What the linker used
+} link_job_t;
+
+//Build the link command of a job and hash it together with the contents of
+//every object and library it links.
+static int prepare_link(link_job_t *job, fortean_objcache_t *objcache) {
+    fortean_cmd_free(&job->cmd);
+    free(job->missing);
+    job->missing = NULL;
+
+    fortean_cmd_t *cmd = &job->cmd;
+    fortean_cmd_init(cmd, job->compiler);
+    cmd->response_file = 1;
+    for (int i = 0; i < job->flag_count; i++) fortean_cmd_add(cmd, job->flags[i]);
+    fortean_cmd_add_list(cmd, job->link_flags);
+
+    //Link all the objects files except the other programs. We check if the file exists to prevent issues...
+    for (int i = 0; i < job->src_count; i++) {
+        if (job->member && !job->member[i]) continue;
+        if (is_other_main(job->sources[i], job->bins, job->bin_count, job->self)) continue;
+
+        char *obj_path = object_path_for_source(job->obj_dir, job->sources[i]);
+        if (!obj_path) return -1;
+        if (!job->missing && !file_exists(obj_path)) job->missing = strdup(obj_path);
+        fortean_cmd_add(cmd, obj_path);
+        free(obj_path);
+    }
+
+    //Link with the libraries (if they exist).
+    fortean_cmd_add_list(cmd, job->source_libs);
+
+    //Build the final link command
+    fortean_cmd_add(cmd, "-o");
+    fortean_cmd_add(cmd, job->bins[job->self].name);
+    if (cmd->failed) return -1;
+
+    unsigned int hash = FNV_SEED;
+    for (int i = 0; i < cmd->argc; i++) {
+        hash = hash_str_fnv1a(cmd->argv[i], hash);
+        hash = hash_str_fnv1a("\x1f", hash);
+        if (i == 0 || cmd->argv[i][0] == '-' || strcmp(cmd->argv[i - 1], "-o") == 0) continue;
+        char content[16];
+        snprintf(content, sizeof(content), "%u", fortean_objcache_hash(objcache, cmd->argv[i]));
+        hash = hash_str_fnv1a(content, hash);
+    }
+    job->manifest = hash;
+    return 0;
+}
+
+static int link_executable(link_job_t *job) {
+    //Check if the obj files actually built and/or still exist.
+    if (job->missing) {
+        char msg[1024];
+        snprintf(msg, sizeof(msg), "Object file %s does not exist.", job->missing);
+        print_error(msg);
+        return -1;
+    }
+
+    char *link_str = fortean_cmd_string(&job->cmd);
+    if (link_str) print_info(link_str);
+    free(link_str);
+
+    double start = fortean_wall_time();
+    int ret = fortean_cmd_run(&job->cmd);
+    if (ret != 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Linking %s failed.", job->bins[job->self].name);
+        print_error(msg);
+        return -1;
+    }
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Link time %s: %.3f s", job->bins[job->self].name, fortean_wall_time() - start);
+    print_info(msg);
+    return 0;
+}
+
+static void link_worker(void *arg) {
+    link_job_t *job = (link_job_t *)arg;
+    job->cmd.usage = &job->usage;
+    job->start  = fortean_wall_time();
+    job->status = link_executable(job);
+    job->end    = fortean_wall_time();
+}
+
+//Sources left out of this build (other programs, pruned files, failed compiles) must not
+//be recorded as up to date, so zero their hash and they rebuild the next time they are needed.
+static void forget_skipped_sources(FileNode *hash_table[], HashEntry *skip_map[]) {
+    for (int j = 0; j < HASH_TABLE_SIZE; j++) {
+        for (FileNode *node = hash_table[j]; node; node = node->next) {
+            if (hash_entry_get(skip_map, node->filename)) node->file_hash = 0;
+        }
+    }
+}
+
+//Why a source is compiled, for --explain
+typedef enum {
+    REBUILD_NONE,
+    REBUILD_ALL,             // -r
+    REBUILD_NEW,             // Not in the last build
+    REBUILD_SKIPPED,         // The last build left it out or failed to compile it
+    REBUILD_CONTENT,
+    REBUILD_FLAGS,
+    REBUILD_TRACED,          // A file its last compile read changed, with trace-deps
+    REBUILD_OBJECT,          // Its object is gone
+    REBUILD_DEPENDENCY       // A file it uses is compiled
+} rebuild_reason_t;
+
+static const char *rebuild_names[] = {"up to date", "full rebuild (-r)", "new file",
+                                      "not compiled by the last build (left out or failed)", "content hash changed",
+                                      "flags fingerprint changed", "a file its last compile read changed",
+                                      "object file missing", "dependency compiled"};
+
+//Reason of a graph node, and for a dependency the node it uses that is compiled
+typedef struct {
+    rebuild_reason_t reason;
+    int cause;
+} rebuild_t;
+
+//The change at the end of the chain of uses that makes node compile
+static int rebuild_root(const rebuild_t *why, int node) {
+    while (why[node].reason == REBUILD_DEPENDENCY) node = why[node].cause;
+    return node;
+}
+
+static const int *sort_counts;
+
+static int compare_counts(const void *a, const void *b) {
+    int x = sort_counts[*(const int *)a], y = sort_counts[*(const int *)b];
+    if (x != y) return y - x;
+    return *(const int *)a - *(const int *)b;
+}
+
+//--explain: every source to compile with the change behind it, through the chain of
+//uses when it is a dependency, then the changes that compile the most files. The time
+//is estimated from the last compile of each source.
+static void explain_plan(const fortean_graph_t *graph, char **sources, const int *src_node, int src_count,
+                         const unsigned char *need, const rebuild_t *why, const char *times_file) {
+    int node_count = graph->count > 0 ? graph->count : 1;
+    int *files     = calloc(node_count, sizeof(int));   // Sources each change compiles
+    int *chain     = malloc(node_count * sizeof(int));
+    int *roots     = malloc(node_count * sizeof(int));
+    if (!files || !chain || !roots) {
+        print_error("Memory allocation error.");
+        free(files);
+        free(chain);
+        free(roots);
+        return;
+    }
+    HashEntry *times[HASH_TABLE_SIZE] = {NULL};
+    load_prev_hashes(times_file, times);
+
+    char msg[4096];
+    int count = 0, untimed = 0;
+    double seconds = 0.0;
+    for (int i = 0; i < src_count; i++) {
+        if (!need[i]) continue;
+        count++;
+        HashEntry *time = hash_entry_get(times, sources[i]);
+        if (time) seconds += time->file_hash / 1000.0;
+        else      untimed++;
+
+        int node = src_node[i];
+        int root = rebuild_root(why, node);
+        files[root]++;
+        if (why[node].reason != REBUILD_DEPENDENCY) {
+            snprintf(msg, sizeof(msg), "%s: %s", sources[i], rebuild_names[why[node].reason]);
+            print_info(msg);
+            continue;
+        }
+
+        //From the changed file to this one
+        int len = 0;
+        for (int n = node; n != root; n = why[n].cause) chain[len++] = n;
+        chain[len++] = root;
+        size_t used = (size_t)snprintf(msg, sizeof(msg), "%s: uses %s (%s) through ", sources[i], graph->files[root],
+                                       rebuild_names[why[root].reason]);
+        for (int k = len - 1; k >= 0 && used < sizeof(msg); k--) {
+            used += (size_t)snprintf(msg + used, sizeof(msg) - used, "%s%s", graph->files[chain[k]], k ? " -> " : "");
+        }
+        print_info(msg);
+    }
+
+    if (count == 0) {
+        print_info("Nothing to compile, every source is up to date.");
+    } else {
+        snprintf(msg, sizeof(msg), "%d of %d sources to compile, about %.1f s of compiling by their last compile times%s",
+                 count, src_count, seconds, untimed ? "" : ".");
+        if (untimed) {
+            size_t used = strlen(msg);
+            snprintf(msg + used, sizeof(msg) - used, " (%d never timed).", untimed);
+        }
+        print_info(msg);
+
+        int root_count = 0;
+        for (int n = 0; n < graph->count; n++) {
+            if (files[n] > 0) roots[root_count++] = n;
+        }
+        sort_counts = files;
+        qsort(roots, (size_t)root_count, sizeof(int), compare_counts);
+        print_info("Changes compiling the most sources:");
+        for (int k = 0; k < root_count && k < 10; k++) {
+            snprintf(msg, sizeof(msg), "  %s (%s): %d file%s", graph->files[roots[k]], rebuild_names[why[roots[k]].reason],
+                     files[roots[k]], files[roots[k]] == 1 ? "" : "s");
+            print_info(msg);
+        }
+        if (root_count > 10) {
+            snprintf(msg, sizeof(msg), "  and %d more", root_count - 10);
+            print_info(msg);
+        }
+    }
+    free_prev_hash_table(times);
+    free(files);
+    free(chain);
+    free(roots);
+}
+
+//Source holding the program unit to prune around: the [[bin]] main, else build.entry,
+//else the only program unit among the sources. *root is a graph index, or -1 when the
+//sources hold no program at all. Returns -1 on error.
+static int find_program_root(const fortean_graph_t *graph, char **sources, const int *src_node, int src_count,
+                             const char *main, const char *entry, int *root) {
+    char msg[512];
+    *root = -1;
+
+    const char *wanted = main ? main : entry;
+    if (wanted) {
+        *root = fortean_graph_find(graph, wanted);
+        if (*root < 0) {
+            snprintf(msg, sizeof(msg), "Program file %s is not among the scanned sources.", wanted);
+            print_error(msg);
+            return -1;
+        }
+        return 0;
+    }
+
+    int found = 0;
+    for (int i = 0; i < src_count; i++) {
+        fortean_fscan_t scan;
+        if (fortean_fscan_file(sources[i], &scan) != 0) continue;
+        if (scan.is_program) {
+            if (found == 0) *root = src_node[i];
+            found++;
+        }
+        fortean_fscan_free(&scan);
+    }
+    if (found > 1) {
+        snprintf(msg, sizeof(msg), "Found %d program units. Set build.entry or add [[bin]] tables to pick one.", found);
+        print_error(msg);
+        return -1;
+    }
+    return 0;
+}
+
+//Mark (by position in sources) everything the program at root reaches through use
+//statements, together with the extra sources and everything they use.
+static int use_closure(const fortean_graph_t *graph, const int *src_node, int src_count,
+                       int root, const int *extra, int extra_count, unsigned char *member) {
+    unsigned char *mark = calloc(graph->count > 0 ? graph->count : 1, 1);
+    if (!mark) return -1;
+    fortean_graph_closure(graph, root, mark);
+    for (int i = 0; i < extra_count; i++) fortean_graph_closure(graph, extra[i], mark);
+    for (int i = 0; i < src_count; i++) member[i] = mark[src_node[i]];
+    free(mark);
+    return 0;
+}
+
+//What every compile of a build shares.
+typedef struct {
+    const char *compiler;
+    const fortean_compiler_t *cc;          // How the compiler spells the module directory and depfile
+    char **flags;                          // build.flags after the profile edits
+    int flag_count;
+    const fortean_overrides_t *overrides;
+    const char *obj_dir;
+    const char *mod_dir;
+    const char *plain_mod_dir;             // build.mod_dir, differs from mod_dir in profile and variant builds
+    int parallel;
+    int batch_files;                       // Most sources in one compiler call, below 2 is off
+    long batch_bytes;                      // Size limit for small sources without a recorded time
+    unsigned int batch_ms;                 // Compile time limit for small sources
+    HashEntry **times;                     // Last compile time of each source in ms
+    int depfiles;                          // Write <object>.d next to every object
+    fortean_cas_t *cas;                    // Compilation cache, NULL when it is off
+    fortean_workers_t *workers;            // [[worker]] hosts of parallel builds, NULL when there are none
+    fortean_tracedb_t *tracedb;            // Records the files every local compile opens, NULL when it is off
+    fortean_timeline_t *timeline;          // Spans of the build for --trace and the report
+} compile_ctx_t;
+
+//One compiler call for one or more sources, run on a thread for parallel builds.
+typedef struct {
+    fortean_cmd_t cmd;
+    int *srcs;                             // Indices of the sources it compiles
+    int src_count;
+    double queued;                         // When its level was planned
+    double start;
+    double seconds;
+    int status;
+    int lane;                              // Worker lane it is sent to, -1 to compile here
+    fortean_trace_t trace;                 // Files it opened, when the compiles are traced
+    fortean_cmd_usage_t usage;             // What the compiler used, when it ran here
+} compile_job_t;
+
+static void compile_worker(void *arg) {
+    compile_job_t *job = (compile_job_t *)arg;
+    job->cmd.usage = &job->usage;
+    double start = fortean_wall_time();
+    job->start   = start;
+    job->status  = fortean_cmd_run(&job->cmd);
+    job->seconds = fortean_wall_time() - start;
+}
+
+//gfortran searches -I before -J, so an inherited -I<mod_dir> would pick up the modules
+//of the plain build. It is pointed at the module directory of this build when the
+//command is made, which keeps the flag fingerprints the same in every build directory.
+static int is_plain_mod_include(const compile_ctx_t *ctx, const char *flag) {
+    return strcmp(ctx->mod_dir, ctx->plain_mod_dir) != 0 && strncmp(flag, "-I", 2) == 0 &&
+           strcmp(flag + 2, ctx->plain_mod_dir) == 0;
+}
+
+//Dependency file the compiler writes next to an object, obj/a.o -> obj/a.d
+static void depfile_for_object(const char *obj_file, char *buf, size_t size) {
+    const char *dot = strrchr(obj_file, '.');
+    snprintf(buf, size, "%.*s.d", dot ? (int)(dot - obj_file) : (int)strlen(obj_file), obj_file);
+}
+
+//Compile command for one source (caller must free cmd)
+static int compile_args(const compile_ctx_t *ctx, const char *src, fortean_cmd_t *cmd) {
+    int count    = 0;
+    char **flags = fortean_flags_for_file(ctx->flags, ctx->flag_count, ctx->overrides, src, &count);
+    char *obj_file = object_path_for_source(ctx->obj_dir, src);
+
+    fortean_cmd_init(cmd, ctx->compiler);
+    cmd->response_file = 1;
+    for (int i = 0; i < count; i++) {
+        if (is_plain_mod_include(ctx, flags[i])) fortean_cmd_addf(cmd, "-I%s", ctx->mod_dir);
+        else                                     fortean_cmd_add(cmd, flags[i]);
+    }
+    fortean_compiler_add_module_dir(ctx->cc, cmd, ctx->mod_dir);
+    if (ctx->depfiles && obj_file) {
+        char dep_file[1024];
+        depfile_for_object(obj_file, dep_file, sizeof(dep_file));
+        fortean_compiler_add_depfile(ctx->cc, cmd, dep_file);
+    }
+    fortean_cmd_add(cmd, "-c");
+    fortean_cmd_add(cmd, src);
+    fortean_cmd_add(cmd, "-o");
+    fortean_cmd_add(cmd, obj_file);
+    fortean_flags_free(flags, count);
+
+    if (!obj_file || !flags) cmd->failed = 1;
+    free(obj_file);
+    if (cmd->failed) {
+        print_error("Memory allocation error for compile command.");
+        fortean_cmd_free(cmd);
+        return -1;
+    }
+    return 0;
+}
+
+//Compile command for one source, printed before it runs (caller must free cmd)
+static int compile_command(const compile_ctx_t *ctx, const char *src, fortean_cmd_t *cmd) {
+    if (compile_args(ctx, src, cmd) != 0) return -1;
+    char *str = fortean_cmd_string(cmd);
+    if (str) print_info(str);
+    free(str);
+    return 0;
+}
+
+//A source is small enough to share a compiler call when its last compile was quick,
+//or, before it has been timed, when the file is short.
+static int is_batchable(const compile_ctx_t *ctx, const char *src) {
+    //A dependency file is named per object, and a trace is per compiler call.
+    if (ctx->depfiles || ctx->tracedb) return 0;
+
+    //The compiler names the objects of a batch itself, which only matches ours
+    //when the extension is replaced.
+    char *name = get_last_path_segment(src);
+    int named  = name && is_object_extension(strrchr(name, '.'));
+    free(name);
+    if (!named) return 0;
+
+    HashEntry *time = hash_entry_get(ctx->times, src);
+    if (time) return time->file_hash <= ctx->batch_ms;
+
+    struct stat st;
+    return stat(src, &st) == 0 && (long)st.st_size <= ctx->batch_bytes;
+}
+
+//Compile command for several sources with the same flags. gfortran has no -o for more
+//than one source, so it runs in the object directory and every path it is given is
+//made absolute (caller must free cmd).
+static int batch_command(const compile_ctx_t *ctx, char **sources, const int *srcs, int n,
+                         fortean_cmd_t *cmd) {
+    int count    = 0;
+    char **flags = fortean_flags_for_file(ctx->flags, ctx->flag_count, ctx->overrides, sources[srcs[0]], &count);
+
+    fortean_cmd_init(cmd, ctx->compiler);
+    cmd->response_file = 1;
+    cmd->cwd           = ctx->obj_dir;
+    for (int i = 0; i < count; i++) {
+        //Include and module directories, joined ("-Imod") or separate ("-I", "mod").
+        const char *flag = flags[i];
+        char build_inc[700];
+        if (is_plain_mod_include(ctx, flag)) {
+            snprintf(build_inc, sizeof(build_inc), "-I%s", ctx->mod_dir);
+            flag = build_inc;
+        }
+        int dir_flag = strncmp(flag, "-I", 2) == 0 || strncmp(flag, "-J", 2) == 0;
+        if (!dir_flag) {
+            fortean_cmd_add(cmd, flag);
+            continue;
+        }
+        if (flag[2] == '\0') {
+            fortean_cmd_add(cmd, flag);
+            if (++i >= count) break;
+            flag = flags[i];
+        }
+        char *dir = fortean_absolute_path(flag[0] == '-' ? flag + 2 : flag);
+        if (!dir) {
+            cmd->failed = 1;
+            break;
+        }
+        if (flag[0] == '-') fortean_cmd_addf(cmd, "%.2s%s", flag, dir);
+        else                fortean_cmd_add(cmd, dir);
+        free(dir);
+    }
+    char *mod_dir = fortean_absolute_path(ctx->mod_dir);
+    if (mod_dir) fortean_compiler_add_module_dir(ctx->cc, cmd, mod_dir);
+    else         cmd->failed = 1;
+    free(mod_dir);
+    fortean_cmd_add(cmd, "-c");
+    for (int j = 0; j < n; j++) {
+        char *src = fortean_absolute_path(sources[srcs[j]]);
+        if (src) fortean_cmd_add(cmd, src);
+        else     cmd->failed = 1;
+        free(src);
+    }
+    fortean_flags_free(flags, count);
+
+    if (!flags) cmd->failed = 1;
+    if (cmd->failed) {
+        print_error("Memory allocation error for compile command.");
+        fortean_cmd_free(cmd);
+        return -1;
+    }
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Compiling %d small sources in one call (in %s):", n, ctx->obj_dir);
+    print_info(msg);
+    char *str = fortean_cmd_string(cmd);
+    if (str) print_info(str);
+    free(str);
+    return 0;
+}
+
+//Split the sources of one level into compiler calls. Small sources with the same flags
+//share a call, up to batch_files of them. Files of one level never use each other's
+//modules, so any grouping is safe. unit_src receives the source indices of every job.
+static int plan_level(const compile_ctx_t *ctx, char **sources, int src_count, const int *level,
+                      int lvl, const unsigned char *need, int *unit_src, compile_job_t *jobs) {
+    int job_count = 0;
+    int used      = 0;
+
+    int *small        = calloc(src_count > 0 ? src_count : 1, sizeof(int));
+    unsigned int *fps = calloc(src_count > 0 ? src_count : 1, sizeof(unsigned int));
+    if (!small || !fps) {
+        print_error("Memory allocation error.");
+        free(small);
+        free(fps);
+        return -1;
+    }
+
+    int small_count = 0;
+    for (int i = 0; i < src_count; i++) {
+        if (!need[i] || level[i] != lvl) continue;
+        if (ctx->batch_files > 1 && is_batchable(ctx, sources[i])) {
+            fps[i] = fingerprint_for_source(ctx->compiler, ctx->flags, ctx->flag_count, ctx->overrides, sources[i]);
+            small[small_count++] = i;
+            continue;
+        }
+        compile_job_t *job = &jobs[job_count];
+        memset(job, 0, sizeof(*job));
+        job->srcs      = &unit_src[used];
+        job->src_count = 1;
+        unit_src[used++] = i;
+        if (compile_command(ctx, sources[i], &job->cmd) != 0) goto fail;
+        job_count++;
+    }
+
+    //Group the small sources by their flags in build order.
+    for (int a = 0; a < small_count; a++) {
+        if (small[a] < 0) continue;
+        compile_job_t *job = &jobs[job_count];
+        memset(job, 0, sizeof(*job));
+        job->srcs = &unit_src[used];
+        unsigned int fp = fps[small[a]];
+        for (int b = a; b < small_count && job->src_count < ctx->batch_files; b++) {
+            if (small[b] < 0 || fps[small[b]] != fp) continue;
+            unit_src[used++] = small[b];
+            job->src_count++;
+            small[b] = -1;
+        }
+        int res = job->src_count == 1
+                ? compile_command(ctx, sources[job->srcs[0]], &job->cmd)
+                : batch_command(ctx, sources, job->srcs, job->src_count, &job->cmd);
+        if (res != 0) goto fail;
+        job_count++;
+    }
+
+    free(small);
+    free(fps);
+    return job_count;
+
+fail:
+    for (int j = 0; j < job_count; j++) fortean_cmd_free(&jobs[j].cmd);
+    free(small);
+    free(fps);
+    return -1;
+}
+
+//The jobs of one level sent to one slot of a worker, one after another. A job the
+//worker can't take is compiled here, and so are the rest once it stops answering.
+typedef struct {
+    const compile_ctx_t *ctx;
+    char **sources;
+    compile_job_t *jobs;
+    int *list;                             // Indices of its jobs
+    int count;
+    int worker;
+    int threaded;
+    int down;                              // The worker stopped answering
+    int lost;                              // Jobs compiled here instead
+    int sent;
+    double seconds;
+} worker_lane_t;
+
+static void lane_worker(void *arg) {
+    worker_lane_t *lane = (worker_lane_t *)arg;
+    const compile_ctx_t *ctx = lane->ctx;
+    for (int i = 0; i < lane->count; i++) {
+        compile_job_t *job = &lane->jobs[lane->list[i]];
+        const char *src    = lane->sources[job->srcs[0]];
+        job->status = FORTEAN_WORKER_LOST;
+        double start = fortean_wall_time();
+        job->start   = start;
+        if (!lane->down) {
+            int count      = 0;
+            char **flags   = fortean_flags_for_file(ctx->flags, ctx->flag_count, ctx->overrides, src, &count);
+            char *obj_file = object_path_for_source(ctx->obj_dir, src);
+            if (obj_file && flags) {
+                job->status = fortean_worker_compile(ctx->workers, lane->worker, flags, count, src, obj_file,
+                                                     ctx->mod_dir);
+            }
+            fortean_flags_free(flags, count);
+            free(obj_file);
+        }
+        if (job->status == FORTEAN_WORKER_LOST || job->status == FORTEAN_WORKER_LOCAL) {
+            if (job->status == FORTEAN_WORKER_LOST) lane->down = 1;
+            lane->lost++;
+            compile_worker(job);
+            continue;
+        }
+        job->seconds = fortean_wall_time() - start;
+        lane->seconds += job->seconds;
+        lane->sent++;
+    }
+}
+
+//Share the single source jobs of a level between the local threads and the worker
+//slots, each going to whichever has the least work per slot. Returns the number of
+//lanes, with their job lists in lane_jobs.
+static int assign_lanes(const compile_ctx_t *ctx, char **sources, compile_job_t *jobs, int job_count,
+                        worker_lane_t *lanes, int *lane_jobs) {
+    for (int j = 0; j < job_count; j++) jobs[j].lane = -1;
+    fortean_workers_t *workers = ctx->workers;
+    if (!workers || job_count < 2) return 0;
+
+    int lane_count = 0;
+    int local_load = 0;
+    int local      = fortean_cpu_count();
+    int *first     = calloc(workers->count, sizeof(int));
+    int *load      = calloc(workers->count, sizeof(int));
+    if (!first || !load) {
+        free(first);
+        free(load);
+        return 0;
+    }
+    for (int w = 0; w < workers->count; w++) {
+        first[w] = lane_count;
+        if (!workers->list[w].down) lane_count += workers->list[w].slots;
+    }
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].src_count != 1 || ctx->depfiles || jobs[j].cmd.cwd) {
+            local_load++;
+            continue;
+        }
+        //(load + 1) / slots compared without dividing, ties stay here
+        int best        = -1;
+        long best_load  = local_load + 1;
+        long best_slots = local;
+        for (int w = 0; w < workers->count; w++) {
+            const fortean_worker_t *worker = &workers->list[w];
+            if (worker->down || (long)(load[w] + 1) * best_slots >= best_load * worker->slots) continue;
+            best       = w;
+            best_load  = load[w] + 1;
+            best_slots = worker->slots;
+        }
+        if (best < 0) {
+            local_load++;
+            continue;
+        }
+        jobs[j].lane = first[best] + load[best] % workers->list[best].slots;
+        load[best]++;
+    }
+
+    //Job lists in lane order
+    memset(lanes, 0, lane_count * sizeof(worker_lane_t));
+    for (int w = 0; w < workers->count; w++) {
+        for (int s = 0; !workers->list[w].down && s < workers->list[w].slots; s++) lanes[first[w] + s].worker = w;
+    }
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].lane >= 0) lanes[jobs[j].lane].count++;
+    }
+    int used = 0;
+    for (int l = 0; l < lane_count; l++) {
+        lanes[l].ctx     = ctx;
+        lanes[l].sources = sources;
+        lanes[l].jobs    = jobs;
+        lanes[l].list    = &lane_jobs[used];
+        used += lanes[l].count;
+        lanes[l].count = 0;
+    }
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].lane >= 0) lanes[jobs[j].lane].list[lanes[jobs[j].lane].count++] = j;
+    }
+    free(first);
+    free(load);
+    return lane_count;
+}
+
+//Restore the object and modules of a source from the compilation cache instead of
+//compiling it. key receives the key to store the compile under, "" if it can't be.
+static int cache_restore(const compile_ctx_t *ctx, const char *src, char *key) {
+    key[0] = '\0';
+    if (!ctx->cas) return 0;
+    int count    = 0;
+    char **flags = fortean_flags_for_file(ctx->flags, ctx->flag_count, ctx->overrides, src, &count);
+    int res      = flags ? fortean_cas_key(ctx->cas, src, flags, count, ctx->mod_dir, key) : -1;
+    fortean_flags_free(flags, count);
+    if (res != 0) {
+        key[0] = '\0';
+        return 0;
+    }
+    char *obj_file = object_path_for_source(ctx->obj_dir, src);
+    double start   = fortean_wall_time();
+    int hit = obj_file && fortean_cas_restore(ctx->cas, key, obj_file, ctx->mod_dir);
+    free(obj_file);
+    fortean_timeline_span_t *span = fortean_timeline_phase(ctx->timeline, src, start);
+    if (span) span->cat = "cache";
+    fortean_timeline_arg_int(span, "hit", hit);
+    if (hit) {
+        char msg[600];
+        snprintf(msg, sizeof(msg), "Restored %s from the compilation cache", src);
+        print_info(msg);
+    }
+    return hit;
+}
+
+static void cache_store(const compile_ctx_t *ctx, const char *src, const char *key) {
+    if (!ctx->cas || !key[0]) return;
+    char *obj_file = object_path_for_source(ctx->obj_dir, src);
+    if (obj_file) fortean_cas_store(ctx->cas, key, src, obj_file, ctx->mod_dir);
+    free(obj_file);
+}
+
+//Span of a compile job that has run, on the row of the thread or worker lane that ran
+//it. Recorded before its command is freed.
+static void timeline_job(const compile_ctx_t *ctx, const compile_job_t *job, const char *src, const char *worker) {
+    if (!ctx->timeline) return;
+    char name[600];
+    if (job->src_count > 1) snprintf(name, sizeof(name), "%s and %d more", src, job->src_count - 1);
+    else                    snprintf(name, sizeof(name), "%s", src);
+    int lane = job->lane >= 0 ? job->lane + 1 : FORTEAN_TIMELINE_LOCAL;
+    fortean_timeline_span_t *span = fortean_timeline_add(ctx->timeline, "compile", name, job->queued, job->start,
+                                                         job->start + job->seconds, lane);
+    if (!span) return;
+    span->usage  = job->usage;
+    span->status = job->status;
+    fortean_timeline_arg(span, "file", src);
+    if (job->src_count > 1) fortean_timeline_arg_int(span, "files", job->src_count);
+
+    int count    = 0;
+    char **flags = fortean_flags_for_file(ctx->flags, ctx->flag_count, ctx->overrides, src, &count);
+    size_t len = 1;
+    for (int i = 0; i < count; i++) len += strlen(flags[i]) + 1;
+    char *text = malloc(len);
+    if (text) {
+        text[0] = '\0';
+        for (int i = 0; i < count; i++) {
+            if (i > 0) strcat(text, " ");
+            strcat(text, flags[i]);
+        }
+        fortean_timeline_arg(span, "flags", text);
+    }
+    free(text);
+    fortean_flags_free(flags, count);
+
+    text = fortean_cmd_string(&job->cmd);
+    fortean_timeline_arg(span, "command", text);
+    free(text);
+    fortean_timeline_arg_int(span, "exit", job->status);
+    if (worker) fortean_timeline_arg(span, "worker", worker);
+}
+
+//Compile one source on its own and record the result. Returns 0 on success.
+static int compile_single(const compile_ctx_t *ctx, const char *src, unsigned char *done_flag) {
+    compile_job_t job;
+    memset(&job, 0, sizeof(job));
+    if (compile_command(ctx, src, &job.cmd) != 0) return -1;
+    if (ctx->tracedb) job.cmd.trace = &job.trace;
+    job.lane   = -1;
+    job.queued = fortean_wall_time();
+    compile_worker(&job);
+    timeline_job(ctx, &job, src, NULL);
+    fortean_cmd_free(&job.cmd);
+    if (job.status == 0 && ctx->tracedb) fortean_tracedb_record(ctx->tracedb, src, &job.trace);
+    fortean_trace_free(&job.trace);
+    if (job.status != 0) return -1;
+    hash_entry_put(ctx->times, src, (unsigned int)(job.seconds * 1000.0));
+    *done_flag = 1;
+    return 0;
+}
+
+//Compile the sources with need[i] set, in build order. Parallel and batched builds
+//compile one dependency level at a time so the modules a file uses are always written
+//first. done[i] is set for every source that compiled or came from the compilation
+//cache. Returns -1 on the first failure.
+static int compile_sources(const compile_ctx_t *ctx, char **sources, int src_count, const int *level,
+                           const unsigned char *need, unsigned char *done) {
+    if (!ctx->parallel && ctx->batch_files < 2) {
+        for (int i = 0; i < src_count; i++) {
+            if (!need[i]) continue;
+            char key[FORTEAN_CAS_KEY_LEN];
+            if (cache_restore(ctx, sources[i], key)) {
+                done[i] = 1;
+                continue;
+            }
+            if (compile_single(ctx, sources[i], &done[i]) != 0) {
+                print_error("Compilation failed.");
+                return -1;
+            }
+            cache_store(ctx, sources[i], key);
+        }
+        return 0;
+    }
+
+    int max_level = 0;
+    for (int i = 0; i < src_count; i++) {
+        if (need[i] && level[i] > max_level) max_level = level[i];
+    }
+
+    //The most jobs we can have is every source of one level on its own.
+    compile_job_t *jobs = calloc(src_count > 0 ? src_count : 1, sizeof(compile_job_t));
+    thread_t *threads   = calloc(src_count > 0 ? src_count : 1, sizeof(thread_t));
+    int *unit_src       = calloc(src_count > 0 ? src_count : 1, sizeof(int));
+    unsigned char *todo = malloc(src_count > 0 ? src_count : 1);
+    char (*keys)[FORTEAN_CAS_KEY_LEN] = calloc(src_count > 0 ? src_count : 1, FORTEAN_CAS_KEY_LEN);
+    int worker_slots = 0;
+    for (int w = 0; ctx->workers && w < ctx->workers->count; w++) worker_slots += ctx->workers->list[w].slots;
+    worker_lane_t *lanes = calloc(worker_slots > 0 ? worker_slots : 1, sizeof(worker_lane_t));
+    thread_t *lane_threads = calloc(worker_slots > 0 ? worker_slots : 1, sizeof(thread_t));
+    int *lane_jobs         = calloc(src_count > 0 ? src_count : 1, sizeof(int));
+    if (!jobs || !threads || !unit_src || !todo || !keys || !lanes || !lane_threads || !lane_jobs) {
+        print_error("Memory allocation error.");
+        free(jobs);
+        free(threads);
+        free(unit_src);
+        free(todo);
+        free(keys);
+        free(lanes);
+        free(lane_threads);
+        free(lane_jobs);
+        return -1;
+    }
+    memcpy(todo, need, src_count);
+
+    int failed = 0;
+    for (int lvl = 0; lvl <= max_level && !failed; lvl++) {
+        double level_start = fortean_wall_time();
+
+        //The modules of the levels below are in place, so the keys of this one are known.
+        for (int i = 0; i < src_count; i++) {
+            if (!todo[i] || level[i] != lvl || !cache_restore(ctx, sources[i], keys[i])) continue;
+            todo[i] = 0;
+            done[i] = 1;
+        }
+
+        int job_count = plan_level(ctx, sources, src_count, level, lvl, todo, unit_src, jobs);
+        if (job_count < 0) {
+            failed = 1;
+            break;
+        }
+        double queued = fortean_wall_time();
+        for (int j = 0; j < job_count; j++) jobs[j].queued = queued;
+
+        //Jobs given to a worker lane are left to its thread.
+        int lane_count = assign_lanes(ctx, sources, jobs, job_count, lanes, lane_jobs);
+        int started = 0;
+        for (; started < job_count; started++) {
+            if (jobs[started].lane >= 0) {
+                continue;
+            }
+            if (ctx->tracedb) jobs[started].cmd.trace = &jobs[started].trace;
+            if (!ctx->parallel) {
+                compile_worker(&jobs[started]);
+            } else if (thread_create(&threads[started], compile_worker, &jobs[started]) != 0) {
+                print_error("Failed to create thread");
+                failed = 1;
+                break;
+            }
+        }
+
+        int lanes_run = started == job_count;
+        for (int l = 0; lanes_run && l < lane_count; l++) {
+            lanes[l].threaded = lanes[l].count > 0 && thread_create(&lane_threads[l], lane_worker, &lanes[l]) == 0;
+            if (lanes[l].count > 0 && !lanes[l].threaded) lane_worker(&lanes[l]);
+        }
+        for (int l = 0; lanes_run && l < lane_count; l++) {
+            worker_lane_t *lane      = &lanes[l];
+            fortean_worker_t *worker = &ctx->workers->list[lane->worker];
+            if (lane->threaded) thread_join(lane_threads[l]);
+            worker->jobs += lane->sent;
+            worker->retried += lane->lost;
+            worker->seconds += lane->seconds;
+            if (lane->down && !worker->down) {
+                char msg[512];
+                snprintf(msg, sizeof(msg), "Worker %s stopped answering, compiling its files locally.", worker->address);
+                print_info(msg);
+                worker->down = 1;
+            }
+        }
+
+        //Join the whole level before the next one reads its modules.
+        for (int j = 0; j < job_count; j++) {
+            compile_job_t *job = &jobs[j];
+            int ran = job->lane >= 0 ? lanes_run : j < started;
+            if (ran && job->lane < 0 && ctx->parallel) thread_join(threads[j]);
+            if (ran) {
+                timeline_job(ctx, job, sources[job->srcs[0]],
+                             job->lane >= 0 ? ctx->workers->list[lanes[job->lane].worker].address : NULL);
+            }
+            fortean_cmd_free(&job->cmd);
+            if (!ran) continue;
+
+            if (job->status == 0) {
+                //A batch's time is shared out evenly between its sources.
+                unsigned int ms = (unsigned int)(job->seconds * 1000.0 / job->src_count);
+                for (int k = 0; k < job->src_count; k++) {
+                    if (ctx->tracedb && job->lane < 0) fortean_tracedb_record(ctx->tracedb, sources[job->srcs[k]], &job->trace);
+                    done[job->srcs[k]] = 1;
+                    hash_entry_put(ctx->times, sources[job->srcs[k]], ms);
+                    cache_store(ctx, sources[job->srcs[k]], keys[job->srcs[k]]);
+                }
+            } else if (job->src_count > 1) {
+                //Retry a failed batch one source at a time so only the broken files stay
+                //out of date and their errors are reported on their own.
+                print_info("Batched compile failed, compiling its sources one at a time.");
+                for (int k = 0; k < job->src_count; k++) {
+                    int src = job->srcs[k];
+                    if (compile_single(ctx, sources[src], &done[src]) != 0) failed = 1;
+                    else cache_store(ctx, sources[src], keys[src]);
+                }
+            } else {
+                failed = 1;
+            }
+            fortean_trace_free(&job->trace);
+        }
+
+        //The levels show where the module graph makes the build wait.
+        char level_name[64];
+        snprintf(level_name, sizeof(level_name), "level %d", lvl);
+        fortean_timeline_span_t *span = fortean_timeline_phase(ctx->timeline, level_name, level_start);
+        if (span) span->cat = "level";
+        fortean_timeline_arg_int(span, "jobs", job_count);
+    }
+    if (failed) print_error("Compilation failed.");
+
+    free(jobs);
+    free(threads);
+    free(unit_src);
+    free(todo);
+    free(keys);
+    free(lanes);
+    free(lane_threads);
+    free(lane_jobs);
+    return failed ? -1 : 0;
+}
+
+//Libary build
+//The main programs of [[bin]] targets are left out of the archive.
+static int collect_archive_objects(char **sources, int src_count, const char *obj_dir,
+                                   const fortean_bin_t *bins, int bin_count, fortean_archive_t *archive) {
+    archive->objects      = calloc(src_count > 0 ? src_count : 1, sizeof(char *));
+    archive->object_count = 0;
+    if (!archive->objects) return -1;
+    for (int i = 0; i < src_count; i++) {
+        if (is_other_main(sources[i], bins, bin_count, -1)) continue;
+        char *obj_path = object_path_for_source(obj_dir, sources[i]);
+        if (!obj_path) return -1;
+        archive->objects[archive->object_count++] = obj_path;
+    }
+    return 0;
+}
+
+//The archive update and when it ran
+typedef struct {
+    fortean_archive_t *archive;
+    double start;
+    double end;
+} archive_run_t;
+
+static void archive_worker(void *arg) {
+    archive_run_t *run = (archive_run_t *)arg;
+    run->start = fortean_wall_time();
+    run->archive->status = fortean_archive_update(run->archive);
+    run->end = fortean_wall_time();
+}
+
+//The compile items of a unity build, used in place of the sources from the compile
+//step on. sources[] borrows the unit paths and the leftover source paths.
+typedef struct {
+    fortean_unity_t plan;
+    char **sources;
+    unsigned char *need;
+    unsigned char *done;
+    unsigned char **member;        // Per executable, NULL links every item
+} unity_build_t;
+
+//Sources that can go into a unit: built with the plain build flags, a known source
+//form and no program unit unless programs_ok is set.
+static int unity_eligible(const char *src, unsigned int base_fp, const char *compiler, char **flags,
+                          int flag_count, const fortean_overrides_t *overrides, int programs_ok,
+                          unsigned char *fixed) {
+    char *name = get_last_path_segment(src);
+    char *ext  = name ? strrchr(name, '.') : NULL;
+    int known  = is_object_extension(ext);
+    *fixed     = known && strcmp_case_insensitive(ext, ".f90") != 0;
+    free(name);
+    if (!known) return 0;
+    if (fingerprint_for_source(compiler, flags, flag_count, overrides, src) != base_fp) return 0;
+
+    fortean_fscan_t scan;
+    if (fortean_fscan_file(src, &scan) != 0) return 0;
+    int is_program = scan.is_program;
+    fortean_fscan_free(&scan);
+    return programs_ok || !is_program;
+}
+
+//Group the sources into units under unity_dir and write them. The program joins a
+//unit too, so the procedures it calls can be inlined, unless several executables or
+//an archive share the units. Fortran include lines are looked up next to the
+//including file, so the units get an override that adds the directory of every
+//source they hold.
+static int setup_unity(fortean_toml_t *cfg, const char *profile, const fortean_graph_t *graph,
+                       char **sources, const int *src_node, int src_count, const unsigned char *build_mark,
+                       const unsigned char *need, const char *compiler, char **flags, int flag_count,
+                       fortean_overrides_t *overrides, const char *obj_dir, const char *unity_dir,
+                       unsigned char **bin_member, int bin_count, int has_lib, unity_build_t *ub) {
+    int n = src_count > 0 ? src_count : 1;
+    unsigned char *eligible = calloc(n, 1);
+    unsigned char *fixed    = calloc(n, 1);
+    unsigned int *key       = calloc(n, sizeof(unsigned int));
+    int res = -1;
+    if (!eligible || !fixed || !key) {
+        print_error("Memory allocation error for the unity build.");
+        goto cleanup;
+    }
+
+    unsigned int base_fp = fortean_flags_fingerprint(compiler, flags, flag_count);
+    for (int i = 0; i < src_count; i++) {
+        if (!build_mark[i]) continue;
+        eligible[i] = unity_eligible(sources[i], base_fp, compiler, flags, flag_count, overrides,
+                                     bin_count == 1 && !has_lib, &fixed[i]);
+        key[i]      = base_fp;
+    }
+
+    int max_files  = fortean_toml_get_profile_int(cfg, profile, "unity-files", 0);
+    long max_bytes = fortean_toml_get_profile_int(cfg, profile, "unity-bytes", 262144);
+    if (fortean_unity_plan(graph, sources, src_node, src_count, build_mark, eligible, key, fixed,
+                           max_files, max_bytes, unity_dir, &ub->plan) != 0) goto cleanup;
+    if (fortean_unity_write(&ub->plan, sources) != 0) goto cleanup;
+
+    //One -I per directory holding a unit member.
+    fortean_override_t inc = {0};
+    inc.files = calloc(2, sizeof(char *));
+    inc.add   = calloc(n + 1, sizeof(char *));
+    fortean_override_t *items = realloc(overrides->items, (overrides->count + 1) * sizeof(fortean_override_t));
+    if (!inc.files || !inc.add || !items) {
+        free(inc.files);
+        free(inc.add);
+        print_error("Memory allocation error for the unity build.");
+        goto cleanup;
+    }
+    overrides->items = items;
+    char unit_glob[600];
+    snprintf(unit_glob, sizeof(unit_glob), "%s/", unity_dir);
+    inc.files[0] = strdup(unit_glob);
+    int inc_count = 0;
+    for (int i = 0; i < src_count; i++) {
+        if (ub->plan.unit_of[i] < 0) continue;
+        const char *end = strrchr(sources[i], '/');
+#ifdef _WIN32
+        const char *bs = strrchr(sources[i], '\\');
+        if (bs && (!end || bs > end)) end = bs;
+#endif
+        char inc_flag[600];
+        if (end) snprintf(inc_flag, sizeof(inc_flag), "-I%.*s", (int)(end - sources[i]), sources[i]);
+        else     snprintf(inc_flag, sizeof(inc_flag), "-I.");
+        int seen = 0;
+        for (int k = 0; k < inc_count && !seen; k++) seen = strcmp(inc.add[k], inc_flag) == 0;
+        if (!seen) inc.add[inc_count++] = strdup(inc_flag);
+    }
+    overrides->items[overrides->count++] = inc;
+
+    int items_n = ub->plan.item_count > 0 ? ub->plan.item_count : 1;
+    ub->sources = calloc(items_n, sizeof(char *));
+    ub->need    = calloc(items_n, 1);
+    ub->done    = calloc(items_n, 1);
+    ub->member  = calloc(bin_count > 0 ? bin_count : 1, sizeof(unsigned char *));
+    if (!ub->sources || !ub->need || !ub->done || !ub->member) {
+        print_error("Memory allocation error for the unity build.");
+        goto cleanup;
+    }
+    for (int it = 0; it < ub->plan.item_count; it++) {
+        int u = ub->plan.item_unit[it];
+        if (u < 0) {
+            ub->sources[it] = sources[ub->plan.item_src[it]];
+            ub->need[it]    = need[ub->plan.item_src[it]];
+            continue;
+        }
+
+        //A unit compiles when one of its files would, or its content or object changed.
+        fortean_unit_t *unit = &ub->plan.units[u];
+        ub->sources[it] = unit->path;
+        ub->need[it]    = unit->rewritten;
+        for (int m = 0; m < unit->member_count; m++) ub->need[it] |= need[unit->members[m]];
+        char *obj_path = object_path_for_source(obj_dir, unit->path);
+        if (obj_path && !file_exists(obj_path)) ub->need[it] = 1;
+        free(obj_path);
+    }
+
+    //An executable links the items holding a file of its use closure.
+    for (int b = 0; b < bin_count; b++) {
+        if (!bin_member[b]) continue;
+        ub->member[b] = calloc(items_n, 1);
+        if (!ub->member[b]) {
+            print_error("Memory allocation error for the unity build.");
+            goto cleanup;
+        }
+        for (int i = 0; i < src_count; i++) {
+            if (bin_member[b][i] && ub->plan.item_of[i] >= 0) ub->member[b][ub->plan.item_of[i]] = 1;
+        }
+    }
+
+    int unit_files = 0;
+    for (int u = 0; u < ub->plan.unit_count; u++) unit_files += ub->plan.units[u].member_count;
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Unity build: %d sources in %d units, %d compiled on their own",
+             unit_files, ub->plan.unit_count, ub->plan.item_count - ub->plan.unit_count);
+    print_info(msg);
+    res = 0;
+
+cleanup:
+    free(eligible);
+    free(fixed);
+    free(key);
+    return res;
 }
 
+static void free_unity_build(unity_build_t *ub, int bin_count) {
+    for (int b = 0; ub->member && b < bin_count; b++) free(ub->member[b]);
+    free(ub->member);
+    free(ub->sources);
+    free(ub->need);
+    free(ub->done);
+    fortean_unity_free(&ub->plan);
+}
 
-//Libary build
-int build_library(char** sources, int src_count, const char* obj_dir, const char* lib_name){
-    char ar_cmd[4096] = {0};
-    size_t ar_pos = 0;
+void fortean_build_cache_key(const fortean_build_opts_t *opts, char *buf, size_t size) {
+    const char *parts[] = {opts->profile, opts->variant, opts->unity ? "unity" : NULL};
+    buf[0] = '\0';
+    for (int i = 0; i < 3; i++) {
+        if (!parts[i]) continue;
+        size_t len = strlen(buf);
+        snprintf(buf + len, size - len, "%s%s", len ? "-" : "", parts[i]);
+    }
+}
 
-    ar_pos += snprintf(ar_cmd + ar_pos, sizeof(ar_cmd) - ar_pos, "ar rcs %s%c%s ","lib",PATH_SEP,lib_name);
+//fortean gen: the compiles of the sources in the build, then the links and the
+//archive, written as a ninja or make file. A compile reads the .mod files of the
+//sources it uses and writes the ones of the modules it defines.
+static int write_build_file(const fortean_build_opts_t *opts, const compile_ctx_t *ctx, const fortean_graph_t *graph,
+                            char **sources, const int *src_node, int src_count, const unsigned char *build_mark,
+                            link_job_t *jobs, int job_count, const fortean_archive_t *archive) {
+    fortean_gen_t gen = {0};
+    int result  = -1;
+    int failed  = 0;
+    int *node_step = malloc((graph->count > 0 ? graph->count : 1) * sizeof(int));  // -1 when not compiled
+    int *step_node = malloc((src_count > 0 ? src_count : 1) * sizeof(int));
+    if (!node_step || !step_node) goto nomem;
+    for (int i = 0; i < graph->count; i++) node_step[i] = -1;
 
     for (int i = 0; i < src_count; i++) {
-        const char *src      = sources[i];
-        const char *rel_path = get_last_path_segment(src);
-        char *ext = strrchr(rel_path, '.');
-        if (ext && (strcmp_case_insensitive(ext, ".f90") == 0 
-                ||  strcmp_case_insensitive(ext, ".for") == 0
-                ||  strcmp_case_insensitive(ext, ".f")   == 0
-                ||  strcmp_case_insensitive(ext, ".f77") == 0)){
-            *ext = '\0';
-        }
-
-        //Write the "object" to the obj directory. For simplified building, 
-        //we eliminate the relative path to the src in the obj dir and link against
-        //just a list of all .o files we need in one place. This is much cleaner. 
-        char obj_path[512];
-        snprintf(obj_path, sizeof(obj_path), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
-        ar_pos += snprintf(ar_cmd + ar_pos, sizeof(ar_cmd) - ar_pos, " %s", obj_path);
-    }
-    print_info(ar_cmd);
-    int ret = system(ar_cmd);
-    if (ret != 0) {
-        print_error("Linking failed.");
-        return -1;
+        if (!build_mark[i]) continue;
+        fortean_cmd_t cmd;
+        if (compile_args(ctx, sources[i], &cmd) != 0) goto cleanup;
+        char *obj_file = object_path_for_source(ctx->obj_dir, sources[i]);
+        fortean_gen_step_t *step = obj_file ? fortean_gen_add(&gen, FORTEAN_GEN_COMPILE, &cmd, obj_file) : NULL;
+        if (!step) {
+            fortean_cmd_free(&cmd);
+            free(obj_file);
+            goto nomem;
+        }
+        failed |= fortean_gen_add_path(&step->inputs, sources[i]);
+        if (ctx->depfiles) {
+            char dep_file[1024];
+            depfile_for_object(obj_file, dep_file, sizeof(dep_file));
+            step->depfile = strdup(dep_file);
+            failed |= !step->depfile;
+        }
+        free(obj_file);
+
+        fortean_fscan_t scan;
+        if (fortean_fscan_file(sources[i], &scan) == 0) {
+            for (int m = 0; m < scan.module_count; m++) {
+                char mod[1024];
+                snprintf(mod, sizeof(mod), "%s%c%s.mod", ctx->mod_dir, PATH_SEP, scan.modules[m]);
+                failed |= fortean_gen_add_path(&step->mods_out, mod);
+            }
+            fortean_fscan_free(&scan);
+        }
+        node_step[src_node[i]] = gen.count - 1;
+        step_node[gen.count - 1] = src_node[i];
+    }
+    int compile_count = gen.count;
+    for (int s = 0; s < compile_count; s++) {
+        int node = step_node[s];
+        for (int d = 0; d < graph->dep_count[node]; d++) {
+            int used = node_step[graph->deps[node][d]];
+            if (used < 0 || used == s) continue;
+            for (int m = 0; gen.steps[used].mods_out && gen.steps[used].mods_out[m]; m++) {
+                failed |= fortean_gen_add_path(&gen.steps[s].mods_in, gen.steps[used].mods_out[m]);
+            }
+        }
     }
-    return 0;
-}
 
-int fortean_build_project_incremental(const int parallel_build, const int incremental_build_override, const int lib_only) {
+    //The archive before the links, an executable can link the project library.
+    if (archive) {
+        fortean_cmd_t cmd;
+        fortean_cmd_init(&cmd, archive->archiver ? archive->archiver : "ar");
+        if (archive->thin) fortean_cmd_add(&cmd, "--thin");
+        fortean_cmd_add(&cmd, "rcs");
+        fortean_cmd_add(&cmd, archive->lib_path);
+        for (int i = 0; i < archive->object_count; i++) fortean_cmd_add(&cmd, archive->objects[i]);
+        fortean_gen_step_t *step = fortean_gen_add(&gen, FORTEAN_GEN_ARCHIVE, &cmd, archive->lib_path);
+        if (!step) {
+            fortean_cmd_free(&cmd);
+            goto nomem;
+        }
+        for (int i = 0; i < archive->object_count; i++) failed |= fortean_gen_add_path(&step->inputs, archive->objects[i]);
+        failed |= fortean_gen_add_path(&gen.targets, archive->lib_path);
+    }
 
-    //Check if we can do an incremental build.
-    int incremental_build = file_exists(hash_cache_file);
+    //The same objects prepare_link puts on the command line, and the libraries that are files.
+    for (int j = 0; j < job_count; j++) {
+        link_job_t *job  = &jobs[j];
+        const char *name = job->bins[job->self].name;
+        fortean_gen_step_t *step = fortean_gen_add(&gen, FORTEAN_GEN_LINK, &job->cmd, name);
+        if (!step) goto nomem;
+        for (int i = 0; i < job->src_count; i++) {
+            if (job->member && !job->member[i]) continue;
+            if (is_other_main(job->sources[i], job->bins, job->bin_count, job->self)) continue;
+            char *obj_path = object_path_for_source(job->obj_dir, job->sources[i]);
+            failed |= !obj_path || fortean_gen_add_path(&step->inputs, obj_path);
+            free(obj_path);
+        }
+        for (int i = 0; job->source_libs && job->source_libs[i]; i++) {
+            if (job->source_libs[i][0] != '-') failed |= fortean_gen_add_path(&step->inputs, job->source_libs[i]);
+        }
+        failed |= fortean_gen_add_path(&gen.targets, name);
+    }
+    if (failed) goto nomem;
+
+    result = fortean_gen_write(&gen, opts->gen_format, opts->gen_path);
+    goto cleanup;
+
+nomem:
+    print_error("Memory allocation error.");
+cleanup:
+    fortean_gen_free(&gen);
+    free(node_step);
+    free(step_node);
+    return result;
+}
 
-    //If we allow the override, then we want to rebuild all, so incremental build is disabled.
-    if(incremental_build_override == 0) incremental_build = 0;
+static int build_project(const fortean_build_opts_t *opts) {
+
+    const int parallel_build = opts->parallel_build;
+    const int lib_only       = opts->lib_only;
+    const char *profile      = opts->profile;
+    int result               = -1;
+
+    //Allocate the hashmaps up front so every cleanup path can free them.
+    FileNode*  cur_map[HASH_TABLE_SIZE]       = {NULL};
+    HashEntry* prev_map[HASH_TABLE_SIZE]      = {NULL};
+    HashEntry* prev_fp_map[HASH_TABLE_SIZE]   = {NULL};
+    FileNode*  exclusion_map[HASH_TABLE_SIZE] = {NULL};
+    HashEntry* skip_map[HASH_TABLE_SIZE]      = {NULL};
+    HashEntry* time_map[HASH_TABLE_SIZE]      = {NULL};
+    HashEntry* known_map[HASH_TABLE_SIZE]     = {NULL};
+    fortean_graph_t graph = {0};
+    fortean_tracedb_t tracedb = {0};
+    fortean_archive_t archive = {0};
+    fortean_objcache_t objcache = {0};
+    unity_build_t unity = {0};
+    fortean_lto_t lto = {0};
+    fortean_timeline_t timeline_spans;     // Every build keeps one for its report
+    fortean_timeline_init(&timeline_spans);
+    fortean_timeline_t *timeline = &timeline_spans;
+    double phase = timeline->origin;
+    link_job_t *link_jobs = NULL;
+    int link_job_count    = 0;
+    char **source_libs    = NULL;
+
+    //Per source state, all indexed like sources[].
+    int *src_node             = NULL;  // Position in the graph
+    int *src_level            = NULL;  // Dependency level for parallel builds
+    unsigned char *build_mark = NULL;  // Part of this build
+    unsigned char *need       = NULL;  // Has to be compiled
+    unsigned char *done       = NULL;  // Compiled successfully
+    rebuild_t *why            = NULL;  // Why each graph node is compiled
+    unsigned char **bin_member = NULL; // Per executable use closure, NULL links everything
 
     //Load the toml file.
     const char* toml_path = "Fortean.toml";
@@ -194,22 +1703,89 @@ int fortean_build_project_incremental(const int parallel_build, const int increm
         return -1;
     }
 
-    const char *target = fortean_toml_get_string(&cfg, "build.target");
-    if (!target) {
-        print_error("Missing 'build.target' in config.");
+    if (profile && !fortean_toml_has_profile(&cfg, profile)) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "No [profile.%s] table in Fortean.toml.", profile);
+        print_error(msg);
+        fortean_toml_free(&cfg);
+        return -1;
+    }
+
+    //Every profile gets its own cache state, and so does a unity or pgo build of it.
+    char cache_name[256];
+    fortean_build_cache_key(opts, cache_name, sizeof(cache_name));
+    const char *cache_key = cache_name[0] ? cache_name : NULL;
+    char cache_dir[512];
+    char hash_cache_file[512];
+    char deps_file[512];
+    char flags_cache_file[512];
+    char times_cache_file[512];
+    char trace_cache_file[512];
+    snprintf(cache_dir, sizeof(cache_dir), ".cache%c%s", PATH_SEP, cache_key ? cache_key : "");
+    cache_file_path(hash_cache_file,  sizeof(hash_cache_file),  cache_key, "hash.dep");
+    cache_file_path(deps_file,        sizeof(deps_file),        cache_key, "topo.dep");
+    cache_file_path(flags_cache_file, sizeof(flags_cache_file), cache_key, "flags.dep");
+    cache_file_path(times_cache_file, sizeof(times_cache_file), cache_key, "times.dep");
+    cache_file_path(trace_cache_file, sizeof(trace_cache_file), cache_key, "trace.dep");
+    if (cache_key && ensure_dir(cache_dir) != 0) {
+        fortean_toml_free(&cfg);
+        return -1;
+    }
+
+    //Check if we can do an incremental build.
+    int incremental_build = file_exists(hash_cache_file);
+
+    //If we allow the override, then we want to rebuild all, so incremental build is disabled.
+    if(opts->incremental_build == 0) incremental_build = 0;
+
+    //Executables to link: the [[bin]] tables or build.target.
+    const char *target = fortean_toml_get_profile_string(&cfg, profile, "target");
+    fortean_bin_t *bins = NULL;
+    int bin_count       = 0;
+    if (load_bins(&cfg, target, &bins, &bin_count) != 0) {
+        free_bins(bins, bin_count);
         fortean_toml_free(&cfg);
         return -1;
     }
 
-    char *compiler = (char *)fortean_toml_get_string(&cfg, "build.compiler");
+    //With --bin only that executable is compiled and linked.
+    int selected_bin = -1;
+    if (opts->bin) {
+        for (int i = 0; i < bin_count; i++) {
+            if (strcmp(bins[i].name, opts->bin) == 0) selected_bin = i;
+        }
+        if (selected_bin < 0) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "No executable named %s in Fortean.toml.", opts->bin);
+            print_error(msg);
+            free_bins(bins, bin_count);
+            fortean_toml_free(&cfg);
+            return -1;
+        }
+    }
+
+    //Another build tree, e.g. one compiler of fortean compare, keeps its outputs apart.
+    for (int i = 0; opts->out_dir && i < bin_count; i++) {
+        char *name = malloc(strlen(opts->out_dir) + strlen(bins[i].name) + 2);
+        if (!name) continue;
+        sprintf(name, "%s%c%s", opts->out_dir, PATH_SEP, bins[i].name);
+        free(bins[i].name);
+        bins[i].name = name;
+    }
+
+    char *compiler = (char *)(opts->compiler ? opts->compiler
+                                             : fortean_toml_get_profile_string(&cfg, profile, "compiler"));
     if (!compiler) {
         print_error("Invalid compiler selected");
+        free_bins(bins, bin_count);
+        fortean_toml_free(&cfg);
         return -1;
     }
 
-    char **flags_array = fortean_toml_get_array(&cfg, "build.flags");
+    char **flags_array = fortean_toml_get_profile_array(&cfg, profile, "flags");
     if (!flags_array) {
         print_error("Missing or empty 'build.flags' in config.");
+        free_bins(bins, bin_count);
         fortean_toml_free(&cfg);
         return -1;
     }
@@ -225,394 +1801,806 @@ int fortean_build_project_incremental(const int parallel_build, const int increm
         }
     }
 
-    // Build single string of all flags (space separated)
-    size_t flags_len = 0;
-    for (int i = 0; i < unique_count; i++) {
-        flags_len += strlen(unique_flags[i]) + 1; // +1 for space or null terminator
+    //A profile can also edit the inherited flags, e.g. remove = ["-O*"], add = ["-O0", "-g"].
+    if (profile) {
+        char key_path[256];
+        snprintf(key_path, sizeof(key_path), "profile.%s.remove", profile);
+        char **profile_remove = fortean_toml_get_array(&cfg, key_path);
+        snprintf(key_path, sizeof(key_path), "profile.%s.add", profile);
+        char **profile_add = fortean_toml_get_array(&cfg, key_path);
+
+        int res = fortean_flags_edit(&unique_flags, &unique_count, profile_remove, profile_add);
+        for (int i = 0; profile_remove && profile_remove[i]; i++) free(profile_remove[i]);
+        for (int i = 0; profile_add && profile_add[i]; i++) free(profile_add[i]);
+        free(profile_remove);
+        free(profile_add);
+        if (res != 0) {
+            print_error("Memory error applying profile flags");
+            goto cleanup_arrays;
+        }
     }
 
-    char *flags_str = malloc(flags_len + 1);
-    if (!flags_str) {
-        print_error("Memory allocation error for flags string.");
+    //Settings each compiler spells its own way, e.g. opt-level = "3" or openmp = true.
+    const fortean_compiler_t *cc = fortean_compiler_lookup(compiler);
+    char opt_flag[32] = "";
+    const char *opt_level = fortean_toml_get_profile_string(&cfg, profile, "opt-level");
+    int opt_number        = fortean_toml_get_profile_int(&cfg, profile, "opt-level", -1);
+    if (!opt_level && opt_number >= 0) {
+        snprintf(opt_flag, sizeof(opt_flag), "%d", opt_number);
+        opt_level = opt_flag;
+    }
+    if (opt_level) {
+        char level[32];
+        snprintf(level, sizeof(level), "%s", opt_level);
+        if (fortean_compiler_opt_flag(cc, level, opt_flag, sizeof(opt_flag)) != 0) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "Unknown opt-level %s, use 0, 1, 2, 3, s or fast.", level);
+            print_error(msg);
+            goto cleanup_arrays;
+        }
+    }
+    char *remove_opt[] = {"-O*", "-fast", NULL};
+    char *add_opt[]    = {opt_flag, NULL};
+    char *add_openmp[] = {(char *)cc->openmp, NULL};
+    if ((opt_flag[0] && fortean_flags_edit(&unique_flags, &unique_count, remove_opt, add_opt) != 0) ||
+        (fortean_toml_get_profile_bool(&cfg, profile, "openmp", 0) &&
+         fortean_flags_edit(&unique_flags, &unique_count, NULL, add_openmp) != 0)) {
+        print_error("Memory error applying profile flags");
         goto cleanup_arrays;
     }
-    flags_str[0] = '\0';
+    int depfiles = fortean_toml_get_profile_bool(&cfg, profile, "depfile", 0);
+    if (depfiles && !cc->depfile[0]) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "%s can't write dependency files, depfile is ignored.", compiler);
+        print_info(msg);
+        depfiles = 0;
+    }
+
+    //Linker selection for the link step only, e.g. linker = "mold".
+    char *link_flags[16] = {NULL};
+    char fuse_ld[64];
+    const char *linker = fortean_toml_get_profile_string(&cfg, profile, "linker");
+    int link_count     = 0;
+    int gdb_index      = 0;
+    if (linker) {
+        if (strcmp(linker, "lld") != 0 && strcmp(linker, "mold") != 0 &&
+            strcmp(linker, "gold") != 0 && strcmp(linker, "bfd") != 0) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "Unknown linker %s, use lld, mold, gold or bfd.", linker);
+            print_error(msg);
+            goto cleanup_arrays;
+        }
+        snprintf(fuse_ld, sizeof(fuse_ld), "-fuse-ld=%s", linker);
+        link_flags[link_count++] = fuse_ld;
+        gdb_index = strcmp(linker, "bfd") != 0;
+    }
+
+    //Debug info in .dwo files next to the objects, so the linker does not have to copy it.
+    //The fast linkers can also build the index gdb needs to find it.
+    if (fortean_toml_get_profile_bool(&cfg, profile, "split-dwarf", 0)) {
+        char *split_dwarf[] = {"-gsplit-dwarf", NULL};
+        if (fortean_flags_edit(&unique_flags, &unique_count, NULL, split_dwarf) != 0) {
+            print_error("Memory error applying profile flags");
+            goto cleanup_arrays;
+        }
+        if (gdb_index) link_flags[link_count++] = "-Wl,--gdb-index";
+    }
+
+    //Link time optimisation, e.g. lto = "thin". The objects hold the compiler's IR and
+    //the link generates the code, in one partition per core with -j. A hand written
+    //-flto in build.flags is replaced so the two do not fight.
+    const char *lto_mode = fortean_toml_get_profile_string(&cfg, profile, "lto");
+    if (lto_mode && strcmp(lto_mode, "off") != 0) {
+        char lto_cache[512];
+        cache_file_path(lto_cache, sizeof(lto_cache), cache_key, "lto");
+        if (ensure_dir(lto_cache) != 0) goto cleanup_arrays;
+        if (fortean_lto_setup(lto_mode, compiler, linker, parallel_build ? fortean_cpu_count() : 1,
+                              lto_cache, &lto) != 0) {
+            goto cleanup_arrays;
+        }
+        char *remove_lto[] = {"-flto*", "-ipo*", NULL};
+        if (fortean_flags_edit(&unique_flags, &unique_count, remove_lto, lto.compile) != 0) {
+            print_error("Memory error applying profile flags");
+            goto cleanup_arrays;
+        }
+        for (int i = 0; lto.link[i] && link_count < 15; i++) link_flags[link_count++] = lto.link[i];
+    }
 
-    for (int i = 0; i < unique_count; i++) {
-        strcat(flags_str, unique_flags[i]);
-        if (i < unique_count - 1) strcat(flags_str, " ");
+    //Flags of the build driving this one, e.g. the instrumentation of fortean pgo.
+    if (!opts->flag_files &&
+        fortean_flags_edit(&unique_flags, &unique_count, opts->remove_flags, opts->add_flags) != 0) {
+        print_error("Memory error applying profile flags");
+        goto cleanup_arrays;
     }
 
-    //Load the location to place the obj and mod files. 
+    //Load the location to place the obj and mod files. Profiles default to a
+    //sub directory of the plain ones so their objects never overwrite each other.
     const char *obj_dir = fortean_toml_get_string(&cfg, "build.obj_dir");
     const char *mod_dir = fortean_toml_get_string(&cfg, "build.mod_dir");
 
     if (!obj_dir || !mod_dir) {
         print_error("Missing directory settings in config.");
-        goto cleanup_flags_str;
+        goto cleanup_arrays;
     }
 
-    if (!dir_exists(obj_dir)) {
+    //Objects and modules on a RAM disk, e.g. scratch = "/dev/shm/fortean". The directories
+    //keep their names under a directory of the project there.
+    const char *scratch = fortean_toml_get_profile_string(&cfg, profile, "scratch");
+    const char *plain_obj_dir = obj_dir;
+    const char *plain_mod_dir = mod_dir;
+    char scratch_root[700];
+    char scratch_obj_dir[1024];
+    char scratch_mod_dir[1024];
+    if (scratch) {
+        if (fortean_scratch_root(scratch, scratch_root, sizeof(scratch_root)) != 0) {
+            print_error("Failed to get the project directory for the scratch path.");
+            goto cleanup_arrays;
+        }
+        scratch_path(scratch_root, obj_dir, scratch_obj_dir, sizeof(scratch_obj_dir));
+        scratch_path(scratch_root, mod_dir, scratch_mod_dir, sizeof(scratch_mod_dir));
+        if (fortean_scratch_make_dirs(scratch_obj_dir) != 0 || fortean_scratch_make_dirs(scratch_mod_dir) != 0) {
+            char msg[800];
+            snprintf(msg, sizeof(msg), "Failed to create the scratch directories in %s", scratch_root);
+            print_error(msg);
+            goto cleanup_arrays;
+        }
+        obj_dir = scratch_obj_dir;
+        mod_dir = scratch_mod_dir;
+    }
+
+    //The build files of fortean gen make the directories themselves.
+    if (!dir_exists(obj_dir) && !opts->gen_format) {
         print_error("Object directory does not exist.");
-        goto cleanup_flags_str;
+        goto cleanup_arrays;
     }
-    if (!dir_exists(mod_dir)) {
+    if (!dir_exists(mod_dir) && !opts->gen_format) {
         print_error("Module directory does not exist.");
+        goto cleanup_arrays;
+    }
+
+    char profile_obj_dir[1100];
+    char profile_mod_dir[1100];
+    if (profile) {
+        const char *dir = fortean_toml_get_profile_string(&cfg, profile, "obj_dir");
+        if (dir == NULL || strcmp(dir, plain_obj_dir) == 0) {
+            snprintf(profile_obj_dir, sizeof(profile_obj_dir), "%s%c%s", obj_dir, PATH_SEP, profile);
+        } else {
+            scratch_path(scratch ? scratch_root : NULL, dir, profile_obj_dir, sizeof(profile_obj_dir));
+        }
+        dir = fortean_toml_get_profile_string(&cfg, profile, "mod_dir");
+        if (dir == NULL || strcmp(dir, plain_mod_dir) == 0) {
+            snprintf(profile_mod_dir, sizeof(profile_mod_dir), "%s%c%s", mod_dir, PATH_SEP, profile);
+        } else {
+            scratch_path(scratch ? scratch_root : NULL, dir, profile_mod_dir, sizeof(profile_mod_dir));
+        }
+        if (ensure_dir(profile_obj_dir) != 0 || ensure_dir(profile_mod_dir) != 0) goto cleanup_arrays;
+
+        obj_dir = profile_obj_dir;
+        mod_dir = profile_mod_dir;
+    }
+
+    //A unity or pgo build keeps its objects and modules apart from the file by file build.
+    char variant_obj_dir[1200];
+    char variant_mod_dir[1200];
+    if (opts->unity || opts->variant) {
+        fortean_build_opts_t variant = {0};
+        variant.unity   = opts->unity;
+        variant.variant = opts->variant;
+        char name[128];
+        fortean_build_cache_key(&variant, name, sizeof(name));
+        int obj_len = snprintf(variant_obj_dir, sizeof(variant_obj_dir), "%s%c%s", obj_dir, PATH_SEP, name);
+        int mod_len = snprintf(variant_mod_dir, sizeof(variant_mod_dir), "%s%c%s", mod_dir, PATH_SEP, name);
+        if (obj_len < 0 || (size_t)obj_len >= sizeof(variant_obj_dir) || mod_len < 0 ||
+            (size_t)mod_len >= sizeof(variant_mod_dir)) {
+            print_error("The object or module directory path is too long.");
+            goto cleanup_arrays;
+        }
+        if (ensure_dir(variant_obj_dir) != 0 || ensure_dir(variant_mod_dir) != 0) goto cleanup_arrays;
+
+        //A new variant starts from a copy of its seed, e.g. a fortean tune candidate from
+        //the baseline, so only the files whose flags differ are compiled.
+        if (opts->seed && !file_exists(hash_cache_file)) {
+            variant.variant = opts->seed;
+            fortean_build_cache_key(&variant, name, sizeof(name));
+            char seed_dir[1400];
+            snprintf(seed_dir, sizeof(seed_dir), "%s%c%s", obj_dir, PATH_SEP, name);
+            copy_dir_files(seed_dir, variant_obj_dir);
+            snprintf(seed_dir, sizeof(seed_dir), "%s%c%s", mod_dir, PATH_SEP, name);
+            copy_dir_files(seed_dir, variant_mod_dir);
+            variant.profile = profile;
+            fortean_build_cache_key(&variant, name, sizeof(name));
+            snprintf(seed_dir, sizeof(seed_dir), ".cache%c%s", PATH_SEP, name);
+            copy_dir_files(seed_dir, cache_dir);
+            incremental_build = opts->incremental_build && file_exists(hash_cache_file);
+        }
+        obj_dir = variant_obj_dir;
+        mod_dir = variant_mod_dir;
+    }
+
+    //Scratch directories emptied since the last build, e.g. by a reboot, get their files
+    //back from the copy under .cache, or everything is compiled again.
+    char scratch_manifest[512];
+    char scratch_store[512];
+    cache_file_path(scratch_manifest, sizeof(scratch_manifest), cache_key, "scratch.dep");
+    cache_file_path(scratch_store,    sizeof(scratch_store),    cache_key, "scratch");
+    if (scratch && incremental_build && fortean_scratch_restore(scratch_manifest, scratch_store) != 0) {
+        print_info("The scratch directories have files missing from .cache, building everything.");
+        incremental_build = 0;
+    }
+
+    //Per-file and per-directory flag overrides, the profile's entries apply last.
+    fortean_overrides_t overrides = {0};
+    if (fortean_overrides_load(&cfg, "build.override", &overrides) != 0) {
+        goto cleanup_flags_str;
+    }
+    if (profile) {
+        char key_path[256];
+        snprintf(key_path, sizeof(key_path), "profile.%s.override", profile);
+        if (fortean_overrides_load(&cfg, key_path, &overrides) != 0) goto cleanup_flags_str;
+    }
+    if (opts->flag_files &&
+        fortean_overrides_add(&overrides, opts->flag_files, opts->remove_flags, opts->add_flags) != 0) {
         goto cleanup_flags_str;
     }
 
     char **deep_dirs    = fortean_toml_get_array(&cfg, "search.deep");
     char **shallow_dirs = fortean_toml_get_array(&cfg, "search.shallow");
+    char **exclude_files = NULL;
+    char **sources = NULL;
+    int src_count  = 0;
 
-    //Build the command for the maketopologicf90 call. 
-    //This will be a loop when we support multiple binaries. 
-    char maketop_cmd[1024] = {0};
+    fortean_timeline_phase(timeline, "configure", phase);
+    phase = fortean_wall_time();
+
+    //Sources hashed by their tokens, e.g. semantic-hash = true, so an edit of comments or
+    //layout alone doesn't recompile them or the sources using them. Each source is hashed
+    //as its own flags say, overrides included.
+    fortean_semhash_build_t semhash_build = {unique_flags, unique_count, &overrides};
+    const fortean_semhash_build_t *semhash = NULL;
+    if (fortean_toml_get_profile_bool(&cfg, profile, "semantic-hash", 0)) semhash = &semhash_build;
+
+    //fortean watch knows which files changed since the last build and that no module or
+    //use line did, so the graph of that build still holds and only those files are read.
+    char *topo_make = NULL;
+    if (opts->changed && incremental_build) {
+        size_t topo_len = 0;
+        topo_make = read_file(deps_file, &topo_len);
+        if (topo_make && !graph_covers(topo_make, opts->changed)) {
+            free(topo_make);
+            topo_make = NULL;
+        }
+    }
+    if (topo_make) {
+        load_prev_hashes(hash_cache_file, known_map);
+        for (int i = 0; opts->changed[i]; i++) {
+            int flags = semhash ? fortean_semhash_flags_for_file(semhash, opts->changed[i]) : 0;
+            hash_entry_put(known_map, opts->changed[i], fortean_semhash_file(opts->changed[i], flags));
+        }
+    } else {
+        //Build the command for the maketopologicf90 call. The -m output lists every
+        //source with the files it uses in build order, so one call gives both.
+        fortean_cmd_t maketop_cmd;
 #ifdef _WIN32
-    strcat(maketop_cmd, "bin\\maketopologicf90.exe");
+        fortean_cmd_init(&maketop_cmd, "bin\\maketopologicf90.exe");
 #else
-    strcat(maketop_cmd, "./bin/maketopologicf90.exe");
+        fortean_cmd_init(&maketop_cmd, "./bin/maketopologicf90.exe");
 #endif
-    if (deep_dirs) {
-        strcat(maketop_cmd, " -D ");
-        for (int i = 0; deep_dirs[i]; i++) {
-            strcat(maketop_cmd, deep_dirs[i]);
-            if (deep_dirs[i + 1]) strcat(maketop_cmd, ",");
+        if (deep_dirs) {
+            char *dirs = join_dir_list(deep_dirs);
+            fortean_cmd_add(&maketop_cmd, "-D");
+            fortean_cmd_add(&maketop_cmd, dirs);
+            free(dirs);
         }
-    }
-    if (shallow_dirs) {
-        strcat(maketop_cmd, " -d ");
-        for (int i = 0; shallow_dirs[i]; i++) {
-            strcat(maketop_cmd, shallow_dirs[i]);
-            if (shallow_dirs[i + 1]) strcat(maketop_cmd, ",");
+        if (shallow_dirs) {
+            char *dirs = join_dir_list(shallow_dirs);
+            fortean_cmd_add(&maketop_cmd, "-d");
+            fortean_cmd_add(&maketop_cmd, dirs);
+            free(dirs);
+        }
+        fortean_cmd_add(&maketop_cmd, "-m");
+        topo_make = fortean_cmd_capture(&maketop_cmd);
+        fortean_cmd_free(&maketop_cmd);
+        if (!topo_make) {
+            print_error("Failed to get topologically sorted sources.");
+            goto cleanup_search_arrays;
+        }
+
+        //Write the dependency list to a file and then load it into the hash table.
+        FILE* depedency_chain = fopen(deps_file ,"w+");
+        if (!depedency_chain) {
+            print_error("Failed to write the dependency file. Check that the .cache directory exists.");
+            goto cleanup_sources;
         }
+        fprintf(depedency_chain,"%s",topo_make);
+        fclose(depedency_chain);
     }
-    //Still need the list of source files to link against.
-    char *topo_src= run_command_capture(maketop_cmd);
 
-    //Allocate the hashmaps.
-    FileNode*  cur_map[HASH_TABLE_SIZE]  = {NULL};
-    HashEntry* prev_map[HASH_TABLE_SIZE] = {NULL};
-    
-    //Need the list of everything for linking. 
-    if (!topo_src) {
-        print_error("Failed to get topologically sorted sources.");
-        goto cleanup_search_arrays;
+    fortean_timeline_phase(timeline, "scan", phase);
+    phase = fortean_wall_time();
+    int parsed = parse_dependency_file_known(deps_file,cur_map,known_map,semhash);
+    fortean_timeline_phase(timeline, "hash sources", phase);
+    phase = fortean_wall_time();
+    if (!parsed || fortean_graph_parse(topo_make, &graph) != 0) {
+        print_error("Failed to make hash table of dependency graph");
+        goto cleanup_sources;
+    }
+    fortean_timeline_phase(timeline, "parse graph", phase);
+    phase = fortean_wall_time();
+
+    //The uses the scanner missed, seen by tracing the last compiles, e.g. trace-deps = true.
+    int trace_deps = fortean_toml_get_profile_bool(&cfg, profile, "trace-deps", 0);
+#ifndef FORTEAN_TRACE_SUPPORTED
+    if (trace_deps) print_info("trace-deps needs Linux on x86-64 or arm64, using the scanned dependencies only.");
+    trace_deps = 0;
+#endif
+    if (trace_deps) {
+        fortean_tracedb_load(&tracedb, trace_cache_file);
+        if (fortean_tracedb_merge(&tracedb, &graph) < 0) {
+            print_error("Memory allocation error.");
+            goto cleanup_sources;
+        }
     }
 
-    
     //Now we get the exclusion list (if it exists)
-    FileNode*  exclusion_map[HASH_TABLE_SIZE]  = {NULL};
-    char **exclude_files = fortean_toml_get_array(&cfg, "exclude.files");
+    exclude_files = fortean_toml_get_array(&cfg, "exclude.files");
     if(exclude_files){
         for(int i = 0; exclude_files[i]; i++){
             insert_node(exclude_files[i],exclusion_map);
         }
     }
 
-
-    //From the list of topologically sorted files, we need to parse them
-    //properly as they are a single string. 
-    char *line     = strtok(topo_src, "\n");
-    char **sources = NULL;
-    int src_count  = 0;
-    char **tmp     = NULL;
-    while (line) {
-        tmp = realloc(sources, sizeof(char *)*(src_count + 1));
-        if (!tmp) {
-            print_error("Memory allocation error.");
-            free(topo_src);
-            goto cleanup_sources;
-        }
-                
-        //Skip if this file is in the exclusion list
-        if(node_is_in_the_hashmap(line,exclusion_map)){
-            line = strtok(NULL, "\n");
-            continue;
-        }
-
-        //Otherwise, add to the list of sources!
-        sources = tmp;
-        sources[src_count] = strdup(line);
+    //The sources are the graph in build order without the excluded files.
+    int alloc_count = graph.count > 0 ? graph.count : 1;
+    sources    = calloc(alloc_count, sizeof(char *));
+    src_node   = calloc(alloc_count, sizeof(int));
+    src_level  = calloc(alloc_count, sizeof(int));
+    build_mark = calloc(alloc_count, 1);
+    need       = calloc(alloc_count, 1);
+    done       = calloc(alloc_count, 1);
+    why        = calloc(alloc_count, sizeof(rebuild_t));
+    bin_member = calloc(bin_count, sizeof(unsigned char *));
+    int *node_level = fortean_graph_levels(&graph);
+    if (!sources || !src_node || !src_level || !build_mark || !need || !done || !why || !bin_member || !node_level) {
+        print_error("Memory allocation error.");
+        free(node_level);
+        goto cleanup_sources;
+    }
+    for (int i = 0; i < graph.count; i++) {
+        if (node_is_in_the_hashmap(graph.files[i],exclusion_map)) continue;
+        sources[src_count]   = strdup(graph.files[i]);
+        src_node[src_count]  = i;
+        src_level[src_count] = node_level[i];
         src_count++;
-        line = strtok(NULL, "\n");
     }
+    free(node_level);
 
+    //Everything is part of the build except the programs of the executables not selected with --bin.
+    int unpruned_count = 0;
+    for (int i = 0; i < src_count; i++) {
+        build_mark[i] = !(selected_bin >= 0 && is_other_main(sources[i], bins, bin_count, selected_bin));
+        unpruned_count += build_mark[i];
+    }
 
-    //Define the rebuild count
-    int rebuild_cnt = 0;
-
-    // Compile each source in parallel if asked.
-    thread_t *threads;
-
-    //The most threads we can have is all of them so this is a safe allocation. 
-    if(parallel_build) threads = (thread_t*)malloc(src_count*sizeof(thread_t));
-
-    //For the incremental build, we parse the dependency files and rebuild. 
-    if(incremental_build){
-        strcat(maketop_cmd," -m");
-        char *topo_make = run_command_capture(maketop_cmd);
-
-        //Write the new list to a file and then reload it. 
-        FILE* depedency_chain = fopen(deps_file ,"w+");
-        fprintf(depedency_chain,"%s",topo_make);
-        fclose(depedency_chain);
-
-        //Parse the dependency file first
-        int res = parse_dependency_file(deps_file,cur_map);
-        if(!res){
-            print_error("Failed to make hash table of dependency graph\n");
-            return -1;
-        }
-            
-        //If hash file exists, load it and compare
-        if (file_exists(hash_cache_file)) {
-            load_prev_hashes(hash_cache_file,prev_map);
-            save_hashes(hash_cache_file,cur_map);
-            prune_obsolete_cached_entries(prev_map,cur_map);
-        }else{
-            print_error("Cannot do an incremental build with no history!");
-            print_error("Check that the .cache/hash.dep file exists.\n");
-            return -1;
+    //Only compile what the programs reach through use statements, plus the extra sources.
+    //Pruning is opt in: external procedures are reached through calls, not use statements.
+    //The archive of a library needs every module, so library builds are never pruned.
+    const char *lib = fortean_toml_get_string(&cfg, "lib.target");
+    int prune = lib == NULL && fortean_toml_get_profile_bool(&cfg, profile, "prune", 0);
+    char prune_msg[1024] = {0};
+    if (prune) {
+        const char *entry  = fortean_toml_get_profile_string(&cfg, profile, "entry");
+        char **extra_globs = fortean_toml_get_profile_array(&cfg, profile, "extra-sources");
+        int *extra         = calloc(src_count > 0 ? src_count : 1, sizeof(int));
+        int extra_count    = 0;
+        for (int i = 0; extra && i < src_count; i++) {
+            for (int j = 0; extra_globs && extra_globs[j]; j++) {
+                if (!fortean_glob_match(extra_globs[j], sources[i])) continue;
+                extra[extra_count++] = src_node[i];
+                break;
+            }
         }
-
-
-        //Check the hash table for what we need to build.
-        FileNode *rebuild_list = NULL;
-        for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-            FileNode *node = cur_map[i];
-            while (node) {
-                // Check if this node has changed
-                if (!file_is_unchanged(node->filename, node->file_hash, prev_map)) {
-                    // It changed — mark its dependents
-                    mark_dependents_for_rebuild(node->filename, cur_map, &rebuild_list, &rebuild_cnt);
-                }
-                node = node->next;
+        for (int j = 0; extra_globs && extra_globs[j]; j++) free(extra_globs[j]);
+        free(extra_globs);
+
+        const char *root_file = NULL;
+        int res = extra ? 0 : -1;
+        for (int b = 0; b < bin_count && res == 0 && prune; b++) {
+            if (selected_bin >= 0 && b != selected_bin) continue;
+            int root = -1;
+            res = find_program_root(&graph, sources, src_node, src_count, bins[b].main, entry, &root);
+            if (res != 0) break;
+
+            //No program unit at all, so there is nothing to prune around.
+            if (root < 0) {
+                prune = 0;
+                break;
             }
+            bin_member[b] = calloc(src_count > 0 ? src_count : 1, 1);
+            if (!bin_member[b]) res = -1;
+            else res = use_closure(&graph, src_node, src_count, root, extra, extra_count, bin_member[b]);
+            root_file = root_file ? "the selected programs" : graph.files[root];
         }
-
-        //Rebuild required if the rebuild list is not empty.
-        //Otherwise, we jump to our memory cleanup.
-        if(rebuild_list == NULL && lib_only == 0) goto cleanup_sources;
-
-        //Compile each source only if it changed and needs to be rebuilt. 
-        FileNode *curr = rebuild_list;
-        while(curr){
-            const char *src = curr->filename;
-
-            //Check the exclusion list here. This can break a build,
-            //but that is the correct behavior if asked. 
-            if(node_is_in_the_hashmap(src,exclusion_map)) {
-                curr = curr->next;
-                continue;
+        free(extra);
+        if (res != 0) goto cleanup_sources;
+
+        if (prune) {
+            int kept = 0;
+            for (int i = 0; i < src_count; i++) {
+                int member = 0;
+                for (int b = 0; b < bin_count; b++) member |= (bin_member[b] && bin_member[b][i]);
+                build_mark[i] = build_mark[i] && member;
+                kept += build_mark[i];
             }
-
-            //Otherwise continue on 
-            const char *rel_path = get_last_path_segment(src);
-            char *ext = strrchr(rel_path, '.');
-            if (ext && (strcmp_case_insensitive(ext, ".f90") == 0 
-                    ||  strcmp_case_insensitive(ext, ".for") == 0
-                    ||  strcmp_case_insensitive(ext, ".f")   == 0
-                    ||  strcmp_case_insensitive(ext, ".f77") == 0)){
-                *ext = '\0';
+            if (kept < unpruned_count) {
+                snprintf(prune_msg, sizeof(prune_msg), "Pruned %d of %d source files outside the use closure of %s",
+                         unpruned_count - kept, unpruned_count, root_file);
             }
-
-            char obj_file[1024];
-            snprintf(obj_file, sizeof(obj_file), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
-
-            char compile_cmd[2048];
-            snprintf(compile_cmd, sizeof(compile_cmd), "%s %s -J%s -c %s -o %s",
-                     compiler, flags_str, mod_dir, src, obj_file);
-
-
-            //Print the info
-            print_info(compile_cmd);
-
-            //Parallel build logic.
-            if(!parallel_build){
-                int ret = system(compile_cmd);
-                if (ret != 0) {
-                    print_error("Compilation failed.");
-                    free(topo_make);
-                    free(rebuild_list); 
-                    goto cleanup_sources;
-                }
-            }else{
-                //Copy the command to a per thread buffer to avoid conflicts. 
-                char *compile_cmd_ts = strdup(compile_cmd);
-                if (thread_create(&threads[rebuild_cnt++], compile_system_worker, compile_cmd_ts) != 0) {
-                    print_error("Failed to create thread");
-                    free(topo_make);
-                    free(rebuild_list); 
-                    goto cleanup_sources;
-                }
+        } else {
+            for (int b = 0; b < bin_count; b++) {
+                free(bin_member[b]);
+                bin_member[b] = NULL;
             }
+        }
+    }
+    for (int i = 0; i < src_count; i++) {
+        if (!build_mark[i]) hash_entry_put(skip_map, sources[i], 1);
+    }
 
-            //Next node
-            curr = curr->next;
+    //Work out what to compile. A file is compiled when it or the flags it is compiled
+    //with changed, or when a file it uses was compiled. The build order lists the used
+    //files first, so one pass carries the changes through the whole graph. The first
+    //change found is kept as the reason, and a dependency's the file it uses.
+    if (incremental_build) {
+        load_prev_hashes(hash_cache_file,prev_map);
+        load_prev_hashes(flags_cache_file,prev_fp_map);
+        prune_obsolete_cached_entries(prev_map,cur_map);
+
+        for (int i = 0; i < graph.count; i++) {
+            FileNode *node  = find_file_node(graph.files[i], cur_map);
+            unsigned int fp = fingerprint_for_source(compiler, unique_flags, unique_count, &overrides, graph.files[i]);
+            why[i].cause = -1;
+            if (!node || !file_is_unchanged(graph.files[i], node->file_hash, prev_map)) {
+                HashEntry *prev = hash_entry_get(prev_map, graph.files[i]);
+                why[i].reason = !prev ? REBUILD_NEW : prev->file_hash == 0 ? REBUILD_SKIPPED : REBUILD_CONTENT;
+            } else if (!file_is_unchanged(graph.files[i], fp, prev_fp_map)) {
+                why[i].reason = REBUILD_FLAGS;
+            } else if (trace_deps && fortean_tracedb_changed(&tracedb, graph.files[i])) {
+                why[i].reason = REBUILD_TRACED;
+            }
+            for (int d = 0; d < graph.dep_count[i] && why[i].reason == REBUILD_NONE; d++) {
+                if (why[graph.deps[i][d]].reason == REBUILD_NONE) continue;
+                why[i].reason = REBUILD_DEPENDENCY;
+                why[i].cause  = graph.deps[i][d];
+            }
         }
 
-        //Free the topo_make here and then free the rebuild list. 
-        free(topo_make);
-        free(rebuild_list);
-    }else{
+        //A missing object only compiles its own source, the modules are still current.
+        //Unity builds have objects per unit instead.
         for (int i = 0; i < src_count; i++) {
-            const char *src      = sources[i];
-            const char *rel_path = get_last_path_segment(src);
-            char *ext = strrchr(rel_path, '.');
-            if (ext && (strcmp_case_insensitive(ext, ".f90") == 0 
-                    ||  strcmp_case_insensitive(ext, ".for") == 0
-                    ||  strcmp_case_insensitive(ext, ".f")   == 0
-                    ||  strcmp_case_insensitive(ext, ".f77") == 0)){
-                *ext = '\0';
+            need[i] = build_mark[i] && why[src_node[i]].reason != REBUILD_NONE;
+            if (need[i] || !build_mark[i] || opts->unity) continue;
+            char *obj_file = object_path_for_source(obj_dir, sources[i]);
+            struct stat st;
+            if (obj_file && stat(obj_file, &st) != 0) {
+                why[src_node[i]].reason = REBUILD_OBJECT;
+                need[i] = 1;
             }
+            free(obj_file);
+        }
+    } else {
+        for (int i = 0; i < src_count; i++) {
+            need[i] = build_mark[i];
+            why[src_node[i]].reason = REBUILD_ALL;
+        }
+    }
 
-            char obj_file[1024];
-            snprintf(obj_file, sizeof(obj_file), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
-
-            char compile_cmd[2048];
-            snprintf(compile_cmd, sizeof(compile_cmd), "%s %s -J%s -c %s -o %s",
-                     compiler, flags_str, mod_dir, src, obj_file);
-
-            //Print the info
-            print_info(compile_cmd);
-
-            //Check if we issue a sys call or spawn a thread to do it.
-            if(!parallel_build){
-                int ret = system(compile_cmd);
-                if (ret != 0) {
-                    print_error("Compilation failed.");
-                    goto cleanup_sources;
-                }
-            }else{
-                //Copy the command to a per thread buffer to avoid conflicts. 
-                char *compile_cmd_ts = strdup(compile_cmd);
-                if (thread_create(&threads[i], compile_system_worker, compile_cmd_ts) != 0) {
-                    print_error("Failed to create thread");
-                    goto cleanup_sources;
-                }
-            }
+    //Why each source is compiled, e.g. --explain, and with --dry-run nothing more
+    if (opts->explain || opts->dry_run) {
+        if (incremental_build) {
+            explain_plan(&graph, sources, src_node, src_count, need, why, times_cache_file);
+        } else {
+            int count = 0;
+            for (int i = 0; i < src_count; i++) count += need[i];
+            char msg[256];
+            snprintf(msg, sizeof(msg), "Compiling all %d sources, -r leaves the last build out.", count);
+            print_info(msg);
         }
     }
+    if (opts->dry_run) {
+        print_info("Dry run, nothing was compiled.");
+        result = 0;
+        goto cleanup_sources;
+    }
 
-    
-    //If waiting on a parallel build, we finish up here by joining all the threads.
-    if(parallel_build){
-        int num_threads_spawned = (incremental_build) ? rebuild_cnt : src_count;
-        for (int i = 0; i < num_threads_spawned; i++) {
-            thread_join(threads[i]);
+    //From here on the build works on compile items: the sources, or with --unity the
+    //units and the sources compiled on their own.
+    char **items              = sources;
+    int item_count            = src_count;
+    int *item_level           = src_level;
+    unsigned char *item_need  = need;
+    unsigned char *item_done  = done;
+    unsigned char **item_member = bin_member;
+    if (opts->unity) {
+        if (setup_unity(&cfg, profile, &graph, sources, src_node, src_count, build_mark, need, compiler,
+                        unique_flags, unique_count, &overrides, obj_dir, cache_dir, bin_member, bin_count,
+                        lib != NULL, &unity) != 0) {
+            goto cleanup_sources;
         }
+        items       = unity.sources;
+        item_count  = unity.plan.item_count;
+        item_level  = unity.plan.item_level;
+        item_need   = unity.need;
+        item_done   = unity.done;
+        item_member = unity.member;
     }
 
-    //Check if we are building a library or not.
-    const char* lib = fortean_toml_get_string(&cfg, "lib.target");
-    if(lib != NULL) {
-        if(build_library(sources,src_count,obj_dir,lib) == -1){
-            print_error("Failed to link library. Check if ar is installed and if the paths are correct.");
-            return -1;
+    int nothing_rebuilt = 1;
+    for (int i = 0; i < item_count; i++) {
+        if (item_need[i]) nothing_rebuilt = 0;
+    }
+
+    //The archive is kept in step with the objects through a manifest, shared by the
+    //profiles since they all write the same lib/<target>.
+    char lib_path[1024];
+    char archive_manifest[512];
+    if (lib != NULL) {
+        snprintf(lib_path, sizeof(lib_path), "%s%c%s", opts->out_dir ? opts->out_dir : "lib", PATH_SEP, lib);
+        cache_file_path(archive_manifest, sizeof(archive_manifest), opts->out_dir ? cache_key : NULL, "archive.dep");
+        archive.lib_path = lib_path;
+        archive.manifest = archive_manifest;
+        archive.thin     = fortean_toml_get_bool(&cfg, "lib.thin", 0);
+        archive.archiver = lto.archiver;
+        if (collect_archive_objects(items, item_count, obj_dir, bins, bin_count, &archive) != 0) {
+            print_error("Memory allocation error.");
+            goto cleanup_sources;
         }
+    } else if (lib_only) {
+        print_error("No target lib found in Fortean.toml");
+        goto cleanup_sources;
+    }
 
-        //If lib only, we skip linking the executable.
-        if(lib_only) goto skip_linking;
-    }else{
-        if(lib_only){
-            print_error("No target lib found in Fortean.toml");
-            return -1;
+    //Link jobs for every executable (or just the one selected with --bin).
+    char objcache_file[512];
+    cache_file_path(objcache_file, sizeof(objcache_file), cache_key, "objects.dep");
+    const char *stamp_key = opts->out_dir ? cache_key : NULL;
+    fortean_objcache_load(&objcache, objcache_file);
+    source_libs = fortean_toml_get_array(&cfg, "library.source-libs");
+    for (int i = 0; lib != NULL && opts->out_dir && source_libs && source_libs[i]; i++) {
+        char plain_lib[1024];
+        snprintf(plain_lib, sizeof(plain_lib), "lib%c%s", PATH_SEP, lib);
+        if (!fortean_path_equal(source_libs[i], plain_lib)) continue;
+        char *moved = strdup(lib_path);
+        if (!moved) continue;
+        free(source_libs[i]);
+        source_libs[i] = moved;
+    }
+    link_jobs   = calloc(bin_count, sizeof(link_job_t));
+    if (!link_jobs) {
+        print_error("Memory allocation error.");
+        goto cleanup_sources;
+    }
+    for (int i = 0; i < bin_count && !lib_only; i++) {
+        if (selected_bin >= 0 && i != selected_bin) continue;
+
+        link_job_t *job  = &link_jobs[link_job_count++];
+        job->compiler    = compiler;
+        job->flags       = unique_flags;
+        job->flag_count  = unique_count;
+        job->link_flags  = link_flags;
+        job->obj_dir     = obj_dir;
+        job->sources     = items;
+        job->src_count   = item_count;
+        job->member      = item_member[i];
+        job->source_libs = source_libs;
+        job->bins        = bins;
+        job->bin_count   = bin_count;
+        job->self        = i;
+        if (prepare_link(job, &objcache) != 0) {
+            print_error("Memory allocation error for link command.");
+            goto cleanup_sources;
         }
     }
 
+    //Nothing to compile, so we are done unless an executable is out of date (linked by
+    //another profile, or its objects changed on disk) or the archive is.
+    int all_current = 1;
+    for (int i = 0; i < link_job_count; i++) {
+        if (!target_is_current(bins[link_jobs[i].self].name, profile, stamp_key, link_jobs[i].manifest)) all_current = 0;
+    }
+    int lib_current = (lib == NULL) || fortean_archive_is_current(&archive);
+    if (incremental_build && nothing_rebuilt && all_current && lib_current && !opts->gen_format) {
+        fortean_objcache_save(&objcache, objcache_file);
+        result = 0;
+        goto cleanup_sources;
+    }
+
+    if (prune_msg[0]) print_info(prune_msg);
 
-    // Link
-    char link_cmd[4096] = {0};
-    size_t link_pos = 0;
+    //Small independent sources can share one compiler call, e.g. batch = true.
+    load_prev_hashes(times_cache_file, time_map);
+    compile_ctx_t ctx = {compiler, cc, unique_flags, unique_count, &overrides, obj_dir, mod_dir, plain_mod_dir,
+                         parallel_build, 0, fortean_toml_get_profile_int(&cfg, profile, "batch-bytes", 8192),
+                         (unsigned int)fortean_toml_get_profile_int(&cfg, profile, "batch-ms", 250), time_map,
+                         depfiles, NULL, NULL, NULL, timeline};
+    if (fortean_toml_get_profile_bool(&cfg, profile, "batch", 0)) {
+        ctx.batch_files = fortean_toml_get_profile_int(&cfg, profile, "batch-files", 16);
+    }
 
-    link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, "%s %s", compiler, flags_str);
+    //fortean gen writes down the steps instead of running them.
+    if (opts->gen_format) {
+        result = write_build_file(opts, &ctx, &graph, sources, src_node, src_count, build_mark, link_jobs,
+                                  link_job_count, lib != NULL ? &archive : NULL);
+        goto cleanup_sources;
+    }
 
+    fortean_timeline_phase(timeline, "plan", phase);
+    phase = fortean_wall_time();
+
+    //Objects compiled before, in this or another checkout, come from the cache, e.g.
+    //[cache] enabled = true.
+    fortean_cas_t cas;
+    if (fortean_cas_open(&cas, &cfg, compiler) == 0) ctx.cas = &cas;
+    //Parallel builds also compile on the [[worker]] hosts.
+    fortean_workers_t workers;
+    if (parallel_build && fortean_workers_open(&workers, &cfg, compiler) > 0) ctx.workers = &workers;
+    if (trace_deps) ctx.tracedb = &tracedb;
+    int compile_failed = compile_sources(&ctx, items, item_count, item_level, item_need, item_done) != 0;
+    if (ctx.workers) fortean_workers_close(&workers);
+    if (ctx.cas) fortean_cas_close(&cas);
+    fortean_timeline_phase(timeline, "compile", phase);
+    phase = fortean_wall_time();
+
+    //A source of a unit compiled when its unit did.
+    for (int i = 0; opts->unity && i < src_count; i++) {
+        if (unity.plan.item_of[i] >= 0) done[i] = unity.done[unity.plan.item_of[i]];
+    }
 
-    //Link all the objects files. We check if the file exists to prevent issues...
+    //Save the state of the sources. Files that had to be compiled but were not are
+    //stored with a zero hash so the next build retries them.
     for (int i = 0; i < src_count; i++) {
-        const char *src      = sources[i];
-        const char *rel_path = get_last_path_segment(src);
-        char *ext = strrchr(rel_path, '.');
-        if (ext && (strcmp_case_insensitive(ext, ".f90") == 0 
-                ||  strcmp_case_insensitive(ext, ".for") == 0
-                ||  strcmp_case_insensitive(ext, ".f")   == 0
-                ||  strcmp_case_insensitive(ext, ".f77") == 0)){
-            *ext = '\0';
-        }
-
-        //Write the "object" to the obj directory. For simplified building, 
-        //we eliminate the relative path to the src in the obj dir and link against
-        //just a list of all .o files we need in one place. This is much cleaner. 
-        char obj_path[512];
-        snprintf(obj_path, sizeof(obj_path), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
-
-        //Check if the obj file actually built and/or still exists.
-        if(!file_exists(obj_path)){
-            char msg[256];
-            snprintf(msg, sizeof(msg), "Object file %s does not exist.", obj_path);
-            print_error(msg);
-            return -1;
+        if (need[i] && !done[i]) hash_entry_put(skip_map, sources[i], 1);
+    }
+    forget_skipped_sources(cur_map, skip_map);
+    save_hashes(hash_cache_file,cur_map);
+    save_fingerprints(flags_cache_file,cur_map,compiler,unique_flags,unique_count,&overrides);
+    save_compile_times(times_cache_file,time_map,cur_map);
+    if (scratch) {
+        const char *scratch_dirs[] = {obj_dir, mod_dir, NULL};
+        if (fortean_scratch_save(scratch_manifest, scratch_store, scratch_dirs) != 0) {
+            print_info("Failed to copy the scratch directories to .cache, a build after they are emptied compiles everything.");
         }
-
-
-        link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, " %s", obj_path);
     }
-
-    //Link with the libraries (if they exist).
-    char **source_libs = fortean_toml_get_array(&cfg, "library.source-libs");
-    if (!source_libs) source_libs = NULL;
-    if (source_libs ) {
-        for (int i = 0; source_libs[i]; i++) {
-            link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, " %s", source_libs[i]);
+    if (trace_deps) {
+        fortean_tracedb_save(&tracedb, trace_cache_file, &graph);
+        if (tracedb.failed) print_info("The compiles could not be traced (ptrace isn't permitted here), trace-deps has no effect.");
+    }
+    fortean_timeline_phase(timeline, "save state", phase);
+    phase = fortean_wall_time();
+    if (compile_failed) goto cleanup_sources;
+
+    //Recompiled objects can come out identical, so the manifests decide what relinks.
+    for (int i = 0; i < link_job_count && !nothing_rebuilt; i++) {
+        if (prepare_link(&link_jobs[i], &objcache) != 0) {
+            print_error("Memory allocation error for link command.");
+            goto cleanup_sources;
         }
     }
+    fortean_timeline_phase(timeline, "hash objects", phase);
+    phase = fortean_wall_time();
 
-    //Build the final link command
-    link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, " -o %s", target);
-
-    print_info(link_cmd);
-    int ret = system(link_cmd);
-    if (ret != 0) {
-        print_error("Linking failed.");
+    thread_t *link_threads = calloc(link_job_count > 0 ? link_job_count : 1, sizeof(thread_t));
+    if (!link_threads) {
+        print_error("Memory allocation error.");
         goto cleanup_sources;
     }
 
+    //The executables link the objects themselves, so with -j the archive is written at
+    //the same time unless an executable links against it through library.source-libs.
+    thread_t archive_thread;
+    int archive_threaded = 0;
+    archive_run_t archive_run = {&archive, 0.0, 0.0};
+    if (lib != NULL) {
+        int archive_first = lib_only || !parallel_build;
+        for (int i = 0; source_libs && source_libs[i]; i++) {
+            if (fortean_path_equal(source_libs[i], lib_path)) archive_first = 1;
+        }
+        if (!archive_first && thread_create(&archive_thread, archive_worker, &archive_run) == 0) {
+            archive_threaded = 1;
+        } else {
+            archive_worker(&archive_run);
+        }
+    }
 
-    skip_linking:
-    print_ok("Built Successfully");
-
-
-    //If we aren't on an incremental build, we need to dump everything
-    //to the .cache files here for the first run. 
-    if(!incremental_build){
-         //For the incremental build, we parse the files!
-        strcat(maketop_cmd," -m");
-        char *topo_make = run_command_capture(maketop_cmd);
-
-        //Build the dependency table and save to file.
-        FILE* depedency_chain = fopen(deps_file ,"w+");
-        fprintf(depedency_chain,"%s",topo_make);
-        fclose(depedency_chain);
+    //A failed archive written first stops the links. The status of an archive written on
+    //its thread is only read after the join below.
+    int threaded_links = parallel_build && link_job_count > 1;
+    for (int i = 0; i < link_job_count && (archive_threaded || archive.status == 0); i++) {
+        link_job_t *job = &link_jobs[i];
+        if (target_is_current(bins[job->self].name, profile, stamp_key, job->manifest)) {
+            if (!nothing_rebuilt) {
+                char msg[512];
+                snprintf(msg, sizeof(msg), "Objects of %s are unchanged, skipping the link.", bins[job->self].name);
+                print_info(msg);
+            }
+            continue;
+        }
 
-        //Parse the dependency file first
-        int res = parse_dependency_file(deps_file,cur_map);
-        if(!res){
-            print_error("Failed to make hash table of dependency graph\n");
-            return -1;
+        //Executables only share the objects, so they can link at the same time.
+        job->linked = 1;
+        if (threaded_links) {
+            if (thread_create(&link_threads[i], link_worker, job) != 0) {
+                print_error("Failed to create thread");
+                job->linked = 0;
+                job->status = -1;
+            }
+        } else {
+            link_worker(job);
         }
+    }
 
-        //Save hashes for the current state of the project. 
-        save_hashes(hash_cache_file,cur_map);
+    int link_failed = 0;
+    for (int i = 0; i < link_job_count; i++) {
+        link_job_t *job = &link_jobs[i];
+        if (threaded_links && job->linked) thread_join(link_threads[i]);
+        if (job->status != 0) link_failed = 1;
+        else if (job->linked) record_target_link(bins[job->self].name, profile, stamp_key, job->manifest);
+        if (!job->linked) continue;
+        fortean_timeline_span_t *span = fortean_timeline_add(timeline, "link", bins[job->self].name, phase,
+                                                             job->start, job->end, FORTEAN_TIMELINE_LOCAL);
+        if (span) {
+            span->usage  = job->usage;
+            span->status = job->status;
+        }
+        char *link_str = fortean_cmd_string(&job->cmd);
+        fortean_timeline_arg(span, "command", link_str);
+        free(link_str);
+        fortean_timeline_arg_int(span, "exit", job->status);
+    }
+    if (archive_threaded) thread_join(archive_thread);
+    if (lib != NULL) {
+        fortean_timeline_span_t *span = fortean_timeline_add(timeline, "archive", lib_path, phase, archive_run.start,
+                                                             archive_run.end, FORTEAN_TIMELINE_LOCAL);
+        if (span) span->status = archive.status;
+        fortean_timeline_arg_int(span, "objects", archive.object_count);
+        fortean_timeline_arg_int(span, "exit", archive.status);
+    }
+    fortean_timeline_phase(timeline, "link", phase);
+    free(link_threads);
+    fortean_objcache_save(&objcache, objcache_file);
+    if (archive.status != 0) {
+        print_error("Failed to link library. Check if ar is installed and if the paths are correct.");
+        goto cleanup_sources;
     }
+    if (link_failed) goto cleanup_sources;
+
+
+    print_ok("Built Successfully");
+    result = 0;
 
 
     //GOTO's for freeing the memory. Basically defer, but obviously C doesn't have a real defer. 
 cleanup_sources:
+    fortean_archive_free_objects(&archive);
+    for (int i = 0; i < link_job_count; i++) {
+        fortean_cmd_free(&link_jobs[i].cmd);
+        free(link_jobs[i].missing);
+    }
+    free(link_jobs);
+    if (source_libs) {
+        for (int i = 0; source_libs[i]; i++) free(source_libs[i]);
+        free(source_libs);
+    }
+    fortean_objcache_free(&objcache);
+    free_unity_build(&unity, bin_count);
     if (sources) {
         for (int i = 0; i < src_count; i++) free(sources[i]);
         free(sources);
     }
-    free(topo_src);
+    if (exclude_files) {
+        for (int i = 0; exclude_files[i]; i++) free(exclude_files[i]);
+        free(exclude_files);
+    }
+    free(topo_make);
 
 cleanup_search_arrays:
     if (deep_dirs) {
@@ -625,20 +2613,79 @@ cleanup_search_arrays:
     }
 
 cleanup_flags_str:
-    free(flags_str);
+    fortean_overrides_free(&overrides);
 
 cleanup_arrays:
     for (int i = 0; flags_array[i]; i++) free(flags_array[i]);
     free(flags_array);
 
     free_string_list(unique_flags, unique_count);
+    fortean_lto_free(&lto);
+    for (int i = 0; bin_member && i < bin_count; i++) free(bin_member[i]);
+    free(bin_member);
+    free_bins(bins, bin_count);
     fortean_toml_free(&cfg);
 
-    //Free the hashmaps.
+    //Free the hashmaps and the per source state.
     free_all(cur_map);
     free_prev_hash_table(prev_map);
+    free_prev_hash_table(prev_fp_map);
+    free_prev_hash_table(skip_map);
+    free_prev_hash_table(time_map);
+    free_prev_hash_table(known_map);
     free_all(exclusion_map);
+    fortean_graph_free(&graph);
+    fortean_tracedb_free(&tracedb);
+    free(src_node);
+    free(src_level);
+    free(build_mark);
+    free(need);
+    free(done);
+    free(why);
+
+    //The report of this build and its line in the history for fortean stats, kept per
+    //cache key like hash.dep so the builds of fortean compare -j never share them.
+    fortean_timeline_span_t *build_span = fortean_timeline_phase(timeline, "build", timeline->origin);
+    fortean_timeline_arg_int(build_span, "exit", result);
+    if (opts->trace_file) fortean_timeline_write(timeline, opts->trace_file);
+    if (!opts->gen_format && !opts->dry_run) {
+        char report_file[512];
+        char history_file[512];
+        cache_file_path(report_file,  sizeof(report_file),  cache_key, "report.json");
+        cache_file_path(history_file, sizeof(history_file), cache_key, "history.log");
+        if (fortean_timeline_report(timeline, report_file, cache_key, result) != 0 ||
+            fortean_timeline_history(timeline, history_file, cache_key, result) != 0) {
+            print_info("Failed to write the build report to .cache.");
+        }
+    }
+    fortean_timeline_free(timeline);
+    return result;
+}
+
+int fortean_build_project_incremental(const fortean_build_opts_t *opts) {
+    //Builds with overrides are rare and have no state the daemon could keep, and fortean
+    //watch follows the changes itself.
+    int plain = opts->incremental_build && !opts->variant && !opts->out_dir && !opts->compiler &&
+                !opts->add_flags && !opts->remove_flags && !opts->flag_files && !opts->seed && !opts->changed &&
+                !opts->gen_format && !opts->trace_file && !opts->explain && !opts->dry_run;
+    if (!plain) return build_project(opts);
+
+    char cache_name[256], key[300];
+    fortean_build_cache_key(opts, cache_name, sizeof(cache_name));
+    snprintf(key, sizeof(key), "k:%s:%s:%d", cache_name, opts->bin ? opts->bin : "", opts->lib_only);
+    for (char *c = key; *c; c++) {
+        if (*c == ' ') *c = '_';
+    }
+
+    //Nothing changed since this build last succeeded, so there is nothing to do.
+    unsigned long long gen = 0;
+    fortean_daemon_state_t state = fortean_daemon_begin(key, &gen);
+    if (state == FORTEAN_DAEMON_CLEAN) return 0;
 
+    int result = build_project(opts);
+    if (result != 0) return result;
+    if (state == FORTEAN_DAEMON_DIRTY) fortean_daemon_built(key, gen);
+    else                               fortean_daemon_autostart();
     return 0;
 }
 
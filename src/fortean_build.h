@@ -1,6 +1,36 @@
 #ifndef FORTEAN_BUILD_H
 #define FORTEAN_BUILD_H
 
-int fortean_build_project_incremental(const int parallel_build, const int incremental_build_override, const int lib_only);
+#include <stddef.h>
+
+//Options for a single build, filled in from the cli.
+typedef struct {
+    int parallel_build;
+    int incremental_build;   // 0 forces a full rebuild
+    int lib_only;
+    const char *profile;     // [profile.<name>] to build with, NULL for the plain [build] settings
+    const char *bin;         // Only build the [[bin]] with this name, NULL for all of them
+    int unity;               // Compile the sources as a few concatenated units
+    const char *variant;     // Own obj/mod sub directories and cache state, e.g. "pgo"
+    char **remove_flags;     // Flag globs removed for this build (NULL-terminated)
+    char **add_flags;        // Flags added to the compile and link steps (NULL-terminated)
+    char **flag_files;       // Limit remove/add_flags to these file globs, applied after the overrides
+    const char *seed;        // A new variant starts from a copy of this variant's objects and state
+    const char *compiler;    // Used instead of the configured compiler
+    const char *out_dir;     // The executables and library go here instead of the project paths
+    char **changed;          // fortean watch: the only files changed since the last build, with the
+                             // module graph unchanged (NULL-terminated). NULL scans everything.
+    const char *gen_format;  // fortean gen: write the build as "ninja" or "make" file instead of running it
+    const char *gen_path;    // The file written by fortean gen
+    const char *trace_file;  // --trace: write the phases and jobs of the build as Chrome trace events
+    int explain;             // --explain: print why every source is compiled
+    int dry_run;             // --dry-run: explain what would be compiled and stop
+} fortean_build_opts_t;
+
+int fortean_build_project_incremental(const fortean_build_opts_t *opts);
+
+//Name of the .cache sub directory holding the state of this build, e.g. "release-pgo".
+//Empty for the plain build, whose state lives in .cache itself.
+void fortean_build_cache_key(const fortean_build_opts_t *opts, char *buf, size_t size);
 
 #endif // FORTEAN_BUILD_H
@@ -0,0 +1,640 @@
+#include "fortean_cas.h"
+#include "fortean_compiler.h"
+#include "fortean_hash.h"
+#include "fortean_fscan.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#define PATH_SEP '\\'
+#define MAKE_DIR(path) _mkdir(path)
+#define getpid _getpid
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#define PATH_SEP '/'
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+#define CAS_MAGIC "FORTEANCAS1\n"
+
+//Create a directory and its parents
+static int make_dirs(const char *path) {
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/' && *p != '\\') continue;
+        char sep = *p;
+        *p = '\0';
+        if (p[-1] != ':') MAKE_DIR(dir);
+        *p = sep;
+    }
+    return MAKE_DIR(dir) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+void fortean_cas_dir(fortean_toml_t *cfg, char *buf, size_t size) {
+    const char *dir  = cfg ? fortean_toml_get_string(cfg, "cache.dir") : NULL;
+    const char *env  = getenv("FORTEAN_CACHE_DIR");
+#ifdef _WIN32
+    const char *home = getenv("USERPROFILE");
+    const char *user = getenv("LOCALAPPDATA");
+#else
+    const char *home = getenv("HOME");
+    const char *user = getenv("XDG_CACHE_HOME");
+#endif
+    if (dir && dir[0] == '~' && home) snprintf(buf, size, "%s%s", home, dir + 1);
+    else if (dir)                     snprintf(buf, size, "%s", dir);
+    else if (env && env[0])           snprintf(buf, size, "%s", env);
+    else if (user && user[0])         snprintf(buf, size, "%s%cfortean", user, PATH_SEP);
+    else if (home)                    snprintf(buf, size, "%s%c.cache%cfortean", home, PATH_SEP, PATH_SEP);
+    else                              snprintf(buf, size, ".cache%cshared", PATH_SEP);
+}
+
+int fortean_cas_open(fortean_cas_t *cas, fortean_toml_t *cfg, const char *compiler) {
+    memset(cas, 0, sizeof(*cas));
+    if (!fortean_toml_get_bool(cfg, "cache.enabled", 0)) return -1;
+
+    fortean_cas_dir(cfg, cas->dir, sizeof(cas->dir));
+    cas->max_bytes = (long long)fortean_toml_get_int(cfg, "cache.max-size", 5120) * 1024 * 1024;
+    if (make_dirs(cas->dir) != 0) {
+        char msg[1100];
+        snprintf(msg, sizeof(msg), "Can't create the compilation cache %s, compiling without it.", cas->dir);
+        print_info(msg);
+        return -1;
+    }
+    if (!getcwd(cas->root, sizeof(cas->root))) cas->root[0] = '\0';
+
+    const char *remote = fortean_toml_get_string(cfg, "cache.remote");
+    if (remote) {
+        if (fortean_url_parse(remote, &cas->remote) == 0) {
+            cas->remote_on = 1;
+        } else {
+            char msg[600];
+            snprintf(msg, sizeof(msg), "Only http:// remote caches are supported, ignoring %s.", remote);
+            print_info(msg);
+        }
+        cas->remote_push       = fortean_toml_get_bool(cfg, "cache.remote-push", 1);
+        cas->remote_timeout_ms = fortean_toml_get_int(cfg, "cache.remote-timeout", 2000);
+    }
+
+    //Machines with the same compiler in another place share entries.
+    cas->compiler_hash = fortean_compiler_fingerprint(compiler);
+    return 0;
+}
+
+//Hash a string with its terminator, so "ab","c" and "a","bc" differ
+static unsigned long long mix(unsigned long long h, const char *str) {
+    return hash_bytes_fnv1a64(str, strlen(str) + 1, h);
+}
+
+//Hash a path or flag with the project root taken out
+static unsigned long long mix_path(const fortean_cas_t *cas, unsigned long long h, const char *str) {
+    size_t root_len = strlen(cas->root);
+    const char *at  = root_len > 1 ? strstr(str, cas->root) : NULL;
+    if (!at) return mix(h, str);
+    h = hash_bytes_fnv1a64(str, (size_t)(at - str), h);
+    return mix_path(cas, h, at + root_len);
+}
+
+//Hash the contents of name, found in first_dir or one of the -I directories of the
+//flags. Files that aren't found (system modules and the like) add only their name.
+static unsigned long long mix_found(unsigned long long h, const char *name, const char *first_dir,
+                                    char **flags, int flag_count) {
+    h = mix(h, name);
+    char path[1200];
+    if (first_dir) {
+        snprintf(path, sizeof(path), "%s%c%s", first_dir, PATH_SEP, name);
+        if (hash_file_fnv1a64(path, &h) == 0) return h;
+    }
+    for (int i = 0; i < flag_count; i++) {
+        if (strncmp(flags[i], "-I", 2) != 0) continue;
+        const char *dir = flags[i][2] ? flags[i] + 2 : (i + 1 < flag_count ? flags[i + 1] : "");
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, name);
+        if (hash_file_fnv1a64(path, &h) == 0) return h;
+    }
+    return mix(h, "missing");
+}
+
+int fortean_cas_key(const fortean_cas_t *cas, const char *src, char **flags, int flag_count,
+                    const char *mod_dir, char key[FORTEAN_CAS_KEY_LEN]) {
+    unsigned long long h = mix(FNV64_SEED, CAS_MAGIC);
+    h = hash_bytes_fnv1a64(&cas->compiler_hash, sizeof(cas->compiler_hash), h);
+
+    //Objects built with profile data depend on files the key doesn't see.
+    int debug_info = 0;
+    for (int i = 0; i < flag_count; i++) {
+        if (strncmp(flags[i], "-fprofile-use", 13) == 0 || strncmp(flags[i], "-prof-use", 9) == 0) return -1;
+        if (strncmp(flags[i], "-g", 2) == 0 && strcmp(flags[i], "-g0") != 0) debug_info = 1;
+        h = mix_path(cas, h, flags[i]);
+    }
+    //Debug info records the directory of the compile, so only that checkout can use it.
+    if (debug_info) h = mix(h, cas->root);
+
+    if (strncmp(src, "./", 2) == 0) src += 2;
+    h = mix_path(cas, h, src);
+    if (hash_file_fnv1a64(src, &h) != 0) return -1;
+
+    fortean_fscan_t scan;
+    if (fortean_fscan_file(src, &scan) != 0) return -1;
+    for (int i = 0; i < scan.use_count; i++) {
+        char mod[300];
+        snprintf(mod, sizeof(mod), "%s.mod", scan.uses[i]);
+        h = mix_found(h, mod, mod_dir, flags, flag_count);
+    }
+    //Includes are looked up next to the source first, like the compiler does.
+    char src_dir[1024];
+    snprintf(src_dir, sizeof(src_dir), "%s", src);
+    char *slash = strrchr(src_dir, '/');
+    char *bslash = strrchr(src_dir, '\\');
+    if (bslash > slash) slash = bslash;
+    if (slash) *slash = '\0';
+    else       snprintf(src_dir, sizeof(src_dir), ".");
+    for (int i = 0; i < scan.include_count; i++) h = mix_found(h, scan.includes[i], src_dir, flags, flag_count);
+    fortean_fscan_free(&scan);
+
+    snprintf(key, FORTEAN_CAS_KEY_LEN, "%016llx", h);
+    return 0;
+}
+
+static void entry_path(const fortean_cas_t *cas, const char *key, char *buf, size_t size) {
+    snprintf(buf, size, "%s%c%.2s%c%s", cas->dir, PATH_SEP, key, PATH_SEP, key);
+}
+
+//Whole file in memory (caller must free)
+static char *read_file(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (data && fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (data) *len = (size_t)size;
+    return data;
+}
+
+//Write through a temporary file that is renamed into place, so other builds reading
+//the same path see the old or the new file and never half of one.
+static int write_atomic(fortean_cas_t *cas, const char *path, const char *data, size_t len) {
+    char tmp[1200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp%d-%p-%u", path, (int)getpid(), (void *)cas, cas->seq++);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return -1;
+    int ok = fwrite(data, 1, len, fp) == len;
+    if (fclose(fp) != 0) ok = 0;
+#ifdef _WIN32
+    if (ok) ok = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    if (ok) ok = rename(tmp, path) == 0;
+#endif
+    if (!ok) remove(tmp);
+    return ok ? 0 : -1;
+}
+
+//One request to the remote cache, timed. A remote that can't be reached is left alone
+//for the rest of the build so every compile doesn't wait for the timeout.
+static int remote_request(fortean_cas_t *cas, const char *method, const char *key, const char *body,
+                          size_t body_len, char **response, size_t *response_len) {
+    char path[64];
+    snprintf(path, sizeof(path), "/cas/%s", key);
+    double start = fortean_wall_time();
+    int status   = fortean_http_request(&cas->remote, method, path, body, body_len, cas->remote_timeout_ms,
+                                        response, response_len);
+    cas->remote_seconds += fortean_wall_time() - start;
+    if (status < 0) {
+        char msg[600];
+        snprintf(msg, sizeof(msg), "Remote cache %s is not answering, compiling locally.", cas->remote.address);
+        print_info(msg);
+        cas->remote_on = 0;
+    }
+    if (status < 0 || status >= 500) cas->remote_errors++;
+    return status;
+}
+
+//Fetch an entry the local cache doesn't have and keep a copy of it (caller must free)
+static char *remote_fetch(fortean_cas_t *cas, const char *key, const char *path, size_t *len) {
+    if (!cas->remote_on) return NULL;
+    char *data = NULL;
+    int status = remote_request(cas, "GET", key, NULL, 0, &data, len);
+    if (status == 404) cas->remote_misses++;
+    if (status != 200 || !data) {
+        free(data);
+        return NULL;
+    }
+    cas->remote_hits++;
+    cas->bytes_down += (long long)*len;
+    char dir[1100];
+    snprintf(dir, sizeof(dir), "%s%c%.2s", cas->dir, PATH_SEP, key);
+    MAKE_DIR(dir);
+    write_atomic(cas, path, data, *len);
+    return data;
+}
+
+int fortean_cas_restore(fortean_cas_t *cas, const char *key, const char *obj_path, const char *mod_dir) {
+    char path[1200];
+    entry_path(cas, key, path, sizeof(path));
+    size_t len = 0;
+    char *data = read_file(path, &len);
+    if (!data) data = remote_fetch(cas, key, path, &len);
+    if (!data) {
+        cas->misses++;
+        return 0;
+    }
+
+    //"o <size>\n<bytes>" for the object and "m <name> <size>\n<bytes>" per module. The
+    //whole entry is checked before anything is written.
+    size_t magic = strlen(CAS_MAGIC);
+    int valid = len >= magic && memcmp(data, CAS_MAGIC, magic) == 0;
+    for (int pass = 0; pass < 2 && valid; pass++) {
+        size_t pos = magic;
+        while (valid && pos < len) {
+            char *eol = memchr(data + pos, '\n', len - pos);
+            char name[256] = "";
+            unsigned long size = 0;
+            if (!eol) {
+                valid = 0;
+                break;
+            }
+            *eol = '\0';
+            int fields = data[pos] == 'o' ? sscanf(data + pos, "o %lu", &size)
+                                          : sscanf(data + pos, "m %255s %lu", name, &size) - 1;
+            *eol = '\n';
+            size_t body = (size_t)(eol - data) + 1;
+            if (fields != 1 || size > len - body || strchr(name, '/') || strchr(name, '\\')) {
+                valid = 0;
+                break;
+            }
+            if (pass == 1) {
+                char dest[1200];
+                if (name[0]) snprintf(dest, sizeof(dest), "%s%c%s", mod_dir, PATH_SEP, name);
+                else         snprintf(dest, sizeof(dest), "%s", obj_path);
+                //A module that is already there unchanged keeps its time stamp.
+                size_t old_len = 0;
+                char *old = name[0] ? read_file(dest, &old_len) : NULL;
+                int same = old && old_len == size && memcmp(old, data + body, size) == 0;
+                free(old);
+                if (!same && write_atomic(cas, dest, data + body, size) != 0) valid = 0;
+            }
+            pos = body + size;
+        }
+    }
+    free(data);
+    if (!valid) {
+        remove(path);
+        cas->misses++;
+        return 0;
+    }
+
+    //The modification time orders the entries for eviction.
+    utime(path, NULL);
+    cas->hits++;
+    return 1;
+}
+
+//Append "<header>\n<contents of path>" to the entry being built
+static int append_member(char **buf, size_t *len, const char *header, const char *path) {
+    size_t size = 0;
+    char *data  = read_file(path, &size);
+    if (!data) return -1;
+    char line[400];
+    int n = snprintf(line, sizeof(line), "%s %lu\n", header, (unsigned long)size);
+    char *grown = realloc(*buf, *len + (size_t)n + size);
+    if (!grown) {
+        free(data);
+        return -1;
+    }
+    *buf = grown;
+    memcpy(*buf + *len, line, (size_t)n);
+    memcpy(*buf + *len + n, data, size);
+    *len += (size_t)n + size;
+    free(data);
+    return 0;
+}
+
+void fortean_cas_store(fortean_cas_t *cas, const char *key, const char *src, const char *obj_path,
+                       const char *mod_dir) {
+    char path[1200];
+    entry_path(cas, key, path, sizeof(path));
+    struct stat st;
+    if (stat(path, &st) == 0) return;
+
+    fortean_fscan_t scan;
+    if (fortean_fscan_file(src, &scan) != 0) return;
+    size_t len = strlen(CAS_MAGIC);
+    char *buf  = malloc(len);
+    int res    = buf ? 0 : -1;
+    if (buf) memcpy(buf, CAS_MAGIC, len);
+    if (res == 0) res = append_member(&buf, &len, "o", obj_path);
+    for (int i = 0; i < scan.module_count && res == 0; i++) {
+        char header[300], mod[1200];
+        snprintf(header, sizeof(header), "m %s.mod", scan.modules[i]);
+        snprintf(mod, sizeof(mod), "%s%c%s.mod", mod_dir, PATH_SEP, scan.modules[i]);
+        res = append_member(&buf, &len, header, mod);
+    }
+    fortean_fscan_free(&scan);
+
+    char dir[1100];
+    snprintf(dir, sizeof(dir), "%s%c%.2s", cas->dir, PATH_SEP, key);
+    MAKE_DIR(dir);
+    if (res == 0 && write_atomic(cas, path, buf, len) == 0) cas->stores++;
+    if (res == 0 && cas->remote_on && cas->remote_push) {
+        int status = remote_request(cas, "PUT", key, buf, len, NULL, NULL);
+        if (status >= 200 && status < 300) cas->bytes_up += (long long)len;
+    }
+    free(buf);
+}
+
+typedef struct {
+    char *path;
+    long long size;
+    time_t used;
+} cas_entry_t;
+
+static int by_last_use(const void *a, const void *b) {
+    const cas_entry_t *x = (const cas_entry_t *)a;
+    const cas_entry_t *y = (const cas_entry_t *)b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+//Call fn for every file of a directory, skipping names too long for a path
+static void for_each_file(const char *dir, void (*fn)(const char *path, void *data), void *data) {
+    char path[1200];
+#ifdef _WIN32
+    char pattern[1200];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return;
+    do {
+        if (fd.cFileName[0] == '.') continue;
+        int len = snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, fd.cFileName);
+        if (len < 0 || (size_t)len >= sizeof(path)) continue;
+        fn(path, data);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        int len = snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, entry->d_name);
+        if (len < 0 || (size_t)len >= sizeof(path)) continue;
+        fn(path, data);
+    }
+    closedir(d);
+#endif
+}
+
+typedef struct {
+    cas_entry_t *entries;
+    int count;
+    int cap;
+    long long bytes;
+} cas_scan_t;
+
+static void collect_entry(const char *path, void *data) {
+    cas_scan_t *scan = (cas_scan_t *)data;
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    //Temporary files of a store that died are removed after a day.
+    if (strstr(path, ".tmp")) {
+        if (time(NULL) - st.st_mtime > 86400) remove(path);
+        return;
+    }
+    if (scan->count == scan->cap) {
+        int cap = scan->cap ? scan->cap * 2 : 256;
+        cas_entry_t *grown = realloc(scan->entries, cap * sizeof(cas_entry_t));
+        if (!grown) return;
+        scan->entries = grown;
+        scan->cap     = cap;
+    }
+    cas_entry_t *e = &scan->entries[scan->count];
+    e->path = strdup(path);
+    if (!e->path) return;
+    e->size = (long long)st.st_size;
+    e->used = st.st_mtime;
+    scan->bytes += e->size;
+    scan->count++;
+}
+
+static void collect_dir(const char *path, void *data) {
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode) && strlen(strrchr(path, PATH_SEP) + 1) == 2) {
+        for_each_file(path, collect_entry, data);
+    }
+}
+
+static void scan_entries(const char *dir, cas_scan_t *scan) {
+    memset(scan, 0, sizeof(*scan));
+    for_each_file(dir, collect_dir, scan);
+}
+
+static void free_scan(cas_scan_t *scan) {
+    for (int i = 0; i < scan->count; i++) free(scan->entries[i].path);
+    free(scan->entries);
+}
+
+//Drop the least recently used entries down to 90% of the limit, so the next
+//few stores don't have to scan again.
+static void trim_cache(const char *dir, long long max_bytes) {
+    cas_scan_t scan;
+    scan_entries(dir, &scan);
+    if (scan.bytes > max_bytes) {
+        qsort(scan.entries, scan.count, sizeof(cas_entry_t), by_last_use);
+        long long target = max_bytes / 10 * 9;
+        for (int i = 0; i < scan.count && scan.bytes > target; i++) {
+            if (remove(scan.entries[i].path) == 0) scan.bytes -= scan.entries[i].size;
+        }
+    }
+    free_scan(&scan);
+}
+
+void fortean_cas_close(fortean_cas_t *cas) {
+    if (cas->hits + cas->misses > 0) {
+        //"<time> <hits> <misses> <stores> <remote hits> <remote misses> <remote errors>
+        //<remote ms> <bytes down> <bytes up>" per build.
+        char log[1100];
+        snprintf(log, sizeof(log), "%s%cstats.log", cas->dir, PATH_SEP);
+        FILE *fp = fopen(log, "a");
+        if (fp) {
+            fprintf(fp, "%ld %d %d %d %d %d %d %.0f %lld %lld\n", (long)time(NULL), cas->hits, cas->misses,
+                    cas->stores, cas->remote_hits, cas->remote_misses, cas->remote_errors,
+                    cas->remote_seconds * 1000.0, cas->bytes_down, cas->bytes_up);
+            fclose(fp);
+        }
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Compilation cache: %d hits, %d misses, %d stored", cas->hits, cas->misses,
+                 cas->stores);
+        print_info(msg);
+        if (cas->remote.address[0]) {
+            snprintf(msg, sizeof(msg), "Remote cache: %d hits, %d misses, %d errors, %.1f KB down, %.1f KB up in %.3f s",
+                     cas->remote_hits, cas->remote_misses, cas->remote_errors, cas->bytes_down / 1024.0,
+                     cas->bytes_up / 1024.0, cas->remote_seconds);
+            print_info(msg);
+        }
+    }
+    if (cas->stores > 0) trim_cache(cas->dir, cas->max_bytes);
+}
+
+int fortean_cas_stats(void) {
+    fortean_toml_t cfg = {0};
+    int have_cfg = fortean_toml_load("Fortean.toml", &cfg) == 0;
+    char dir[1024];
+    fortean_cas_dir(have_cfg ? &cfg : NULL, dir, sizeof(dir));
+    long long max_mb = have_cfg ? fortean_toml_get_int(&cfg, "cache.max-size", 5120) : 5120;
+    int enabled = have_cfg && fortean_toml_get_bool(&cfg, "cache.enabled", 0);
+    if (have_cfg) fortean_toml_free(&cfg);
+
+    long long hits = 0, misses = 0, stores = 0, builds = 0;
+    long long remote_hits = 0, remote_misses = 0, remote_errors = 0, down = 0, up = 0;
+    double remote_ms = 0.0;
+    char log[1100];
+    snprintf(log, sizeof(log), "%s%cstats.log", dir, PATH_SEP);
+    FILE *fp = fopen(log, "r");
+    if (fp) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            long stamp;
+            int h = 0, m = 0, s = 0, rh = 0, rm = 0, re = 0;
+            double ms = 0.0;
+            long long bd = 0, bu = 0;
+            if (sscanf(line, "%ld %d %d %d %d %d %d %lf %lld %lld", &stamp, &h, &m, &s, &rh, &rm, &re, &ms,
+                       &bd, &bu) < 4) {
+                continue;
+            }
+            hits += h;
+            misses += m;
+            stores += s;
+            remote_hits += rh;
+            remote_misses += rm;
+            remote_errors += re;
+            remote_ms += ms;
+            down += bd;
+            up += bu;
+            builds++;
+        }
+        fclose(fp);
+    }
+
+    cas_scan_t scan;
+    scan_entries(dir, &scan);
+    char msg[1200];
+    snprintf(msg, sizeof(msg), "Cache directory: %s%s", dir, enabled ? "" : " (not enabled for this project)");
+    print_info(msg);
+    snprintf(msg, sizeof(msg), "Entries: %d, %.1f MB of %lld MB", scan.count, scan.bytes / 1048576.0, max_mb);
+    print_info(msg);
+    snprintf(msg, sizeof(msg), "Builds: %lld, hits: %lld, misses: %lld, stored: %lld", builds, hits, misses, stores);
+    print_info(msg);
+    if (hits + misses > 0) {
+        snprintf(msg, sizeof(msg), "Hit rate: %.1f%%", 100.0 * hits / (hits + misses));
+        print_info(msg);
+    }
+    if (remote_hits + remote_misses + remote_errors > 0) {
+        snprintf(msg, sizeof(msg), "Remote: %lld hits, %lld misses, %lld errors, %.1f MB down, %.1f MB up, %.1f s transferring",
+                 remote_hits, remote_misses, remote_errors, down / 1048576.0, up / 1048576.0, remote_ms / 1000.0);
+        print_info(msg);
+    }
+    free_scan(&scan);
+    return 0;
+}
+
+typedef struct {
+    fortean_cas_t cas;              // The directory and the temporary file names
+    int puts;
+} cas_server_t;
+
+//Only <prefix>/cas/<16 hex digits>, so a request can't name any other file
+static const char *request_key(const char *path) {
+    const char *key = strstr(path, "/cas/");
+    if (!key) return NULL;
+    key += 5;
+    if (strlen(key) != FORTEAN_CAS_KEY_LEN - 1) return NULL;
+    for (const char *p = key; *p; p++) {
+        if (!strchr("0123456789abcdef", *p)) return NULL;
+    }
+    return key;
+}
+
+static int serve_request(const fortean_http_req_t *req, char **body, size_t *len, void *data) {
+    cas_server_t *server = (cas_server_t *)data;
+    const char *key = request_key(req->path);
+    int status = 400;
+    char path[1200];
+    if (key) entry_path(&server->cas, key, path, sizeof(path));
+
+    if (key && (strcmp(req->method, "GET") == 0 || strcmp(req->method, "HEAD") == 0)) {
+        *body  = read_file(path, len);
+        status = *body ? 200 : 404;
+        if (*body) utime(path, NULL);
+    } else if (key && strcmp(req->method, "PUT") == 0) {
+        size_t magic = strlen(CAS_MAGIC);
+        if (req->body_len < magic || memcmp(req->body, CAS_MAGIC, magic) != 0) {
+            status = 400;
+        } else {
+            char dir[1100];
+            snprintf(dir, sizeof(dir), "%s%c%.2s", server->cas.dir, PATH_SEP, key);
+            MAKE_DIR(dir);
+            status = write_atomic(&server->cas, path, req->body, req->body_len) == 0 ? 201 : 500;
+            if (status == 201 && ++server->puts % 64 == 0) trim_cache(server->cas.dir, server->cas.max_bytes);
+        }
+    } else if (key) {
+        status = 405;
+    }
+
+    char msg[700];
+    snprintf(msg, sizeof(msg), "%s %s %d", req->method, req->path, status);
+    print_info(msg);
+    fflush(stdout);
+    return status;
+}
+
+int fortean_cas_serve(const char *address, const char *dir) {
+    cas_server_t server;
+    memset(&server, 0, sizeof(server));
+    fortean_toml_t cfg = {0};
+    int have_cfg = fortean_toml_load("Fortean.toml", &cfg) == 0;
+    if (dir) {
+        snprintf(server.cas.dir, sizeof(server.cas.dir), "%s", dir);
+    } else {
+        //Below the local cache but out of the way of its two letter entry directories
+        char local[1024];
+        fortean_cas_dir(have_cfg ? &cfg : NULL, local, sizeof(local));
+        snprintf(server.cas.dir, sizeof(server.cas.dir), "%.1000s%cserver", local, PATH_SEP);
+    }
+    server.cas.max_bytes = (long long)(have_cfg ? fortean_toml_get_int(&cfg, "cache.max-size", 5120) : 5120) * 1024 * 1024;
+    if (have_cfg) fortean_toml_free(&cfg);
+    dir = server.cas.dir;
+    if (make_dirs(dir) != 0) {
+        char msg[1100];
+        snprintf(msg, sizeof(msg), "Can't create the cache directory %s.", dir);
+        print_error(msg);
+        return -1;
+    }
+
+    char msg[1400];
+    snprintf(msg, sizeof(msg), "Serving the build cache in %s on http://%s", dir, address);
+    print_ok(msg);
+    if (fortean_http_serve(address, 512u << 20, serve_request, &server) != 0) {
+        snprintf(msg, sizeof(msg), "Can't listen on %s.", address);
+        print_error(msg);
+        return -1;
+    }
+    return 0;
+}
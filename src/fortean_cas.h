@@ -0,0 +1,71 @@
+#ifndef FORTEAN_CAS_H
+#define FORTEAN_CAS_H
+
+#include "fortean_toml.h"
+#include "fortean_http.h"
+
+#include <stddef.h>
+
+//16 hex digits and the terminator
+#define FORTEAN_CAS_KEY_LEN 17
+
+//Content addressed store of compiled objects and modules, shared by every project on
+//the machine, so a branch switch or a second worktree restores what was compiled
+//before instead of compiling it again. An entry is one file named by the hash of
+//everything that goes into the compile: the source, the modules it uses, the files it
+//includes, the flags and the compiler version.
+typedef struct {
+    char dir[1024];                  // ~/.cache/fortean unless [cache] dir says otherwise
+    long long max_bytes;             // Least recently used entries go above this size
+    unsigned long long compiler_hash;
+    char root[1024];                 // Project root, stripped from paths so checkouts share entries
+    int hits;
+    int misses;
+    int stores;
+    unsigned int seq;                // Names the temporary files of this build
+
+    //[cache] remote, an HTTP cache behind the local one (GET and PUT <remote>/cas/<key>)
+    fortean_url_t remote;
+    int remote_on;                   // Cleared for the rest of the build when it stops answering
+    int remote_push;                 // Upload the entries this build stores
+    int remote_timeout_ms;
+    int remote_hits;
+    int remote_misses;
+    int remote_errors;
+    double remote_seconds;           // Spent waiting for the remote
+    long long bytes_down;
+    long long bytes_up;
+} fortean_cas_t;
+
+//Directory of the cache: [cache] dir, $FORTEAN_CACHE_DIR or the user cache directory
+//(cfg may be NULL).
+void fortean_cas_dir(fortean_toml_t *cfg, char *buf, size_t size);
+
+//Open the cache for builds with compiler when [cache] enabled = true.
+//Returns 0 when it can be used, -1 otherwise.
+int fortean_cas_open(fortean_cas_t *cas, fortean_toml_t *cfg, const char *compiler);
+
+//Key of compiling src with flags, where the modules it uses are looked up in mod_dir and
+//the -I directories. Returns -1 when the compile can't be cached, e.g. it reads profile data.
+int fortean_cas_key(const fortean_cas_t *cas, const char *src, char **flags, int flag_count,
+                    const char *mod_dir, char key[FORTEAN_CAS_KEY_LEN]);
+
+//Write the object of the entry to obj_path and its modules into mod_dir. Returns 1 on a hit.
+int fortean_cas_restore(fortean_cas_t *cas, const char *key, const char *obj_path, const char *mod_dir);
+
+//Store the object and the modules src defines once it compiled.
+void fortean_cas_store(fortean_cas_t *cas, const char *key, const char *src, const char *obj_path,
+                       const char *mod_dir);
+
+//Record the hits and misses of the build and trim the cache to its size limit.
+void fortean_cas_close(fortean_cas_t *cas);
+
+//fortean cache stats: hit rate over the recorded builds, entries and size. Returns 0 on success.
+int fortean_cas_stats(void);
+
+//fortean cache-server: serve the entries under dir (<cache dir>/server when NULL) over
+//HTTP on address ("host:port") until stopped, for [cache] remote. Returns -1 if it
+//can't listen.
+int fortean_cas_serve(const char *address, const char *dir);
+
+#endif // FORTEAN_CAS_H
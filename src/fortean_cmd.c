@@ -0,0 +1,365 @@
+#include "fortean_cmd.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#define PSAPI_VERSION 2
+#include <psapi.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+extern char **environ;
+
+static void usage_from_rusage(const struct rusage *ru, fortean_cmd_usage_t *usage) {
+    usage->user  = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    usage->sys   = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    usage->max_rss = ru->ru_maxrss / 1024;  // Bytes on macOS
+#else
+    usage->max_rss = ru->ru_maxrss;
+#endif
+    //Blocks of 512 bytes
+    usage->read_bytes  = (long long)ru->ru_inblock * 512;
+    usage->write_bytes = (long long)ru->ru_oublock * 512;
+    usage->valid       = 1;
+}
+#endif
+
+void fortean_cmd_init(fortean_cmd_t *cmd, const char *program) {
+    memset(cmd, 0, sizeof(*cmd));
+    fortean_cmd_add(cmd, program);
+}
+
+void fortean_cmd_init_shell(fortean_cmd_t *cmd, const char *line) {
+#ifdef _WIN32
+    fortean_cmd_init(cmd, "cmd");
+    fortean_cmd_add(cmd, "/C");
+#else
+    fortean_cmd_init(cmd, "sh");
+    fortean_cmd_add(cmd, "-c");
+#endif
+    fortean_cmd_add(cmd, line);
+}
+
+int fortean_cmd_add(fortean_cmd_t *cmd, const char *arg) {
+    if (!arg) return 0;
+    if (cmd->argc + 2 > cmd->cap) {
+        int cap = cmd->cap ? cmd->cap * 2 : 16;
+        char **argv = realloc(cmd->argv, cap * sizeof(char *));
+        if (!argv) {
+            print_error("Memory allocation error while building a command.");
+            cmd->failed = 1;
+            return -1;
+        }
+        cmd->argv = argv;
+        cmd->cap  = cap;
+    }
+    cmd->argv[cmd->argc] = strdup(arg);
+    if (!cmd->argv[cmd->argc]) {
+        cmd->failed = 1;
+        return -1;
+    }
+    cmd->length += strlen(arg) + (cmd->argc > 0 ? 1 : 0);
+    cmd->argc++;
+    cmd->argv[cmd->argc] = NULL;
+    return 0;
+}
+
+int fortean_cmd_addf(fortean_cmd_t *cmd, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0) return -1;
+
+    char *arg = malloc(len + 1);
+    if (!arg) {
+        cmd->failed = 1;
+        return -1;
+    }
+    va_start(ap, fmt);
+    vsnprintf(arg, len + 1, fmt, ap);
+    va_end(ap);
+
+    int res = fortean_cmd_add(cmd, arg);
+    free(arg);
+    return res;
+}
+
+int fortean_cmd_add_list(fortean_cmd_t *cmd, char **args) {
+    for (int i = 0; args && args[i]; i++) {
+        if (fortean_cmd_add(cmd, args[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+void fortean_cmd_free(fortean_cmd_t *cmd) {
+    for (int i = 0; i < cmd->argc; i++) free(cmd->argv[i]);
+    free(cmd->argv);
+    memset(cmd, 0, sizeof(*cmd));
+}
+
+static int needs_quotes(const char *arg) {
+    return arg[0] == '\0' || strpbrk(arg, " \t\n\"") != NULL;
+}
+
+//Append arg to buf at *pos, quoted when needed. Backslashes in front of a quote are
+//doubled, which is how Windows programs split their command line.
+static void append_quoted(char *buf, size_t *pos, const char *arg) {
+    if (!needs_quotes(arg)) {
+        size_t n = strlen(arg);
+        memcpy(buf + *pos, arg, n);
+        *pos += n;
+        return;
+    }
+    buf[(*pos)++] = '"';
+    for (const char *p = arg; ; p++) {
+        size_t slashes = 0;
+        while (*p == '\\') {
+            slashes++;
+            p++;
+        }
+        if (*p == '\0') {
+            for (size_t i = 0; i < slashes * 2; i++) buf[(*pos)++] = '\\';
+            break;
+        }
+        if (*p == '"') slashes = slashes * 2 + 1;
+        for (size_t i = 0; i < slashes; i++) buf[(*pos)++] = '\\';
+        buf[(*pos)++] = *p;
+    }
+    buf[(*pos)++] = '"';
+}
+
+char *fortean_cmd_string(const fortean_cmd_t *cmd) {
+    //Worst case every character is escaped and every argument quoted.
+    size_t size = 2 * cmd->length + 3 * cmd->argc + 1;
+    char *str = malloc(size);
+    if (!str) return NULL;
+    size_t pos = 0;
+    for (int i = 0; i < cmd->argc; i++) {
+        if (i > 0) str[pos++] = ' ';
+        append_quoted(str, &pos, cmd->argv[i]);
+    }
+    str[pos] = '\0';
+    return str;
+}
+
+//Write every argument but the program to a response file. Special characters are
+//escaped with a backslash, which gcc, gfortran and GNU ar all understand.
+static int write_response_file(const fortean_cmd_t *cmd, char *path, size_t size) {
+    FILE *fp = NULL;
+#ifdef _WIN32
+    char dir[MAX_PATH];
+    if (GetTempPathA(sizeof(dir), dir) == 0 || GetTempFileNameA(dir, "frt", 0, path) == 0) return -1;
+    (void)size;
+    fp = fopen(path, "w");
+#else
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/fortean-XXXXXX", dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+    fp = fdopen(fd, "w");
+    if (!fp) close(fd);
+#endif
+    if (!fp) return -1;
+
+    for (int i = 1; i < cmd->argc; i++) {
+        for (const char *p = cmd->argv[i]; *p; p++) {
+            if (strchr(" \t\n\r\"'\\", *p)) fputc('\\', fp);
+            fputc(*p, fp);
+        }
+        fputc('\n', fp);
+    }
+    if (fclose(fp) != 0) {
+        remove(path);
+        return -1;
+    }
+    return 0;
+}
+
+static int spawn_and_wait(char **argv, const char *cwd, const char *log, fortean_trace_t *trace,
+                          fortean_cmd_usage_t *usage) {
+    //Keep our own buffered output ahead of the child's.
+    fflush(stdout);
+    fflush(stderr);
+#ifdef _WIN32
+    (void)trace;
+    fortean_cmd_t tmp = {0};
+    tmp.argv = argv;
+    for (tmp.argc = 0; argv[tmp.argc]; tmp.argc++) tmp.length += strlen(argv[tmp.argc]) + 1;
+    char *line = fortean_cmd_string(&tmp);
+    if (!line) return -1;
+
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    memset(&si, 0, sizeof(si));
+    si.cb = sizeof(si);
+    HANDLE out = INVALID_HANDLE_VALUE;
+    if (log) {
+        SECURITY_ATTRIBUTES sa = {sizeof(sa), NULL, TRUE};
+        out = CreateFileA(log, GENERIC_WRITE, FILE_SHARE_READ, &sa, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (out == INVALID_HANDLE_VALUE) {
+            free(line);
+            return -1;
+        }
+        si.dwFlags    = STARTF_USESTDHANDLES;
+        si.hStdInput  = GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = out;
+        si.hStdError  = out;
+    }
+    BOOL ok = CreateProcessA(NULL, line, NULL, NULL, TRUE, 0, NULL, cwd, &si, &pi);
+    free(line);
+    if (out != INVALID_HANDLE_VALUE) CloseHandle(out);
+    if (!ok) return -1;
+
+    DWORD code = 1;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &code);
+    if (usage) {
+        //The compiler's own process only, Windows doesn't add up the children.
+        FILETIME created, exited, kernel, user;
+        PROCESS_MEMORY_COUNTERS mem;
+        IO_COUNTERS io;
+        memset(usage, 0, sizeof(*usage));
+        if (GetProcessTimes(pi.hProcess, &created, &exited, &kernel, &user)) {
+            usage->user = (((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime) / 1e7;
+            usage->sys  = (((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) / 1e7;
+            usage->valid = 1;
+        }
+        if (GetProcessMemoryInfo(pi.hProcess, &mem, sizeof(mem))) usage->max_rss = (long long)(mem.PeakWorkingSetSize / 1024);
+        if (GetProcessIoCounters(pi.hProcess, &io)) {
+            usage->read_bytes  = (long long)io.ReadTransferCount;
+            usage->write_bytes = (long long)io.WriteTransferCount;
+        }
+    }
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return (int)code;
+#else
+    struct rusage ru;
+#ifdef FORTEAN_TRACE_SUPPORTED
+    if (trace) {
+        int code = fortean_trace_spawn(argv, cwd, log, trace, usage ? &ru : NULL);
+        if (usage && code != -1) usage_from_rusage(&ru, usage);
+        return code;
+    }
+#else
+    (void)trace;
+#endif
+    pid_t pid;
+    if (cwd || log) {
+        //posix_spawn has no portable way to change directory, fork for these.
+        pid = fork();
+        if (pid < 0) return -1;
+        if (pid == 0) {
+            if (log) {
+                int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0 || dup2(fd, STDERR_FILENO) < 0) _exit(127);
+                close(fd);
+            }
+            if (!cwd || chdir(cwd) == 0) execvp(argv[0], argv);
+            _exit(127);
+        }
+    } else if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        return -1;
+    }
+    int status = 0;
+    if (wait4(pid, &status, 0, &ru) < 0) return -1;
+    if (usage) usage_from_rusage(&ru, usage);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+int fortean_cmd_run(const fortean_cmd_t *cmd) {
+    if (cmd->failed || cmd->argc == 0) return -1;
+
+    if (!cmd->response_file || cmd->length <= FORTEAN_CMD_RSP_THRESHOLD) {
+        return spawn_and_wait(cmd->argv, cmd->cwd, cmd->log, cmd->trace, cmd->usage);
+    }
+
+    char path[1024];
+    if (write_response_file(cmd, path, sizeof(path)) != 0) {
+        print_error("Failed to write a response file for a long command.");
+        return -1;
+    }
+    char rsp_arg[1030];
+    snprintf(rsp_arg, sizeof(rsp_arg), "@%s", path);
+    char *argv[3] = {cmd->argv[0], rsp_arg, NULL};
+    int ret = spawn_and_wait(argv, cmd->cwd, cmd->log, cmd->trace, cmd->usage);
+    remove(path);
+    return ret;
+}
+
+char *fortean_cmd_capture(const fortean_cmd_t *cmd) {
+    if (cmd->failed || cmd->argc == 0) return NULL;
+
+#ifdef _WIN32
+    char *line = fortean_cmd_string(cmd);
+    if (!line) return NULL;
+    FILE *pipe = popen(line, "r");
+    free(line);
+    if (!pipe) {
+        print_error("Failed to run command.");
+        return NULL;
+    }
+    int fd = _fileno(pipe);
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        print_error("Failed to run command.");
+        return NULL;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    pid_t pid;
+    int spawned = posix_spawnp(&pid, cmd->argv[0], &actions, NULL, cmd->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (spawned != 0) {
+        close(fds[0]);
+        print_error("Failed to run command.");
+        return NULL;
+    }
+    int fd = fds[0];
+#endif
+
+    char *buffer = NULL;
+    size_t size = 0;
+    char chunk[4096];
+    int n;
+    while ((n = (int)read(fd, chunk, sizeof(chunk))) > 0) {
+        char *newbuf = realloc(buffer, size + n + 1);
+        if (!newbuf) {
+            free(buffer);
+            buffer = NULL;
+            print_error("Memory allocation error.");
+            break;
+        }
+        buffer = newbuf;
+        memcpy(buffer + size, chunk, n);
+        size += n;
+        buffer[size] = '\0';
+    }
+
+#ifdef _WIN32
+    pclose(pipe);
+#else
+    close(fd);
+    waitpid(pid, NULL, 0);
+#endif
+    return buffer;
+}
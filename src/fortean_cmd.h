@@ -0,0 +1,62 @@
+#ifndef FORTEAN_CMD_H
+#define FORTEAN_CMD_H
+
+#include <stddef.h>
+#include "fortean_trace.h"
+
+//Command lines longer than this are passed to tools that accept them through an
+//@response file. Windows limits a whole command line to 32767 characters.
+#define FORTEAN_CMD_RSP_THRESHOLD 30000
+
+//What a program used, its children included. Zero where the system doesn't say.
+typedef struct {
+    double user;             // CPU seconds in user mode
+    double sys;              // CPU seconds in the kernel
+    long long max_rss;       // Peak resident set in KB, of the largest process
+    long long read_bytes;    // Read from disk, page cache hits don't count
+    long long write_bytes;   // Written to disk
+    int valid;               // Filled in by fortean_cmd_run
+} fortean_cmd_usage_t;
+
+//Growable argument vector for the compiler, ar, linker and scanner calls.
+typedef struct {
+    char **argv;        // NULL-terminated
+    int argc;
+    int cap;
+    size_t length;      // Length of the command line with the arguments joined by spaces
+    int response_file;  // The program understands @file arguments
+    int failed;         // An allocation failed, run and capture refuse to start
+    const char *cwd;    // Directory fortean_cmd_run starts the program in, NULL for ours (not owned)
+    const char *log;    // File fortean_cmd_run sends the program's output and errors to, NULL for ours (not owned)
+    fortean_trace_t *trace;  // fortean_cmd_run records the files the program opens here, NULL for none (not owned)
+    fortean_cmd_usage_t *usage;  // fortean_cmd_run records what the program used here, NULL for none (not owned)
+} fortean_cmd_t;
+
+void fortean_cmd_init(fortean_cmd_t *cmd, const char *program);
+
+//Command that runs one line from Fortean.toml through the shell (sh -c, cmd /C on
+//Windows), so redirections and quoting work as written.
+void fortean_cmd_init_shell(fortean_cmd_t *cmd, const char *line);
+
+//Append one argument. Returns 0 on success.
+int fortean_cmd_add(fortean_cmd_t *cmd, const char *arg);
+
+//Append a printf formatted argument
+int fortean_cmd_addf(fortean_cmd_t *cmd, const char *fmt, ...);
+
+//Append every argument of a NULL-terminated list (NULL is skipped)
+int fortean_cmd_add_list(fortean_cmd_t *cmd, char **args);
+
+//Command line for printing, arguments with spaces are quoted (caller must free)
+char *fortean_cmd_string(const fortean_cmd_t *cmd);
+
+//Run the command and wait for it, switching to a response file above the threshold.
+//Returns the exit code, or -1 when it could not be started.
+int fortean_cmd_run(const fortean_cmd_t *cmd);
+
+//Run the command and return everything it wrote to stdout (caller must free)
+char *fortean_cmd_capture(const fortean_cmd_t *cmd);
+
+void fortean_cmd_free(fortean_cmd_t *cmd);
+
+#endif // FORTEAN_CMD_H
@@ -0,0 +1,301 @@
+#include "fortean_compare.h"
+#include "fortean_compiler.h"
+#include "fortean_flags.h"
+#include "fortean_toml.h"
+#include "fortean_cmd.h"
+#include "fortean_threads.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define PATH_SEP '\\'
+#define MAKE_DIR(path) _mkdir(path)
+#define EXE_SUFFIX ".exe"
+#else
+#define PATH_SEP '/'
+#define MAKE_DIR(path) mkdir(path, 0755)
+#define EXE_SUFFIX ""
+#endif
+
+#define COMPARE_MAX_COMPILERS 16
+
+typedef enum {
+    COMPARE_DONE,
+    COMPARE_NOT_INSTALLED,
+    COMPARE_BUILD_FAILED,
+    COMPARE_RUN_FAILED
+} compare_status_t;
+
+static const char *status_names[] = {"done", "not installed", "build failed", "run failed"};
+
+//One compiler of the comparison, built on its own thread with -j.
+typedef struct {
+    char name[64];
+    char variant[80];       // cc-<name>, its obj/mod sub directories and cache state
+    char out_dir[340];      // .cache/compare/<name>, where its executables are linked
+    char *path;             // The installed compiler, NULL when it is not installed
+    fortean_build_opts_t build;
+    double build_seconds;
+    long long size;         // Executable size in bytes, -1 when unknown
+    double median;          // Workload run time, 0 without [compare] run
+    int runs;
+    compare_status_t status;
+} compare_entry_t;
+
+static const char *base_name(const char *path) {
+    const char *base = path;
+    for (const char *c = path; *c; c++) {
+        if (*c == '/' || *c == '\\') base = c + 1;
+    }
+    return base;
+}
+
+static void free_entries(compare_entry_t *entries, int count) {
+    for (int i = 0; i < count; i++) free(entries[i].path);
+}
+
+static void build_worker(void *arg) {
+    compare_entry_t *e = (compare_entry_t *)arg;
+    double start = fortean_wall_time();
+    if (fortean_build_project_incremental(&e->build) != 0) e->status = COMPARE_BUILD_FAILED;
+    e->build_seconds = fortean_wall_time() - start;
+}
+
+//The executable the workload runs: --bin, the first [[bin]] or build.target (caller must free)
+static char *compared_executable(fortean_toml_t *cfg, const fortean_build_opts_t *opts) {
+    if (opts->bin) return strdup(opts->bin);
+    toml_array_t *arr = fortean_toml_get_table_array(cfg, "bin");
+    if (arr && toml_array_nelem(arr) > 0) {
+        toml_datum_t name = toml_string_in(toml_table_at(arr, 0), "name");
+        if (name.ok) return name.u.s;
+    }
+    const char *target = fortean_toml_get_profile_string(cfg, opts->profile, "target");
+    return target ? strdup(target) : NULL;
+}
+
+//The run line with every {exe} replaced by the path of the executable (caller must free)
+static char *expand_exe(const char *line, const char *exe) {
+    size_t cap = strlen(line) + 1;
+    for (const char *p = strstr(line, "{exe}"); p; p = strstr(p + 5, "{exe}")) cap += strlen(exe);
+    char *out = malloc(cap);
+    if (!out) return NULL;
+    char *w = out;
+    while (*line) {
+        if (strncmp(line, "{exe}", 5) == 0) {
+            w += sprintf(w, "%s", exe);
+            line += 5;
+        } else {
+            *w++ = *line++;
+        }
+    }
+    *w = '\0';
+    return out;
+}
+
+static double median_of(double *times, int n) {
+    if (n == 0) return 0.0;
+    for (int i = 1; i < n; i++) {
+        double v = times[i];
+        int j = i - 1;
+        while (j >= 0 && times[j] > v) {
+            times[j + 1] = times[j];
+            j--;
+        }
+        times[j + 1] = v;
+    }
+    return n % 2 ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+}
+
+//Time repeat runs of the workload with the executable of one compiler
+static void run_workload(compare_entry_t *e, const char *run, const char *exe_name, int repeat) {
+    char exe[512];
+    snprintf(exe, sizeof(exe), "%s%c%s%s", e->out_dir, PATH_SEP, exe_name, EXE_SUFFIX);
+    struct stat st;
+    e->size = stat(exe, &st) == 0 ? (long long)st.st_size : -1;
+    if (!run) return;
+
+    char *line    = expand_exe(run, exe);
+    double *times = calloc(repeat, sizeof(double));
+    if (!line || !times) {
+        e->status = COMPARE_RUN_FAILED;
+        free(line);
+        free(times);
+        return;
+    }
+    for (int r = 0; r < repeat; r++) {
+        fortean_cmd_t cmd;
+        fortean_cmd_init_shell(&cmd, line);
+        double start = fortean_wall_time();
+        int status   = fortean_cmd_run(&cmd);
+        double secs  = fortean_wall_time() - start;
+        fortean_cmd_free(&cmd);
+        if (status != 0) {
+            e->status = COMPARE_RUN_FAILED;
+            break;
+        }
+        times[e->runs++] = secs;
+    }
+    e->median = median_of(times, e->runs);
+    free(line);
+    free(times);
+}
+
+//Results of every compiler, printed and written to .cache/compare/report.md
+static void write_report(compare_entry_t *entries, int count, const char *run, int repeat) {
+    char report[256];
+    snprintf(report, sizeof(report), ".cache%ccompare%creport.md", PATH_SEP, PATH_SEP);
+    FILE *fp = fopen(report, "w");
+    if (fp) {
+        fprintf(fp, "# fortean compare\n\n");
+        if (run) fprintf(fp, "Workload: `%s`, median of %d runs.\n\n", run, repeat);
+        fprintf(fp, "| Compiler | Build (s) | Size (bytes) | Run (s) | Status |\n");
+        fprintf(fp, "| -------- | --------- | ------------ | ------- | ------ |\n");
+    }
+
+    print_info("Compiler              Build(s)        Size    Run(s)  Status");
+    for (int i = 0; i < count; i++) {
+        compare_entry_t *e = &entries[i];
+        char build[32] = "-", size[32] = "-", runtime[32] = "-";
+        if (e->status != COMPARE_NOT_INSTALLED) snprintf(build, sizeof(build), "%.3f", e->build_seconds);
+        if (e->size >= 0) snprintf(size, sizeof(size), "%lld", e->size);
+        if (e->runs > 0) snprintf(runtime, sizeof(runtime), "%.3f", e->median);
+        char msg[300];
+        snprintf(msg, sizeof(msg), "%-20.63s  %8s  %10s  %8s  %s", e->name, build, size, runtime,
+                 status_names[e->status]);
+        print_info(msg);
+        if (fp) fprintf(fp, "| %s | %s | %s | %s | %s |\n", e->name, build, size, runtime, status_names[e->status]);
+    }
+    if (fp) {
+        fclose(fp);
+        char msg[300];
+        snprintf(msg, sizeof(msg), "Report written to %s", report);
+        print_ok(msg);
+    }
+}
+
+int fortean_compare_run(const fortean_build_opts_t *opts, const char *compilers) {
+    fortean_toml_t cfg = {0};
+    if (fortean_toml_load("Fortean.toml", &cfg) != 0) {
+        print_error("Failed to load project.toml.");
+        return -1;
+    }
+    const char *run = fortean_toml_get_string(&cfg, "compare.run");
+    int repeat      = fortean_toml_get_int(&cfg, "compare.repeat", 3);
+    if (repeat < 1) repeat = 1;
+    char *exe_name = compared_executable(&cfg, opts);
+    if (!exe_name) {
+        print_error("No executable to compare, add build.target or a [[bin]] to Fortean.toml.");
+        fortean_toml_free(&cfg);
+        return -1;
+    }
+
+    char dir[256];
+    MAKE_DIR(".cache");
+    snprintf(dir, sizeof(dir), ".cache%ccompare", PATH_SEP);
+    MAKE_DIR(dir);
+
+    //One entry per listed compiler, e.g. --compilers gfortran,flang-new,ifx.
+    compare_entry_t entries[COMPARE_MAX_COMPILERS];
+    int count = 0;
+    for (const char *p = compilers; *p && count < COMPARE_MAX_COMPILERS;) {
+        size_t len = strcspn(p, ",");
+        if (len > 0 && len < sizeof(entries[0].name)) {
+            compare_entry_t *e = &entries[count++];
+            memset(e, 0, sizeof(*e));
+            snprintf(e->name, sizeof(e->name), "%.*s", (int)len, p);
+            e->size = -1;
+
+            //Objects of different compilers never mix: each gets its own variant
+            //directories, and the flags of a [profile.<compiler>] when there is one.
+            //Two installs of one compiler (/opt/gcc-12/bin/gfortran,/opt/gcc-14/bin/gfortran)
+            //share a name, so the later ones get their position in the list appended.
+            const char *base = base_name(e->name);
+            char key[72];
+            snprintf(key, sizeof(key), "%s", base);
+            for (int k = 0; k < count - 1; k++) {
+                if (strcmp(base_name(entries[k].name), base) == 0) {
+                    snprintf(key, sizeof(key), "%s-%d", base, count);
+                    break;
+                }
+            }
+            snprintf(e->variant, sizeof(e->variant), "cc-%s", key);
+            snprintf(e->out_dir, sizeof(e->out_dir), "%s%c%s", dir, PATH_SEP, key);
+            e->build = *opts;
+            e->build.compiler          = e->name;
+            e->build.variant           = e->variant;
+            e->build.out_dir           = e->out_dir;
+            e->build.incremental_build = 0;
+            if (!opts->profile && fortean_toml_has_profile(&cfg, base)) e->build.profile = base;
+
+            e->path = fortean_find_program(e->name);
+            if (e->path) {
+                MAKE_DIR(e->out_dir);
+            } else {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "%s is not installed, skipping it.", e->name);
+                print_info(msg);
+                e->status = COMPARE_NOT_INSTALLED;
+            }
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+
+    //The same compiler listed twice, e.g. gfortran,/usr/bin/gfortran, would only
+    //compare with itself.
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < i; k++) {
+            if (fortean_path_equal(entries[i].path, entries[k].path)) {
+                char msg[400];
+                snprintf(msg, sizeof(msg), "%s and %s are the same compiler (%s).",
+                         entries[k].name, entries[i].name, entries[i].path);
+                print_error(msg);
+                free_entries(entries, count);
+                free(exe_name);
+                fortean_toml_free(&cfg);
+                return -1;
+            }
+        }
+    }
+    if (count == 0) {
+        print_error("No compilers given. Syntax is \"fortean compare --compilers gfortran,flang-new\"");
+        free(exe_name);
+        fortean_toml_free(&cfg);
+        return -1;
+    }
+
+    //Full builds, so the build times compare. With -j all compilers build at once.
+    thread_t threads[COMPARE_MAX_COMPILERS];
+    int started[COMPARE_MAX_COMPILERS] = {0};
+    for (int i = 0; i < count; i++) {
+        if (entries[i].status != COMPARE_DONE) continue;
+        if (opts->parallel_build && thread_create(&threads[i], build_worker, &entries[i]) == 0) {
+            started[i] = 1;
+        } else {
+            build_worker(&entries[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (started[i]) thread_join(threads[i]);
+    }
+
+    //The workloads run one at a time so they do not slow each other down.
+    int built = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].status != COMPARE_DONE) continue;
+        built++;
+        run_workload(&entries[i], run, exe_name, repeat);
+    }
+    write_report(entries, count, run, repeat);
+    if (!run) print_info("Add [compare] run = \"{exe} input\" to Fortean.toml to time a workload.");
+
+    free_entries(entries, count);
+    free(exe_name);
+    fortean_toml_free(&cfg);
+    return built > 0 ? 0 : -1;
+}
@@ -0,0 +1,12 @@
+#ifndef FORTEAN_COMPARE_H
+#define FORTEAN_COMPARE_H
+
+#include "fortean_build.h"
+
+//fortean compare --compilers gfortran,flang-new: build the project with every listed
+//compiler that is installed, each into its own directories (at the same time with -j),
+//and report the build time, executable size and run time of the [compare] workload.
+//Returns 0 on success.
+int fortean_compare_run(const fortean_build_opts_t *opts, const char *compilers);
+
+#endif // FORTEAN_COMPARE_H
@@ -0,0 +1,125 @@
+#include "fortean_compiler.h"
+#include "fortean_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define PATH_LIST_SEP ';'
+#define PATH_SEP '\\'
+#define IS_EXECUTABLE(path) (_access(path, 0) == 0)
+#else
+#include <unistd.h>
+#define PATH_LIST_SEP ':'
+#define PATH_SEP '/'
+#define IS_EXECUTABLE(path) (access(path, X_OK) == 0)
+#endif
+
+//gfortran only writes dependency files while preprocessing, hence the -cpp.
+static const fortean_compiler_t compilers[] = {
+    {"gfortran",  FORTEAN_CC_GNU,    {"-J%s", NULL},          "-fopenmp", "-O%s", "-Ofast",
+     {"-cpp", "-MMD", "-MF%s"}},
+    {"flang",     FORTEAN_CC_LLVM,   {"-module-dir", "%s"},   "-fopenmp", "-O%s", "-Ofast",
+     {NULL}},
+    {"ifx",       FORTEAN_CC_LLVM,   {"-module", "%s"},       "-qopenmp", "-O%s", "-Ofast",
+     {"-gen-dep=%s", "-gen-depformat=make", NULL}},
+    {"ifort",     FORTEAN_CC_IFORT,  {"-module", "%s"},       "-qopenmp", "-O%s", "-Ofast",
+     {"-gen-dep=%s", "-gen-depformat=make", NULL}},
+    {"nvfortran", FORTEAN_CC_NVIDIA, {"-module", "%s"},       "-mp",      "-O%s", "-fast",
+     {NULL}},
+    {"pgfortran", FORTEAN_CC_NVIDIA, {"-module", "%s"},       "-mp",      "-O%s", "-fast",
+     {NULL}},
+};
+
+static const fortean_compiler_t unknown_compiler =
+    {"",          FORTEAN_CC_OTHER,  {"-J%s", NULL},          "-fopenmp", "-O%s", "-Ofast",
+     {"-cpp", "-MMD", "-MF%s"}};
+
+//File name part of a path
+static const char *base_name(const char *path) {
+    const char *name = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    return name;
+}
+
+const fortean_compiler_t *fortean_compiler_lookup(const char *compiler) {
+    const char *name = base_name(compiler);
+    for (size_t i = 0; i < sizeof(compilers) / sizeof(compilers[0]); i++) {
+        if (strstr(name, compilers[i].name)) return &compilers[i];
+    }
+    return &unknown_compiler;
+}
+
+fortean_cc_family_t fortean_compiler_family(const char *compiler) {
+    return fortean_compiler_lookup(compiler)->family;
+}
+
+//Append options, each with an optional %s for value
+static int add_options(fortean_cmd_t *cmd, const char *const *options, int count, const char *value) {
+    for (int i = 0; i < count && options[i]; i++) {
+        if (strstr(options[i], "%s")) fortean_cmd_addf(cmd, options[i], value);
+        else                          fortean_cmd_add(cmd, options[i]);
+    }
+    return cmd->failed ? -1 : 0;
+}
+
+int fortean_compiler_add_module_dir(const fortean_compiler_t *cc, fortean_cmd_t *cmd, const char *dir) {
+    return add_options(cmd, cc->module_dir, 2, dir);
+}
+
+int fortean_compiler_add_depfile(const fortean_compiler_t *cc, fortean_cmd_t *cmd, const char *path) {
+    if (!cc->depfile[0]) return -1;
+    return add_options(cmd, cc->depfile, 3, path);
+}
+
+int fortean_compiler_opt_flag(const fortean_compiler_t *cc, const char *level, char *buf, size_t size) {
+    if (strcmp(level, "fast") == 0) {
+        snprintf(buf, size, "%s", cc->opt_fast);
+        return 0;
+    }
+    if (strlen(level) != 1 || !strchr("0123s", level[0])) return -1;
+    snprintf(buf, size, cc->opt_level, level);
+    return 0;
+}
+
+unsigned long long fortean_compiler_fingerprint(const char *compiler) {
+    fortean_cmd_t cmd;
+    fortean_cmd_init(&cmd, compiler);
+    fortean_cmd_add(&cmd, "--version");
+    char *version = fortean_cmd_capture(&cmd);
+    fortean_cmd_free(&cmd);
+    const char *name = compiler;
+    for (const char *p = compiler; *p; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    unsigned long long h = hash_bytes_fnv1a64(name, strlen(name), FNV64_SEED);
+    if (version) h = hash_bytes_fnv1a64(version, strlen(version), h);
+    free(version);
+    return h;
+}
+
+char *fortean_find_program(const char *name) {
+    //A path is used as it is.
+    if (strchr(name, '/') || strchr(name, '\\')) return IS_EXECUTABLE(name) ? strdup(name) : NULL;
+
+    const char *path = getenv("PATH");
+    while (path && *path) {
+        const char *end = strchr(path, PATH_LIST_SEP);
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+        char candidate[1024];
+        if (len > 0 && len < 900) {
+            snprintf(candidate, sizeof(candidate), "%.*s%c%s", (int)len, path, PATH_SEP, name);
+            if (IS_EXECUTABLE(candidate)) return strdup(candidate);
+#ifdef _WIN32
+            strcat(candidate, ".exe");
+            if (IS_EXECUTABLE(candidate)) return strdup(candidate);
+#endif
+        }
+        path = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
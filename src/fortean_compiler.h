@@ -0,0 +1,50 @@
+#ifndef FORTEAN_COMPILER_H
+#define FORTEAN_COMPILER_H
+
+#include "fortean_cmd.h"
+
+//Compiler families that spell the LTO and profile options differently.
+typedef enum {
+    FORTEAN_CC_GNU,     // gfortran
+    FORTEAN_CC_LLVM,    // flang, flang-new and ifx
+    FORTEAN_CC_IFORT,   // Classic Intel ifort
+    FORTEAN_CC_NVIDIA,  // nvfortran
+    FORTEAN_CC_OTHER
+} fortean_cc_family_t;
+
+//How one compiler spells the settings fortean passes it. A "%s" in an option is
+//replaced by the value, options that are NULL are not supported.
+typedef struct {
+    const char *name;           // Found in the file name of the compiler, e.g. gfortran-12
+    fortean_cc_family_t family;
+    const char *module_dir[2];  // Where the .mod files are written, one or two arguments
+    const char *openmp;
+    const char *opt_level;      // Optimisation level 0 to 3 or s
+    const char *opt_fast;       // opt-level = "fast"
+    const char *depfile[3];     // Make style dependency file of an object
+} fortean_compiler_t;
+
+//Profile of a compiler from its file name, e.g. /usr/bin/gfortran-12. Unknown compilers
+//get the gfortran spellings, which most of them accept.
+const fortean_compiler_t *fortean_compiler_lookup(const char *compiler);
+
+//Family of a compiler from its file name, e.g. /usr/bin/gfortran-12 is GNU.
+fortean_cc_family_t fortean_compiler_family(const char *compiler);
+
+//Append the options that write the modules to dir
+int fortean_compiler_add_module_dir(const fortean_compiler_t *cc, fortean_cmd_t *cmd, const char *dir);
+
+//Append the options that write the dependency file path, -1 when the compiler can't
+int fortean_compiler_add_depfile(const fortean_compiler_t *cc, fortean_cmd_t *cmd, const char *path);
+
+//Flag for opt-level = "0" to "3", "s" or "fast" in buf. Returns -1 for an unknown level.
+int fortean_compiler_opt_flag(const fortean_compiler_t *cc, const char *level, char *buf, size_t size);
+
+//Hash of the file name and --version output of a compiler. Only the version text
+//identifies it, so the same compiler installed in another place hashes the same.
+unsigned long long fortean_compiler_fingerprint(const char *compiler);
+
+//Full path of a program found on PATH, or NULL when it is not installed (caller must free)
+char *fortean_find_program(const char *name);
+
+#endif // FORTEAN_COMPILER_H
@@ -0,0 +1,279 @@
+#include "fortean_daemon.h"
+#include "fortean_net.h"
+#include "fortean_watch.h"
+#include "fortean_toml.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DAEMON_SOCKET "unix:.cache/daemon.sock"
+#define DAEMON_TIMEOUT_MS 1000
+
+//One request and its answer line
+static int daemon_request(const char *request, char *answer, size_t size) {
+    fortean_socket_t sock = fortean_net_connect(DAEMON_SOCKET, DAEMON_TIMEOUT_MS);
+    if (sock == FORTEAN_NO_SOCKET) return -1;
+    int ok = fortean_net_send_all(sock, request, strlen(request)) == 0 &&
+             fortean_net_recv_line(sock, answer, size) > 0;
+    fortean_net_close(sock);
+    return ok ? 0 : -1;
+}
+
+fortean_daemon_state_t fortean_daemon_begin(const char *key, unsigned long long *gen) {
+    char request[400], answer[128];
+    snprintf(request, sizeof(request), "begin %s\n", key);
+    *gen = 0;
+    if (daemon_request(request, answer, sizeof(answer)) != 0) return FORTEAN_DAEMON_NONE;
+    if (strncmp(answer, "clean", 5) == 0) return FORTEAN_DAEMON_CLEAN;
+    if (sscanf(answer, "dirty %llu", gen) == 1) return FORTEAN_DAEMON_DIRTY;
+    return FORTEAN_DAEMON_NONE;
+}
+
+void fortean_daemon_built(const char *key, unsigned long long gen) {
+    char request[400], answer[128];
+    snprintf(request, sizeof(request), "built %s %llu\n", key, gen);
+    daemon_request(request, answer, sizeof(answer));
+}
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//A build that succeeded and the state of the files it saw
+typedef struct {
+    char key[300];
+    unsigned long long source_gen;
+    unsigned long long output_gen;
+} clean_build_t;
+
+//Changes under an output directory (objects, modules, the executables, .cache) are the
+//build's own unless they happen between builds.
+typedef struct {
+    fortean_watch_t watch;
+    unsigned long long source_gen;         // Bumped by every change of a source or Fortean.toml
+    unsigned long long output_gen;         // Bumped by every change of an output
+    clean_build_t *clean;
+    int clean_count;
+    int reload;                            // Fortean.toml changed, read it and watch again
+} daemon_t;
+
+static void on_change(const fortean_watch_change_t *change, void *data) {
+    daemon_t *d = data;
+    if (change->path && strncmp(change->path, ".cache/daemon.", 14) == 0) return;   // Its own socket and log
+    if (change->kind != FORTEAN_WATCH_OUTPUT) d->source_gen++;
+    if (change->kind == FORTEAN_WATCH_OUTPUT || change->kind == FORTEAN_WATCH_LOST) d->output_gen++;
+    if (change->kind == FORTEAN_WATCH_CONFIG) d->reload = 1;
+}
+
+static clean_build_t *find_clean(daemon_t *d, const char *key) {
+    for (int i = 0; i < d->clean_count; i++) {
+        if (strcmp(d->clean[i].key, key) == 0) return &d->clean[i];
+    }
+    return NULL;
+}
+
+//Answer one request. Returns 1 for stop.
+static int handle_request(daemon_t *d, fortean_socket_t sock) {
+    char line[512], command[16], key[300] = "";
+    if (fortean_net_recv_line(sock, line, sizeof(line)) <= 0 || sscanf(line, "%15s %299s", command, key) < 1) return 0;
+    fortean_watch_read(&d->watch, on_change, d);
+    if (d->reload) {
+        //A new Fortean.toml can search other directories, and every build is stale.
+        fortean_watch_close(&d->watch);
+        fortean_watch_open(&d->watch);
+        d->reload      = 0;
+        d->clean_count = 0;
+    }
+
+    char answer[256];
+    int stop = 0;
+    if (strcmp(command, "begin") == 0) {
+        clean_build_t *c = find_clean(d, key);
+        if (c && c->source_gen == d->source_gen && c->output_gen == d->output_gen) {
+            snprintf(answer, sizeof(answer), "clean\n");
+        } else {
+            snprintf(answer, sizeof(answer), "dirty %llu\n", d->source_gen);
+        }
+    } else if (strcmp(command, "built") == 0) {
+        //The build's own objects and executables are part of the clean state, a source
+        //edited while it ran is not.
+        unsigned long long gen = 0;
+        sscanf(line, "%*s %*s %llu", &gen);
+        clean_build_t *c = find_clean(d, key);
+        if (!c && gen == d->source_gen) {
+            clean_build_t *grown = realloc(d->clean, (d->clean_count + 1) * sizeof(clean_build_t));
+            if (grown) {
+                d->clean = grown;
+                c = &d->clean[d->clean_count++];
+                snprintf(c->key, sizeof(c->key), "%s", key);
+            }
+        }
+        if (c && gen == d->source_gen) {
+            c->source_gen = d->source_gen;
+            c->output_gen = d->output_gen;
+        }
+        snprintf(answer, sizeof(answer), "%s\n", gen == d->source_gen ? "ok" : "stale");
+    } else if (strcmp(command, "status") == 0) {
+        snprintf(answer, sizeof(answer), "ok %d %d %llu %llu\n", (int)getpid(), d->watch.count, d->source_gen,
+                 d->output_gen);
+    } else if (strcmp(command, "stop") == 0) {
+        snprintf(answer, sizeof(answer), "ok\n");
+        stop = 1;
+    } else {
+        snprintf(answer, sizeof(answer), "error unknown request\n");
+    }
+    fortean_net_send_all(sock, answer, strlen(answer));
+    return stop;
+}
+
+static int serve(void) {
+    daemon_t d;
+    memset(&d, 0, sizeof(d));
+    fortean_toml_t cfg = {0};
+    int idle_minutes = 60;
+    if (fortean_toml_load("Fortean.toml", &cfg) == 0) {
+        idle_minutes = fortean_toml_get_int(&cfg, "daemon.idle-timeout", 60);
+        fortean_toml_free(&cfg);
+    }
+    if (fortean_watch_open(&d.watch) != 0) {
+        print_error("inotify is not available, the daemon can't watch the project.");
+        fortean_watch_close(&d.watch);
+        return -1;
+    }
+    mkdir(".cache", 0755);
+    fortean_socket_t server = fortean_net_listen(DAEMON_SOCKET);
+    if (server == FORTEAN_NO_SOCKET) {
+        print_error("Can't listen on .cache/daemon.sock.");
+        fortean_watch_close(&d.watch);
+        return -1;
+    }
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Daemon %d watching %d directories", (int)getpid(), d.watch.count);
+    print_ok(msg);
+    fflush(stdout);
+
+    //Wake up for requests and for changes, so the inotify queue never overflows.
+    int stop = 0;
+    while (!stop) {
+        struct pollfd fds[2] = {{(int)server, POLLIN, 0}, {d.watch.fd, POLLIN, 0}};
+        int ready = poll(fds, 2, idle_minutes > 0 ? idle_minutes * 60000 : -1);
+        if (ready == 0) break;
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) fortean_watch_read(&d.watch, on_change, &d);
+        if (fds[0].revents) {
+            fortean_socket_t sock = fortean_net_accept(server, DAEMON_TIMEOUT_MS);
+            if (sock == FORTEAN_NO_SOCKET) continue;
+            stop = handle_request(&d, sock);
+            fortean_net_close(sock);
+        }
+    }
+    fortean_net_close(server);
+    unlink(".cache/daemon.sock");
+    fortean_watch_close(&d.watch);
+    free(d.clean);
+    return 0;
+}
+
+//Run serve() in a detached process with its output in .cache/daemon.log
+static int start_background(void) {
+    mkdir(".cache", 0755);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        setsid();
+        if (fork() != 0) _exit(0);
+        int null = open("/dev/null", O_RDONLY);
+        int log  = open(".cache/daemon.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (null >= 0) dup2(null, STDIN_FILENO);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        signal(SIGHUP, SIG_IGN);
+        _exit(serve() == 0 ? 0 : 1);
+    }
+    waitpid(pid, NULL, 0);
+
+    //Wait until it answers, so the next build finds it.
+    char answer[128];
+    for (int i = 0; i < 100; i++) {
+        if (daemon_request("status\n", answer, sizeof(answer)) == 0) return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+void fortean_daemon_autostart(void) {
+    fortean_toml_t cfg = {0};
+    if (fortean_toml_load("Fortean.toml", &cfg) != 0) return;
+    int enabled = fortean_toml_get_bool(&cfg, "daemon.enabled", 0);
+    fortean_toml_free(&cfg);
+    char answer[128];
+    if (!enabled || daemon_request("status\n", answer, sizeof(answer)) == 0) return;
+    if (start_background() == 0) print_info("Started the build daemon, the next builds ask it what changed.");
+}
+
+int fortean_daemon_command(const char *command) {
+    char answer[128];
+    int running = daemon_request("status\n", answer, sizeof(answer)) == 0;
+    if (strcmp(command, "run") == 0) return serve();
+    if (strcmp(command, "start") == 0) {
+        if (running) {
+            print_info("The daemon is already running.");
+            return 0;
+        }
+        if (start_background() != 0) {
+            print_error("The daemon didn't start, see .cache/daemon.log.");
+            return -1;
+        }
+        print_ok("Daemon started.");
+        return 0;
+    }
+    if (strcmp(command, "stop") == 0) {
+        if (running) daemon_request("stop\n", answer, sizeof(answer));
+        print_ok(running ? "Daemon stopped." : "No daemon is running.");
+        return 0;
+    }
+    if (strcmp(command, "status") == 0) {
+        int pid = 0, watches = 0;
+        unsigned long long source_gen = 0, output_gen = 0;
+        if (!running || sscanf(answer, "ok %d %d %llu %llu", &pid, &watches, &source_gen, &output_gen) != 4) {
+            print_info("No daemon is running.");
+            return 0;
+        }
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Daemon %d watching %d directories, %llu source and %llu output changes seen",
+                 pid, watches, source_gen, output_gen);
+        print_info(msg);
+        return 0;
+    }
+    print_error("Unknown daemon command. Syntax is \"fortean daemon start|stop|status|run\"");
+    return -1;
+}
+
+#else
+
+void fortean_daemon_autostart(void) {
+}
+
+int fortean_daemon_command(const char *command) {
+    (void)command;
+    print_error("The build daemon needs inotify and is only available on Linux.");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FORTEAN_DAEMON_H
+#define FORTEAN_DAEMON_H
+
+//Background server of one project ([daemon] enabled = true) that watches the sources,
+//Fortean.toml and the build outputs with inotify, so a build that nothing changed for
+//is answered without loading the config, running the scanner or hashing a file. It
+//listens on .cache/daemon.sock and stops after [daemon] idle-timeout minutes without
+//a build. Only on Linux, everywhere else builds run as before.
+
+typedef enum {
+    FORTEAN_DAEMON_NONE,     // No daemon is running
+    FORTEAN_DAEMON_CLEAN,    // Nothing changed since the build last succeeded
+    FORTEAN_DAEMON_DIRTY     // Build, then report it with fortean_daemon_built
+} fortean_daemon_state_t;
+
+//Ask the daemon whether the build named key is current. gen receives the state of the
+//files the answer is for.
+fortean_daemon_state_t fortean_daemon_begin(const char *key, unsigned long long *gen);
+
+//Tell the daemon the build named key succeeded from the files of gen
+void fortean_daemon_built(const char *key, unsigned long long gen);
+
+//Start the daemon in the background if Fortean.toml enables it and it isn't running
+void fortean_daemon_autostart(void);
+
+//fortean daemon start|stop|status|run. Returns 0 on success.
+int fortean_daemon_command(const char *command);
+
+#endif // FORTEAN_DAEMON_H
@@ -0,0 +1,290 @@
+#include "fortean_flags.h"
+#include "fortean_hash.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Glob matcher shared by the path and flag matching. When slash_special is set,
+//'*' and '?' stop at a '/' and only "**" crosses directories.
+static int glob_match_impl(const char *p, const char *s, int slash_special) {
+    while (*p) {
+        if (*p == '*') {
+            int crosses = !slash_special;
+            if (p[1] == '*') {
+                crosses = 1;
+                while (*p == '*') p++;
+                //"**/" also matches zero directories.
+                if (*p == '/' && glob_match_impl(p + 1, s, slash_special)) return 1;
+            } else {
+                p++;
+            }
+            if (*p == '\0') {
+                if (crosses) return 1;
+                return strchr(s, '/') == NULL;
+            }
+            for (; *s; s++) {
+                if (glob_match_impl(p, s, slash_special)) return 1;
+                if (!crosses && *s == '/') return 0;
+            }
+            return glob_match_impl(p, s, slash_special);
+        }
+        if (*s == '\0') return 0;
+        if (*p == '?') {
+            if (slash_special && *s == '/') return 0;
+        } else if (*p != *s) {
+            return 0;
+        }
+        p++;
+        s++;
+    }
+    return *s == '\0';
+}
+
+//Paths from the scanner and from Fortean.toml may use either separator or a leading ./
+static void normalize_path(const char *in, char *out, size_t out_size) {
+    while (in[0] == '.' && (in[1] == '/' || in[1] == '\\')) in += 2;
+    size_t i = 0;
+    for (; in[i] && i < out_size - 1; i++) {
+        out[i] = (in[i] == '\\') ? '/' : in[i];
+    }
+    out[i] = '\0';
+}
+
+int fortean_path_equal(const char *a, const char *b) {
+    if (!a || !b) return 0;
+    char na[1024], nb[1024];
+    normalize_path(a, na, sizeof(na));
+    normalize_path(b, nb, sizeof(nb));
+    return strcmp(na, nb) == 0;
+}
+
+int fortean_glob_match(const char *pattern, const char *path) {
+    if (!pattern || !path) return 0;
+
+    char pat[1024], str[1024];
+    normalize_path(pattern, pat, sizeof(pat) - 2);
+    normalize_path(path, str, sizeof(str));
+
+    //A directory entry covers everything below it.
+    size_t len = strlen(pat);
+    if (len > 0 && pat[len - 1] == '/') strcat(pat, "**");
+
+    //A bare file pattern like "*_table.f90" is checked against the file name only.
+    if (!strchr(pat, '/')) {
+        const char *name = strrchr(str, '/');
+        return glob_match_impl(pat, name ? name + 1 : str, 1);
+    }
+    return glob_match_impl(pat, str, 1);
+}
+
+static void free_null_list(char **list) {
+    if (!list) return;
+    for (int i = 0; list[i]; i++) free(list[i]);
+    free(list);
+}
+
+int fortean_overrides_load(fortean_toml_t *cfg, const char *key_path, fortean_overrides_t *ov) {
+    toml_array_t *arr = fortean_toml_get_table_array(cfg, key_path);
+    if (!arr) return 0;
+
+    int n = toml_array_nelem(arr);
+    fortean_override_t *items = realloc(ov->items, (ov->count + n + 1) * sizeof(fortean_override_t));
+    if (!items) {
+        print_error("Memory allocation error for flag overrides.");
+        return -1;
+    }
+    ov->items = items;
+
+    for (int i = 0; i < n; i++) {
+        toml_table_t *tbl = toml_table_at(arr, i);
+        fortean_override_t *item = &ov->items[ov->count];
+        item->files  = fortean_toml_table_get_array(tbl, "files");
+        item->flags  = fortean_toml_table_get_array(tbl, "flags");
+        item->remove = fortean_toml_table_get_array(tbl, "remove");
+        item->add    = fortean_toml_table_get_array(tbl, "add");
+
+        if (!item->files) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "Entry %d of '%s' has no 'files' list and is ignored.", i + 1, key_path);
+            print_error(msg);
+            free_null_list(item->flags);
+            free_null_list(item->remove);
+            free_null_list(item->add);
+            continue;
+        }
+        ov->count++;
+    }
+    return 0;
+}
+
+//Copy of a NULL-terminated list, NULL stays NULL
+static char **dup_null_list(char **list, int *failed) {
+    if (!list) return NULL;
+    int n = 0;
+    while (list[n]) n++;
+    char **copy = calloc(n + 1, sizeof(char *));
+    for (int i = 0; copy && i < n; i++) {
+        copy[i] = strdup(list[i]);
+        if (!copy[i]) {
+            free_null_list(copy);
+            copy = NULL;
+        }
+    }
+    if (!copy) *failed = 1;
+    return copy;
+}
+
+int fortean_overrides_add(fortean_overrides_t *ov, char **files, char **remove, char **add) {
+    fortean_override_t *items = realloc(ov->items, (ov->count + 1) * sizeof(fortean_override_t));
+    if (!items) {
+        print_error("Memory allocation error for flag overrides.");
+        return -1;
+    }
+    ov->items = items;
+
+    int failed = 0;
+    fortean_override_t *item = &ov->items[ov->count];
+    item->files  = dup_null_list(files, &failed);
+    item->flags  = NULL;
+    item->remove = dup_null_list(remove, &failed);
+    item->add    = dup_null_list(add, &failed);
+    ov->count++;
+    if (failed || !item->files) {
+        print_error("Memory allocation error for flag overrides.");
+        return -1;
+    }
+    return 0;
+}
+
+void fortean_overrides_free(fortean_overrides_t *ov) {
+    if (!ov) return;
+    for (int i = 0; i < ov->count; i++) {
+        free_null_list(ov->items[i].files);
+        free_null_list(ov->items[i].flags);
+        free_null_list(ov->items[i].remove);
+        free_null_list(ov->items[i].add);
+    }
+    free(ov->items);
+    ov->items = NULL;
+    ov->count = 0;
+}
+
+static int list_contains(char **list, int count, const char *flag) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i], flag) == 0) return 1;
+    }
+    return 0;
+}
+
+static int list_push(char ***list, int *count, const char *flag) {
+    char **newlist = realloc(*list, sizeof(char *) * (*count + 1));
+    if (!newlist) return -1;
+    *list = newlist;
+    (*list)[*count] = strdup(flag);
+    if (!(*list)[*count]) return -1;
+    (*count)++;
+    return 0;
+}
+
+int fortean_flags_edit(char ***flags, int *count, char **remove, char **add) {
+    if (remove) {
+        int kept = 0;
+        for (int k = 0; k < *count; k++) {
+            int drop = 0;
+            for (int j = 0; remove[j] && !drop; j++) {
+                drop = glob_match_impl(remove[j], (*flags)[k], 0);
+            }
+            if (drop) free((*flags)[k]);
+            else      (*flags)[kept++] = (*flags)[k];
+        }
+        *count = kept;
+    }
+    if (add) {
+        for (int j = 0; add[j]; j++) {
+            if (list_contains(*flags, *count, add[j])) continue;
+            if (list_push(flags, count, add[j]) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+char **fortean_flags_for_file(char **base, int base_count, const fortean_overrides_t *ov,
+                              const char *src, int *out_count) {
+    char **out = NULL;
+    int count  = 0;
+    for (int i = 0; i < base_count; i++) {
+        if (list_push(&out, &count, base[i]) != 0) goto fail;
+    }
+
+    for (int i = 0; ov && i < ov->count; i++) {
+        const fortean_override_t *item = &ov->items[i];
+
+        int matched = 0;
+        for (int j = 0; item->files[j] && !matched; j++) {
+            matched = fortean_glob_match(item->files[j], src);
+        }
+        if (!matched) continue;
+
+        //Replace first, then remove, then add so an entry can say "-O* out, -O1 in".
+        if (item->flags) {
+            fortean_flags_free(out, count);
+            out   = NULL;
+            count = 0;
+            for (int j = 0; item->flags[j]; j++) {
+                if (list_contains(out, count, item->flags[j])) continue;
+                if (list_push(&out, &count, item->flags[j]) != 0) goto fail;
+            }
+        }
+        if (fortean_flags_edit(&out, &count, item->remove, item->add) != 0) goto fail;
+    }
+
+    //An override can leave no flags at all, which is still a list
+    if (!out) {
+        out = malloc(sizeof(char *));
+        if (!out) goto fail;
+    }
+    *out_count = count;
+    return out;
+
+fail:
+    print_error("Memory allocation error while applying flag overrides.");
+    fortean_flags_free(out, count);
+    *out_count = 0;
+    return NULL;
+}
+
+char *fortean_flags_join(char **flags, int count) {
+    size_t len = 1;
+    for (int i = 0; i < count; i++) len += strlen(flags[i]) + 1;
+
+    char *str = malloc(len);
+    if (!str) return NULL;
+
+    size_t pos = 0;
+    for (int i = 0; i < count; i++) {
+        size_t n = strlen(flags[i]);
+        memcpy(str + pos, flags[i], n);
+        pos += n;
+        if (i < count - 1) str[pos++] = ' ';
+    }
+    str[pos] = '\0';
+    return str;
+}
+
+unsigned int fortean_flags_fingerprint(const char *compiler, char **flags, int count) {
+    unsigned int hash = hash_str_fnv1a(compiler ? compiler : "", FNV_SEED);
+    for (int i = 0; i < count; i++) {
+        //Separator so {"-O", "3"} and {"-O3"} differ.
+        hash = hash_str_fnv1a("\x1f", hash);
+        hash = hash_str_fnv1a(flags[i], hash);
+    }
+    return hash;
+}
+
+void fortean_flags_free(char **flags, int count) {
+    if (!flags) return;
+    for (int i = 0; i < count; i++) free(flags[i]);
+    free(flags);
+}
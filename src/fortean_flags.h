@@ -0,0 +1,55 @@
+#ifndef FORTEAN_FLAGS_H
+#define FORTEAN_FLAGS_H
+
+#include "fortean_toml.h"
+
+//One [[build.override]] entry from Fortean.toml.
+typedef struct {
+    char **files;   // Path globs the entry applies to (NULL-terminated)
+    char **flags;   // Replaces the whole flag set when present
+    char **remove;  // Flag globs removed from the set, e.g. "-O*"
+    char **add;     // Flags appended to the set
+} fortean_override_t;
+
+typedef struct {
+    fortean_override_t *items;
+    int count;
+} fortean_overrides_t;
+
+//Append every [[build.override]] style entry found at key_path to ov (zero it first).
+//Returns 0 on success.
+int fortean_overrides_load(fortean_toml_t *cfg, const char *key_path, fortean_overrides_t *ov);
+
+//Append one entry that applies remove, then add, to the files matching the globs.
+//The lists are copied. Returns 0 on success.
+int fortean_overrides_add(fortean_overrides_t *ov, char **files, char **remove, char **add);
+
+//Free the override entries
+void fortean_overrides_free(fortean_overrides_t *ov);
+
+//Match a path against a glob. Supports *, ? and **, a trailing '/' matches
+//everything below a directory and a pattern without '/' matches the file name.
+int fortean_glob_match(const char *pattern, const char *path);
+
+//Compare two relative paths ignoring a leading ./ and the separator style
+int fortean_path_equal(const char *a, const char *b);
+
+//Apply the matching overrides (in file order) to the base flags for one source file.
+//Returns a new list with *out_count entries, possibly none (caller must free all), or
+//NULL when out of memory.
+char **fortean_flags_for_file(char **base, int base_count, const fortean_overrides_t *ov,
+                              const char *src, int *out_count);
+
+//Remove the flags matching the remove globs, then append the add flags (NULL lists are skipped).
+int fortean_flags_edit(char ***flags, int *count, char **remove, char **add);
+
+//Join a list of flags into a single space separated string (caller must free)
+char *fortean_flags_join(char **flags, int count);
+
+//Fingerprint of everything besides the source that changes an object file.
+unsigned int fortean_flags_fingerprint(const char *compiler, char **flags, int count);
+
+//Free a list of flags
+void fortean_flags_free(char **flags, int count);
+
+#endif // FORTEAN_FLAGS_H
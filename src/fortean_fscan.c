@@ -0,0 +1,123 @@
+#include "fortean_fscan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define FSCAN_MAX_LINE 4096
+#define FSCAN_MAX_NAME 256
+
+static int starts_with_word(const char *line, const char *word) {
+    size_t n = strlen(word);
+    for (size_t i = 0; i < n; i++) {
+        if (tolower((unsigned char)line[i]) != word[i]) return 0;
+    }
+    //The keyword has to end here, "programme = 1" is not a program statement.
+    char c = line[n];
+    return c == '\0' || isspace((unsigned char)c) || c == ',' || c == ':' || c == '(' || c == '!' || c == '\'' || c == '"';
+}
+
+static const char *skip_space(const char *p) {
+    while (*p && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+//Copy the identifier at p (lowercased) into dst
+static int read_name(const char *p, char *dst, size_t size) {
+    size_t j = 0;
+    while (*p && (isalnum((unsigned char)*p) || *p == '_') && j < size - 1) {
+        dst[j++] = (char)tolower((unsigned char)*p++);
+    }
+    dst[j] = '\0';
+    return j > 0;
+}
+
+static int push_unique(char ***list, int *count, const char *item) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*list)[i], item) == 0) return 0;
+    }
+    char **tmp = realloc(*list, (*count + 1) * sizeof(char *));
+    if (!tmp) return -1;
+    *list = tmp;
+    (*list)[*count] = strdup(item);
+    if (!(*list)[*count]) return -1;
+    (*count)++;
+    return 0;
+}
+
+//Quoted file name after include / #include
+static int read_quoted(const char *p, char *dst, size_t size) {
+    p = skip_space(p);
+    char close = *p;
+    if (close == '<') close = '>';
+    else if (close != '\'' && close != '"') return 0;
+    p++;
+    size_t j = 0;
+    while (*p && *p != close && j < size - 1) dst[j++] = *p++;
+    dst[j] = '\0';
+    return *p == close && j > 0;
+}
+
+int fortean_fscan_file(const char *path, fortean_fscan_t *scan) {
+    memset(scan, 0, sizeof(*scan));
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    char line[FSCAN_MAX_LINE];
+    char name[FSCAN_MAX_NAME];
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = skip_space(line);
+        if (*p == '\0' || *p == '!') continue;
+
+        if (*p == '#') {
+            p = skip_space(p + 1);
+            if (starts_with_word(p, "include") && read_quoted(p + 7, name, sizeof(name))) {
+                push_unique(&scan->includes, &scan->include_count, name);
+            }
+            continue;
+        }
+
+        if (starts_with_word(p, "program")) {
+            scan->is_program = 1;
+        } else if (starts_with_word(p, "module")) {
+            p = skip_space(p + 6);
+            if (read_name(p, name, sizeof(name)) &&
+                strcmp(name, "procedure") != 0 && strcmp(name, "function") != 0 &&
+                strcmp(name, "subroutine") != 0) {
+                push_unique(&scan->modules, &scan->module_count, name);
+            }
+        } else if (starts_with_word(p, "use")) {
+            p = skip_space(p + 3);
+            int intrinsic = 0;
+            if (*p == ',') {
+                p = skip_space(p + 1);
+                intrinsic = starts_with_word(p, "intrinsic");
+                while (*p && *p != ':') p++;
+            }
+            if (p[0] == ':' && p[1] == ':') p = skip_space(p + 2);
+            if (!intrinsic && read_name(p, name, sizeof(name))) {
+                push_unique(&scan->uses, &scan->use_count, name);
+            }
+        } else if (starts_with_word(p, "include")) {
+            if (read_quoted(p + 7, name, sizeof(name))) {
+                push_unique(&scan->includes, &scan->include_count, name);
+            }
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void free_list(char **list, int count) {
+    for (int i = 0; i < count; i++) free(list[i]);
+    free(list);
+}
+
+void fortean_fscan_free(fortean_fscan_t *scan) {
+    if (!scan) return;
+    free_list(scan->modules, scan->module_count);
+    free_list(scan->uses, scan->use_count);
+    free_list(scan->includes, scan->include_count);
+    memset(scan, 0, sizeof(*scan));
+}
@@ -0,0 +1,21 @@
+#ifndef FORTEAN_FSCAN_H
+#define FORTEAN_FSCAN_H
+
+//Lexical summary of one Fortran source, in the same spirit as maketopologicf90:
+//line based and case-insensitive, module names are stored lowercase.
+typedef struct {
+    int    is_program;      // Holds a main program unit
+    char **modules;         // Modules defined in the file
+    int    module_count;
+    char **uses;            // Modules used by the file (intrinsic modules are skipped)
+    int    use_count;
+    char **includes;        // Files named by include '...' or #include "..."
+    int    include_count;
+} fortean_fscan_t;
+
+//Scan a source file. Returns 0 on success, -1 if it cannot be read.
+int fortean_fscan_file(const char *path, fortean_fscan_t *scan);
+
+void fortean_fscan_free(fortean_fscan_t *scan);
+
+#endif // FORTEAN_FSCAN_H
@@ -0,0 +1,334 @@
+#include "fortean_gen.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define GEN_HEADER "# Generated by fortean gen"
+
+//Growable text of the build file
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} text_t;
+
+static void text_add(text_t *t, const char *s) {
+    size_t n = strlen(s);
+    if (t->failed) return;
+    if (t->len + n + 1 > t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        while (cap < t->len + n + 1) cap *= 2;
+        char *grown = realloc(t->data, cap);
+        if (!grown) {
+            t->failed = 1;
+            return;
+        }
+        t->data = grown;
+        t->cap  = cap;
+    }
+    memcpy(t->data + t->len, s, n + 1);
+    t->len += n;
+}
+
+static void text_addf(text_t *t, const char *fmt, ...) {
+    char buf[2048];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    text_add(t, buf);
+}
+
+//Add s with every character in escaped written as escape followed by the character
+static void text_escaped(text_t *t, const char *s, const char *escaped, char escape) {
+    char pair[3] = {escape, 0, 0};
+    char one[2]  = {0, 0};
+    for (; *s; s++) {
+        if (strchr(escaped, *s)) {
+            pair[1] = *s;
+            text_add(t, pair);
+        } else {
+            one[0] = *s;
+            text_add(t, one);
+        }
+    }
+}
+
+//A path in a ninja build line, or in a make rule
+static void text_path(text_t *t, const char *path, int ninja) {
+    if (ninja) text_escaped(t, path, "$ :", '$');
+    else       text_escaped(t, path, " #", '\\');
+}
+
+//The command for sh, each argument quoted when it needs it and $ doubled for both tools
+static void text_command(text_t *t, const fortean_cmd_t *cmd) {
+    for (int i = 0; i < cmd->argc; i++) {
+        const char *arg = cmd->argv[i];
+        if (i > 0) text_add(t, " ");
+        if (arg[0] && strspn(arg, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+=.,/:@%") ==
+                          strlen(arg)) {
+            text_add(t, arg);
+            continue;
+        }
+        text_add(t, "'");
+        for (const char *c = arg; *c; c++) {
+            if (*c == '\'')     text_add(t, "'\\''");
+            else if (*c == '$') text_add(t, "$$");
+            else {
+                char one[2] = {*c, 0};
+                text_add(t, one);
+            }
+        }
+        text_add(t, "'");
+    }
+}
+
+static void text_paths(text_t *t, char **list, int ninja) {
+    for (int i = 0; list && list[i]; i++) {
+        text_add(t, " ");
+        text_path(t, list[i], ninja);
+    }
+}
+
+int fortean_gen_add_path(char ***list, const char *path) {
+    int n = 0;
+    while (*list && (*list)[n]) {
+        if (strcmp((*list)[n], path) == 0) return 0;
+        n++;
+    }
+    char **grown = realloc(*list, (n + 2) * sizeof(char *));
+    if (!grown) return -1;
+    *list = grown;
+    grown[n] = strdup(path);
+    grown[n + 1] = NULL;
+    return grown[n] ? 0 : -1;
+}
+
+static void free_list(char **list) {
+    for (int i = 0; list && list[i]; i++) free(list[i]);
+    free(list);
+}
+
+//Add the directory of path to dirs, nothing for a file in the root
+static void add_dir_of(char ***dirs, const char *path, text_t *t) {
+    const char *slash = strrchr(path, '/');
+    if (!slash || slash == path) return;
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    if (fortean_gen_add_path(dirs, dir) != 0) t->failed = 1;
+}
+
+fortean_gen_step_t *fortean_gen_add(fortean_gen_t *gen, fortean_gen_kind_t kind, fortean_cmd_t *cmd,
+                                    const char *output) {
+    if (gen->count == gen->cap) {
+        int cap = gen->cap ? gen->cap * 2 : 64;
+        fortean_gen_step_t *grown = realloc(gen->steps, cap * sizeof(fortean_gen_step_t));
+        if (!grown) return NULL;
+        gen->steps = grown;
+        gen->cap   = cap;
+    }
+    fortean_gen_step_t *step = &gen->steps[gen->count];
+    memset(step, 0, sizeof(*step));
+    step->kind   = kind;
+    step->cmd    = *cmd;
+    step->output = strdup(output);
+    memset(cmd, 0, sizeof(*cmd));
+    gen->count++;
+    return step->output ? step : NULL;
+}
+
+static void write_ninja(text_t *t, const fortean_gen_t *gen) {
+    text_add(t, GEN_HEADER " ninja from Fortean.toml. Run it again when a source is added or\n"
+                "# removed or a use statement changes, the module dependencies come from the scan.\n\n");
+    text_add(t, "ninja_required_version = 1.7\n\n");
+
+    //The compiler leaves a .mod file alone when the interface didn't change, and restat
+    //keeps the sources that use it from compiling again.
+    text_add(t, "rule fc\n  command = $cmd\n  description = Compiling $in\n  restat = 1\n\n");
+    text_add(t, "rule fc_dep\n  command = $cmd\n  description = Compiling $in\n  depfile = $dep\n"
+                "  deps = gcc\n  restat = 1\n\n");
+    text_add(t, "rule link\n  command = $cmd\n  description = Linking $out\n\n");
+    text_add(t, "rule ar\n  command = rm -f $out && $cmd\n  description = Archiving $out\n\n");
+
+    static const char *rules[] = {"fc", "link", "ar"};
+    for (int i = 0; i < gen->count; i++) {
+        const fortean_gen_step_t *s = &gen->steps[i];
+        text_add(t, "build ");
+        text_path(t, s->output, 1);
+        if (s->mods_out) {
+            text_add(t, " |");
+            text_paths(t, s->mods_out, 1);
+        }
+        text_addf(t, ": %s%s", rules[s->kind], s->depfile ? "_dep" : "");
+        text_paths(t, s->inputs, 1);
+        if (s->mods_in) {
+            text_add(t, " |");
+            text_paths(t, s->mods_in, 1);
+        }
+        text_add(t, "\n  cmd = ");
+        text_command(t, &s->cmd);
+        text_add(t, "\n");
+        if (s->depfile) {
+            text_add(t, "  dep = ");
+            text_path(t, s->depfile, 1);
+            text_add(t, "\n");
+        }
+        text_add(t, "\n");
+    }
+    text_add(t, "build all: phony");
+    text_paths(t, gen->targets, 1);
+    text_add(t, "\n\ndefault all\n");
+}
+
+static void write_make(text_t *t, const fortean_gen_t *gen, const char *path) {
+    text_add(t, GEN_HEADER " make from Fortean.toml. Run it again when a source is added or\n"
+                "# removed or a use statement changes, the module dependencies come from the scan.\n\n");
+    text_add(t, "SHELL = /bin/sh\n\n.PHONY: all clean\n.DELETE_ON_ERROR:\n\nall:");
+    text_paths(t, gen->targets, 0);
+    text_add(t, "\n\n");
+
+    //The directories the steps write to, made before they run.
+    char **dirs = NULL;
+    for (int i = 0; i < gen->count; i++) {
+        const fortean_gen_step_t *s = &gen->steps[i];
+        add_dir_of(&dirs, s->output, t);
+        for (int m = 0; s->mods_out && s->mods_out[m]; m++) add_dir_of(&dirs, s->mods_out[m], t);
+    }
+    for (int i = 0; dirs && dirs[i]; i++) {
+        text_path(t, dirs[i], 0);
+        text_add(t, dirs[i + 1] ? " " : ":\n\tmkdir -p $@\n\n");
+    }
+
+    //Every step depends on this file, so new flags rebuild. A .mod file is written by
+    //the compile of its object and left alone when the interface didn't change: make
+    //sees its old time after the rule ran, so the sources that use it don't compile
+    //again. The rule only compiles when the .mod file went missing.
+    for (int i = 0; i < gen->count; i++) {
+        const fortean_gen_step_t *s = &gen->steps[i];
+        text_path(t, s->output, 0);
+        text_add(t, ":");
+        text_paths(t, s->inputs, 0);
+        text_paths(t, s->mods_in, 0);
+        text_add(t, " ");
+        text_path(t, path, 0);
+        char **step_dirs = NULL;
+        add_dir_of(&step_dirs, s->output, t);
+        for (int m = 0; s->mods_out && s->mods_out[m]; m++) add_dir_of(&step_dirs, s->mods_out[m], t);
+        if (step_dirs) text_add(t, " |");
+        text_paths(t, step_dirs, 0);
+        free_list(step_dirs);
+        text_add(t, "\n\t");
+        if (s->kind == FORTEAN_GEN_ARCHIVE) text_add(t, "rm -f $@\n\t");
+        text_command(t, &s->cmd);
+        text_add(t, "\n");
+        for (int m = 0; s->mods_out && s->mods_out[m]; m++) {
+            text_path(t, s->mods_out[m], 0);
+            text_add(t, ": ");
+            text_path(t, s->output, 0);
+            text_add(t, "\n\t@test -f $@ || { rm -f ");
+            text_path(t, s->output, 0);
+            text_add(t, "; $(MAKE) --no-print-directory -f ");
+            text_path(t, path, 0);
+            text_add(t, " ");
+            text_path(t, s->output, 0);
+            text_add(t, "; }\n");
+        }
+        text_add(t, "\n");
+    }
+
+    text_add(t, "clean:\n\trm -f");
+    for (int i = 0; i < gen->count; i++) {
+        const fortean_gen_step_t *s = &gen->steps[i];
+        text_add(t, " ");
+        text_path(t, s->output, 0);
+        text_paths(t, s->mods_out, 0);
+        if (s->depfile) {
+            text_add(t, " ");
+            text_path(t, s->depfile, 0);
+        }
+    }
+    text_add(t, "\n");
+
+    //The include files of every object, from the dependency files the compiler writes.
+    int depfiles = 0;
+    for (int i = 0; i < gen->count; i++) {
+        if (!gen->steps[i].depfile) continue;
+        text_add(t, depfiles++ ? " " : "\n-include ");
+        text_path(t, gen->steps[i].depfile, 0);
+    }
+    if (depfiles) text_add(t, "\n");
+    free_list(dirs);
+}
+
+int fortean_gen_write(const fortean_gen_t *gen, const char *format, const char *path) {
+    int ninja = strcmp(format, "ninja") == 0;
+    if (!ninja && strcmp(format, "make") != 0) {
+        print_error("Unknown build file format. Syntax is \"fortean gen ninja|make\"");
+        return -1;
+    }
+    text_t t = {0};
+    if (ninja) write_ninja(&t, gen);
+    else       write_make(&t, gen, path);
+    if (t.failed) {
+        print_error("Memory allocation error.");
+        free(t.data);
+        return -1;
+    }
+
+    //Leave a build file that someone wrote by hand alone, and one that is current untouched.
+    char msg[1200];
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        char *old   = malloc(t.len + 1);
+        size_t n    = old ? fread(old, 1, t.len, f) : 0;
+        int more    = fgetc(f) != EOF;
+        fclose(f);
+        int ours    = n >= strlen(GEN_HEADER) && strncmp(old, GEN_HEADER, strlen(GEN_HEADER)) == 0;
+        int same    = ours && !more && n == t.len && memcmp(old, t.data, n) == 0;
+        free(old);
+        if (!ours) {
+            snprintf(msg, sizeof(msg), "%s was not written by fortean gen, choose another file with --out.", path);
+            print_error(msg);
+            free(t.data);
+            return -1;
+        }
+        if (same) {
+            snprintf(msg, sizeof(msg), "%s is up to date", path);
+            print_ok(msg);
+            free(t.data);
+            return 0;
+        }
+    }
+
+    f = fopen(path, "wb");
+    int ok = f && fwrite(t.data, 1, t.len, f) == t.len;
+    if (f && fclose(f) != 0) ok = 0;
+    free(t.data);
+    if (!ok) {
+        snprintf(msg, sizeof(msg), "Can't write %s", path);
+        print_error(msg);
+        return -1;
+    }
+    snprintf(msg, sizeof(msg), "Wrote %s with %d steps", path, gen->count);
+    print_ok(msg);
+    return 0;
+}
+
+void fortean_gen_free(fortean_gen_t *gen) {
+    for (int i = 0; i < gen->count; i++) {
+        fortean_gen_step_t *s = &gen->steps[i];
+        fortean_cmd_free(&s->cmd);
+        free(s->output);
+        free_list(s->inputs);
+        free_list(s->mods_out);
+        free_list(s->mods_in);
+        free(s->depfile);
+    }
+    free(gen->steps);
+    free_list(gen->targets);
+    memset(gen, 0, sizeof(*gen));
+}
@@ -0,0 +1,49 @@
+#ifndef FORTEAN_GEN_H
+#define FORTEAN_GEN_H
+
+#include "fortean_cmd.h"
+
+//Build files for ninja and make written from the planned build, so build runners that
+//only have those tools build the project without fortean: fortean gen ninja|make. The
+//module dependencies come from the scan, so the file is written again when a source
+//is added or removed or a use statement changes.
+
+typedef enum {
+    FORTEAN_GEN_COMPILE,
+    FORTEAN_GEN_LINK,
+    FORTEAN_GEN_ARCHIVE      // The output is removed before the command writes it
+} fortean_gen_kind_t;
+
+//One step of the build with the files it reads and writes. The lists are NULL-terminated.
+typedef struct {
+    fortean_gen_kind_t kind;
+    fortean_cmd_t cmd;
+    char *output;            // Object, executable or library
+    char **inputs;           // Source, objects or libraries
+    char **mods_out;         // Modules the compile writes
+    char **mods_in;          // Modules of other sources the compile reads
+    char *depfile;           // Written by the compiler with the include files, NULL for none
+} fortean_gen_step_t;
+
+typedef struct {
+    fortean_gen_step_t *steps;
+    int count;
+    int cap;
+    char **targets;          // Built by default, the executables and the library
+} fortean_gen_t;
+
+//New step writing output, taking over cmd. Returns NULL when out of memory.
+fortean_gen_step_t *fortean_gen_add(fortean_gen_t *gen, fortean_gen_kind_t kind, fortean_cmd_t *cmd,
+                                    const char *output);
+
+//Append path to a NULL-terminated list unless it is already there. Returns 0 on success.
+int fortean_gen_add_path(char ***list, const char *path);
+
+//Write the steps as a build.ninja ("ninja") or a Makefile ("make") to path. The file
+//is only rewritten when it changes, since the Makefile rebuilds everything when it is
+//newer than the objects. Returns 0 on success.
+int fortean_gen_write(const fortean_gen_t *gen, const char *format, const char *path);
+
+void fortean_gen_free(fortean_gen_t *gen);
+
+#endif // FORTEAN_GEN_H
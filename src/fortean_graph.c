@@ -0,0 +1,227 @@
+#include "fortean_graph.h"
+#include "fortean_flags.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int graph_add_file(fortean_graph_t *graph, const char *file) {
+    char **files = realloc(graph->files, (graph->count + 1) * sizeof(char *));
+    if (!files) return -1;
+    graph->files = files;
+
+    int **deps = realloc(graph->deps, (graph->count + 1) * sizeof(int *));
+    if (!deps) return -1;
+    graph->deps = deps;
+
+    int *dep_count = realloc(graph->dep_count, (graph->count + 1) * sizeof(int));
+    if (!dep_count) return -1;
+    graph->dep_count = dep_count;
+
+    graph->files[graph->count]     = strdup(file);
+    graph->deps[graph->count]      = NULL;
+    graph->dep_count[graph->count] = 0;
+    hash_entry_put(graph->index, file, (unsigned int)graph->count);
+    return graph->count++;
+}
+
+int fortean_graph_parse(const char *topo_make, fortean_graph_t *graph) {
+    memset(graph, 0, sizeof(*graph));
+    if (!topo_make) return -1;
+
+    char *text = strdup(topo_make);
+    if (!text) return -1;
+
+    //Split into "file" and "deps" halves in place. Every file is registered first
+    //so the dependencies can be resolved to indices in the second pass.
+    char **dep_text = NULL;
+    for (char *line = text; line && *line; ) {
+        char *eol = strchr(line, '\n');
+        if (eol) *eol = '\0';
+        char *colon = strchr(line, ':');
+        if (colon) {
+            *colon = '\0';
+            int idx = graph_add_file(graph, line);
+            char **tmp = (idx < 0) ? NULL : realloc(dep_text, graph->count * sizeof(char *));
+            if (!tmp) goto fail;
+            dep_text = tmp;
+            dep_text[idx] = colon + 1;
+        }
+        line = eol ? eol + 1 : NULL;
+    }
+
+    for (int i = 0; i < graph->count; i++) {
+        char *dep = dep_text[i];
+        while (*dep) {
+            while (*dep == ' ' || *dep == '\t' || *dep == '\r') dep++;
+            if (!*dep) break;
+            char *end = dep;
+            while (*end && *end != ' ' && *end != '\t' && *end != '\r') end++;
+            char saved = *end;
+            *end = '\0';
+
+            HashEntry *entry = hash_entry_get(graph->index, dep);
+            if (entry) {
+                int *deps = realloc(graph->deps[i], (graph->dep_count[i] + 1) * sizeof(int));
+                if (!deps) goto fail;
+                graph->deps[i] = deps;
+                graph->deps[i][graph->dep_count[i]++] = (int)entry->file_hash;
+            }
+            *end = saved;
+            dep = end;
+        }
+    }
+
+    free(dep_text);
+    free(text);
+    return 0;
+
+fail:
+    print_error("Memory allocation error while reading the dependency graph.");
+    free(dep_text);
+    free(text);
+    fortean_graph_free(graph);
+    return -1;
+}
+
+int fortean_graph_find(const fortean_graph_t *graph, const char *file) {
+    HashEntry *entry = hash_entry_get((HashEntry **)graph->index, file);
+    if (entry) return (int)entry->file_hash;
+
+    //Paths from Fortean.toml may be written differently than the scanner prints them.
+    for (int i = 0; i < graph->count; i++) {
+        if (fortean_path_equal(graph->files[i], file)) return i;
+    }
+    return -1;
+}
+
+void fortean_graph_closure(const fortean_graph_t *graph, int root, unsigned char *mark) {
+    if (root < 0 || root >= graph->count || mark[root]) return;
+
+    int *stack = malloc(graph->count * sizeof(int));
+    if (!stack) return;
+    int top = 0;
+    stack[top++] = root;
+    mark[root] = 1;
+    while (top > 0) {
+        int u = stack[--top];
+        for (int d = 0; d < graph->dep_count[u]; d++) {
+            int v = graph->deps[u][d];
+            if (mark[v]) continue;
+            mark[v] = 1;
+            stack[top++] = v;
+        }
+    }
+    free(stack);
+}
+
+int *fortean_graph_levels(const fortean_graph_t *graph) {
+    int *level = calloc(graph->count > 0 ? graph->count : 1, sizeof(int));
+    if (!level) return NULL;
+
+    //Build order guarantees every used file has its level already.
+    for (int i = 0; i < graph->count; i++) {
+        for (int d = 0; d < graph->dep_count[i]; d++) {
+            int dep_level = level[graph->deps[i][d]] + 1;
+            if (dep_level > level[i]) level[i] = dep_level;
+        }
+    }
+    return level;
+}
+
+int fortean_graph_add_dep(fortean_graph_t *graph, int file, int dep) {
+    if (file == dep) return 0;
+    for (int d = 0; d < graph->dep_count[file]; d++) {
+        if (graph->deps[file][d] == dep) return 0;
+    }
+    unsigned char *mark = calloc(graph->count, 1);
+    if (!mark) return -1;
+    fortean_graph_closure(graph, dep, mark);
+    int cycle = mark[file];
+    free(mark);
+    if (cycle) return 0;
+
+    int *deps = realloc(graph->deps[file], (graph->dep_count[file] + 1) * sizeof(int));
+    if (!deps) return -1;
+    graph->deps[file] = deps;
+    graph->deps[file][graph->dep_count[file]++] = dep;
+    return 1;
+}
+
+int fortean_graph_sort(fortean_graph_t *graph) {
+    int n = graph->count;
+    int *order = malloc((n > 0 ? n : 1) * sizeof(int));   // Old position of each new one
+    int *pos   = malloc((n > 0 ? n : 1) * sizeof(int));   // New position of each old one
+    int *stack = malloc((n > 0 ? n : 1) * sizeof(int));
+    int *next  = calloc(n > 0 ? n : 1, sizeof(int));      // Next use to visit
+    char **files = malloc((n > 0 ? n : 1) * sizeof(char *));
+    int **deps   = malloc((n > 0 ? n : 1) * sizeof(int *));
+    int *dep_count = malloc((n > 0 ? n : 1) * sizeof(int));
+    if (!order || !pos || !stack || !next || !files || !deps || !dep_count) {
+        free(order);
+        free(pos);
+        free(stack);
+        free(next);
+        free(files);
+        free(deps);
+        free(dep_count);
+        return -1;
+    }
+
+    //Depth first in the old order, a file is placed once everything it uses is.
+    int count = 0;
+    for (int i = 0; i < n; i++) pos[i] = -1;
+    for (int root = 0; root < n; root++) {
+        if (pos[root] != -1) continue;
+        int top = 0;
+        stack[top++] = root;
+        pos[root] = -2;
+        while (top > 0) {
+            int u = stack[top - 1];
+            if (next[u] < graph->dep_count[u]) {
+                int v = graph->deps[u][next[u]++];
+                if (pos[v] == -1) {
+                    pos[v] = -2;
+                    stack[top++] = v;
+                }
+                continue;
+            }
+            pos[u] = count;
+            order[count++] = u;
+            top--;
+        }
+    }
+
+    free_prev_hash_table(graph->index);
+    for (int k = 0; k < n; k++) {
+        files[k]     = graph->files[order[k]];
+        deps[k]      = graph->deps[order[k]];
+        dep_count[k] = graph->dep_count[order[k]];
+        for (int d = 0; d < dep_count[k]; d++) deps[k][d] = pos[deps[k][d]];
+        hash_entry_put(graph->index, files[k], (unsigned int)k);
+    }
+    free(graph->files);
+    free(graph->deps);
+    free(graph->dep_count);
+    graph->files     = files;
+    graph->deps      = deps;
+    graph->dep_count = dep_count;
+    free(order);
+    free(pos);
+    free(stack);
+    free(next);
+    return 0;
+}
+
+void fortean_graph_free(fortean_graph_t *graph) {
+    for (int i = 0; i < graph->count; i++) {
+        free(graph->files[i]);
+        free(graph->deps[i]);
+    }
+    free(graph->files);
+    free(graph->deps);
+    free(graph->dep_count);
+    free_prev_hash_table(graph->index);
+    memset(graph, 0, sizeof(*graph));
+}
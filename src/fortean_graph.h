@@ -0,0 +1,38 @@
+#ifndef FORTEAN_GRAPH_H
+#define FORTEAN_GRAPH_H
+
+#include "fortean_hash.h"
+
+//The scanner's "file: used files" output (maketopologicf90 -m) held in memory.
+//Lines come out in topological order, so files[] is also the build order.
+typedef struct {
+    char **files;       // Sources in build order
+    int  **deps;        // Indices of the sources each file uses
+    int   *dep_count;
+    int    count;
+    HashEntry *index[HASH_TABLE_SIZE];  // Source path -> position in files
+} fortean_graph_t;
+
+//Parse the scanner output. Returns 0 on success.
+int fortean_graph_parse(const char *topo_make, fortean_graph_t *graph);
+
+//Position of a source in the graph or -1 (paths are compared after normalizing ./ and separators)
+int fortean_graph_find(const fortean_graph_t *graph, const char *file);
+
+//Set mark[i] = 1 for every source reachable from root through use statements (root included).
+void fortean_graph_closure(const fortean_graph_t *graph, int root, unsigned char *mark);
+
+//Dependency level of every source: 0 uses nothing, otherwise 1 + the deepest file it uses.
+int *fortean_graph_levels(const fortean_graph_t *graph);
+
+//Make file use dep, e.g. for a use the scanner missed. Returns 1 when added, 0 when it
+//already does or dep uses file through others (a cycle), -1 on a memory error.
+int fortean_graph_add_dep(fortean_graph_t *graph, int file, int dep);
+
+//Put files[] back in build order after fortean_graph_add_dep added a use of a later
+//file. The order is kept where the uses allow it. Returns 0 on success.
+int fortean_graph_sort(fortean_graph_t *graph);
+
+void fortean_graph_free(fortean_graph_t *graph);
+
+#endif // FORTEAN_GRAPH_H
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "fortean_hash.h"
 #include "fortean_helper_fn.h"
+#include "fortean_semhash.h"
 
 #define MAX_LINE 1024
 #define HASH_TABLE_SIZE 1024
@@ -33,6 +34,38 @@ unsigned int hash_file_fnv1a(const char *filename) {
     return hash;
 }
 
+// FNV-1a over a string, continuing from a previous hash (start from FNV_SEED)
+unsigned int hash_str_fnv1a(const char *str, unsigned int hash) {
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+#define FNV64_PRIME 1099511628211ull
+
+unsigned long long hash_bytes_fnv1a64(const void *data, size_t len, unsigned long long hash) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= FNV64_PRIME;
+    }
+    return hash;
+}
+
+int hash_file_fnv1a64(const char *filename, unsigned long long *hash) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) return -1;
+    unsigned char buffer[4096];
+    size_t bytesRead;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        *hash = hash_bytes_fnv1a64(buffer, bytesRead, *hash);
+    }
+    fclose(file);
+    return 0;
+}
+
 // Simple hash function for strings (djb2)
 unsigned int str_hash(const char *str) {
     unsigned int hash = 5381;
@@ -93,6 +126,30 @@ FileNode *get_or_create_file_node(const char *filename, FileNode *hash_table[])
     return node;
 }
 
+//Like get_or_create_file_node, but a file in known takes that hash instead of being read
+//and the others are hashed with the flags semhash gives them
+static FileNode *get_or_create_known_node(const char *filename, FileNode *hash_table[], HashEntry *known[],
+                                          const fortean_semhash_build_t *semhash) {
+    HashEntry *entry = known ? hash_entry_get(known, filename) : NULL;
+    if (!entry && !semhash) return get_or_create_file_node(filename, hash_table);
+    FileNode *node = find_file_node(filename, hash_table);
+    if (node) return node;
+
+    node = malloc(sizeof(FileNode));
+    if (!node) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    node->filename   = strdup(filename);
+    node->file_hash  = entry ? entry->file_hash
+                             : fortean_semhash_file(filename, fortean_semhash_flags_for_file(semhash, filename));
+    node->dependents = NULL;
+    unsigned int index = str_hash(filename);
+    node->next = hash_table[index];
+    hash_table[index] = node;
+    return node;
+}
+
 // Add dependent to file's dependents list if not already present
 void add_dependent(FileNode *file, const char *dependent) {
     DependentNode *curr = file->dependents;
@@ -125,7 +182,8 @@ void insert_node(const char *filename, FileNode *hash_table[]) {
 }
 
 // Parse a dependency line, update hashtable with dependents
-void parse_line(char *line, FileNode *hash_table[]) {
+static void parse_known_line(char *line, FileNode *hash_table[], HashEntry *known[],
+                             const fortean_semhash_build_t *semhash) {
     char *colon = strchr(line, ':');
     if (!colon) return;
 
@@ -142,22 +200,33 @@ void parse_line(char *line, FileNode *hash_table[]) {
     }
 
     // Ensure target is in the graph
-    FileNode *target_node = get_or_create_file_node(target, hash_table);
+    FileNode *target_node = get_or_create_known_node(target, hash_table, known, semhash);
     if(target_node == NULL){
         print_error("Unable to insert node into hash table when parsing the hash.dep file");
         exit(1);
     }
 
-    // Parse dependencies and add edges
-    char *dep = strtok(deps, " \t");
-    while (dep) {
-        FileNode *dep_node = get_or_create_file_node(dep, hash_table);
+    // Parse dependencies and add edges (no strtok, builds can run on threads)
+    char *dep = deps + strspn(deps, " \t");
+    while (*dep) {
+        char *next = dep + strcspn(dep, " \t");
+        if (*next) *next++ = '\0';
+        FileNode *dep_node = get_or_create_known_node(dep, hash_table, known, semhash);
         add_dependent(dep_node, target);  // dep_node -> target
-        dep = strtok(NULL, " \t");
+        dep = next + strspn(next, " \t");
     }
 }
 
+void parse_line(char *line, FileNode *hash_table[]) {
+    parse_known_line(line, hash_table, NULL, NULL);
+}
+
 int parse_dependency_file(const char *filename, FileNode *hash_table[]) {
+    return parse_dependency_file_known(filename, hash_table, NULL, NULL);
+}
+
+int parse_dependency_file_known(const char *filename, FileNode *hash_table[], HashEntry *known[],
+                                const fortean_semhash_build_t *semhash) {
     // Initialize table to NULLs
     for (int i = 0; i < HASH_TABLE_SIZE; i++) {
         hash_table[i] = NULL;
@@ -173,7 +242,7 @@ int parse_dependency_file(const char *filename, FileNode *hash_table[]) {
     while (fgets(line, sizeof(line), fp)) {
         line[strcspn(line, "\n")] = 0; // strip newline
         if (strlen(line) == 0) continue;
-        parse_line(line, hash_table);
+        parse_known_line(line, hash_table, known, semhash);
     }
 
     fclose(fp);
@@ -278,6 +347,35 @@ void load_prev_hashes(const char *filename, HashEntry *prev_hash_table[]) {
     fclose(fp);
 }
 
+// Insert or update an entry of a HashEntry table (also used as a plain string -> int map)
+void hash_entry_put(HashEntry *table[], const char *filename, unsigned int value) {
+    unsigned int idx = str_hash(filename);
+    for (HashEntry *entry = table[idx]; entry; entry = entry->next) {
+        if (strcmp(entry->filename, filename) == 0) {
+            entry->file_hash = value;
+            return;
+        }
+    }
+    HashEntry *entry = malloc(sizeof(HashEntry));
+    if (!entry) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    entry->filename  = strdup(filename);
+    entry->file_hash = value;
+    entry->next      = table[idx];
+    table[idx]       = entry;
+}
+
+// Find an entry of a HashEntry table, NULL if missing
+HashEntry *hash_entry_get(HashEntry *table[], const char *filename) {
+    unsigned int idx = str_hash(filename);
+    for (HashEntry *entry = table[idx]; entry; entry = entry->next) {
+        if (strcmp(entry->filename, filename) == 0) return entry;
+    }
+    return NULL;
+}
+
 int file_is_unchanged(const char *filename, unsigned int current_hash, HashEntry *prev_hash_table[]) {
     unsigned int idx = str_hash(filename);
     HashEntry *entry = prev_hash_table[idx];
@@ -2,6 +2,8 @@
 #define FORTEAN_HASH_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include "fortean_semhash.h"
 
 #define HASH_TABLE_SIZE 1024
 
@@ -23,10 +25,21 @@ typedef struct HashEntry {
     struct HashEntry *next;
 } HashEntry;
 
+//Starting value for the chained FNV-1a string hash
+#define FNV_SEED 2166136261u
+
 // Hash functions
 unsigned int hash_file_fnv1a(const char *filename);
+unsigned int hash_str_fnv1a(const char *str, unsigned int hash);
 unsigned int str_hash(const char *str);
 
+//64-bit FNV-1a for content addressed keys, where 32 bits would collide
+#define FNV64_SEED 14695981039346656037ull
+unsigned long long hash_bytes_fnv1a64(const void *data, size_t len, unsigned long long hash);
+
+//Continue a 64-bit hash over the contents of a file. Returns -1 if it can't be read.
+int hash_file_fnv1a64(const char *filename, unsigned long long *hash);
+
 // Node creation
 DependentNode *new_dependent_node(const char *dependent);
 FileNode *new_file_node(const char *filename);
@@ -40,6 +53,12 @@ void add_dependent(FileNode *file, const char *dependent);
 void parse_line(char *line, FileNode *hash_table[]);
 int parse_dependency_file(const char *filename, FileNode *hash_table[]);
 
+//parse_dependency_file where the files in known keep that hash instead of being read and
+//the others are hashed with fortean_semhash_file and their flags in semhash, NULL for
+//their bytes
+int parse_dependency_file_known(const char *filename, FileNode *hash_table[], HashEntry *known[],
+                                const fortean_semhash_build_t *semhash);
+
 // Hashtable operations
 void print_hashtable(FileNode *hash_table[]);
 void free_all(FileNode *hash_table[]);
@@ -55,6 +74,10 @@ void prune_unchanged_files(FileNode *hash_table[], HashEntry *prev_hash_table[])
 void prune_obsolete_cached_entries(HashEntry *prev_hash_table[], FileNode *hash_table[]);
 void free_prev_hash_table(HashEntry *prev_hash_table[]);
 
+// HashEntry tables double as string -> int maps
+void hash_entry_put(HashEntry *table[], const char *filename, unsigned int value);
+HashEntry *hash_entry_get(HashEntry *table[], const char *filename);
+
 // Dependency checking
 DependentNode* get_dependents_if_changed(const char *filename, FileNode *hash_table[], HashEntry *prev_hash_table[]);
 
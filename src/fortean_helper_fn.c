@@ -14,4 +14,52 @@ void print_error(const char *msg) {
 
 void print_test(const char *msg) {
     printf("%s[TEST]%s  %s\n", COLOR_BLUE, COLOR_RESET, msg);
-}
\ No newline at end of file
+}
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+double fortean_wall_time(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+int fortean_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+char *fortean_absolute_path(const char *path) {
+#ifdef _WIN32
+    char full[MAX_PATH];
+    DWORD len = GetFullPathNameA(path, sizeof(full), full, NULL);
+    if (len == 0 || len >= sizeof(full)) return NULL;
+    return strdup(full);
+#else
+    if (path[0] == '/') return strdup(path);
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return NULL;
+    size_t len = strlen(cwd) + strlen(path) + 2;
+    char *full = malloc(len);
+    if (full) snprintf(full, len, "%s/%s", cwd, path);
+    return full;
+#endif
+}
@@ -16,4 +16,13 @@ void print_info(const char *msg);
 void print_error(const char *msg);
 void print_test(const char *msg);
 
+//Monotonic wall clock in seconds, for timing build steps
+double fortean_wall_time(void);
+
+//Number of online processors, at least 1
+int fortean_cpu_count(void);
+
+//Absolute version of a path relative to the project root (caller must free)
+char *fortean_absolute_path(const char *path);
+
 #endif
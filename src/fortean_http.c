@@ -0,0 +1,159 @@
+#include "fortean_http.h"
+#include "fortean_net.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+int fortean_url_parse(const char *url, fortean_url_t *out) {
+    if (strncmp(url, "http://", 7) != 0) return -1;
+    const char *host = url + 7;
+    const char *path = strchr(host, '/');
+    size_t host_len  = path ? (size_t)(path - host) : strlen(host);
+    if (host_len == 0 || host_len >= sizeof(out->address) - 6) return -1;
+
+    //A port is the part after the last colon, unless that is inside [ipv6].
+    const char *colon = NULL;
+    for (const char *p = host; p < host + host_len; p++) {
+        if (*p == ':') colon = p;
+        if (*p == ']') colon = NULL;
+    }
+    if (colon) snprintf(out->address, sizeof(out->address), "%.*s", (int)host_len, host);
+    else       snprintf(out->address, sizeof(out->address), "%.*s:80", (int)host_len, host);
+
+    snprintf(out->prefix, sizeof(out->prefix), "%s", path ? path : "");
+    size_t len = strlen(out->prefix);
+    while (len > 0 && out->prefix[len - 1] == '/') out->prefix[--len] = '\0';
+    return 0;
+}
+
+//Read the headers up to the blank line, returning Content-Length (-1 when absent)
+static long read_headers(fortean_socket_t sock, int *failed) {
+    long length = -1;
+    char line[1024];
+    for (;;) {
+        int n = fortean_net_recv_line(sock, line, sizeof(line));
+        if (n <= 0) {
+            *failed = 1;
+            return -1;
+        }
+        if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) return length;
+        char name[32];
+        size_t i = 0;
+        while (line[i] && line[i] != ':' && i < sizeof(name) - 1) {
+            name[i] = (char)tolower((unsigned char)line[i]);
+            i++;
+        }
+        name[i] = '\0';
+        if (line[i] == ':' && strcmp(name, "content-length") == 0) length = strtol(line + i + 1, NULL, 10);
+    }
+}
+
+int fortean_http_request(const fortean_url_t *url, const char *method, const char *path,
+                         const char *body, size_t body_len, int timeout_ms,
+                         char **response, size_t *response_len) {
+    if (response) *response = NULL;
+    if (response_len) *response_len = 0;
+    fortean_socket_t sock = fortean_net_connect(url->address, timeout_ms);
+    if (sock == FORTEAN_NO_SOCKET) return -1;
+
+    char head[1400];
+    int n = snprintf(head, sizeof(head),
+                     "%s %s%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                     method, url->prefix, path, url->address, (unsigned long)body_len);
+    int status = -1;
+    char line[256];
+    if (n > 0 && n < (int)sizeof(head) && fortean_net_send_all(sock, head, (size_t)n) == 0 &&
+        (body_len == 0 || fortean_net_send_all(sock, body, body_len) == 0) &&
+        fortean_net_recv_line(sock, line, sizeof(line)) > 0 && sscanf(line, "HTTP/%*s %d", &status) == 1) {
+        int failed = 0;
+        long length = read_headers(sock, &failed);
+        //HEAD answers and bodies nobody asked for are not read.
+        if (failed) {
+            status = -1;
+        } else if (response && length > 0 && strcmp(method, "HEAD") != 0) {
+            *response = malloc((size_t)length + 1);
+            if (!*response || fortean_net_recv_all(sock, *response, (size_t)length) != 0) {
+                free(*response);
+                *response = NULL;
+                status = -1;
+            } else {
+                (*response)[length] = '\0';
+                if (response_len) *response_len = (size_t)length;
+            }
+        }
+    } else {
+        status = -1;
+    }
+    fortean_net_close(sock);
+    return status;
+}
+
+static const char *reason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    default:  return "Internal Server Error";
+    }
+}
+
+//The status line and headers, then the body unless the request was a HEAD
+static void answer(fortean_socket_t sock, int status, const char *body, size_t len, int send_body) {
+    char head[256];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                     status, reason(status), (unsigned long)len);
+    if (fortean_net_send_all(sock, head, (size_t)n) == 0 && send_body && len > 0) fortean_net_send_all(sock, body, len);
+}
+
+int fortean_http_serve(const char *address, size_t max_body, fortean_http_handler_t handler, void *data) {
+    fortean_socket_t server = fortean_net_listen(address);
+    if (server == FORTEAN_NO_SOCKET) return -1;
+
+    for (;;) {
+        //A client that stops sending is dropped after 10 s so it can't hold up the others.
+        fortean_socket_t sock = fortean_net_accept(server, 10000);
+        if (sock == FORTEAN_NO_SOCKET) continue;
+
+        fortean_http_req_t req;
+        memset(&req, 0, sizeof(req));
+        char line[700];
+        int failed = 0;
+        if (fortean_net_recv_line(sock, line, sizeof(line)) <= 0 ||
+            sscanf(line, "%15s %511s", req.method, req.path) != 2) {
+            fortean_net_close(sock);
+            continue;
+        }
+        long length = read_headers(sock, &failed);
+        if (failed) {
+            fortean_net_close(sock);
+            continue;
+        }
+        if (length > 0 && (size_t)length > max_body) {
+            answer(sock, 413, NULL, 0, 0);
+            fortean_net_close(sock);
+            continue;
+        }
+        if (length > 0) {
+            req.body = malloc((size_t)length);
+            if (!req.body || fortean_net_recv_all(sock, req.body, (size_t)length) != 0) {
+                free(req.body);
+                fortean_net_close(sock);
+                continue;
+            }
+            req.body_len = (size_t)length;
+        }
+
+        char *body = NULL;
+        size_t len = 0;
+        int status = handler(&req, &body, &len, data);
+        answer(sock, status, body, len, strcmp(req.method, "HEAD") != 0);
+        free(body);
+        free(req.body);
+        fortean_net_close(sock);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef FORTEAN_HTTP_H
+#define FORTEAN_HTTP_H
+
+#include <stddef.h>
+
+//Just enough HTTP/1.1 for the remote build cache: one request per connection,
+//bodies with a Content-Length.
+
+//http://host:port/prefix split up
+typedef struct {
+    char address[300];   // host:port for fortean_net_connect
+    char prefix[512];    // Path the request paths are appended to, without a trailing /
+} fortean_url_t;
+
+//Parse an http:// URL (the port defaults to 80). Returns 0 on success.
+int fortean_url_parse(const char *url, fortean_url_t *out);
+
+//Send method url->prefix + path with body. Returns the status code, or -1 when the
+//server can't be reached or doesn't answer within timeout_ms. The response body is
+//returned in response when it is not NULL (caller must free).
+int fortean_http_request(const fortean_url_t *url, const char *method, const char *path,
+                         const char *body, size_t body_len, int timeout_ms,
+                         char **response, size_t *response_len);
+
+//One request received by fortean_http_serve
+typedef struct {
+    char method[16];
+    char path[512];
+    char *body;
+    size_t body_len;
+} fortean_http_req_t;
+
+//Answer a request: return the status code and, optionally, a body (freed by the server).
+typedef int (*fortean_http_handler_t)(const fortean_http_req_t *req, char **body, size_t *len, void *data);
+
+//Serve requests on address ("host:port") one at a time until the process is stopped.
+//Bodies above max_body are refused. Returns -1 if it can't listen.
+int fortean_http_serve(const char *address, size_t max_body, fortean_http_handler_t handler, void *data);
+
+#endif // FORTEAN_HTTP_H
@@ -156,8 +156,37 @@ static const char* dictionary[MAX_WORDS] = {"new",
                                             "--bin",
                                             "--rebuild",
                                             "-r",
-                                            "-j"};
-static const int dictSize = 8;
+                                            "-j",
+                                            "--profile",
+                                            "--unity",
+                                            "pgo",
+                                            "--use",
+                                            "tune",
+                                            "compare",
+                                            "--compilers",
+                                            "cache",
+                                            "stats",
+                                            "cache-server",
+                                            "--listen",
+                                            "--dir",
+                                            "worker",
+                                            "--jobs",
+                                            "--compiler",
+                                            "daemon",
+                                            "start",
+                                            "stop",
+                                            "status",
+                                            "watch",
+                                            "--run",
+                                            "gen",
+                                            "ninja",
+                                            "make",
+                                            "--out",
+                                            "--trace",
+                                            "--builds",
+                                            "--explain",
+                                            "--dry-run"};
+static const int dictSize = 37;
 
 void loadDictionary(TrieNode *root) {
     for(int i = 0; i < dictSize; i++) {
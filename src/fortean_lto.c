@@ -0,0 +1,141 @@
+#include "fortean_lto.h"
+#include "fortean_cmd.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+//File name part of a path
+static const char *base_name(const char *path) {
+    const char *name = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    return name;
+}
+
+//The tool installed next to the compiler with the same prefix and suffix, e.g.
+//x86_64-linux-gnu-gfortran-12 gives x86_64-linux-gnu-gcc-ar-12 (caller must free).
+static char *sibling_tool(const char *compiler, const char *name, const char *tool) {
+    const char *at = strstr(base_name(compiler), name);
+    if (!at) return strdup(tool);
+    size_t len = strlen(compiler) - strlen(name) + strlen(tool) + 1;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%.*s%s%s", (int)(at - compiler), compiler, tool, at + strlen(name));
+    return path;
+}
+
+//Append a printf formatted entry to a NULL-terminated list
+static int list_addf(char ***list, const char *fmt, ...) {
+    int count = 0;
+    while (*list && (*list)[count]) count++;
+    char **grown = realloc(*list, (count + 2) * sizeof(char *));
+    if (!grown) return -1;
+    *list = grown;
+
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    (*list)[count]     = strdup(buf);
+    (*list)[count + 1] = NULL;
+    return (*list)[count] ? 0 : -1;
+}
+
+//Major version from "<compiler> -dumpversion", 0 when unknown
+static int gnu_major_version(const char *compiler) {
+    fortean_cmd_t cmd;
+    fortean_cmd_init(&cmd, compiler);
+    fortean_cmd_add(&cmd, "-dumpversion");
+    char *out = fortean_cmd_capture(&cmd);
+    fortean_cmd_free(&cmd);
+    int major = out ? atoi(out) : 0;
+    free(out);
+    return major;
+}
+
+int fortean_lto_setup(const char *mode, const char *compiler, const char *linker, int jobs,
+                      const char *cache_dir, fortean_lto_t *lto) {
+    memset(lto, 0, sizeof(*lto));
+    if (!mode || strcmp(mode, "off") == 0) return 0;
+
+    int thin = strcmp(mode, "thin") == 0;
+    if (!thin && strcmp(mode, "full") != 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Unknown lto mode %s, use thin, full or off.", mode);
+        print_error(msg);
+        return -1;
+    }
+    if (jobs < 1) jobs = 1;
+
+    int res = 0;
+    switch (fortean_compiler_family(compiler)) {
+    case FORTEAN_CC_GNU:
+        //GCC has no thin LTO. Thin splits the program into balanced partitions that are
+        //compiled by jobs processes, full compiles it as one partition.
+        res |= list_addf(&lto->compile, "-flto");
+        if (thin) {
+            res |= list_addf(&lto->link, "-flto=%d", jobs);
+            //GCC 15 can keep the code of partitions that did not change.
+            if (gnu_major_version(compiler) >= 15) res |= list_addf(&lto->link, "-flto-incremental=%s", cache_dir);
+        } else {
+            res |= list_addf(&lto->link, "-flto");
+            res |= list_addf(&lto->link, "-flto-partition=one");
+        }
+        lto->archiver = sibling_tool(compiler, "gfortran", "gcc-ar");
+        break;
+
+    case FORTEAN_CC_LLVM:
+        res |= list_addf(&lto->compile, "-flto=%s", mode);
+        res |= list_addf(&lto->link, "-flto=%s", mode);
+        if (thin && linker && strcmp(linker, "lld") == 0) {
+            res |= list_addf(&lto->link, "-Wl,--thinlto-jobs=%d", jobs);
+            res |= list_addf(&lto->link, "-Wl,--thinlto-cache-dir=%s", cache_dir);
+        } else if (thin) {
+            //The LLVM plugin of ld.bfd, gold and mold.
+            res |= list_addf(&lto->link, "-Wl,-plugin-opt,jobs=%d", jobs);
+            res |= list_addf(&lto->link, "-Wl,-plugin-opt,cache-dir=%s", cache_dir);
+        }
+        lto->archiver = strstr(base_name(compiler), "flang") ? sibling_tool(compiler, "flang", "llvm-ar")
+                                                             : strdup("llvm-ar");
+        break;
+
+    case FORTEAN_CC_IFORT:
+        res |= list_addf(&lto->compile, "-ipo");
+        res |= list_addf(&lto->link, "-ipo");
+        if (thin) res |= list_addf(&lto->link, "-ipo-jobs%d", jobs);
+        lto->archiver = strdup("xiar");
+        break;
+
+    default: {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Don't know how to enable LTO for %s.", compiler);
+        print_error(msg);
+        return -1;
+    }
+    }
+
+    if (res != 0 || !lto->archiver) {
+        print_error("Memory allocation error for the LTO flags.");
+        fortean_lto_free(lto);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_null_list(char **list) {
+    if (!list) return;
+    for (int i = 0; list[i]; i++) free(list[i]);
+    free(list);
+}
+
+void fortean_lto_free(fortean_lto_t *lto) {
+    if (!lto) return;
+    free_null_list(lto->compile);
+    free_null_list(lto->link);
+    free(lto->archiver);
+    memset(lto, 0, sizeof(*lto));
+}
@@ -0,0 +1,22 @@
+#ifndef FORTEAN_LTO_H
+#define FORTEAN_LTO_H
+
+#include "fortean_compiler.h"
+
+//Options for one build.lto setting.
+typedef struct {
+    char **compile;     // Added to the compile flags (NULL-terminated)
+    char **link;        // Added to the link step only (NULL-terminated)
+    char *archiver;     // ar that understands the compiler's IR objects
+} fortean_lto_t;
+
+//Work out the options for lto = "thin" or "full" ("off" leaves lto empty). jobs is the
+//number of parallel code generation partitions at link time and cache_dir keeps the
+//results of unchanged partitions where the toolchain can reuse them.
+//Returns 0 on success, -1 for an unknown mode or compiler.
+int fortean_lto_setup(const char *mode, const char *compiler, const char *linker, int jobs,
+                      const char *cache_dir, fortean_lto_t *lto);
+
+void fortean_lto_free(fortean_lto_t *lto);
+
+#endif // FORTEAN_LTO_H
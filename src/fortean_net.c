@@ -0,0 +1,245 @@
+#include "fortean_net.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int socklen_t;
+#define SOCK(s) ((SOCKET)(s))
+#define CLOSE_SOCKET closesocket
+#define SEND_FLAGS 0
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#define SOCK(s) ((int)(s))
+#define CLOSE_SOCKET close
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+static int net_start(void) {
+#ifdef _WIN32
+    static int started = 0;
+    if (!started) {
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return -1;
+        started = 1;
+    }
+#elif !defined(MSG_NOSIGNAL)
+    //A peer that goes away must fail the send, not stop the process.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    return 0;
+}
+
+void fortean_net_set_timeout(fortean_socket_t sock, int timeout_ms) {
+    if (timeout_ms < 0) return;
+#ifdef _WIN32
+    DWORD tv = (DWORD)timeout_ms;
+#else
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+#endif
+    setsockopt(SOCK(sock), SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv));
+    setsockopt(SOCK(sock), SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof(tv));
+}
+
+//Split "host:port" (the last colon, so "[::1]:80" style hosts are left alone)
+static int split_address(const char *address, char *host, size_t size, char *port, size_t port_size) {
+    const char *colon = strrchr(address, ':');
+    if (!colon || colon[1] == '\0') return -1;
+    size_t len = (size_t)(colon - address);
+    if (len >= size) return -1;
+    memcpy(host, address, len);
+    host[len] = '\0';
+    if (host[0] == '[' && len > 1 && host[len - 1] == ']') {
+        memmove(host, host + 1, len - 2);
+        host[len - 2] = '\0';
+    }
+    snprintf(port, port_size, "%s", colon + 1);
+    return 0;
+}
+
+#ifndef _WIN32
+static fortean_socket_t unix_socket(const char *path, int listening) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return FORTEAN_NO_SOCKET;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return FORTEAN_NO_SOCKET;
+    int ok;
+    if (listening) {
+        unlink(path);
+        ok = bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(sock, 64) == 0;
+    } else {
+        ok = connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!ok) {
+        close(sock);
+        return FORTEAN_NO_SOCKET;
+    }
+    return sock;
+}
+#endif
+
+//connect() that gives up after timeout_ms
+static int connect_within(fortean_socket_t sock, const struct sockaddr *addr, socklen_t len, int timeout_ms) {
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    ioctlsocket(SOCK(sock), FIONBIO, &nonblocking);
+    int res = connect(SOCK(sock), addr, len);
+    int pending = res != 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    int flags = fcntl(SOCK(sock), F_GETFL, 0);
+    fcntl(SOCK(sock), F_SETFL, flags | O_NONBLOCK);
+    int res = connect(SOCK(sock), addr, len);
+    int pending = res != 0 && errno == EINPROGRESS;
+#endif
+    if (res != 0 && !pending) return -1;
+    if (pending) {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(SOCK(sock), &writable);
+        struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        if (select((int)sock + 1, NULL, &writable, NULL, &tv) != 1) return -1;
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(SOCK(sock), SOL_SOCKET, SO_ERROR, (char *)&err, &err_len);
+        if (err != 0) return -1;
+    }
+#ifdef _WIN32
+    nonblocking = 0;
+    ioctlsocket(SOCK(sock), FIONBIO, &nonblocking);
+#else
+    fcntl(SOCK(sock), F_SETFL, flags);
+#endif
+    return 0;
+}
+
+fortean_socket_t fortean_net_connect(const char *address, int timeout_ms) {
+    if (net_start() != 0) return FORTEAN_NO_SOCKET;
+    if (strncmp(address, "unix:", 5) == 0) {
+#ifdef _WIN32
+        return FORTEAN_NO_SOCKET;
+#else
+        fortean_socket_t sock = unix_socket(address + 5, 0);
+        if (sock != FORTEAN_NO_SOCKET) fortean_net_set_timeout(sock, timeout_ms);
+        return sock;
+#endif
+    }
+
+    char host[256], port[16];
+    if (split_address(address, host, sizeof(host), port, sizeof(port)) != 0) return FORTEAN_NO_SOCKET;
+    struct addrinfo hints, *found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host[0] ? host : "localhost", port, &hints, &found) != 0) return FORTEAN_NO_SOCKET;
+
+    fortean_socket_t sock = FORTEAN_NO_SOCKET;
+    for (struct addrinfo *ai = found; ai && sock == FORTEAN_NO_SOCKET; ai = ai->ai_next) {
+        sock = (fortean_socket_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock == FORTEAN_NO_SOCKET) continue;
+        if (connect_within(sock, ai->ai_addr, (socklen_t)ai->ai_addrlen, timeout_ms) != 0) {
+            CLOSE_SOCKET(SOCK(sock));
+            sock = FORTEAN_NO_SOCKET;
+        }
+    }
+    freeaddrinfo(found);
+    if (sock != FORTEAN_NO_SOCKET) fortean_net_set_timeout(sock, timeout_ms);
+    return sock;
+}
+
+fortean_socket_t fortean_net_listen(const char *address) {
+    if (net_start() != 0) return FORTEAN_NO_SOCKET;
+    if (strncmp(address, "unix:", 5) == 0) {
+#ifdef _WIN32
+        return FORTEAN_NO_SOCKET;
+#else
+        return unix_socket(address + 5, 1);
+#endif
+    }
+
+    char host[256], port[16];
+    if (split_address(address, host, sizeof(host), port, sizeof(port)) != 0) return FORTEAN_NO_SOCKET;
+    struct addrinfo hints, *found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &found) != 0) return FORTEAN_NO_SOCKET;
+
+    fortean_socket_t sock = FORTEAN_NO_SOCKET;
+    for (struct addrinfo *ai = found; ai && sock == FORTEAN_NO_SOCKET; ai = ai->ai_next) {
+        sock = (fortean_socket_t)socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock == FORTEAN_NO_SOCKET) continue;
+        int yes = 1;
+        setsockopt(SOCK(sock), SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+        if (bind(SOCK(sock), ai->ai_addr, (socklen_t)ai->ai_addrlen) != 0 || listen(SOCK(sock), 64) != 0) {
+            CLOSE_SOCKET(SOCK(sock));
+            sock = FORTEAN_NO_SOCKET;
+        }
+    }
+    freeaddrinfo(found);
+    return sock;
+}
+
+fortean_socket_t fortean_net_accept(fortean_socket_t server, int timeout_ms) {
+    fortean_socket_t sock = (fortean_socket_t)accept(SOCK(server), NULL, NULL);
+    if (sock != FORTEAN_NO_SOCKET) fortean_net_set_timeout(sock, timeout_ms);
+    return sock;
+}
+
+int fortean_net_send_all(fortean_socket_t sock, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        int chunk = len > 1 << 20 ? 1 << 20 : (int)len;
+        int n = (int)send(SOCK(sock), p, chunk, SEND_FLAGS);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int fortean_net_recv_all(fortean_socket_t sock, void *data, size_t len) {
+    char *p = (char *)data;
+    while (len > 0) {
+        int chunk = len > 1 << 20 ? 1 << 20 : (int)len;
+        int n = (int)recv(SOCK(sock), p, chunk, 0);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int fortean_net_recv_line(fortean_socket_t sock, char *buf, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        char c;
+        if (recv(SOCK(sock), &c, 1, 0) != 1) return -1;
+        buf[len++] = c;
+        if (c == '\n') break;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+void fortean_net_close(fortean_socket_t sock) {
+    if (sock != FORTEAN_NO_SOCKET) CLOSE_SOCKET(SOCK(sock));
+}
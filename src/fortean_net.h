@@ -0,0 +1,33 @@
+#ifndef FORTEAN_NET_H
+#define FORTEAN_NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//A socket handle on every platform (a SOCKET on Windows), -1 when there is none.
+typedef intptr_t fortean_socket_t;
+#define FORTEAN_NO_SOCKET ((fortean_socket_t)-1)
+
+//Connect to "host:port", or "unix:/path" for a Unix domain socket, giving up after
+//timeout_ms. Sends and receives on the socket time out after the same time.
+fortean_socket_t fortean_net_connect(const char *address, int timeout_ms);
+
+//Listen on "host:port" (":port" for every interface) or "unix:/path".
+fortean_socket_t fortean_net_listen(const char *address);
+
+//Wait for the next connection. Its sends and receives time out after timeout_ms.
+fortean_socket_t fortean_net_accept(fortean_socket_t server, int timeout_ms);
+
+//Sends and receives on sock give up after timeout_ms (0 waits forever).
+void fortean_net_set_timeout(fortean_socket_t sock, int timeout_ms);
+
+//Send or receive exactly len bytes. Returns 0 on success, -1 on an error or timeout.
+int fortean_net_send_all(fortean_socket_t sock, const void *data, size_t len);
+int fortean_net_recv_all(fortean_socket_t sock, void *data, size_t len);
+
+//Receive up to size - 1 bytes, stopping after a '\n'. Returns the length, -1 on an error.
+int fortean_net_recv_line(fortean_socket_t sock, char *buf, size_t size);
+
+void fortean_net_close(fortean_socket_t sock);
+
+#endif // FORTEAN_NET_H
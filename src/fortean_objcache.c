@@ -0,0 +1,76 @@
+#include "fortean_objcache.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void fortean_file_signature(const char *path, char *sig, size_t size) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        snprintf(sig, size, "missing");
+        return;
+    }
+    long nsec = 0;
+#if defined(__APPLE__)
+    nsec = st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    nsec = st.st_mtim.tv_nsec;
+#endif
+    snprintf(sig, size, "%lld.%09ld:%lld", (long long)st.st_mtime, nsec, (long long)st.st_size);
+}
+
+//One "<signature hash> <content hash> <path>" line per object
+void fortean_objcache_load(fortean_objcache_t *cache, const char *filename) {
+    memset(cache, 0, sizeof(*cache));
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return;
+
+    char line[2048];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        unsigned int sig, hash;
+        int offset = 0;
+        if (sscanf(line, "%u %u %n", &sig, &hash, &offset) != 2 || offset == 0) continue;
+        hash_entry_put(cache->sig, line + offset, sig);
+        hash_entry_put(cache->hash, line + offset, hash);
+    }
+    fclose(fp);
+}
+
+unsigned int fortean_objcache_hash(fortean_objcache_t *cache, const char *path) {
+    char sig_str[64];
+    fortean_file_signature(path, sig_str, sizeof(sig_str));
+    unsigned int sig = hash_str_fnv1a(sig_str, FNV_SEED);
+
+    HashEntry *prev_sig  = hash_entry_get(cache->sig, path);
+    HashEntry *prev_hash = hash_entry_get(cache->hash, path);
+    if (prev_sig && prev_hash && prev_sig->file_hash == sig) return prev_hash->file_hash;
+
+    unsigned int hash = hash_file_fnv1a(path);
+    hash_entry_put(cache->sig, path, sig);
+    hash_entry_put(cache->hash, path, hash);
+    return hash;
+}
+
+int fortean_objcache_save(fortean_objcache_t *cache, const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        print_error("Failed to save the object hashes.");
+        return -1;
+    }
+    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+        for (HashEntry *entry = cache->sig[i]; entry; entry = entry->next) {
+            HashEntry *hash = hash_entry_get(cache->hash, entry->filename);
+            if (hash) fprintf(fp, "%u %u %s\n", entry->file_hash, hash->file_hash, entry->filename);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+void fortean_objcache_free(fortean_objcache_t *cache) {
+    free_prev_hash_table(cache->sig);
+    free_prev_hash_table(cache->hash);
+}
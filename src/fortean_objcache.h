@@ -0,0 +1,27 @@
+#ifndef FORTEAN_OBJCACHE_H
+#define FORTEAN_OBJCACHE_H
+
+#include <stddef.h>
+#include "fortean_hash.h"
+
+//Content hashes of the object files, so deciding whether an executable has to be
+//relinked only reads the objects whose size or modification time changed.
+typedef struct {
+    HashEntry *sig[HASH_TABLE_SIZE];    // Object path -> hash of its size and mtime
+    HashEntry *hash[HASH_TABLE_SIZE];   // Object path -> hash of its contents
+} fortean_objcache_t;
+
+//Size and modification time of a file (with nanoseconds where available), "missing" if absent
+void fortean_file_signature(const char *path, char *sig, size_t size);
+
+//Load the cache saved by fortean_objcache_save (a missing file is an empty cache)
+void fortean_objcache_load(fortean_objcache_t *cache, const char *filename);
+
+//Content hash of an object, re-read only when its signature changed. 0 if it is missing.
+unsigned int fortean_objcache_hash(fortean_objcache_t *cache, const char *path);
+
+int fortean_objcache_save(fortean_objcache_t *cache, const char *filename);
+
+void fortean_objcache_free(fortean_objcache_t *cache);
+
+#endif // FORTEAN_OBJCACHE_H
@@ -0,0 +1,440 @@
+#include "fortean_pgo.h"
+#include "fortean_toml.h"
+#include "fortean_cmd.h"
+#include "fortean_hash.h"
+#include "fortean_lto.h"
+#include "fortean_threads.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#define PATH_SEP '\\'
+#define MAKE_DIR(path) _mkdir(path)
+#else
+#include <dirent.h>
+#define PATH_SEP '/'
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+//Record tags of a .gcda file
+#define GCOV_DATA_MAGIC   0x67636461u
+#define GCOV_TAG_FUNCTION 0x01000000u
+#define GCOV_TAG_ARCS     0x01a10000u
+
+//Files the instrumented programs write: gfortran .gcda, flang .profraw (merged into
+//.profdata) and ifort .dyn (merged into .dpi by the compiler).
+static const char *profile_exts[] = {".gcda", ".profraw", ".profdata", ".dyn", ".dpi", NULL};
+
+static int ends_with(const char *str, const char *suffix) {
+    size_t n = strlen(str), m = strlen(suffix);
+    return n >= m && strcmp(str + n - m, suffix) == 0;
+}
+
+static int is_profile_file(const char *name) {
+    for (int i = 0; profile_exts[i]; i++) {
+        if (ends_with(name, profile_exts[i])) return 1;
+    }
+    return 0;
+}
+
+typedef void (*profile_file_fn)(const char *path, void *arg);
+
+//Call fn for every profile data file directly in dir
+static void for_each_profile_file(const char *dir, profile_file_fn fn, void *arg) {
+    char path[1024];
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return;
+    do {
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || !is_profile_file(fd.cFileName)) continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, fd.cFileName);
+        fn(path, arg);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!is_profile_file(entry->d_name)) continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, entry->d_name);
+        fn(path, arg);
+    }
+    closedir(d);
+#endif
+}
+
+static void remove_profile_file(const char *path, void *arg) {
+    (void)arg;
+    remove(path);
+}
+
+static void add_profraw(const char *path, void *arg) {
+    if (ends_with(path, ".profraw")) fortean_cmd_add((fortean_cmd_t *)arg, path);
+}
+
+//Whole file in memory (caller must free), NULL when it cannot be read
+static unsigned char *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = len > 0 ? malloc((size_t)len) : NULL;
+    if (data && fread(data, 1, (size_t)len, fp) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (data) *size = (size_t)len;
+    return data;
+}
+
+static int copy_file(const char *src, const char *dest) {
+    size_t size = 0;
+    unsigned char *data = read_file(src, &size);
+    if (!data) return -1;
+    FILE *fp = fopen(dest, "wb");
+    int ok   = fp && fwrite(data, 1, size, fp) == size;
+    if (fp && fclose(fp) != 0) ok = 0;
+    free(data);
+    return ok ? 0 : -1;
+}
+
+typedef struct {
+    int files;
+    int functions;
+    int covered;     // Functions the training runs executed
+} pgo_coverage_t;
+
+static unsigned int read_u32(const unsigned char *p) {
+    return (unsigned int)p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+//Count the functions of one .gcda file and the ones with a non zero arc counter.
+static void count_gcda(const char *path, void *arg) {
+    pgo_coverage_t *cov = (pgo_coverage_t *)arg;
+    if (!ends_with(path, ".gcda")) return;
+    size_t size = 0;
+    unsigned char *data = read_file(path, &size);
+    if (!data) return;
+    if (size < 16 || read_u32(data) != GCOV_DATA_MAGIC) {
+        free(data);
+        return;
+    }
+
+    //The version reads like "B22*" for 12.2. GCC 12 added a checksum to the header
+    //and counts record lengths in bytes instead of words.
+    unsigned int version = read_u32(data + 4);
+    int v0    = (version >> 24) & 0xff;
+    int v1    = (version >> 16) & 0xff;
+    int major = v0 >= 'A' ? (v0 - 'A') * 10 + (v1 - '0') : v0 - '0';
+    int unit  = major >= 12 ? 1 : 4;
+    size_t pos  = major >= 12 ? 16 : 12;
+    int counted = 1;
+    while (pos + 8 <= size) {
+        unsigned int tag = read_u32(data + pos);
+        int len          = (int)read_u32(data + pos + 4);
+        pos += 8;
+        if (tag == 0) break;
+
+        //Counters that are all zero are written as a negative length without data.
+        size_t len_bytes = len > 0 ? (size_t)len * unit : 0;
+        if (pos + len_bytes > size) break;
+        if (tag == GCOV_TAG_FUNCTION && len > 0) {
+            cov->functions++;
+            counted = 0;
+        } else if (tag == GCOV_TAG_ARCS && !counted) {
+            for (size_t k = 0; k < len_bytes; k++) {
+                if (data[pos + k] == 0) continue;
+                cov->covered++;
+                counted = 1;
+                break;
+            }
+        }
+        pos += len_bytes;
+    }
+    cov->files++;
+    free(data);
+}
+
+//Functions in a merged .profdata file and the ones the training runs executed
+static int count_profdata(const char *profdata, pgo_coverage_t *cov) {
+    fortean_cmd_t cmd;
+    fortean_cmd_init(&cmd, "llvm-profdata");
+    fortean_cmd_add(&cmd, "show");
+    fortean_cmd_add(&cmd, "--all-functions");
+    fortean_cmd_add(&cmd, profdata);
+    char *out = fortean_cmd_capture(&cmd);
+    fortean_cmd_free(&cmd);
+    if (!out) return -1;
+
+    const char *key = "Function count: ";
+    for (char *p = strstr(out, key); p; p = strstr(p + 1, key)) {
+        cov->functions++;
+        if (strtoull(p + strlen(key), NULL, 10) > 0) cov->covered++;
+    }
+    cov->files = 1;
+    free(out);
+    return 0;
+}
+
+//One [pgo] train command, run through the shell so redirections and arguments work.
+typedef struct {
+    const char *command;
+    double seconds;
+    int status;
+} train_job_t;
+
+static void train_worker(void *arg) {
+    train_job_t *job = (train_job_t *)arg;
+    fortean_cmd_t cmd;
+    fortean_cmd_init_shell(&cmd, job->command);
+    double start = fortean_wall_time();
+    job->status  = fortean_cmd_run(&cmd);
+    job->seconds = fortean_wall_time() - start;
+    fortean_cmd_free(&cmd);
+}
+
+//Run the training commands, all at once when they are independent. The profiling
+//runtime of every compiler merges the counters of runs that finish at the same time.
+static int run_training(char **train, int parallel) {
+    int count = 0;
+    while (train[count]) count++;
+    train_job_t *jobs  = calloc(count > 0 ? count : 1, sizeof(train_job_t));
+    thread_t *threads  = calloc(count > 0 ? count : 1, sizeof(thread_t));
+    unsigned char *started = calloc(count > 0 ? count : 1, 1);
+    if (!jobs || !threads || !started) {
+        print_error("Memory allocation error for the training runs.");
+        free(jobs);
+        free(threads);
+        free(started);
+        return -1;
+    }
+
+    double start = fortean_wall_time();
+    for (int i = 0; i < count; i++) {
+        jobs[i].command = train[i];
+        char msg[1024];
+        snprintf(msg, sizeof(msg), "Training: %s", train[i]);
+        print_info(msg);
+        if (parallel && thread_create(&threads[i], train_worker, &jobs[i]) == 0) {
+            started[i] = 1;
+        } else {
+            train_worker(&jobs[i]);
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (started[i]) thread_join(threads[i]);
+        char msg[1024];
+        if (jobs[i].status != 0) {
+            snprintf(msg, sizeof(msg), "Training run failed (exit code %d): %s", jobs[i].status, train[i]);
+            print_error(msg);
+            failed = 1;
+        } else {
+            snprintf(msg, sizeof(msg), "Training run took %.3f s: %s", jobs[i].seconds, train[i]);
+            print_info(msg);
+        }
+    }
+    if (!failed) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "%d training runs in %.3f s.", count, fortean_wall_time() - start);
+        print_ok(msg);
+    }
+    free(jobs);
+    free(threads);
+    free(started);
+    return failed ? -1 : 0;
+}
+
+//Sources whose content changed since the training runs, or that were not part of them,
+//are optimised without a profile. Compare the state of this build with the one recorded
+//when the profile was taken.
+static void report_stale(const char *hash_file, const char *train_file) {
+    HashEntry *trained[HASH_TABLE_SIZE] = {NULL};
+    HashEntry *current[HASH_TABLE_SIZE] = {NULL};
+    load_prev_hashes(train_file, trained);
+    load_prev_hashes(hash_file, current);
+
+    int total = 0;
+    int stale = 0;
+    char names[1024] = "";
+    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+        for (HashEntry *e = current[i]; e; e = e->next) {
+            total++;
+            HashEntry *t = hash_entry_get(trained, e->filename);
+            if (t && t->file_hash == e->file_hash) continue;
+            if (stale++ < 8) {
+                size_t len = strlen(names);
+                snprintf(names + len, sizeof(names) - len, "%s%s", len ? ", " : "", e->filename);
+            }
+        }
+    }
+
+    char msg[1400];
+    if (stale == 0) {
+        snprintf(msg, sizeof(msg), "Profile is current for all %d sources.", total);
+        print_ok(msg);
+    } else {
+        snprintf(msg, sizeof(msg), "Profile is stale for %d of %d sources (%s%s), run fortean pgo to retrain.",
+                 stale, total, names, stale > 8 ? ", ..." : "");
+        print_info(msg);
+    }
+    free_prev_hash_table(trained);
+    free_prev_hash_table(current);
+}
+
+int fortean_pgo_run(const fortean_build_opts_t *opts, int use_only) {
+    int result     = -1;
+    char **train   = NULL;
+    char *data_dir = NULL;
+
+    fortean_toml_t cfg = {0};
+    if (fortean_toml_load("Fortean.toml", &cfg) != 0) {
+        print_error("Failed to load project.toml.");
+        return -1;
+    }
+
+    const char *compiler = fortean_toml_get_profile_string(&cfg, opts->profile, "compiler");
+    if (!compiler) {
+        print_error("Invalid compiler selected");
+        goto cleanup;
+    }
+    train = fortean_toml_get_array(&cfg, "pgo.train");
+    if (!use_only && !train) {
+        print_error("No training commands, add [pgo] train = [\"./app input\"] to Fortean.toml.");
+        goto cleanup;
+    }
+
+    //The instrumented and the optimised build share the pgo obj/mod directories, so the
+    //profile data is found under the object names it was recorded for.
+    fortean_build_opts_t build = *opts;
+    build.variant = "pgo";
+    char key[256];
+    char state_dir[512];
+    char hash_file[600];
+    char train_file[600];
+    fortean_build_cache_key(&build, key, sizeof(key));
+    snprintf(state_dir, sizeof(state_dir), ".cache%c%s", PATH_SEP, key);
+    snprintf(hash_file, sizeof(hash_file), "%s%chash.dep", state_dir, PATH_SEP);
+    snprintf(train_file, sizeof(train_file), "%s%ctrain.dep", state_dir, PATH_SEP);
+    MAKE_DIR(".cache");
+    MAKE_DIR(state_dir);
+    data_dir = fortean_absolute_path(state_dir);
+    if (!data_dir) {
+        print_error("Failed to resolve the profile directory.");
+        goto cleanup;
+    }
+
+    //Instrumentation and profile use options of the compiler family. A hand written
+    //-fprofile-* in the flags is replaced.
+    char gen_dir[1100], use_dir[1100], profdata[1024];
+    snprintf(profdata, sizeof(profdata), "%s%cfortean.profdata", data_dir, PATH_SEP);
+    char *remove[] = {"-fprofile-*", "-prof-*", NULL};
+    char *generate[4] = {gen_dir, NULL, NULL, NULL};
+    char *use[8]      = {use_dir, NULL};
+    fortean_cc_family_t family = fortean_compiler_family(compiler);
+    switch (family) {
+    case FORTEAN_CC_GNU:
+        snprintf(gen_dir, sizeof(gen_dir), "-fprofile-generate=%s", data_dir);
+        snprintf(use_dir, sizeof(use_dir), "-fprofile-use=%s", data_dir);
+        generate[1] = "-fprofile-update=prefer-atomic";
+        //Code the training did not reach is optimised as usual instead of for size, and
+        //sources edited since the training warn rather than fail.
+        use[1] = "-fprofile-partial-training";
+        use[2] = "-fprofile-correction";
+        use[3] = "-Wno-missing-profile";
+        use[4] = "-Wno-error=coverage-mismatch";
+        break;
+    case FORTEAN_CC_LLVM:
+        snprintf(gen_dir, sizeof(gen_dir), "-fprofile-generate=%s", data_dir);
+        snprintf(use_dir, sizeof(use_dir), "-fprofile-use=%s", profdata);
+        break;
+    case FORTEAN_CC_IFORT:
+        snprintf(gen_dir, sizeof(gen_dir), "-prof-dir=%s", data_dir);
+        snprintf(use_dir, sizeof(use_dir), "-prof-dir=%s", data_dir);
+        generate[1] = "-prof-gen";
+        use[1]      = "-prof-use";
+        break;
+    default: {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "fortean pgo does not know the profile options of %s.", compiler);
+        print_error(msg);
+        goto cleanup;
+    }
+    }
+    build.remove_flags = remove;
+
+    if (!use_only) {
+        //Counters of an older training would be merged into the new ones.
+        for_each_profile_file(state_dir, remove_profile_file, NULL);
+
+        print_info("Building the instrumented executable.");
+        build.add_flags = generate;
+        if (fortean_build_project_incremental(&build) != 0) goto cleanup;
+        if (run_training(train, opts->parallel_build && fortean_toml_get_bool(&cfg, "pgo.parallel", 1)) != 0) {
+            goto cleanup;
+        }
+
+        if (family == FORTEAN_CC_LLVM) {
+            fortean_cmd_t merge;
+            fortean_cmd_init(&merge, "llvm-profdata");
+            fortean_cmd_add(&merge, "merge");
+            fortean_cmd_add(&merge, "-o");
+            fortean_cmd_add(&merge, profdata);
+            for_each_profile_file(state_dir, add_profraw, &merge);
+            int ret = fortean_cmd_run(&merge);
+            fortean_cmd_free(&merge);
+            if (ret != 0) {
+                print_error("Failed to merge the profile data. Check if llvm-profdata is installed.");
+                goto cleanup;
+            }
+        }
+
+        //The source state the profile belongs to, to tell when it goes stale.
+        if (copy_file(hash_file, train_file) != 0) {
+            print_error("Failed to record the state of the trained sources.");
+            goto cleanup;
+        }
+    } else {
+        struct stat st;
+        if (stat(train_file, &st) != 0) {
+            print_error("No profile has been recorded yet, run fortean pgo first.");
+            goto cleanup;
+        }
+    }
+
+    print_info("Building with the profile.");
+    build.add_flags = use;
+    if (fortean_build_project_incremental(&build) != 0) goto cleanup;
+
+    report_stale(hash_file, train_file);
+    pgo_coverage_t cov = {0};
+    if (family == FORTEAN_CC_GNU) for_each_profile_file(state_dir, count_gcda, &cov);
+    if (family == FORTEAN_CC_LLVM) count_profdata(profdata, &cov);
+    if (cov.functions > 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Profile covers %d of %d functions (%.0f%%) in %d profile files.",
+                 cov.covered, cov.functions, 100.0 * cov.covered / cov.functions, cov.files);
+        print_info(msg);
+    }
+    result = 0;
+
+cleanup:
+    for (int i = 0; train && train[i]; i++) free(train[i]);
+    free(train);
+    free(data_dir);
+    fortean_toml_free(&cfg);
+    return result;
+}
@@ -0,0 +1,12 @@
+#ifndef FORTEAN_PGO_H
+#define FORTEAN_PGO_H
+
+#include "fortean_build.h"
+
+//fortean pgo: build an instrumented executable into its own obj/mod directories, run the
+//[pgo] train commands, merge what they record into the profile under .cache/pgo and
+//rebuild with it. With use_only the recorded profile is reused without training again.
+//Returns 0 on success.
+int fortean_pgo_run(const fortean_build_opts_t *opts, int use_only);
+
+#endif // FORTEAN_PGO_H
@@ -0,0 +1,287 @@
+#include "fortean_scratch.h"
+#include "fortean_hash.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#define PATH_SEP '\\'
+#define MAKE_DIR(path) _mkdir(path)
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#define PATH_SEP '/'
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+//One file of the scratch directories and the store entry holding its contents
+typedef struct {
+    char *path;
+    char hash[17];
+    long long mtime;
+    long long size;
+} scratch_file_t;
+
+typedef struct {
+    scratch_file_t *files;
+    int count;
+    int cap;
+} scratch_list_t;
+
+static int list_add(scratch_list_t *list, const char *path, const char *hash, long long mtime, long long size) {
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 64;
+        scratch_file_t *tmp = realloc(list->files, (size_t)cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        list->files = tmp;
+        list->cap   = cap;
+    }
+    scratch_file_t *f = &list->files[list->count];
+    f->path = strdup(path);
+    if (!f->path) return -1;
+    snprintf(f->hash, sizeof(f->hash), "%s", hash);
+    f->mtime = mtime;
+    f->size  = size;
+    list->count++;
+    return 0;
+}
+
+static void list_free(scratch_list_t *list) {
+    for (int i = 0; i < list->count; i++) free(list->files[i].path);
+    free(list->files);
+    memset(list, 0, sizeof(*list));
+}
+
+//Lines of "hash mtime size path". Returns -1 if there is no manifest.
+static int load_manifest(const char *manifest, scratch_list_t *list) {
+    FILE *fp = fopen(manifest, "r");
+    if (!fp) return -1;
+    char line[1400];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char hash[17];
+        long long mtime = 0, size = 0;
+        int used = 0;
+        if (sscanf(line, "%16s %lld %lld %n", hash, &mtime, &size, &used) != 3 || !line[used]) continue;
+        if (list_add(list, line + used, hash, mtime, size) != 0) break;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int fortean_scratch_make_dirs(const char *path) {
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/' && *p != '\\') continue;
+        char sep = *p;
+        *p = '\0';
+        if (p[-1] != ':') MAKE_DIR(dir);
+        *p = sep;
+    }
+    return MAKE_DIR(dir) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+int fortean_scratch_root(const char *scratch, char *buf, size_t size) {
+    char cwd[1024];
+    if (!getcwd(cwd, sizeof(cwd))) return -1;
+    const char *name = cwd + strlen(cwd);
+    while (name > cwd && name[-1] != '/' && name[-1] != '\\') name--;
+    snprintf(buf, size, "%s%c%s-%08x", scratch, PATH_SEP, name[0] ? name : "root", hash_str_fnv1a(cwd, FNV_SEED));
+    return 0;
+}
+
+//Copy through a temporary file renamed into place, so a build stopped half way never
+//leaves half a file behind
+static int copy_file(const char *src, const char *dest) {
+    char tmp[1200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dest);
+    FILE *in = fopen(src, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(tmp, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    char buf[65536];
+    size_t n;
+    int ok = 1;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) ok = fwrite(buf, 1, n, out) == n;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    if (ok && rename(tmp, dest) != 0) ok = 0;
+    if (!ok) remove(tmp);
+    return ok ? 0 : -1;
+}
+
+int fortean_scratch_restore(const char *manifest, const char *store) {
+    scratch_list_t list = {0};
+    if (load_manifest(manifest, &list) != 0) return -1;
+
+    int res      = 0;
+    int restored = 0;
+    for (int i = 0; i < list.count; i++) {
+        scratch_file_t *f = &list.files[i];
+        struct stat st;
+        if (stat(f->path, &st) == 0) continue;
+
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%s", f->path);
+        char *slash  = strrchr(dir, '/');
+        char *bslash = strrchr(dir, '\\');
+        if (bslash > slash) slash = bslash;
+        if (slash) {
+            *slash = '\0';
+            fortean_scratch_make_dirs(dir);
+        }
+        char from[1200];
+        snprintf(from, sizeof(from), "%s%c%s", store, PATH_SEP, f->hash);
+        if (copy_file(from, f->path) != 0) {
+            res = -1;
+            continue;
+        }
+        //Keep the times, the object hashes are checked by size and time first
+        struct utimbuf times;
+        times.actime  = (time_t)f->mtime;
+        times.modtime = (time_t)f->mtime;
+        utime(f->path, &times);
+        restored++;
+    }
+    if (restored) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Restored %d files of the scratch directories from .cache.", restored);
+        print_info(msg);
+    }
+    list_free(&list);
+    return res;
+}
+
+typedef struct {
+    const char *store;
+    scratch_list_t old;
+    scratch_list_t cur;
+    HashEntry *old_index[HASH_TABLE_SIZE];   // Path -> index in old + 1
+    HashEntry *kept[HASH_TABLE_SIZE];        // Store entries the new manifest uses
+    int failed;
+} scratch_save_t;
+
+static void save_file(scratch_save_t *save, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    size_t len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".tmp") == 0) return;
+
+    //Unchanged since the last build, by size and time, keeps its hash
+    char hash[17] = "";
+    HashEntry *entry = hash_entry_get(save->old_index, path);
+    if (entry) {
+        scratch_file_t *f = &save->old.files[entry->file_hash - 1];
+        if (f->mtime == (long long)st.st_mtime && f->size == (long long)st.st_size) {
+            snprintf(hash, sizeof(hash), "%s", f->hash);
+        }
+    }
+    if (!hash[0]) {
+        unsigned long long h = FNV64_SEED;
+        if (hash_file_fnv1a64(path, &h) != 0) return;
+        snprintf(hash, sizeof(hash), "%016llx", h);
+    }
+
+    char stored[1200];
+    snprintf(stored, sizeof(stored), "%s%c%s", save->store, PATH_SEP, hash);
+    struct stat stored_st;
+    if (stat(stored, &stored_st) != 0 && copy_file(path, stored) != 0) {
+        save->failed = 1;
+        return;
+    }
+    hash_entry_put(save->kept, hash, 1);
+    if (list_add(&save->cur, path, hash, (long long)st.st_mtime, (long long)st.st_size) != 0) save->failed = 1;
+}
+
+static void save_dir(scratch_save_t *save, const char *dir) {
+    char path[1024];
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return;
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, fd.cFileName);
+        save_file(save, path);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, entry->d_name);
+        save_file(save, path);
+    }
+    closedir(d);
+#endif
+}
+
+int fortean_scratch_save(const char *manifest, const char *store, const char **dirs) {
+    if (fortean_scratch_make_dirs(store) != 0) return -1;
+
+    scratch_save_t *save = calloc(1, sizeof(*save));
+    if (!save) return -1;
+    save->store = store;
+    load_manifest(manifest, &save->old);
+    for (int i = 0; i < save->old.count; i++) hash_entry_put(save->old_index, save->old.files[i].path, (unsigned int)i + 1);
+
+    for (int i = 0; dirs[i]; i++) {
+        int seen = 0;
+        for (int j = 0; j < i; j++) seen |= strcmp(dirs[i], dirs[j]) == 0;
+        if (!seen) save_dir(save, dirs[i]);
+    }
+
+    char tmp[1200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", manifest);
+    FILE *fp = fopen(tmp, "w");
+    if (fp) {
+        for (int i = 0; i < save->cur.count; i++) {
+            scratch_file_t *f = &save->cur.files[i];
+            fprintf(fp, "%s %lld %lld %s\n", f->hash, f->mtime, f->size, f->path);
+        }
+#ifdef _WIN32
+        remove(manifest);
+#endif
+        if (fclose(fp) != 0 || rename(tmp, manifest) != 0) save->failed = 1;
+    } else {
+        save->failed = 1;
+    }
+
+    //Earlier versions of the files go, once the manifest no longer names them
+    if (!save->failed) {
+        for (int i = 0; i < save->old.count; i++) {
+            const char *hash = save->old.files[i].hash;
+            if (hash_entry_get(save->kept, hash)) continue;
+            char stored[1200];
+            snprintf(stored, sizeof(stored), "%s%c%s", store, PATH_SEP, hash);
+            remove(stored);
+            hash_entry_put(save->kept, hash, 1);
+        }
+    }
+
+    int res = save->failed ? -1 : 0;
+    list_free(&save->old);
+    list_free(&save->cur);
+    free_prev_hash_table(save->old_index);
+    free_prev_hash_table(save->kept);
+    free(save);
+    return res;
+}
@@ -0,0 +1,30 @@
+#ifndef FORTEAN_SCRATCH_H
+#define FORTEAN_SCRATCH_H
+
+#include <stddef.h>
+
+//Object and module directories on a RAM disk, e.g. scratch = "/dev/shm/fortean", so
+//the compiles never wait on a slow disk. After every build the files there are copied
+//into a content addressed store under .cache, named by the hash of their contents,
+//with a manifest of where each one goes. A build that finds them gone, e.g. after a
+//reboot emptied the RAM disk, copies them back from the store instead of compiling
+//everything again.
+
+//Directory of this project under scratch, <scratch>/<project dir name>-<hash of its
+//path>, so projects sharing a scratch path keep apart. Returns 0 on success.
+int fortean_scratch_root(const char *scratch, char *buf, size_t size);
+
+//Create a directory and its parents. Returns 0 on success.
+int fortean_scratch_make_dirs(const char *path);
+
+//Put back the files of the manifest that are missing, with their old modification
+//times. Returns 0 when every file is there, -1 when there is no manifest or a file
+//can't be restored, so the build starts over.
+int fortean_scratch_restore(const char *manifest, const char *store);
+
+//Copy the files of the NULL-terminated dirs that aren't in store yet and write the
+//manifest. Files of the last manifest no longer used leave the store. Returns 0 on
+//success.
+int fortean_scratch_save(const char *manifest, const char *store, const char **dirs);
+
+#endif // FORTEAN_SCRATCH_H
@@ -0,0 +1,327 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fortean_semhash.h"
+#include "fortean_hash.h"
+
+#define FNV_PRIME 16777619u
+
+#define FORM_FREE  1
+#define FORM_FIXED 2
+
+typedef struct {
+    unsigned int hash;
+    int fold;                // Lower case outside strings
+    int strip;               // Blanks never count, fixed form
+    char last;               // Last character hashed, 0 at the start of a statement
+    int blank;               // A blank was skipped since last
+    int cont;                // The statement goes on on the next line, free form &
+    char quote;              // Inside a string delimited by it
+} semhash_t;
+
+static void mix(semhash_t *s, char c) {
+    s->hash ^= (unsigned char)c;
+    s->hash *= FNV_PRIME;
+}
+
+static void put(semhash_t *s, char c) {
+    mix(s, c);
+    s->last = c;
+}
+
+static int is_word(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f';
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+//A character of code. In free form a blank only counts between two names or numbers.
+static void put_code(semhash_t *s, char c) {
+    if (is_blank(c)) {
+        s->blank = 1;
+        return;
+    }
+    if (s->blank && !s->strip && is_word(c) && is_word(s->last)) put(s, ' ');
+    s->blank = 0;
+    put(s, s->fold ? (char)tolower((unsigned char)c) : c);
+}
+
+//Start a statement, ending the one before if it had anything
+static void new_statement(semhash_t *s) {
+    if (s->last) put(s, '\n');
+    s->last  = 0;
+    s->blank = 0;
+    s->quote = 0;
+}
+
+//nH and the n characters after it are taken as they are (Hollerith constants in the
+//FORMAT and DATA statements of old code). Only after ( , / or =, so REAL*8 H isn't
+//one. Returns the characters used, 0 if p doesn't start one.
+static size_t hollerith(semhash_t *s, const char *p, const char *end) {
+    if (s->last != '(' && s->last != ',' && s->last != '/' && s->last != '=') return 0;
+    const char *q = p;
+    size_t n = 0;
+    while (q < end && isdigit((unsigned char)*q) && n < 10000) n = n * 10 + (size_t)(*q++ - '0');
+    if (q == p || q >= end || (*q != 'h' && *q != 'H') || n == 0 || (size_t)(end - q - 1) < n) return 0;
+    for (const char *c = p; c < q; c++) put(s, *c);
+    put(s, 'h');
+    for (const char *c = q + 1; c <= q + n; c++) put(s, *c);
+    s->blank = 0;
+    return (size_t)(q + 1 + n - p);
+}
+
+//Code from p to end, leaving out the comment at the end. In free form returns 1 when
+//the line ends with the & of a continuation.
+static int scan_code(semhash_t *s, const char *p, const char *end, int free_form) {
+    while (p < end) {
+        char c = *p;
+        if (s->quote) {
+            if (c == s->quote) {
+                put(s, *p++);
+                if (p < end && *p == s->quote) {
+                    put(s, *p++);  // Doubled, the quote itself
+                    continue;
+                }
+                s->quote = 0;
+                continue;
+            }
+            if (free_form && c == '&' && skip_blanks(p + 1, end) == end) return 1;
+            put(s, *p++);
+            continue;
+        }
+        if (c == '!') return 0;
+        if (c == '\'' || c == '"') {
+            s->blank = 0;
+            s->quote = c;
+            put(s, *p++);
+            continue;
+        }
+        if (free_form && c == '&') {
+            const char *rest = skip_blanks(p + 1, end);
+            if (rest == end || *rest == '!') return 1;
+        }
+        if (isdigit((unsigned char)c)) {
+            size_t used = hollerith(s, p, end);
+            if (used) {
+                p += used;
+                continue;
+            }
+        }
+        put_code(s, *p++);
+    }
+    return 0;
+}
+
+//p to end starts with !, c or * and is a directive if a $ ends the word after it:
+//!$omp, !$acc, !$, !dir$, !gcc$, c$omp, *$omp, cdec$. Returns the $, NULL for a comment.
+static const char *sentinel(const char *p, const char *end) {
+    const char *r = p + 1;
+    while (r < end && is_word(*r)) r++;
+    return r < end && *r == '$' ? r : NULL;
+}
+
+//A directive line, hashed with its sentinel like a statement of its own
+static void directive_line(semhash_t *s, const char *p, const char *dollar, const char *end, int free_form) {
+    new_statement(s);
+    put(s, '!');
+    for (const char *c = p + 1; c <= dollar; c++) put(s, (char)tolower((unsigned char)*c));
+    s->blank = 1;
+    scan_code(s, dollar + 1, end, free_form);
+    s->cont = 0;
+}
+
+static void free_line(semhash_t *s, const char *p, const char *end) {
+    const char *q = skip_blanks(p, end);
+    if (q == end) return;
+    if (s->cont) {
+        //Comment lines may sit between the lines of a statement
+        if (*q == '!' && !s->quote) return;
+        if (*q == '&') {
+            q++;
+        } else if (s->quote) {
+            q = p;  // The string goes on from the first column
+        } else {
+            s->blank = 1;
+        }
+        s->cont = scan_code(s, q, end, 1);
+        return;
+    }
+    if (*q == '!') {
+        const char *dollar = sentinel(q, end);
+        if (dollar) directive_line(s, q, dollar, end, 1);
+        return;
+    }
+    new_statement(s);
+    s->cont = scan_code(s, q, end, 1);
+}
+
+static void fixed_line(semhash_t *s, const char *p, const char *end) {
+    const char *q = skip_blanks(p, end);
+    if (q == end) return;
+    if (*p == 'c' || *p == 'C' || *p == '*' || *p == '!') {
+        const char *dollar = sentinel(p, end);
+        if (dollar) directive_line(s, p, dollar, end, 0);
+        return;
+    }
+    //A ! anywhere but column 6 starts a comment line
+    if (*q == '!' && q - p != 5) return;
+
+    //Label in columns 1-5 and a continuation mark in column 6, or a tab ending the
+    //label and a digit after it marking a continuation
+    const char *label_end = p;
+    while (label_end < end && label_end - p < 5 && *label_end != '\t') label_end++;
+    const char *text;
+    int continued;
+    if (label_end < end && *label_end == '\t') {
+        text      = label_end + 1;
+        continued = text < end && *text >= '1' && *text <= '9';
+        if (continued) text++;
+    } else {
+        text      = label_end < end ? label_end + 1 : end;
+        continued = label_end < end && !is_blank(*label_end) && *label_end != '0';
+    }
+    if (!continued) {
+        new_statement(s);
+        int labelled = 0;
+        for (const char *c = p; c < label_end; c++) {
+            if (is_blank(*c)) continue;
+            put(s, *c);
+            labelled = 1;
+        }
+        if (labelled) put(s, ' ');
+    }
+    scan_code(s, text, end, 0);
+}
+
+//Preprocessor line, kept as it is apart from runs of blanks. Returns 1 when a
+//backslash continues it on the next line.
+static int preprocessor_line(semhash_t *s, const char *p, const char *end) {
+    int blank = 0;
+    char last = 0;
+    for (const char *c = skip_blanks(p, end); c < end; c++) {
+        if (is_blank(*c)) {
+            blank = 1;
+            continue;
+        }
+        if (blank) mix(s, ' ');
+        blank = 0;
+        mix(s, *c);
+        last = *c;
+    }
+    return last == '\\';
+}
+
+//Form of the source from its extension, 0 when it isn't Fortran. Upper case
+//extensions and .fpp go through the preprocessor.
+static int source_form(const char *filename, int *preprocessed) {
+    const char *dot  = strrchr(filename, '.');
+    const char *base = strrchr(filename, '/');
+    if (!dot || (base && dot < base) || strlen(dot + 1) >= 8) return 0;
+    char ext[8];
+    *preprocessed = 0;
+    size_t n = 0;
+    for (const char *c = dot + 1; *c; c++) {
+        if (isupper((unsigned char)*c)) *preprocessed = 1;
+        ext[n++] = (char)tolower((unsigned char)*c);
+    }
+    ext[n] = '\0';
+    if (strcmp(ext, "f90") == 0 || strcmp(ext, "f95") == 0 || strcmp(ext, "f03") == 0 ||
+        strcmp(ext, "f08") == 0) {
+        return FORM_FREE;
+    }
+    if (strcmp(ext, "f") == 0 || strcmp(ext, "for") == 0 || strcmp(ext, "ftn") == 0 ||
+        strcmp(ext, "f77") == 0 || strcmp(ext, "fpp") == 0) {
+        if (strcmp(ext, "fpp") == 0) *preprocessed = 1;
+        return FORM_FIXED;
+    }
+    return 0;
+}
+
+int fortean_semhash_flags(char **flags, int count) {
+    int semhash = FORTEAN_SEMHASH_ON;
+    for (int i = 0; i < count; i++) {
+        const char *f = flags[i];
+        if ((strncmp(f, "-g", 2) == 0 && strcmp(f, "-g0") != 0) ||
+            strncmp(f, "-fcheck", 7) == 0 || strncmp(f, "-check", 6) == 0) {
+            semhash |= FORTEAN_SEMHASH_LINES;
+        } else if (strcmp(f, "-cpp") == 0 || strcmp(f, "-fpp") == 0 || strcmp(f, "-Mpreprocess") == 0) {
+            semhash |= FORTEAN_SEMHASH_CPP;
+        } else if (strcmp(f, "-ffixed-form") == 0 || strcmp(f, "-fixed") == 0) {
+            semhash |= FORTEAN_SEMHASH_FIXED;
+        } else if (strcmp(f, "-ffree-form") == 0 || strcmp(f, "-free") == 0) {
+            semhash |= FORTEAN_SEMHASH_FREE;
+        }
+    }
+    return semhash;
+}
+
+int fortean_semhash_flags_for_file(const fortean_semhash_build_t *build, const char *src) {
+    int count    = 0;
+    char **flags = fortean_flags_for_file(build->flags, build->flag_count, build->overrides, src, &count);
+    //Without memory the bytes are hashed, which only recompiles more.
+    if (!flags) return 0;
+    int semhash = fortean_semhash_flags(flags, count);
+    fortean_flags_free(flags, count);
+    return semhash;
+}
+
+unsigned int fortean_semhash_file(const char *filename, int flags) {
+    int preprocessed = 0;
+    int form = (flags & FORTEAN_SEMHASH_ON) ? source_form(filename, &preprocessed) : 0;
+    if (!form) return hash_file_fnv1a(filename);
+    if (flags & FORTEAN_SEMHASH_FIXED) form = FORM_FIXED;
+    if (flags & FORTEAN_SEMHASH_FREE)  form = FORM_FREE;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (!buf) {
+        fclose(fp);
+        return hash_file_fnv1a(filename);
+    }
+    size_t len = fread(buf, 1, (size_t)size, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+    //Line numbers end up in the object with debug info and run-time checks, or
+    //through __LINE__, so there a comment line added above code recompiles it
+    int lines = (flags & FORTEAN_SEMHASH_LINES) || strstr(buf, "__LINE__") != NULL;
+
+    semhash_t s = {0};
+    s.hash  = hash_str_fnv1a(form == FORM_FIXED ? "fixed\n" : "free\n", FNV_SEED);
+    s.fold  = !preprocessed && !(flags & FORTEAN_SEMHASH_CPP);
+    s.strip = form == FORM_FIXED;
+
+    int pp_cont = 0;
+    const char *p   = buf;
+    const char *eof = buf + len;
+    while (p < eof) {
+        const char *eol = memchr(p, '\n', (size_t)(eof - p));
+        const char *end = eol ? eol : eof;
+        const char *q   = skip_blanks(p, end);
+        if (pp_cont || (q < end && *q == '#' && !(s.cont && s.quote))) {
+            if (!pp_cont) mix(&s, '\n');
+            pp_cont = preprocessor_line(&s, p, end);
+            if (!pp_cont) mix(&s, '\n');
+        } else if (form == FORM_FIXED) {
+            fixed_line(&s, p, end);
+        } else {
+            free_line(&s, p, end);
+        }
+        if (lines) mix(&s, '\v');
+        p = eol ? eol + 1 : eof;
+    }
+    free(buf);
+    return s.hash;
+}
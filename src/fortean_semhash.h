@@ -0,0 +1,36 @@
+#ifndef FORTEAN_SEMHASH_H
+#define FORTEAN_SEMHASH_H
+
+#include "fortean_flags.h"
+
+//Hash of the tokens of a Fortran source instead of its bytes, so reformatting it or
+//editing its comments doesn't recompile it: semantic-hash = true. Free and fixed form
+//are told apart by the extension. Comments and blanks the compiler ignores are left
+//out and case is folded outside strings, while preprocessor lines, OpenMP and other
+//directive sentinels (!$omp, !$, !dir$, c$omp) and strings are kept.
+
+#define FORTEAN_SEMHASH_ON     1   // Hash the tokens, without it the bytes are hashed
+#define FORTEAN_SEMHASH_LINES  2   // Line numbers count, for debug info and run-time checks
+#define FORTEAN_SEMHASH_CPP    4   // Sources go through the preprocessor, so case counts
+#define FORTEAN_SEMHASH_FIXED  8   // Every source is fixed form (-ffixed-form)
+#define FORTEAN_SEMHASH_FREE   16  // Every source is free form (-ffree-form)
+
+//The flags for sources compiled with flags, FORTEAN_SEMHASH_ON included
+int fortean_semhash_flags(char **flags, int count);
+
+//The flags of a build and its [[build.override]] entries, which decide how each source
+//is hashed: an override adding -cpp or -g to a directory changes what counts there.
+typedef struct {
+    char **flags;
+    int flag_count;
+    const fortean_overrides_t *overrides;
+} fortean_semhash_build_t;
+
+//fortean_semhash_flags for the flags src is compiled with in build
+int fortean_semhash_flags_for_file(const fortean_semhash_build_t *build, const char *src);
+
+//Hash of filename as the flags say. Files that aren't Fortran and flags without
+//FORTEAN_SEMHASH_ON give hash_file_fnv1a. Returns 0 if it can't be read.
+unsigned int fortean_semhash_file(const char *filename, int flags);
+
+#endif // FORTEAN_SEMHASH_H
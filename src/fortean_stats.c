@@ -0,0 +1,338 @@
+#include "fortean_stats.h"
+#include "fortean_hash.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define PATH_SEP '\\'
+#else
+#define PATH_SEP '/'
+#endif
+
+#define STATS_TOP 10
+
+//A compile is slower than before when it took this much longer than the median of the
+//earlier ones, and by at least STATS_SLOWER_SECONDS so the noise of small files stays out
+#define STATS_SLOWER_RATIO   1.25
+#define STATS_SLOWER_SECONDS 0.1
+
+//One build line of the history
+typedef struct {
+    long long started;
+    char commit[16];
+    int exit_code;
+    double wall;
+    int jobs;
+    double cpu;
+    long long max_rss;
+    double scan;             // Scanning and hashing the sources, reading the graph, hashing the objects
+    double compile;
+    double link;
+    double other;            // Reading the configuration, planning, saving the state
+} stats_build_t;
+
+//One job line of the history
+typedef struct {
+    char cat[16];
+    double wall;
+    double user;
+    double sys;
+    long long max_rss;
+    long long read_bytes;
+    long long write_bytes;
+    int status;
+    char *name;
+    int build;
+} stats_job_t;
+
+typedef struct {
+    stats_build_t *builds;
+    int build_count;
+    int build_cap;
+    stats_job_t *jobs;
+    int job_count;
+    int job_cap;
+} stats_history_t;
+
+static int add_build(stats_history_t *h, const stats_build_t *build) {
+    if (h->build_count == h->build_cap) {
+        int cap = h->build_cap ? h->build_cap * 2 : 64;
+        stats_build_t *tmp = realloc(h->builds, (size_t)cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        h->builds    = tmp;
+        h->build_cap = cap;
+    }
+    h->builds[h->build_count++] = *build;
+    return 0;
+}
+
+static int add_job(stats_history_t *h, const stats_job_t *job) {
+    if (h->job_count == h->job_cap) {
+        int cap = h->job_cap ? h->job_cap * 2 : 256;
+        stats_job_t *tmp = realloc(h->jobs, (size_t)cap * sizeof(*tmp));
+        if (!tmp) return -1;
+        h->jobs    = tmp;
+        h->job_cap = cap;
+    }
+    stats_job_t *dest = &h->jobs[h->job_count];
+    *dest      = *job;
+    dest->name = strdup(job->name);
+    if (!dest->name) return -1;
+    h->job_count++;
+    return 0;
+}
+
+static void free_history(stats_history_t *h) {
+    for (int i = 0; i < h->job_count; i++) free(h->jobs[i].name);
+    free(h->jobs);
+    free(h->builds);
+    memset(h, 0, sizeof(*h));
+}
+
+//Add the phase=seconds fields after the fixed ones to the groups of the build
+static void add_phases(stats_build_t *build, char *fields) {
+    for (char *field = strtok(fields, " "); field; field = strtok(NULL, " ")) {
+        char *eq = strchr(field, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        double seconds = atof(eq + 1);
+        if (strcmp(field, "compile") == 0) {
+            build->compile += seconds;
+        } else if (strcmp(field, "link") == 0) {
+            build->link += seconds;
+        } else if (strcmp(field, "scan") == 0 || strcmp(field, "hash-sources") == 0 ||
+                   strcmp(field, "parse-graph") == 0 || strcmp(field, "hash-objects") == 0) {
+            build->scan += seconds;
+        } else {
+            build->other += seconds;
+        }
+    }
+}
+
+//Builds of profile (and their jobs) from the history. Returns -1 if there is none.
+static int load_history(const char *path, const char *profile, stats_history_t *h) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char line[4096];
+    int keep = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "build ", 6) == 0) {
+            stats_build_t build;
+            memset(&build, 0, sizeof(build));
+            char key[256];
+            int used = 0;
+            keep = sscanf(line + 6, "%lld %15s %255s %d %lf %d %lf %lld%n", &build.started, build.commit, key,
+                          &build.exit_code, &build.wall, &build.jobs, &build.cpu, &build.max_rss, &used) == 8 &&
+                   strcmp(key, profile ? profile : "-") == 0;
+            if (!keep) continue;
+            add_phases(&build, line + 6 + used);
+            if (add_build(h, &build) != 0) break;
+        } else if (keep && strncmp(line, "job ", 4) == 0) {
+            stats_job_t job;
+            memset(&job, 0, sizeof(job));
+            int used = 0;
+            if (sscanf(line + 4, "%15s %lf %lf %lf %lld %lld %lld %d %n", job.cat, &job.wall, &job.user, &job.sys,
+                       &job.max_rss, &job.read_bytes, &job.write_bytes, &job.status, &used) != 8 || !line[4 + used]) {
+                continue;
+            }
+            job.name  = line + 4 + used;
+            job.build = h->build_count - 1;
+            if (add_job(h, &job) != 0) break;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void format_time(long long started, char *buf, size_t size) {
+    time_t t = (time_t)started;
+    struct tm *tm = localtime(&t);
+    if (!tm || strftime(buf, size, "%Y-%m-%d %H:%M", tm) == 0) snprintf(buf, size, "%lld", started);
+}
+
+//Jobs by the latest successful run of each name
+static int latest_jobs(const stats_history_t *h, int *latest) {
+    HashEntry *seen[HASH_TABLE_SIZE] = {NULL};
+    int count = 0;
+    for (int i = h->job_count - 1; i >= 0; i--) {
+        if (h->jobs[i].status != 0 || hash_entry_get(seen, h->jobs[i].name)) continue;
+        hash_entry_put(seen, h->jobs[i].name, 1);
+        latest[count++] = i;
+    }
+    free_prev_hash_table(seen);
+    return count;
+}
+
+static const stats_job_t *sort_jobs;
+
+static int compare_wall(const void *a, const void *b) {
+    double x = sort_jobs[*(const int *)a].wall, y = sort_jobs[*(const int *)b].wall;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int compare_rss(const void *a, const void *b) {
+    long long x = sort_jobs[*(const int *)a].max_rss, y = sort_jobs[*(const int *)b].max_rss;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_jobs(const stats_history_t *h, const int *list, int count, int by_memory) {
+    print_info("  Wall(s)   CPU(s)  Peak(MB)    Read(MB)   Write(MB)  Job");
+    char msg[1200];
+    for (int k = 0; k < count && k < STATS_TOP; k++) {
+        const stats_job_t *job = &h->jobs[list[k]];
+        if (by_memory && job->max_rss == 0) break;
+        snprintf(msg, sizeof(msg), "%9.3f %8.3f %9.1f %11.2f %11.2f  %s %s", job->wall, job->user + job->sys,
+                 job->max_rss / 1024.0, job->read_bytes / 1048576.0, job->write_bytes / 1048576.0, job->cat,
+                 job->name);
+        print_info(msg);
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+//Compiles whose last run took clearly longer than the median of the earlier ones, with
+//the commit of the build where it happened
+static void print_slower(const stats_history_t *h, const int *latest, int latest_count) {
+    double *earlier = malloc((size_t)(h->job_count > 0 ? h->job_count : 1) * sizeof(double));
+    int *found      = malloc((size_t)(latest_count > 0 ? latest_count : 1) * sizeof(int));
+    double *medians = malloc((size_t)(latest_count > 0 ? latest_count : 1) * sizeof(double));
+    if (!earlier || !found || !medians) {
+        free(earlier);
+        free(found);
+        free(medians);
+        return;
+    }
+
+    int found_count = 0;
+    for (int k = 0; k < latest_count; k++) {
+        const stats_job_t *last = &h->jobs[latest[k]];
+        if (strcmp(last->cat, "compile") != 0) continue;
+        int n = 0;
+        for (int i = 0; i < latest[k]; i++) {
+            const stats_job_t *job = &h->jobs[i];
+            if (job->status == 0 && job->build != last->build && strcmp(job->name, last->name) == 0) {
+                earlier[n++] = job->wall;
+            }
+        }
+        if (n < 2) continue;
+        qsort(earlier, (size_t)n, sizeof(double), compare_double);
+        double median = n % 2 ? earlier[n / 2] : (earlier[n / 2 - 1] + earlier[n / 2]) / 2.0;
+        if (last->wall < median * STATS_SLOWER_RATIO || last->wall - median < STATS_SLOWER_SECONDS) continue;
+        medians[found_count] = median;
+        found[found_count++] = latest[k];
+    }
+
+    if (found_count > 0) {
+        print_info("");
+        print_info("Compiles slower than before (last against the median of the earlier ones):");
+        char msg[1200];
+        for (int k = 0; k < found_count && k < STATS_TOP; k++) {
+            const stats_job_t *job = &h->jobs[found[k]];
+            const stats_build_t *build = &h->builds[job->build];
+            snprintf(msg, sizeof(msg), "  %s: %.3f s -> %.3f s (+%.0f%%) at commit %s", job->name, medians[k], job->wall,
+                     100.0 * (job->wall - medians[k]) / (medians[k] > 0.0 ? medians[k] : 1.0), build->commit);
+            print_info(msg);
+        }
+    }
+    free(earlier);
+    free(found);
+    free(medians);
+}
+
+int fortean_stats_run(const fortean_build_opts_t *opts, int builds) {
+    char cache_name[256];
+    fortean_build_cache_key(opts, cache_name, sizeof(cache_name));
+    const char *profile = cache_name[0] ? cache_name : NULL;
+    char path[512];
+    if (profile) snprintf(path, sizeof(path), ".cache%c%s%chistory.log", PATH_SEP, profile, PATH_SEP);
+    else         snprintf(path, sizeof(path), ".cache%chistory.log", PATH_SEP);
+
+    stats_history_t h = {0};
+    char msg[1200];
+    if (load_history(path, profile, &h) != 0 || h.build_count == 0) {
+        snprintf(msg, sizeof(msg), "No builds%s%s recorded in %s yet.", profile ? " of " : "", profile ? profile : "",
+                 path);
+        print_info(msg);
+        free_history(&h);
+        return 0;
+    }
+
+    int *latest = malloc((size_t)(h.job_count > 0 ? h.job_count : 1) * sizeof(int));
+    if (!latest) {
+        print_error("Memory allocation error.");
+        free_history(&h);
+        return -1;
+    }
+
+    const stats_build_t *last = &h.builds[h.build_count - 1];
+    char when[64];
+    format_time(last->started, when, sizeof(when));
+    snprintf(msg, sizeof(msg), "%d builds%s%s recorded, the last at %s (commit %s): %.3f s, %d jobs, %.3f s CPU, peak %.1f MB",
+             h.build_count, profile ? " of " : "", profile ? profile : "", when, last->commit, last->wall, last->jobs,
+             last->cpu, last->max_rss / 1024.0);
+    print_info(msg);
+
+    //Slowest and most memory hungry by their last successful run, whichever build it was in
+    int latest_count = latest_jobs(&h, latest);
+    sort_jobs = h.jobs;
+    if (latest_count > 0) {
+        print_info("");
+        print_info("Slowest jobs, as of their last run:");
+        qsort(latest, (size_t)latest_count, sizeof(int), compare_wall);
+        print_jobs(&h, latest, latest_count, 0);
+        qsort(latest, (size_t)latest_count, sizeof(int), compare_rss);
+        if (h.jobs[latest[0]].max_rss > 0) {
+            print_info("");
+            print_info("Most memory hungry jobs, as of their last run:");
+            print_jobs(&h, latest, latest_count, 1);
+        }
+    }
+
+    //Where the time of the last builds went
+    int first = h.build_count > builds ? h.build_count - builds : 0;
+    double scan = 0.0, compile = 0.0, link = 0.0, other = 0.0, wall = 0.0;
+    for (int b = first; b < h.build_count; b++) {
+        scan += h.builds[b].scan;
+        compile += h.builds[b].compile;
+        link += h.builds[b].link;
+        other += h.builds[b].other;
+        wall += h.builds[b].wall;
+    }
+    double total = wall > 0.0 ? wall : 1.0;
+    print_info("");
+    snprintf(msg, sizeof(msg), "Time of the last %d builds, %.3f s in all:", h.build_count - first, wall);
+    print_info(msg);
+    snprintf(msg, sizeof(msg), "  Scanning and hashing %9.3f s  %5.1f%%", scan, 100.0 * scan / total);
+    print_info(msg);
+    snprintf(msg, sizeof(msg), "  Compiling            %9.3f s  %5.1f%%", compile, 100.0 * compile / total);
+    print_info(msg);
+    snprintf(msg, sizeof(msg), "  Linking              %9.3f s  %5.1f%%", link, 100.0 * link / total);
+    print_info(msg);
+    snprintf(msg, sizeof(msg), "  Everything else      %9.3f s  %5.1f%%", other, 100.0 * other / total);
+    print_info(msg);
+
+    print_info("");
+    print_info("When              Commit        Exit   Wall(s)  Compile(s)  Jobs    CPU(s)  Peak(MB)");
+    for (int b = first; b < h.build_count; b++) {
+        const stats_build_t *build = &h.builds[b];
+        format_time(build->started, when, sizeof(when));
+        snprintf(msg, sizeof(msg), "%-16s  %-12s  %4d  %8.3f  %10.3f  %4d  %8.3f  %8.1f", when, build->commit,
+                 build->exit_code, build->wall, build->compile, build->jobs, build->cpu, build->max_rss / 1024.0);
+        print_info(msg);
+    }
+
+    latest_count = latest_jobs(&h, latest);
+    print_slower(&h, latest, latest_count);
+
+    free(latest);
+    free_history(&h);
+    return 0;
+}
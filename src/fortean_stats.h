@@ -0,0 +1,14 @@
+#ifndef FORTEAN_STATS_H
+#define FORTEAN_STATS_H
+
+#include "fortean_build.h"
+
+//fortean stats: what the builds in .cache[/<profile>]/history.log spent their time and memory on.
+//The slowest and the most memory hungry files as of their last compile, the time spent
+//scanning and hashing against compiling and linking, the last builds with their git
+//commits, and the files whose last compile took clearly longer than the ones before
+//it. Only the builds of the profile (and unity) of opts are read, and the trends cover
+//the last builds of them. Returns 0 on success.
+int fortean_stats_run(const fortean_build_opts_t *opts, int builds);
+
+#endif // FORTEAN_STATS_H
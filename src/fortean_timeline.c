@@ -0,0 +1,450 @@
+#include "fortean_timeline.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PID 1
+#define LANE_TID_BASE 1000
+
+void fortean_timeline_init(fortean_timeline_t *tl) {
+    memset(tl, 0, sizeof(*tl));
+    tl->origin  = fortean_wall_time();
+    tl->started = (long long)time(NULL);
+}
+
+fortean_timeline_span_t *fortean_timeline_add(fortean_timeline_t *tl, const char *cat, const char *name,
+                                              double queued, double start, double end, int lane) {
+    if (!tl) return NULL;
+    if (tl->count == tl->cap) {
+        int cap = tl->cap ? tl->cap * 2 : 256;
+        fortean_timeline_span_t *tmp = realloc(tl->spans, (size_t)cap * sizeof(*tmp));
+        if (!tmp) return NULL;
+        tl->spans = tmp;
+        tl->cap   = cap;
+    }
+    fortean_timeline_span_t *span = &tl->spans[tl->count];
+    span->name = strdup(name);
+    if (!span->name) return NULL;
+    memset(&span->usage, 0, sizeof(span->usage));
+    span->status = 0;
+    span->cat    = cat;
+    span->args   = NULL;
+    span->queued = queued;
+    span->start  = start;
+    span->end    = end < start ? start : end;
+    span->lane   = lane;
+    tl->count++;
+    return span;
+}
+
+fortean_timeline_span_t *fortean_timeline_phase(fortean_timeline_t *tl, const char *name, double start) {
+    return fortean_timeline_add(tl, "phase", name, start, start, fortean_wall_time(), FORTEAN_TIMELINE_MAIN);
+}
+
+//value as a JSON string, quotes included
+static void put_json_string(FILE *fp, const char *value) {
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)value; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(fp, "\\%c", *c);
+        else if (*c == '\n')         fputs("\\n", fp);
+        else if (*c == '\t')         fputs("\\t", fp);
+        else if (*c < 0x20)          fprintf(fp, "\\u%04x", *c);
+        else                         fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+//Append "key":value to the args of span, value already JSON
+static void append_arg(fortean_timeline_span_t *span, const char *key, const char *value, int quote) {
+    if (!span) return;
+    size_t cap = strlen(key) + 2 * strlen(value) + 16 + (span->args ? strlen(span->args) : 0);
+    char *args = malloc(cap);
+    if (!args) return;
+    size_t len = (size_t)snprintf(args, cap, "%s%s\"%s\":%s", span->args ? span->args : "", span->args ? "," : "",
+                                  key, quote ? "\"" : "");
+    for (const char *c = value; *c && len + 8 < cap; c++) {
+        unsigned char u = (unsigned char)*c;
+        if (!quote || (u >= 0x20 && u != '"' && u != '\\')) {
+            args[len++] = *c;
+        } else if (u == '"' || u == '\\') {
+            args[len++] = '\\';
+            args[len++] = *c;
+        } else {
+            args[len++] = ' ';
+        }
+    }
+    if (quote) args[len++] = '"';
+    args[len] = '\0';
+    free(span->args);
+    span->args = args;
+}
+
+void fortean_timeline_arg(fortean_timeline_span_t *span, const char *key, const char *value) {
+    append_arg(span, key, value ? value : "", 1);
+}
+
+void fortean_timeline_arg_int(fortean_timeline_span_t *span, const char *key, long long value) {
+    char num[32];
+    snprintf(num, sizeof(num), "%lld", value);
+    append_arg(span, key, num, 0);
+}
+
+//A change of the running and waiting job counts
+typedef struct {
+    double at;
+    int running;
+    int waiting;
+} timeline_step_t;
+
+static int compare_steps(const void *a, const void *b) {
+    const timeline_step_t *x = a, *y = b;
+    if (x->at != y->at) return x->at < y->at ? -1 : 1;
+    return x->running - y->running;  // Ends before starts at the same moment
+}
+
+static const fortean_timeline_span_t *sort_spans;
+
+static int compare_start(const void *a, const void *b) {
+    const fortean_timeline_span_t *x = &sort_spans[*(const int *)a], *y = &sort_spans[*(const int *)b];
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+static double micros(const fortean_timeline_t *tl, double t) {
+    return (t - tl->origin) * 1e6;
+}
+
+//Args object of a span, with what its program used when it ran here
+static void put_args(FILE *fp, const fortean_timeline_span_t *span) {
+    const fortean_cmd_usage_t *u = &span->usage;
+    fprintf(fp, "{%s", span->args ? span->args : "");
+    if (u->valid) {
+        fprintf(fp, "%s\"user\":%.3f,\"sys\":%.3f,\"max_rss_kb\":%lld,\"read_bytes\":%lld,\"write_bytes\":%lld",
+                span->args ? "," : "", u->user, u->sys, u->max_rss, u->read_bytes, u->write_bytes);
+    }
+    fputc('}', fp);
+}
+
+static void put_thread_name(FILE *fp, int tid, const char *name, int first) {
+    fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",",
+            PID, tid);
+    put_json_string(fp, name);
+    fprintf(fp, "}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+            PID, tid, tid);
+}
+
+int fortean_timeline_write(const fortean_timeline_t *tl, const char *path) {
+    int *order         = malloc((size_t)(tl->count > 0 ? tl->count : 1) * sizeof(int));
+    int *tid           = malloc((size_t)(tl->count > 0 ? tl->count : 1) * sizeof(int));
+    double *row_end    = malloc((size_t)(tl->count > 0 ? tl->count : 1) * sizeof(double));
+    timeline_step_t *steps = malloc((size_t)(tl->count > 0 ? tl->count : 1) * 3 * sizeof(timeline_step_t));
+    FILE *fp = (order && tid && row_end && steps) ? fopen(path, "w") : NULL;
+    if (!fp) {
+        free(order);
+        free(tid);
+        free(row_end);
+        free(steps);
+        char msg[600];
+        snprintf(msg, sizeof(msg), "Failed to write the trace %s", path);
+        print_error(msg);
+        return -1;
+    }
+
+    //Local jobs go onto the first row free at their start, so there are as many rows
+    //as jobs ever ran at once
+    for (int i = 0; i < tl->count; i++) order[i] = i;
+    sort_spans = tl->spans;
+    qsort(order, (size_t)tl->count, sizeof(int), compare_start);
+    int rows = 0;
+    for (int k = 0; k < tl->count; k++) {
+        int i = order[k];
+        const fortean_timeline_span_t *span = &tl->spans[i];
+        if (span->lane == FORTEAN_TIMELINE_MAIN) {
+            tid[i] = 0;
+        } else if (span->lane > 0) {
+            tid[i] = LANE_TID_BASE + span->lane;
+        } else {
+            int row = 0;
+            while (row < rows && row_end[row] > span->start) row++;
+            if (row == rows) rows++;
+            row_end[row] = span->end;
+            tid[i] = row + 1;
+        }
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    fprintf(fp, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"fortean build\"}},", PID);
+    put_thread_name(fp, 0, "fortean", 1);
+    char name[64];
+    for (int r = 0; r < rows; r++) {
+        snprintf(name, sizeof(name), "thread %d", r + 1);
+        put_thread_name(fp, r + 1, name, 0);
+    }
+    int lanes_named[1024] = {0};
+    for (int i = 0; i < tl->count; i++) {
+        int lane = tl->spans[i].lane;
+        if (lane <= 0 || lane >= 1024 || lanes_named[lane]) continue;
+        lanes_named[lane] = 1;
+        snprintf(name, sizeof(name), "worker lane %d", lane);
+        put_thread_name(fp, LANE_TID_BASE + lane, name, 0);
+    }
+
+    int step_count = 0;
+    for (int k = 0; k < tl->count; k++) {
+        int i = order[k];
+        const fortean_timeline_span_t *span = &tl->spans[i];
+        fprintf(fp, ",\n{\"name\":");
+        put_json_string(fp, span->name);
+        fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,\"pid\":%d,\"tid\":%d,\"args\":",
+                span->cat, micros(tl, span->start), (span->end - span->start) * 1e6, PID, tid[i]);
+        put_args(fp, span);
+        fputc('}', fp);
+        if (span->lane == FORTEAN_TIMELINE_MAIN) continue;
+        steps[step_count++] = (timeline_step_t){span->queued, 0, 1};
+        steps[step_count++] = (timeline_step_t){span->start, 1, -1};
+        steps[step_count++] = (timeline_step_t){span->end, -1, 0};
+    }
+
+    //Counters change once per moment, after every job starting or ending then
+    qsort(steps, (size_t)step_count, sizeof(timeline_step_t), compare_steps);
+    int running = 0, waiting = 0;
+    for (int s = 0; s < step_count; s++) {
+        running += steps[s].running;
+        waiting += steps[s].waiting;
+        if (s + 1 < step_count && steps[s + 1].at == steps[s].at) continue;
+        double ts = micros(tl, steps[s].at);
+        fprintf(fp, ",\n{\"name\":\"concurrency\",\"ph\":\"C\",\"ts\":%.1f,\"pid\":%d,\"args\":{\"running\":%d}}", ts, PID,
+                running);
+        fprintf(fp, ",\n{\"name\":\"queue depth\",\"ph\":\"C\",\"ts\":%.1f,\"pid\":%d,\"args\":{\"waiting\":%d}}", ts, PID,
+                waiting);
+    }
+    fprintf(fp, "\n]}\n");
+    int res = fclose(fp) == 0 ? 0 : -1;
+
+    free(order);
+    free(tid);
+    free(row_end);
+    free(steps);
+    if (res == 0) {
+        char msg[600];
+        snprintf(msg, sizeof(msg), "Wrote the trace of the build to %s", path);
+        print_info(msg);
+    }
+    return res;
+}
+
+//First line of a file without its line end. Returns 0 on success.
+static int read_line(const char *path, char *buf, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    int ok = fgets(buf, (int)size, fp) != NULL;
+    fclose(fp);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return 0;
+}
+
+//Commit checked out in the project, the first 12 digits, "-" when it isn't a git
+//checkout. Read from .git directly, running git for every build costs more.
+static void git_commit(char *buf, size_t size) {
+    char git_dir[1100] = ".git";
+    char line[1100];
+    char path[1300];
+    snprintf(buf, size, "-");
+
+    //A worktree or submodule has a .git file naming its directory, with the branches
+    //in the common directory of the repository
+    if (read_line(".git", line, sizeof(line)) == 0 && strncmp(line, "gitdir: ", 8) == 0) {
+        snprintf(git_dir, sizeof(git_dir), "%s", line + 8);
+    }
+    char common[1100];
+    snprintf(common, sizeof(common), "%s", git_dir);
+    snprintf(path, sizeof(path), "%s/commondir", git_dir);
+    if (read_line(path, line, sizeof(line)) == 0) {
+        int absolute = line[0] == '/' || line[0] == '\\' || (line[0] && line[1] == ':');
+        if (absolute) snprintf(common, sizeof(common), "%s", line);
+        else          snprintf(common, sizeof(common), "%.500s/%.500s", git_dir, line);
+    }
+
+    snprintf(path, sizeof(path), "%s/HEAD", git_dir);
+    if (read_line(path, line, sizeof(line)) != 0) return;
+    if (strncmp(line, "ref: ", 5) != 0) {
+        snprintf(buf, size, "%.12s", line);
+        return;
+    }
+    char ref[1100];
+    snprintf(ref, sizeof(ref), "%s", line + 5);
+
+    const char *dirs[2] = {git_dir, common};
+    for (int d = 0; d < 2; d++) {
+        snprintf(path, sizeof(path), "%s/%s", dirs[d], ref);
+        if (read_line(path, line, sizeof(line)) == 0) {
+            snprintf(buf, size, "%.12s", line);
+            return;
+        }
+        snprintf(path, sizeof(path), "%s/packed-refs", dirs[d]);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        while (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            char *space = strchr(line, ' ');
+            if (space && strcmp(space + 1, ref) == 0) {
+                snprintf(buf, size, "%.12s", line);
+                break;
+            }
+        }
+        fclose(fp);
+        if (strcmp(buf, "-") != 0) return;
+    }
+}
+
+//Jobs are the compiles, links and archive updates
+static int is_job(const fortean_timeline_span_t *span) {
+    return span->lane != FORTEAN_TIMELINE_MAIN;
+}
+
+//What the whole build took and used
+typedef struct {
+    double wall;
+    int jobs;
+    double cpu;
+    long long max_rss;
+} timeline_totals_t;
+
+static void build_totals(const fortean_timeline_t *tl, timeline_totals_t *totals) {
+    memset(totals, 0, sizeof(*totals));
+    totals->wall = fortean_wall_time() - tl->origin;
+    for (int i = 0; i < tl->count; i++) {
+        const fortean_timeline_span_t *span = &tl->spans[i];
+        if (span->lane == FORTEAN_TIMELINE_MAIN && strcmp(span->cat, "phase") == 0 && strcmp(span->name, "build") == 0) {
+            totals->wall = span->end - span->start;
+        }
+        if (!is_job(span)) continue;
+        totals->jobs++;
+        totals->cpu += span->usage.user + span->usage.sys;
+        if (span->usage.max_rss > totals->max_rss) totals->max_rss = span->usage.max_rss;
+    }
+}
+
+//Spans of one kind as a JSON array, times in seconds from the start of the build
+static void put_span_array(FILE *fp, const fortean_timeline_t *tl, const char *key, int jobs, const char *cat) {
+    fprintf(fp, "  \"%s\": [", key);
+    int first = 1;
+    for (int i = 0; i < tl->count; i++) {
+        const fortean_timeline_span_t *span = &tl->spans[i];
+        if (is_job(span) != jobs || (cat && strcmp(span->cat, cat) != 0)) continue;
+        fprintf(fp, "%s\n    {\"name\": ", first ? "" : ",");
+        put_json_string(fp, span->name);
+        fprintf(fp, ", \"cat\": \"%s\", \"start\": %.6f, \"seconds\": %.6f", span->cat, span->start - tl->origin,
+                span->end - span->start);
+        if (jobs) fprintf(fp, ", \"queued\": %.6f, \"exit\": %d", span->queued - tl->origin, span->status);
+        fprintf(fp, ", \"args\": ");
+        put_args(fp, span);
+        fputc('}', fp);
+        first = 0;
+    }
+    fprintf(fp, "%s]", first ? "" : "\n  ");
+}
+
+int fortean_timeline_report(const fortean_timeline_t *tl, const char *path, const char *profile, int exit_code) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    char commit[32];
+    git_commit(commit, sizeof(commit));
+    timeline_totals_t totals;
+    build_totals(tl, &totals);
+    double user = 0.0, sys = 0.0;
+    for (int i = 0; i < tl->count; i++) {
+        user += tl->spans[i].usage.user;
+        sys += tl->spans[i].usage.sys;
+    }
+
+    fprintf(fp, "{\n  \"started\": %lld,\n  \"commit\": ", tl->started);
+    if (strcmp(commit, "-") != 0) put_json_string(fp, commit);
+    else                         fputs("null", fp);
+    fprintf(fp, ",\n  \"profile\": ");
+    if (profile) put_json_string(fp, profile);
+    else         fputs("null", fp);
+    fprintf(fp, ",\n  \"exit\": %d,\n  \"wall\": %.6f,\n  \"jobs\": %d,\n  \"user\": %.3f,\n  \"sys\": %.3f,\n"
+                "  \"max_rss_kb\": %lld,\n",
+            exit_code, totals.wall, totals.jobs, user, sys, totals.max_rss);
+    put_span_array(fp, tl, "phases", 0, "phase");
+    fprintf(fp, ",\n");
+    put_span_array(fp, tl, "levels", 0, "level");
+    fprintf(fp, ",\n");
+    put_span_array(fp, tl, "cache", 0, "cache");
+    fprintf(fp, ",\n");
+    put_span_array(fp, tl, "jobs", 1, NULL);
+    fprintf(fp, "\n}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+//Keep the newer half of the history, from the first build line in it
+static void trim_history(const char *path, long size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return;
+    char *text = malloc((size_t)size + 1);
+    size_t len = text ? fread(text, 1, (size_t)size, fp) : 0;
+    fclose(fp);
+    if (!text) return;
+    text[len] = '\0';
+    char *keep = len > FORTEAN_HISTORY_MAX_BYTES / 2 ? strstr(text + len - FORTEAN_HISTORY_MAX_BYTES / 2, "\nbuild ") : NULL;
+    if (keep) {
+        char tmp[1100];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        FILE *out = fopen(tmp, "wb");
+        if (out) {
+            size_t n  = strlen(keep + 1);
+            int ok    = fwrite(keep + 1, 1, n, out) == n;
+            if (fclose(out) != 0) ok = 0;
+#ifdef _WIN32
+            if (ok) remove(path);
+#endif
+            if (!ok || rename(tmp, path) != 0) remove(tmp);
+        }
+    }
+    free(text);
+}
+
+int fortean_timeline_history(const fortean_timeline_t *tl, const char *path, const char *profile, int exit_code) {
+    FILE *fp = fopen(path, "a");
+    if (!fp) return -1;
+    char commit[32];
+    git_commit(commit, sizeof(commit));
+    timeline_totals_t totals;
+    build_totals(tl, &totals);
+
+    fprintf(fp, "build %lld %s %s %d %.3f %d %.3f %lld", tl->started, commit, profile ? profile : "-", exit_code,
+            totals.wall, totals.jobs, totals.cpu, totals.max_rss);
+    for (int i = 0; i < tl->count; i++) {
+        const fortean_timeline_span_t *span = &tl->spans[i];
+        if (is_job(span) || strcmp(span->cat, "phase") != 0 || strcmp(span->name, "build") == 0) continue;
+        fputc(' ', fp);
+        for (const char *c = span->name; *c; c++) fputc(*c == ' ' ? '-' : *c, fp);
+        fprintf(fp, "=%.3f", span->end - span->start);
+    }
+    fputc('\n', fp);
+    for (int i = 0; i < tl->count; i++) {
+        const fortean_timeline_span_t *span = &tl->spans[i];
+        if (!is_job(span)) continue;
+        const fortean_cmd_usage_t *u = &span->usage;
+        fprintf(fp, "job %s %.3f %.3f %.3f %lld %lld %lld %d %s\n", span->cat, span->end - span->start, u->user, u->sys,
+                u->max_rss, u->read_bytes, u->write_bytes, span->status, span->name);
+    }
+    long size = ftell(fp);
+    if (fclose(fp) != 0) return -1;
+    if (size > FORTEAN_HISTORY_MAX_BYTES) trim_history(path, size);
+    return 0;
+}
+
+void fortean_timeline_free(fortean_timeline_t *tl) {
+    for (int i = 0; i < tl->count; i++) {
+        free(tl->spans[i].name);
+        free(tl->spans[i].args);
+    }
+    free(tl->spans);
+    memset(tl, 0, sizeof(*tl));
+}
@@ -0,0 +1,72 @@
+#ifndef FORTEAN_TIMELINE_H
+#define FORTEAN_TIMELINE_H
+
+//Where the time of a build goes, fortean build --trace out.json: a Chrome trace event
+//file that loads in Perfetto (ui.perfetto.dev) and chrome://tracing. fortean's own
+//phases are spans on the first row, every compile, link and archive job a span on the
+//row of the thread or worker lane that ran it, with its files, command and exit code,
+//and two counters follow the jobs running and the jobs waiting to start. Spans are
+//added by the thread running the build, a job's once it has been joined.
+//
+//Every build keeps one, --trace or not: at the end it becomes report.json, the phases
+//and jobs with the CPU time, memory and I/O of each, and a summary line in history.log
+//that fortean stats reads, both in the cache directory of the profile.
+
+#include "fortean_cmd.h"
+
+#define FORTEAN_TIMELINE_MAIN  (-1)   // Row of fortean itself
+#define FORTEAN_TIMELINE_LOCAL 0      // Packed onto the rows of the local threads
+
+typedef struct {
+    char *name;
+    const char *cat;         // "phase", "compile", "link", ...
+    char *args;              // Body of the JSON args object, NULL for none
+    double queued;           // Ready to run, the start for phases
+    double start;
+    double end;
+    int lane;                // FORTEAN_TIMELINE_MAIN, _LOCAL or worker lane + 1
+    fortean_cmd_usage_t usage;  // What the job's program used, valid when it ran here
+    int status;              // Exit code of a job
+} fortean_timeline_span_t;
+
+typedef struct {
+    fortean_timeline_span_t *spans;
+    int count;
+    int cap;
+    double origin;           // fortean_wall_time() when the build started
+    long long started;       // Seconds since the epoch when it started
+} fortean_timeline_t;
+
+void fortean_timeline_init(fortean_timeline_t *tl);
+
+//Phase of fortean from start to now. tl may be NULL.
+fortean_timeline_span_t *fortean_timeline_phase(fortean_timeline_t *tl, const char *name, double start);
+
+//Span of a job that was ready at queued and ran from start to end. Returns NULL when
+//tl is NULL or out of memory.
+fortean_timeline_span_t *fortean_timeline_add(fortean_timeline_t *tl, const char *cat, const char *name,
+                                              double queued, double start, double end, int lane);
+
+//Arguments shown with a span, span may be NULL
+void fortean_timeline_arg(fortean_timeline_span_t *span, const char *key, const char *value);
+void fortean_timeline_arg_int(fortean_timeline_span_t *span, const char *key, long long value);
+
+//Write the trace. Returns 0 on success.
+int fortean_timeline_write(const fortean_timeline_t *tl, const char *path);
+
+//Write the report of the build as JSON: when and at which git commit it ran, the
+//phases, and every job with its arguments and usage. profile is the cache key of the
+//build, NULL for the plain one. Returns 0 on success.
+int fortean_timeline_report(const fortean_timeline_t *tl, const char *path, const char *profile, int exit_code);
+
+//Append the build to the history log, a "build" line followed by a "job" line per job,
+//dropping the oldest builds once it grows past FORTEAN_HISTORY_MAX_BYTES:
+//  build <started> <commit> <profile> <exit> <wall> <jobs> <cpu> <max rss> <phase>=<seconds>...
+//  job <cat> <wall> <user> <sys> <max rss> <read bytes> <write bytes> <exit> <name>
+//Returns 0 on success.
+#define FORTEAN_HISTORY_MAX_BYTES (2 * 1024 * 1024)
+int fortean_timeline_history(const fortean_timeline_t *tl, const char *path, const char *profile, int exit_code);
+
+void fortean_timeline_free(fortean_timeline_t *tl);
+
+#endif // FORTEAN_TIMELINE_H
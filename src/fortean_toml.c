@@ -60,12 +60,15 @@ static toml_table_t* fortean_toml_traverse_table(toml_table_t *table, const char
 
     toml_table_t *cur = table;
     if (last_dot) {
-        char *token = strtok(key_copy, ".");
+        //Split by hand, strtok is not safe when builds run on threads (fortean compare).
+        char *token = key_copy;
         while (token && cur) {
+            char *dot = strchr(token, '.');
+            if (dot) *dot = '\0';
             toml_table_t *next = toml_table_in(cur, token);
             if (!next) return NULL;
             cur = next;
-            token = strtok(NULL, ".");
+            token = dot ? dot + 1 : NULL;
         }
     }
     return cur;
@@ -88,6 +91,13 @@ char **fortean_toml_get_array(fortean_toml_t *cfg, const char *key_path) {
     toml_array_t *arr = toml_array_in(tbl, array_key);
     if (!arr) return NULL;
 
+    return fortean_toml_string_array(arr);
+}
+
+// Copy a toml array of strings into a NULL-terminated list (caller must free all)
+char **fortean_toml_string_array(toml_array_t *arr) {
+    if (!arr) return NULL;
+
     int n = toml_array_nelem(arr);
     char **result = malloc((n + 1) * sizeof(char *));
     if (!result) return NULL;
@@ -105,6 +115,31 @@ char **fortean_toml_get_array(fortean_toml_t *cfg, const char *key_path) {
     return result;
 }
 
+// Get a string array stored directly in a table, e.g. one entry of [[build.override]]
+char **fortean_toml_table_get_array(toml_table_t *tbl, const char *key) {
+    if (!tbl || !key) return NULL;
+    return fortean_toml_string_array(toml_array_in(tbl, key));
+}
+
+// Get an array of tables from key path like "build.override" ([[build.override]] in the file)
+toml_array_t *fortean_toml_get_table_array(fortean_toml_t *cfg, const char *key_path) {
+    if (!cfg || !cfg->table || !key_path) return NULL;
+
+    char key_copy[256];
+    strncpy(key_copy, key_path, sizeof(key_copy));
+    key_copy[sizeof(key_copy)-1] = '\0';
+
+    char *last_dot = strrchr(key_copy, '.');
+    const char *array_key = last_dot ? last_dot + 1 : key_copy;
+
+    toml_table_t *tbl = fortean_toml_traverse_table(cfg->table, key_path);
+    if (!tbl) return NULL;
+
+    toml_array_t *arr = toml_array_in(tbl, array_key);
+    if (!arr || toml_array_kind(arr) != 't') return NULL;
+    return arr;
+}
+
 // Get string value from key path like "build.target"
 const char *fortean_toml_get_string(fortean_toml_t *cfg, const char *key_path) {
     if (!cfg || !cfg->table || !key_path) return NULL;
@@ -124,6 +159,32 @@ const char *fortean_toml_get_string(fortean_toml_t *cfg, const char *key_path) {
     return NULL;
 }
 
+int fortean_toml_get_bool(fortean_toml_t *cfg, const char *key_path, int default_value) {
+    if (!cfg || !cfg->table || !key_path) return default_value;
+
+    const char *last_dot = strrchr(key_path, '.');
+    const char *key_name = last_dot ? last_dot + 1 : key_path;
+
+    toml_table_t *tbl = fortean_toml_traverse_table(cfg->table, key_path);
+    if (!tbl) return default_value;
+
+    toml_datum_t val = toml_bool_in(tbl, key_name);
+    return val.ok ? val.u.b : default_value;
+}
+
+int fortean_toml_get_int(fortean_toml_t *cfg, const char *key_path, int default_value) {
+    if (!cfg || !cfg->table || !key_path) return default_value;
+
+    const char *last_dot = strrchr(key_path, '.');
+    const char *key_name = last_dot ? last_dot + 1 : key_path;
+
+    toml_table_t *tbl = fortean_toml_traverse_table(cfg->table, key_path);
+    if (!tbl) return default_value;
+
+    toml_datum_t val = toml_int_in(tbl, key_name);
+    return val.ok ? (int)val.u.i : default_value;
+}
+
 char ***extract_string_matrix(toml_table_t* cfg, const char* key, int* rows, int* cols) {
     if (!cfg || !key || !rows || !cols) return NULL;
 
@@ -172,3 +233,196 @@ char ***extract_string_matrix(toml_table_t* cfg, const char* key, int* rows, int
     *cols = inner_len;
     return result;
 }
+
+// Look up "profile.<profile>.<key>" first and fall back to "build.<key>"
+static void fortean_toml_profile_key(char *buf, size_t size, const char *section, const char *profile, const char *key) {
+    if (profile) snprintf(buf, size, "%s.%s.%s", section, profile, key);
+    else         snprintf(buf, size, "%s.%s", section, key);
+}
+
+const char *fortean_toml_get_profile_string(fortean_toml_t *cfg, const char *profile, const char *key) {
+    char key_path[256];
+    if (profile) {
+        fortean_toml_profile_key(key_path, sizeof(key_path), "profile", profile, key);
+        const char *val = fortean_toml_get_string(cfg, key_path);
+        if (val) return val;
+    }
+    fortean_toml_profile_key(key_path, sizeof(key_path), "build", NULL, key);
+    return fortean_toml_get_string(cfg, key_path);
+}
+
+char **fortean_toml_get_profile_array(fortean_toml_t *cfg, const char *profile, const char *key) {
+    char key_path[256];
+    if (profile) {
+        fortean_toml_profile_key(key_path, sizeof(key_path), "profile", profile, key);
+        char **val = fortean_toml_get_array(cfg, key_path);
+        if (val) return val;
+    }
+    fortean_toml_profile_key(key_path, sizeof(key_path), "build", NULL, key);
+    return fortean_toml_get_array(cfg, key_path);
+}
+
+// Check that [profile.<profile>] exists
+int fortean_toml_has_profile(fortean_toml_t *cfg, const char *profile) {
+    if (!cfg || !cfg->table || !profile) return 0;
+    toml_table_t *profiles = toml_table_in(cfg->table, "profile");
+    return profiles && toml_table_in(profiles, profile) != NULL;
+}
+
+// The profile value wins over the [build] one
+int fortean_toml_get_profile_bool(fortean_toml_t *cfg, const char *profile, const char *key, int default_value) {
+    char key_path[256];
+    fortean_toml_profile_key(key_path, sizeof(key_path), "build", NULL, key);
+    int val = fortean_toml_get_bool(cfg, key_path, default_value);
+    if (profile) {
+        fortean_toml_profile_key(key_path, sizeof(key_path), "profile", profile, key);
+        val = fortean_toml_get_bool(cfg, key_path, val);
+    }
+    return val;
+}
+
+int fortean_toml_get_profile_int(fortean_toml_t *cfg, const char *profile, const char *key, int default_value) {
+    char key_path[256];
+    fortean_toml_profile_key(key_path, sizeof(key_path), "build", NULL, key);
+    int val = fortean_toml_get_int(cfg, key_path, default_value);
+    if (profile) {
+        fortean_toml_profile_key(key_path, sizeof(key_path), "profile", profile, key);
+        val = fortean_toml_get_int(cfg, key_path, val);
+    }
+    return val;
+}
+
+char *fortean_toml_format_array(const char *key, char **values) {
+    size_t cap = strlen(key) + 16;
+    for (int i = 0; values && values[i]; i++) cap += 2 * strlen(values[i]) + 8;
+    char *out = malloc(cap);
+    if (!out) return NULL;
+
+    //Short lists stay on one line, longer ones get a line per ~70 characters.
+    size_t pos = (size_t)snprintf(out, cap, "%s = [", key);
+    size_t total = 0;
+    for (int i = 0; values && values[i]; i++) total += strlen(values[i]) + 4;
+    int wrap = total > 60;
+    size_t col = 0;
+    for (int i = 0; values && values[i]; i++) {
+        if (wrap && (i == 0 || col > 70)) {
+            if (i > 0) out[pos++] = ',';
+            pos += (size_t)snprintf(out + pos, cap - pos, "\n  ");
+            col = 2;
+        } else if (i > 0) {
+            pos += (size_t)snprintf(out + pos, cap - pos, ", ");
+            col += 2;
+        }
+        out[pos++] = '"';
+        for (const char *c = values[i]; *c; c++) {
+            if (*c == '"' || *c == '\\') out[pos++] = '\\';
+            out[pos++] = *c;
+        }
+        out[pos++] = '"';
+        col += strlen(values[i]) + 2;
+    }
+    if (wrap) out[pos++] = '\n';
+    out[pos++] = ']';
+    out[pos]   = '\0';
+    return out;
+}
+
+//Start of the next line after p
+static const char *next_line(const char *p) {
+    while (*p && *p != '\n') p++;
+    return *p ? p + 1 : p;
+}
+
+static const char *skip_blank(const char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+//End of an array value starting at '[', skipping strings and comments
+static const char *array_end(const char *p) {
+    int depth = 0;
+    for (; *p; p++) {
+        if (*p == '#') {
+            while (*p && *p != '\n') p++;
+            if (!*p) break;
+        } else if (*p == '"' || *p == '\'') {
+            char quote = *p++;
+            while (*p && *p != quote) {
+                if (quote == '"' && *p == '\\' && p[1]) p++;
+                p++;
+            }
+            if (!*p) break;
+        } else if (*p == '[') {
+            depth++;
+        } else if (*p == ']' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return p;
+}
+
+int fortean_toml_set_array(const char *path, const char *table, const char *key, char **values) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    if (!text || fread(text, 1, size, f) != (size_t)size) {
+        free(text);
+        fclose(f);
+        return -1;
+    }
+    text[size] = '\0';
+    fclose(f);
+
+    //The lines of [table], up to the next table header.
+    char header[256];
+    snprintf(header, sizeof(header), "[%s]", table);
+    const char *body = NULL;
+    for (const char *line = text; *line; line = next_line(line)) {
+        const char *p = skip_blank(line);
+        if (strncmp(p, header, strlen(header)) == 0) {
+            body = next_line(line);
+            break;
+        }
+    }
+    if (!body) {
+        free(text);
+        return -1;
+    }
+
+    const char *start = body;
+    const char *end   = body;
+    for (const char *line = body; *line; line = next_line(line)) {
+        const char *p = skip_blank(line);
+        if (*p == '[') break;
+        if (strncmp(p, key, strlen(key)) != 0) continue;
+        const char *eq = skip_blank(p + strlen(key));
+        if (*eq != '=') continue;
+        const char *val = skip_blank(eq + 1);
+        start = line;
+        end   = *val == '[' ? array_end(val) : next_line(line);
+        if (end > start && end[-1] == '\n') end--;
+        break;
+    }
+
+    char *entry = fortean_toml_format_array(key, values);
+    if (!entry) {
+        free(text);
+        return -1;
+    }
+    f = fopen(path, "wb");
+    int ok = f != NULL;
+    if (ok) {
+        fwrite(text, 1, start - text, f);
+        fputs(entry, f);
+        if (start == end) fputs("\n", f);
+        fputs(end, f);
+        if (fclose(f) != 0) ok = 0;
+    }
+    free(entry);
+    free(text);
+    return ok ? 0 : -1;
+}
+
@@ -14,9 +14,46 @@ void fortean_toml_free(fortean_toml_t *cfg);
 //Returns a NULL-terminated array of strings (caller must free all)
 char **fortean_toml_get_array(fortean_toml_t *cfg, const char *key_path);
 
+//Copy a toml array of strings into a NULL-terminated list (caller must free all)
+char **fortean_toml_string_array(toml_array_t *arr);
+
+//Returns a NULL-terminated array of strings stored under key in a table (caller must free all)
+char **fortean_toml_table_get_array(toml_table_t *tbl, const char *key);
+
+//Get an array of tables like [[build.override]] from key_path, or NULL if not found (do NOT free)
+toml_array_t *fortean_toml_get_table_array(fortean_toml_t *cfg, const char *key_path);
+
 //Get a string from key_path, or NULL if not found (do NOT free)
 const char *fortean_toml_get_string(fortean_toml_t *cfg, const char *key_path);
 
+//Get a boolean from key_path, or default_value if not found
+int fortean_toml_get_bool(fortean_toml_t *cfg, const char *key_path, int default_value);
+
+//Get an integer from key_path, or default_value if not found
+int fortean_toml_get_int(fortean_toml_t *cfg, const char *key_path, int default_value);
+
+//Get "profile.<profile>.<key>", falling back to "build.<key>" (profile may be NULL, do NOT free)
+const char *fortean_toml_get_profile_string(fortean_toml_t *cfg, const char *profile, const char *key);
+
+//Array version of the profile lookup (caller must free all)
+char **fortean_toml_get_profile_array(fortean_toml_t *cfg, const char *profile, const char *key);
+
+//Boolean version of the profile lookup
+int fortean_toml_get_profile_bool(fortean_toml_t *cfg, const char *profile, const char *key, int default_value);
+
+//Integer version of the profile lookup
+int fortean_toml_get_profile_int(fortean_toml_t *cfg, const char *profile, const char *key, int default_value);
+
+//Returns 1 if a [profile.<profile>] table exists
+int fortean_toml_has_profile(fortean_toml_t *cfg, const char *profile);
+
+//"key = [...]" with the values quoted, wrapped over several lines when long (caller must free)
+char *fortean_toml_format_array(const char *key, char **values);
+
+//Rewrite the value of key in the [table] of the file at path, or add the key at the top
+//of the table, leaving the rest of the file as it is. Returns 0 on success.
+int fortean_toml_set_array(const char *path, const char *table, const char *key, char **values);
+
 //Get a matrix of strings from a toml file
 char ***extract_string_matrix(toml_table_t* cfg, const char* key, int* rows, int* cols);
 
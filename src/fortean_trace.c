@@ -0,0 +1,428 @@
+//process_vm_readv
+#define _GNU_SOURCE
+
+#include "fortean_trace.h"
+#include "fortean_flags.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+//Append path to a NULL-terminated list unless it is already there
+static int add_unique(char ***list, int *count, const char *path) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*list)[i], path) == 0) return 0;
+    }
+    char **grown = realloc(*list, (*count + 2) * sizeof(char *));
+    if (!grown) return -1;
+    *list = grown;
+    grown[*count] = strdup(path);
+    if (!grown[*count]) return -1;
+    grown[++*count] = NULL;
+    return 0;
+}
+
+static void free_list(char **list, int count) {
+    for (int i = 0; i < count; i++) free(list[i]);
+    free(list);
+}
+
+void fortean_trace_free(fortean_trace_t *trace) {
+    free_list(trace->reads, trace->read_count);
+    free_list(trace->writes, trace->write_count);
+    memset(trace, 0, sizeof(*trace));
+}
+
+#ifdef FORTEAN_TRACE_SUPPORTED
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <elf.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#ifdef __x86_64__
+#define TRACE_AUDIT_ARCH AUDIT_ARCH_X86_64
+#else
+#define TRACE_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#endif
+
+//Handed to the tracer with each stop, so it knows the arguments without the syscall number
+#define TRACE_OPEN    1
+#define TRACE_OPENAT  2
+#define TRACE_OPENAT2 3
+
+//Only the open calls stop the compiler, everything else runs at full speed.
+static struct sock_filter open_filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, TRACE_AUDIT_ARCH, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+#ifdef __NR_open
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_open, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRACE_OPEN),
+#endif
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_openat, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRACE_OPENAT),
+#ifdef __NR_openat2
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_openat2, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRACE_OPENAT2),
+#endif
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+};
+
+//A NUL terminated string from the memory of pid
+static int read_string(pid_t pid, unsigned long addr, char *buf, size_t size) {
+    size_t got = 0;
+    while (got + 1 < size) {
+        //Stay inside the page, the next one may not be mapped.
+        size_t chunk = 4096 - ((addr + got) & 4095);
+        if (chunk > size - 1 - got) chunk = size - 1 - got;
+        struct iovec local  = {buf + got, chunk};
+        struct iovec remote = {(void *)(addr + got), chunk};
+        ssize_t n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        if (n <= 0) return -1;
+        if (memchr(buf + got, '\0', (size_t)n)) return 0;
+        got += (size_t)n;
+    }
+    return -1;
+}
+
+//Record the file of the open call pid stopped at
+static void record_open(pid_t pid, fortean_trace_t *trace, const char *our_cwd) {
+    unsigned long kind = 0;
+    struct user_regs_struct regs;
+    struct iovec io = {&regs, sizeof(regs)};
+    if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &kind) != 0) return;
+    if (ptrace(PTRACE_GETREGSET, pid, (void *)NT_PRSTATUS, &io) != 0) return;
+#ifdef __x86_64__
+    unsigned long long args[3] = {regs.rdi, regs.rsi, regs.rdx};
+#else
+    unsigned long long args[3] = {regs.regs[0], regs.regs[1], regs.regs[2]};
+#endif
+
+    long dirfd = AT_FDCWD;
+    unsigned long addr;
+    unsigned long long flags;
+    if (kind == TRACE_OPEN) {
+        addr  = args[0];
+        flags = args[1];
+    } else {
+        dirfd = (int)args[0];
+        addr  = args[1];
+        flags = args[2];
+        if (kind == TRACE_OPENAT2) {
+            //struct open_how starts with the flags
+            struct iovec local  = {&flags, sizeof(flags)};
+            struct iovec remote = {(void *)(unsigned long)args[2], sizeof(flags)};
+            if (process_vm_readv(pid, &local, 1, &remote, 1, 0) != sizeof(flags)) return;
+        }
+    }
+    if (flags & O_DIRECTORY) return;
+
+    char path[4096];
+    if (read_string(pid, addr, path, sizeof(path)) != 0 || !path[0]) return;
+
+    //Relative paths are kept relative to our directory, the way the scanner spells them.
+    char full[8192];
+    const char *name = path;
+    if (path[0] != '/') {
+        char link[64], dir[4096];
+        if (dirfd == AT_FDCWD) snprintf(link, sizeof(link), "/proc/%d/cwd", (int)pid);
+        else                   snprintf(link, sizeof(link), "/proc/%d/fd/%d", (int)pid, (int)dirfd);
+        ssize_t n = readlink(link, dir, sizeof(dir) - 1);
+        if (n <= 0) return;
+        dir[n] = '\0';
+        if (strcmp(dir, our_cwd) != 0) {
+            snprintf(full, sizeof(full), "%s/%s", dir, path);
+            name = full;
+        }
+        while (name[0] == '.' && name[1] == '/') name += 2;
+    }
+    size_t cwd_len = strlen(our_cwd);
+    if (cwd_len > 1 && strncmp(name, our_cwd, cwd_len) == 0 && name[cwd_len] == '/') name += cwd_len + 1;
+
+    if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC))) {
+        if (add_unique(&trace->writes, &trace->write_count, name) != 0) trace->failed = 1;
+    } else if (add_unique(&trace->reads, &trace->read_count, name) != 0) {
+        trace->failed = 1;
+    }
+}
+
+int fortean_trace_spawn(char **argv, const char *cwd, const char *log, fortean_trace_t *trace,
+                        struct rusage *usage) {
+    char our_cwd[4096];
+    if (!getcwd(our_cwd, sizeof(our_cwd))) our_cwd[0] = '\0';
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        if (log) {
+            int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0 || dup2(fd, STDERR_FILENO) < 0) _exit(127);
+            close(fd);
+        }
+        if (cwd && chdir(cwd) != 0) _exit(127);
+
+        //Without ptrace the compile still runs, only untraced.
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == 0) {
+            raise(SIGSTOP);
+            struct sock_fprog prog = {sizeof(open_filter) / sizeof(open_filter[0]), open_filter};
+            if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0) prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage ru;
+    if (wait4(pid, &status, __WALL, &ru) < 0) return -1;
+    if (!WIFSTOPPED(status)) {
+        if (usage) *usage = ru;
+        trace->failed = 1;
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+    long options = PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |
+                   PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)options) != 0) trace->failed = 1;
+    ptrace(PTRACE_CONT, pid, NULL, NULL);
+
+    //Wait for the compiler and everything it started. __WNOTHREAD keeps the compiles
+    //traced on other threads apart.
+    int code = -1, live = 1, root_done = 0;
+    while (live > 0 || !root_done) {
+        pid_t p = wait4(-1, &status, __WALL | __WNOTHREAD, &ru);
+        if (p < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            live--;
+            if (p == pid) {
+                if (usage) *usage = ru;
+                root_done = 1;
+                code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            }
+            continue;
+        }
+        if (!WIFSTOPPED(status)) continue;
+        int sig   = WSTOPSIG(status);
+        int event = (unsigned int)status >> 16;
+        if (event == PTRACE_EVENT_SECCOMP) record_open(p, trace, our_cwd);
+        if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK || event == PTRACE_EVENT_CLONE) live++;
+
+        //New children start stopped and exec stops with SIGTRAP, real signals go through.
+        int deliver = (event == 0 && sig != SIGTRAP && sig != SIGSTOP) ? sig : 0;
+        ptrace(PTRACE_CONT, p, NULL, (void *)(long)deliver);
+    }
+    return code;
+}
+
+#else
+
+int fortean_trace_spawn(char **argv, const char *cwd, const char *log, fortean_trace_t *trace,
+                        struct rusage *usage) {
+    (void)argv;
+    (void)cwd;
+    (void)log;
+    (void)usage;
+    trace->failed = 1;
+    return -1;
+}
+
+#endif
+
+//Files every compile opens that aren't dependencies of the source: the compiler, its
+//libraries and intrinsic modules, which the flag fingerprint covers, and system state.
+static int is_system_file(const char *path) {
+    static const char *prefixes[] = {"/proc/", "/sys/", "/dev/", "/etc/", "/tmp/", "/var/", "/run/",
+                                     "/usr/lib", "/usr/libexec", "/usr/local/lib", "/lib", "/opt/rh/", NULL};
+    for (int i = 0; prefixes[i]; i++) {
+        if (strncmp(path, prefixes[i], strlen(prefixes[i])) == 0) return 1;
+    }
+    const char *tmp = getenv("TMPDIR");
+    if (tmp && tmp[0] && strncmp(path, tmp, strlen(tmp)) == 0) return 1;
+    return strstr(path, ".so") != NULL && (strstr(path, ".so.") || strcmp(path + strlen(path) - 3, ".so") == 0);
+}
+
+//gfortran writes a module to <name>.mod0 and renames it over <name>.mod when it changed.
+static int module_file(const char *path, char *buf, size_t size) {
+    size_t n = strlen(path);
+    if (n > 5 && strcmp(path + n - 5, ".mod0") == 0) n--;
+    else if (n > 6 && strcmp(path + n - 6, ".smod0") == 0) n--;
+    else if (!(n > 4 && strcmp(path + n - 4, ".mod") == 0) && !(n > 5 && strcmp(path + n - 5, ".smod") == 0)) {
+        return 0;
+    }
+    snprintf(buf, size, "%.*s", (int)n, path);
+    return 1;
+}
+
+static fortean_tracedb_entry_t *db_entry(fortean_tracedb_t *db, const char *source) {
+    HashEntry *e = hash_entry_get(db->index, source);
+    if (e) return &db->entries[e->file_hash];
+    if (db->count == db->cap) {
+        int cap = db->cap ? db->cap * 2 : 256;
+        fortean_tracedb_entry_t *grown = realloc(db->entries, cap * sizeof(fortean_tracedb_entry_t));
+        if (!grown) return NULL;
+        db->entries = grown;
+        db->cap     = cap;
+    }
+    fortean_tracedb_entry_t *entry = &db->entries[db->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->source = strdup(source);
+    if (!entry->source) return NULL;
+    hash_entry_put(db->index, source, (unsigned int)db->count);
+    db->count++;
+    return entry;
+}
+
+static int entry_add_read(fortean_tracedb_entry_t *entry, const char *path, unsigned int hash) {
+    int count = entry->read_count;
+    if (add_unique(&entry->reads, &entry->read_count, path) != 0) return -1;
+    if (entry->read_count == count) return 0;
+    unsigned int *hashes = realloc(entry->hashes, entry->read_count * sizeof(unsigned int));
+    if (!hashes) return -1;
+    entry->hashes = hashes;
+    hashes[entry->read_count - 1] = hash;
+    return 0;
+}
+
+static void entry_clear(fortean_tracedb_entry_t *entry) {
+    free_list(entry->reads, entry->read_count);
+    free_list(entry->writes, entry->write_count);
+    free(entry->hashes);
+    entry->reads       = NULL;
+    entry->writes      = NULL;
+    entry->hashes      = NULL;
+    entry->read_count  = 0;
+    entry->write_count = 0;
+}
+
+void fortean_tracedb_load(fortean_tracedb_t *db, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    char line[4200];
+    fortean_tracedb_entry_t *entry = NULL;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == 's' && line[1] == ' ') {
+            entry = db_entry(db, line + 2);
+        } else if (entry && line[0] == 'r' && line[1] == ' ') {
+            unsigned int hash = 0;
+            int skip = 0;
+            if (sscanf(line + 2, "%u %n", &hash, &skip) == 1 && skip > 0) entry_add_read(entry, line + 2 + skip, hash);
+        } else if (entry && line[0] == 'w' && line[1] == ' ') {
+            if (add_unique(&entry->writes, &entry->write_count, line + 2) == 0) {
+                hash_entry_put(db->writers, line + 2, (unsigned int)(entry - db->entries));
+            }
+        }
+    }
+    fclose(f);
+}
+
+int fortean_tracedb_save(const fortean_tracedb_t *db, const char *path, const fortean_graph_t *graph) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    for (int i = 0; i < db->count; i++) {
+        const fortean_tracedb_entry_t *entry = &db->entries[i];
+        if (fortean_graph_find(graph, entry->source) < 0) continue;
+        fprintf(f, "s %s\n", entry->source);
+        for (int r = 0; r < entry->read_count; r++) fprintf(f, "r %u %s\n", entry->hashes[r], entry->reads[r]);
+        for (int w = 0; w < entry->write_count; w++) fprintf(f, "w %s\n", entry->writes[w]);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void fortean_tracedb_record(fortean_tracedb_t *db, const char *source, const fortean_trace_t *trace) {
+    if (trace->failed) {
+        db->failed = 1;
+        return;
+    }
+    fortean_tracedb_entry_t *entry = db_entry(db, source);
+    if (!entry) return;
+    entry_clear(entry);
+
+    char mod[4096];
+    for (int i = 0; i < trace->write_count; i++) {
+        if (!module_file(trace->writes[i], mod, sizeof(mod))) continue;
+        if (add_unique(&entry->writes, &entry->write_count, mod) == 0) {
+            hash_entry_put(db->writers, mod, (unsigned int)(entry - db->entries));
+        }
+    }
+    for (int i = 0; i < trace->read_count; i++) {
+        const char *path = trace->reads[i];
+        if (is_system_file(path) || fortean_path_equal(path, source)) continue;
+        //gfortran reads the module it is about to replace to compare them.
+        int own = 0;
+        for (int w = 0; w < entry->write_count && !own; w++) own = strcmp(entry->writes[w], path) == 0;
+        struct stat st;
+        if (own || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        entry_add_read(entry, path, hash_file_fnv1a(path));
+    }
+}
+
+int fortean_tracedb_merge(const fortean_tracedb_t *db, fortean_graph_t *graph) {
+    int added = 0, reorder = 0;
+    for (int i = 0; i < db->count; i++) {
+        const fortean_tracedb_entry_t *entry = &db->entries[i];
+        int file = -1;
+        for (int r = 0; r < entry->read_count; r++) {
+            HashEntry *writer = hash_entry_get((HashEntry **)db->writers, entry->reads[r]);
+            if (!writer || (int)writer->file_hash == i) continue;
+            if (file < 0) file = fortean_graph_find(graph, entry->source);
+            if (file < 0) break;
+            int dep = fortean_graph_find(graph, db->entries[writer->file_hash].source);
+            if (dep < 0) continue;
+            int res = fortean_graph_add_dep(graph, file, dep);
+            if (res < 0) return -1;
+            added += res;
+            if (res > 0 && dep > file) reorder = 1;
+        }
+    }
+    if (reorder && fortean_graph_sort(graph) != 0) return -1;
+    return added;
+}
+
+int fortean_tracedb_changed(fortean_tracedb_t *db, const char *source) {
+    HashEntry *e = hash_entry_get(db->index, source);
+    if (!e) return 0;
+    const fortean_tracedb_entry_t *entry = &db->entries[e->file_hash];
+    for (int r = 0; r < entry->read_count; r++) {
+        //The modules of the project come with the sources that write them.
+        if (hash_entry_get(db->writers, entry->reads[r])) continue;
+        HashEntry *now = hash_entry_get(db->current, entry->reads[r]);
+        if (!now) {
+            hash_entry_put(db->current, entry->reads[r], hash_file_fnv1a(entry->reads[r]));
+            now = hash_entry_get(db->current, entry->reads[r]);
+        }
+        if (!now || now->file_hash != entry->hashes[r]) return 1;
+    }
+    return 0;
+}
+
+void fortean_tracedb_free(fortean_tracedb_t *db) {
+    for (int i = 0; i < db->count; i++) {
+        entry_clear(&db->entries[i]);
+        free(db->entries[i].source);
+    }
+    free(db->entries);
+    free_prev_hash_table(db->index);
+    free_prev_hash_table(db->writers);
+    free_prev_hash_table(db->current);
+    memset(db, 0, sizeof(*db));
+}
@@ -0,0 +1,74 @@
+#ifndef FORTEAN_TRACE_H
+#define FORTEAN_TRACE_H
+
+#include "fortean_graph.h"
+
+//Files a compile really opened, recorded by running the compiler under ptrace with a
+//seccomp filter that only stops it (and the programs it starts) at open calls. Linux
+//on x86-64 and arm64 only.
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define FORTEAN_TRACE_SUPPORTED
+#endif
+
+typedef struct {
+    char **reads;            // Opened for reading, NULL-terminated
+    int read_count;
+    char **writes;           // Opened for writing
+    int write_count;
+    int failed;              // The program ran without tracing, e.g. ptrace isn't permitted
+} fortean_trace_t;
+
+struct rusage;
+
+//Start argv (in cwd and with its output in log, when not NULL), wait for it and record
+//the files it and its children open, and what it used in usage when not NULL. Returns
+//the exit code, or -1 when it could not be started.
+int fortean_trace_spawn(char **argv, const char *cwd, const char *log, fortean_trace_t *trace,
+                        struct rusage *usage);
+
+void fortean_trace_free(fortean_trace_t *trace);
+
+//Dependencies of the sources seen by tracing their last compile, kept in
+//.cache/trace.dep. A module file read that another source writes makes the reader use
+//that source, every other file read is checked by its content hash.
+typedef struct {
+    char *source;
+    char **reads;            // Files the compile read, the source itself left out
+    unsigned int *hashes;    // Content of each read file when it was recorded
+    int read_count;
+    char **writes;           // Module files the compile wrote
+    int write_count;
+} fortean_tracedb_entry_t;
+
+typedef struct {
+    fortean_tracedb_entry_t *entries;
+    int count;
+    int cap;
+    HashEntry *index[HASH_TABLE_SIZE];     // Source -> entry
+    HashEntry *writers[HASH_TABLE_SIZE];   // Module file -> entry of the source writing it
+    HashEntry *current[HASH_TABLE_SIZE];   // Hash of each checked file in this build
+    int failed;                            // A compile couldn't be traced
+} fortean_tracedb_t;
+
+//Load the recorded dependencies. A missing file leaves db empty.
+void fortean_tracedb_load(fortean_tracedb_t *db, const char *path);
+
+//Save the entries of the sources still in graph. Returns 0 on success.
+int fortean_tracedb_save(const fortean_tracedb_t *db, const char *path, const fortean_graph_t *graph);
+
+//Replace the entry of source with what its compile opened. System files, the
+//compiler's own files and the files the compile wrote are left out.
+void fortean_tracedb_record(fortean_tracedb_t *db, const char *source, const fortean_trace_t *trace);
+
+//Add the uses the scanner missed: a source that read a module file written by another
+//source uses it. Edges that would close a cycle are skipped and the graph is put back
+//in build order. Returns the number of edges added, -1 on a memory error.
+int fortean_tracedb_merge(const fortean_tracedb_t *db, fortean_graph_t *graph);
+
+//1 if a file the last compile of source read, other than the modules of the project,
+//has changed since
+int fortean_tracedb_changed(fortean_tracedb_t *db, const char *source);
+
+void fortean_tracedb_free(fortean_tracedb_t *db);
+
+#endif // FORTEAN_TRACE_H
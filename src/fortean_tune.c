@@ -0,0 +1,459 @@
+#include "fortean_tune.h"
+#include "fortean_toml.h"
+#include "fortean_cmd.h"
+#include "fortean_flags.h"
+#include "fortean_hash.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define PATH_SEP '\\'
+#define MAKE_DIR(path) _mkdir(path)
+#else
+#define PATH_SEP '/'
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+#define TUNE_MAX_OPTIONS    8
+#define TUNE_MAX_CANDIDATES 64
+#define TUNE_BASELINE       "tune-base"
+
+typedef enum {
+    TUNE_DONE,
+    TUNE_PRUNED,         // Clearly slower than the best candidate so far
+    TUNE_BUILD_FAILED,
+    TUNE_RUN_FAILED,
+    TUNE_CHECK_FAILED    // The [tune] check command rejected the results
+} tune_status_t;
+
+static const char *status_names[] = {"done", "pruned", "build failed", "run failed", "check failed"};
+
+typedef struct {
+    char **add;          // Flags of the candidate (NULL-terminated), NULL for the current flags
+    char *label;
+    char variant[32];    // tune-<fingerprint>, so equal flag sets share their objects
+    double *times;
+    int runs;
+    double median;
+    double best;
+    tune_status_t status;
+} tune_candidate_t;
+
+static void free_list(char **list) {
+    for (int i = 0; list && list[i]; i++) free(list[i]);
+    free(list);
+}
+
+static int list_len(char **list) {
+    int n = 0;
+    while (list && list[n]) n++;
+    return n;
+}
+
+//Append a copy of item to a NULL-terminated list, skipping duplicates
+static int list_add_unique(char ***list, const char *item) {
+    int n = list_len(*list);
+    for (int i = 0; i < n; i++) {
+        if (strcmp((*list)[i], item) == 0) return 0;
+    }
+    char **grown = realloc(*list, (n + 2) * sizeof(char *));
+    if (!grown) return -1;
+    *list = grown;
+    (*list)[n]     = strdup(item);
+    (*list)[n + 1] = NULL;
+    return (*list)[n] ? 0 : -1;
+}
+
+//Split "-O3 -march=native" into a NULL-terminated list
+static char **split_flags(const char *str) {
+    char **list = calloc(1, sizeof(char *));
+    char flag[256];
+    while (list && *str) {
+        while (*str && isspace((unsigned char)*str)) str++;
+        size_t n = 0;
+        while (*str && !isspace((unsigned char)*str) && n < sizeof(flag) - 1) flag[n++] = *str++;
+        flag[n] = '\0';
+        if (n > 0 && list_add_unique(&list, flag) != 0) {
+            free_list(list);
+            return NULL;
+        }
+    }
+    return list;
+}
+
+static int add_candidate(tune_candidate_t *cands, int *count, char **add, char **files, char **remove) {
+    //The directory name covers everything that changes the objects.
+    unsigned int hash = FNV_SEED;
+    char **parts[] = {files, remove, add};
+    for (int p = 0; p < 3; p++) {
+        for (int i = 0; parts[p] && parts[p][i]; i++) {
+            hash = hash_str_fnv1a(parts[p][i], hash);
+            hash = hash_str_fnv1a("\x1f", hash);
+        }
+        hash = hash_str_fnv1a("\x1e", hash);
+    }
+    char variant[32];
+    snprintf(variant, sizeof(variant), "tune-%08x", hash);
+    for (int i = 1; i < *count; i++) {
+        if (strcmp(cands[i].variant, variant) == 0) {
+            free_list(add);
+            return 0;
+        }
+    }
+    if (*count >= TUNE_MAX_CANDIDATES) {
+        free_list(add);
+        return -1;
+    }
+    tune_candidate_t *c = &cands[(*count)++];
+    memset(c, 0, sizeof(*c));
+    c->add   = add;
+    c->label = fortean_flags_join(add, list_len(add));
+    snprintf(c->variant, sizeof(c->variant), "%s", variant);
+    return 0;
+}
+
+static double median_of(const double *times, int n) {
+    if (n == 0) return 0.0;
+    double *sorted = malloc(n * sizeof(double));
+    if (!sorted) return times[0];
+    memcpy(sorted, times, n * sizeof(double));
+    for (int i = 1; i < n; i++) {
+        double v = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    double m = n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+    free(sorted);
+    return m;
+}
+
+//Run one line through the shell, returning the wall time and setting the exit code
+static double time_command(const char *line, int *status) {
+    fortean_cmd_t cmd;
+    fortean_cmd_init_shell(&cmd, line);
+    double start = fortean_wall_time();
+    *status      = fortean_cmd_run(&cmd);
+    double secs  = fortean_wall_time() - start;
+    fortean_cmd_free(&cmd);
+    return secs;
+}
+
+//Build and time one candidate. A candidate whose fastest run so far is more than
+//prune percent behind the best median so far is dropped without the remaining runs.
+static void run_candidate(tune_candidate_t *c, const fortean_build_opts_t *opts, int is_base,
+                          char **files, char **remove, const char *bench, const char *check,
+                          int repeat, int prune, double best) {
+    fortean_build_opts_t build = *opts;
+    build.variant = c->variant;
+    if (!is_base) {
+        build.seed         = TUNE_BASELINE;
+        build.remove_flags = remove;
+        build.add_flags    = c->add;
+        build.flag_files   = files;
+    }
+    if (fortean_build_project_incremental(&build) != 0) {
+        c->status = TUNE_BUILD_FAILED;
+        return;
+    }
+
+    c->times = calloc(repeat, sizeof(double));
+    if (!c->times) {
+        c->status = TUNE_RUN_FAILED;
+        return;
+    }
+    for (int r = 0; r < repeat; r++) {
+        int status  = 0;
+        double secs = time_command(bench, &status);
+        if (status != 0) {
+            c->status = TUNE_RUN_FAILED;
+            break;
+        }
+        c->times[c->runs++] = secs;
+        if (c->runs == 1 || secs < c->best) c->best = secs;
+
+        if (r == 0 && check) {
+            time_command(check, &status);
+            if (status != 0) {
+                c->status = TUNE_CHECK_FAILED;
+                break;
+            }
+        }
+        if (best > 0.0 && prune > 0 && c->best > best * (1.0 + prune / 100.0)) {
+            c->status = TUNE_PRUNED;
+            break;
+        }
+    }
+    c->median = median_of(c->times, c->runs);
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%s: median %.3f s over %d runs (%s)", c->label, c->median, c->runs,
+             status_names[c->status]);
+    print_info(msg);
+}
+
+//Report of every candidate, fastest first, printed and written to .cache/tune/report.md
+static void write_report(tune_candidate_t *cands, int count, const int *order, const char *bench,
+                         char **files, int repeat) {
+    MAKE_DIR(".cache");
+    char report[256];
+    snprintf(report, sizeof(report), ".cache%ctune", PATH_SEP);
+    MAKE_DIR(report);
+    snprintf(report, sizeof(report), ".cache%ctune%creport.md", PATH_SEP, PATH_SEP);
+    FILE *fp = fopen(report, "w");
+    if (fp) {
+        fprintf(fp, "# fortean tune\n\nBenchmark: `%s`, up to %d runs per candidate.\n", bench, repeat);
+        if (files) {
+            char *joined = fortean_flags_join(files, list_len(files));
+            fprintf(fp, "Tuned files: `%s`\n", joined ? joined : "");
+            free(joined);
+        }
+        fprintf(fp, "\n| Rank | Flags | Median (s) | Fastest (s) | Runs | Speedup | Status |\n");
+        fprintf(fp, "| ---- | ----- | ---------- | ----------- | ---- | ------- | ------ |\n");
+    }
+
+    double base = cands[0].status == TUNE_DONE ? cands[0].median : 0.0;
+    print_info("Rank  Median(s)  Fastest(s)  Runs  Speedup  Flags");
+    for (int k = 0; k < count; k++) {
+        tune_candidate_t *c = &cands[order[k]];
+        char speedup[32] = "-";
+        if (base > 0.0 && c->runs > 0 && c->median > 0.0) snprintf(speedup, sizeof(speedup), "%.2fx", base / c->median);
+        char msg[700];
+        snprintf(msg, sizeof(msg), "%4d  %9.3f  %10.3f  %4d  %7s  %s%s%s%s", k + 1, c->median, c->best, c->runs,
+                 speedup, c->label, c->status != TUNE_DONE ? " (" : "",
+                 c->status != TUNE_DONE ? status_names[c->status] : "", c->status != TUNE_DONE ? ")" : "");
+        print_info(msg);
+        if (fp) {
+            fprintf(fp, "| %d | `%s` | %.3f | %.3f | %d | %s | %s |\n", k + 1, c->label, c->median, c->best,
+                    c->runs, speedup, status_names[c->status]);
+        }
+    }
+    if (fp) {
+        fclose(fp);
+        char msg[300];
+        snprintf(msg, sizeof(msg), "Report written to %s", report);
+        print_ok(msg);
+    }
+}
+
+static int ask_yes_no(const char *question) {
+    printf("%s [y/N] ", question);
+    fflush(stdout);
+    char answer[16];
+    if (!fgets(answer, sizeof(answer), stdin)) return 0;
+    return answer[0] == 'y' || answer[0] == 'Y';
+}
+
+//Keep the winning flags: build.flags edited like the candidate was, or a new
+//[[build.override]] for the tuned files.
+static int apply_flags(fortean_toml_t *cfg, char **files, char **remove, char **add) {
+    if (files) {
+        FILE *fp = fopen("Fortean.toml", "a");
+        if (!fp) return -1;
+        char *keys[]   = {"files", "remove", "add"};
+        char **vals[]  = {files, remove, add};
+        fprintf(fp, "\n#Chosen by fortean tune\n[[build.override]]\n");
+        for (int i = 0; i < 3; i++) {
+            char *entry = fortean_toml_format_array(keys[i], vals[i]);
+            if (entry) fprintf(fp, "%s\n", entry);
+            free(entry);
+        }
+        return fclose(fp) == 0 ? 0 : -1;
+    }
+
+    char **flags = fortean_toml_get_array(cfg, "build.flags");
+    int count    = list_len(flags);
+    int res      = fortean_flags_edit(&flags, &count, remove, add);
+    char **terminated = res == 0 ? realloc(flags, (count + 1) * sizeof(char *)) : NULL;
+    if (!terminated) {
+        fortean_flags_free(flags, count);
+        return -1;
+    }
+    terminated[count] = NULL;
+    res = fortean_toml_set_array("Fortean.toml", "build", "flags", terminated);
+    fortean_flags_free(terminated, count);
+    return res;
+}
+
+int fortean_tune_run(const fortean_build_opts_t *opts) {
+    int result = -1;
+    int count  = 0;
+    int *order = NULL;
+    tune_candidate_t *cands = NULL;
+    char **levels  = NULL;
+    char **options = NULL;
+    char **extra   = NULL;
+    char **files   = NULL;
+    char **remove  = NULL;
+
+    fortean_toml_t cfg = {0};
+    if (fortean_toml_load("Fortean.toml", &cfg) != 0) {
+        print_error("Failed to load project.toml.");
+        return -1;
+    }
+
+    const char *bench = fortean_toml_get_string(&cfg, "tune.run");
+    const char *check = fortean_toml_get_string(&cfg, "tune.check");
+    int repeat        = fortean_toml_get_int(&cfg, "tune.repeat", 5);
+    int prune         = fortean_toml_get_int(&cfg, "tune.prune", 20);
+    if (repeat < 1) repeat = 1;
+    levels  = fortean_toml_get_array(&cfg, "tune.levels");
+    options = fortean_toml_get_array(&cfg, "tune.options");
+    extra   = fortean_toml_get_array(&cfg, "tune.candidates");
+    files   = fortean_toml_get_array(&cfg, "tune.files");
+    remove  = fortean_toml_get_array(&cfg, "tune.remove");
+    if (!bench) {
+        print_error("No benchmark, add [tune] run = \"./app input\" to Fortean.toml.");
+        goto cleanup;
+    }
+    if (list_len(options) > TUNE_MAX_OPTIONS) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "At most %d tune.options, every combination of them is built.", TUNE_MAX_OPTIONS);
+        print_error(msg);
+        goto cleanup;
+    }
+
+    //The current flags come first, as the baseline the others are seeded from and
+    //compared with. Then every level with every combination of the options, then the
+    //candidates given in full.
+    cands = calloc(TUNE_MAX_CANDIDATES, sizeof(tune_candidate_t));
+    order = calloc(TUNE_MAX_CANDIDATES, sizeof(int));
+    if (!cands || !order) {
+        print_error("Memory allocation error for the tuning candidates.");
+        goto cleanup;
+    }
+    snprintf(cands[0].variant, sizeof(cands[0].variant), "%s", TUNE_BASELINE);
+    cands[0].label = strdup("(current flags)");
+    count = 1;
+
+    int level_count  = levels ? list_len(levels) : 1;
+    int option_count = list_len(options);
+    int too_many     = 0;
+    for (int l = 0; l < level_count && (levels || options); l++) {
+        for (int mask = 0; mask < (1 << option_count); mask++) {
+            char **add = calloc(1, sizeof(char *));
+            if (add && levels) list_add_unique(&add, levels[l]);
+            for (int o = 0; add && o < option_count; o++) {
+                if (mask & (1 << o)) list_add_unique(&add, options[o]);
+            }
+            if (!add || list_len(add) == 0) {
+                free_list(add);
+                continue;
+            }
+            if (add_candidate(cands, &count, add, files, remove) != 0) too_many = 1;
+        }
+    }
+    for (int i = 0; extra && extra[i]; i++) {
+        char **add = split_flags(extra[i]);
+        if (add && add_candidate(cands, &count, add, files, remove) != 0) too_many = 1;
+    }
+    if (too_many) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "More than %d candidates, only the first ones are tried.", TUNE_MAX_CANDIDATES);
+        print_info(msg);
+    }
+    if (count < 2) {
+        print_error("No candidates, add [tune] levels, options or candidates to Fortean.toml.");
+        goto cleanup;
+    }
+
+    //By default a candidate replaces the optimisation level and every flag the search
+    //space uses, so the baseline's own choices do not leak into it.
+    if (!remove) {
+        int failed = list_add_unique(&remove, "-O*") != 0;
+        for (int i = 1; i < count; i++) {
+            for (int j = 0; cands[i].add[j]; j++) {
+                if (strncmp(cands[i].add[j], "-O", 2) == 0) continue;
+                failed |= list_add_unique(&remove, cands[i].add[j]) != 0;
+            }
+        }
+        if (failed) {
+            print_error("Memory allocation error for the tuning candidates.");
+            goto cleanup;
+        }
+    }
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Tuning %d flag sets with up to %d runs of: %s", count - 1, repeat, bench);
+    print_info(msg);
+    double best = 0.0;
+    for (int i = 0; i < count; i++) {
+        snprintf(msg, sizeof(msg), "Candidate %d of %d: %s", i + 1, count, cands[i].label);
+        print_info(msg);
+        run_candidate(&cands[i], opts, i == 0, files, remove, bench, check, repeat, prune, best);
+        if (cands[i].status == TUNE_DONE && (best == 0.0 || cands[i].median < best)) best = cands[i].median;
+        if (i == 0 && cands[0].status != TUNE_DONE) {
+            print_error("The benchmark failed with the current flags, fix it before tuning.");
+            goto cleanup;
+        }
+    }
+
+    //Finished candidates by median, then the pruned and failed ones.
+    for (int i = 0; i < count; i++) order[i] = i;
+    for (int i = 1; i < count; i++) {
+        int v = order[i];
+        int j = i - 1;
+        while (j >= 0) {
+            tune_candidate_t *a = &cands[order[j]], *b = &cands[v];
+            int later = a->status != b->status ? a->status > b->status : a->median > b->median;
+            if (!later) break;
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = v;
+    }
+    write_report(cands, count, order, bench, files, repeat);
+    print_info("The executable is from the last candidate, fortean build relinks it with your flags.");
+
+    tune_candidate_t *winner = &cands[order[0]];
+    if (order[0] == 0) {
+        print_ok("The current flags are the fastest.");
+        result = 0;
+        goto cleanup;
+    }
+    snprintf(msg, sizeof(msg), "Fastest: %s, %.2fx the speed of the current flags.", winner->label,
+             cands[0].median / winner->median);
+    print_ok(msg);
+    if (opts->profile) {
+        snprintf(msg, sizeof(msg), "Add the flags to [profile.%s] to use them.", opts->profile);
+        print_info(msg);
+        result = 0;
+        goto cleanup;
+    }
+    if (ask_yes_no(files ? "Add a [[build.override]] with these flags for the tuned files to Fortean.toml?"
+                         : "Write these flags to build.flags in Fortean.toml?")) {
+        if (apply_flags(&cfg, files, remove, winner->add) != 0) {
+            print_error("Failed to update Fortean.toml.");
+            goto cleanup;
+        }
+        print_ok("Updated Fortean.toml.");
+    } else {
+        print_info("Fortean.toml is unchanged.");
+    }
+    result = 0;
+
+cleanup:
+    for (int i = 0; cands && i < count; i++) {
+        free_list(cands[i].add);
+        free(cands[i].label);
+        free(cands[i].times);
+    }
+    free(cands);
+    free(order);
+    free_list(levels);
+    free_list(options);
+    free_list(extra);
+    free_list(files);
+    free_list(remove);
+    fortean_toml_free(&cfg);
+    return result;
+}
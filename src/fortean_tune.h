@@ -0,0 +1,11 @@
+#ifndef FORTEAN_TUNE_H
+#define FORTEAN_TUNE_H
+
+#include "fortean_build.h"
+
+//fortean tune: build every candidate flag set of [tune] in its own obj/mod directories,
+//time the benchmark command on each, write a report and offer to keep the fastest
+//flags. Returns 0 on success.
+int fortean_tune_run(const fortean_build_opts_t *opts);
+
+#endif // FORTEAN_TUNE_H
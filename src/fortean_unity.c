@@ -0,0 +1,252 @@
+#include "fortean_unity.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define PATH_SEP '\\'
+#else
+#define PATH_SEP '/'
+#endif
+
+//Whole file in memory (caller must free), NULL when it cannot be read
+static char *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = len >= 0 ? malloc((size_t)len + 1) : NULL;
+    if (data && fread(data, 1, (size_t)len, fp) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (!data) return NULL;
+    data[len] = '\0';
+    *size = (size_t)len;
+    return data;
+}
+
+//A source may join an open unit while the unit is small enough and everything the
+//source uses is in the unit or was placed before the unit was started. Anything placed
+//earlier cannot use the unit, so the units never form a cycle.
+static int can_join(const fortean_graph_t *graph, const fortean_unity_t *unity, int u, int node,
+                    const int *node_src, const int *seq_of, const unsigned char *in_build,
+                    int max_files, long max_bytes) {
+    const fortean_unit_t *unit = &unity->units[u];
+    if (max_files > 0 && unit->member_count >= max_files) return 0;
+    if (max_bytes > 0 && (long)unit->bytes >= max_bytes) return 0;
+    for (int d = 0; d < graph->dep_count[node]; d++) {
+        int s = node_src[graph->deps[node][d]];
+        if (s < 0 || !in_build[s] || unity->unit_of[s] == u) continue;
+        if (seq_of[s] >= unit->open_seq) return 0;
+    }
+    return 1;
+}
+
+int fortean_unity_plan(const fortean_graph_t *graph, char **sources, const int *src_node, int src_count,
+                       const unsigned char *in_build, const unsigned char *eligible,
+                       const unsigned int *key, const unsigned char *fixed,
+                       int max_files, long max_bytes, const char *dir, fortean_unity_t *unity) {
+    memset(unity, 0, sizeof(*unity));
+    int n = src_count > 0 ? src_count : 1;
+    unity->units      = calloc(n, sizeof(fortean_unit_t));
+    unity->unit_of    = malloc(n * sizeof(int));
+    unity->item_of    = malloc(n * sizeof(int));
+    unity->item_unit  = malloc(n * sizeof(int));
+    unity->item_src   = malloc(n * sizeof(int));
+    unity->item_level = calloc(n, sizeof(int));
+    int *seq_of   = calloc(n, sizeof(int));
+    int *open     = calloc(n, sizeof(int));
+    int *node_src = malloc((graph->count > 0 ? graph->count : 1) * sizeof(int));
+    int res = -1;
+    if (!unity->units || !unity->unit_of || !unity->item_unit || !unity->item_src ||
+        !unity->item_of || !unity->item_level || !seq_of || !open || !node_src) {
+        print_error("Memory allocation error for the unity build.");
+        goto cleanup;
+    }
+    for (int i = 0; i < graph->count; i++) node_src[i] = -1;
+    for (int i = 0; i < src_count; i++) {
+        node_src[src_node[i]] = i;
+        unity->unit_of[i]     = -1;
+        unity->item_of[i]     = -1;
+    }
+
+    int seq        = 0;
+    int open_count = 0;
+    for (int i = 0; i < src_count; i++) {
+        if (!in_build[i]) continue;
+        if (!eligible[i]) {
+            seq_of[i]         = seq++;
+            unity->item_of[i] = unity->item_count;
+            unity->item_unit[unity->item_count] = -1;
+            unity->item_src[unity->item_count]  = i;
+            unity->item_count++;
+            continue;
+        }
+
+        //The open unit for this key, closed when the source cannot join it.
+        int u = -1;
+        for (int k = 0; k < open_count; k++) {
+            int first = unity->units[open[k]].members[0];
+            if (key[first] != key[i] || fixed[first] != fixed[i]) continue;
+            if (can_join(graph, unity, open[k], src_node[i], node_src, seq_of, in_build, max_files, max_bytes)) {
+                u = open[k];
+            } else {
+                open[k] = open[--open_count];
+            }
+            break;
+        }
+        if (u < 0) {
+            u = unity->unit_count++;
+            fortean_unit_t *unit = &unity->units[u];
+            size_t len = strlen(dir) + 32;
+            unit->path = malloc(len);
+            unit->members = malloc(sizeof(int));
+            if (!unit->path || !unit->members) {
+                print_error("Memory allocation error for the unity build.");
+                goto cleanup;
+            }
+            snprintf(unit->path, len, "%s%cunit_%03d.%s", dir, PATH_SEP, u, fixed[i] ? "F" : "F90");
+            unit->open_seq = seq++;
+            unit->item     = unity->item_count;
+            unity->item_unit[unity->item_count] = u;
+            unity->item_src[unity->item_count]  = -1;
+            unity->item_count++;
+            open[open_count++] = u;
+        }
+
+        fortean_unit_t *unit = &unity->units[u];
+        int *members = realloc(unit->members, (unit->member_count + 1) * sizeof(int));
+        if (!members) {
+            print_error("Memory allocation error for the unity build.");
+            goto cleanup;
+        }
+        unit->members = members;
+        unit->members[unit->member_count++] = i;
+        struct stat st;
+        if (stat(sources[i], &st) == 0) unit->bytes += (size_t)st.st_size;
+        unity->unit_of[i] = u;
+        unity->item_of[i] = unit->item;
+        seq_of[i]         = seq++;
+    }
+
+    //Everything an item uses comes from an earlier item, so one pass gives the levels.
+    for (int it = 0; it < unity->item_count; it++) {
+        int u     = unity->item_unit[it];
+        int count = u >= 0 ? unity->units[u].member_count : 1;
+        int level = 0;
+        for (int m = 0; m < count; m++) {
+            int node = src_node[u >= 0 ? unity->units[u].members[m] : unity->item_src[it]];
+            for (int d = 0; d < graph->dep_count[node]; d++) {
+                int s = node_src[graph->deps[node][d]];
+                if (s < 0 || !in_build[s]) continue;
+                int dep_item = unity->item_of[s];
+                if (dep_item != it && unity->item_level[dep_item] + 1 > level) {
+                    level = unity->item_level[dep_item] + 1;
+                }
+            }
+        }
+        unity->item_level[it] = level;
+    }
+    res = 0;
+
+cleanup:
+    free(seq_of);
+    free(open);
+    free(node_src);
+    if (res != 0) fortean_unity_free(unity);
+    return res;
+}
+
+int fortean_unity_write(fortean_unity_t *unity, char **sources) {
+    for (int u = 0; u < unity->unit_count; u++) {
+        fortean_unit_t *unit = &unity->units[u];
+
+        size_t cap  = unit->bytes + 256 * (size_t)unit->member_count + 1;
+        size_t size = 0;
+        char *text  = malloc(cap);
+        if (!text) {
+            print_error("Memory allocation error for the unity build.");
+            return -1;
+        }
+        for (int m = 0; m < unit->member_count; m++) {
+            const char *src = sources[unit->members[m]];
+            size_t len = 0;
+            char *data = read_file(src, &len);
+            if (!data) {
+                char msg[600];
+                snprintf(msg, sizeof(msg), "Failed to read %s for the unity build.", src);
+                print_error(msg);
+                free(text);
+                return -1;
+            }
+
+            //The marker puts the compiler back on line 1 of the original file. cpp reads
+            //escapes in the name, so the separators are written as '/'.
+            char marker[600];
+            int mlen = snprintf(marker, sizeof(marker), "# 1 \"%s\"\n", src);
+            if (mlen < 0 || mlen >= (int)sizeof(marker)) mlen = 0;
+            for (int k = 0; k < mlen; k++) {
+                if (marker[k] == '\\') marker[k] = '/';
+            }
+            if (size + mlen + len + 2 > cap) {
+                cap = (size + mlen + len + 2) * 2;
+                char *grown = realloc(text, cap);
+                if (!grown) {
+                    print_error("Memory allocation error for the unity build.");
+                    free(data);
+                    free(text);
+                    return -1;
+                }
+                text = grown;
+            }
+            memcpy(text + size, marker, mlen);
+            size += mlen;
+            memcpy(text + size, data, len);
+            size += len;
+            if (len > 0 && data[len - 1] != '\n') text[size++] = '\n';
+            free(data);
+        }
+
+        //Leave an unchanged unit alone so its time stamp stays put.
+        size_t old_size = 0;
+        char *old = read_file(unit->path, &old_size);
+        unit->rewritten = !old || old_size != size || memcmp(old, text, size) != 0;
+        free(old);
+
+        if (unit->rewritten) {
+            FILE *fp = fopen(unit->path, "wb");
+            int ok   = fp && fwrite(text, 1, size, fp) == size;
+            if (fp && fclose(fp) != 0) ok = 0;
+            if (!ok) {
+                char msg[600];
+                snprintf(msg, sizeof(msg), "Failed to write %s.", unit->path);
+                print_error(msg);
+                free(text);
+                return -1;
+            }
+        }
+        free(text);
+    }
+    return 0;
+}
+
+void fortean_unity_free(fortean_unity_t *unity) {
+    if (!unity) return;
+    for (int u = 0; unity->units && u < unity->unit_count; u++) {
+        free(unity->units[u].path);
+        free(unity->units[u].members);
+    }
+    free(unity->units);
+    free(unity->unit_of);
+    free(unity->item_of);
+    free(unity->item_unit);
+    free(unity->item_src);
+    free(unity->item_level);
+    memset(unity, 0, sizeof(*unity));
+}
@@ -0,0 +1,47 @@
+#ifndef FORTEAN_UNITY_H
+#define FORTEAN_UNITY_H
+
+#include "fortean_graph.h"
+
+#include <stddef.h>
+
+//One generated translation unit: several sources concatenated in build order, each
+//behind a '# 1 "file"' marker so diagnostics name the original file and line.
+typedef struct {
+    char *path;          // e.g. .cache/unity/unit_000.F90
+    int *members;        // Source indices in build order
+    int member_count;
+    size_t bytes;
+    int item;            // Position in the compile items
+    int open_seq;        // Placement sequence when the unit was started
+    int rewritten;       // Set by fortean_unity_write when the file content changed
+} fortean_unit_t;
+
+//The compile items of a unity build in build order. Every item is a unit or a
+//source that is compiled on its own (programs, files with their own flags, ...).
+typedef struct {
+    fortean_unit_t *units;
+    int unit_count;
+    int *unit_of;        // Unit of each source, -1 for the ones compiled on their own
+    int *item_of;        // Item of each source, -1 when it is not part of the build
+    int *item_unit;      // Unit of each item, -1 for a single source
+    int *item_src;       // Source of each single source item, -1 for a unit
+    int *item_level;     // Dependency level of each item
+    int item_count;
+} fortean_unity_t;
+
+//Split the sources with in_build[i] set into units. Sources with eligible[i] set and
+//the same key (flags and source form) share units, a unit is closed at max_files
+//sources or max_bytes (0 means no limit). Units never depend on each other in a cycle.
+//fixed[i] picks the .F extension instead of .F90. Returns 0 on success.
+int fortean_unity_plan(const fortean_graph_t *graph, char **sources, const int *src_node, int src_count,
+                       const unsigned char *in_build, const unsigned char *eligible,
+                       const unsigned int *key, const unsigned char *fixed,
+                       int max_files, long max_bytes, const char *dir, fortean_unity_t *unity);
+
+//Write the unit files, leaving the ones whose content is unchanged alone. Returns 0 on success.
+int fortean_unity_write(fortean_unity_t *unity, char **sources);
+
+void fortean_unity_free(fortean_unity_t *unity);
+
+#endif // FORTEAN_UNITY_H
@@ -0,0 +1,558 @@
+#include "fortean_watch.h"
+#include "fortean_toml.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include "fortean_hash.h"
+#include "fortean_fscan.h"
+
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                    IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+//"./src/" -> "src"
+static char *clean_path(const char *path) {
+    while (path[0] == '.' && path[1] == '/') path += 2;
+    char *copy = strdup(path[0] ? path : ".");
+    if (!copy) return NULL;
+    size_t len = strlen(copy);
+    while (len > 1 && copy[len - 1] == '/') copy[--len] = '\0';
+    return copy;
+}
+
+static int is_output(const fortean_watch_t *watch, const char *path) {
+    char *clean = clean_path(path);
+    int found   = 0;
+    for (int i = 0; clean && watch->outputs && watch->outputs[i]; i++) {
+        if (strcmp(watch->outputs[i], clean) == 0) found = 1;
+    }
+    free(clean);
+    return found;
+}
+
+//Sources, modules included by name and include files
+static int is_fortran_name(const char *name) {
+    const char *ext = strrchr(name, '.');
+    const char *known[] = {".f90", ".f95", ".f03", ".f08", ".f", ".for", ".fpp", ".ftn", ".inc", ".fi", ".h"};
+    for (size_t i = 0; ext && i < sizeof(known) / sizeof(known[0]); i++) {
+        if (strcasecmp(ext, known[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+//What editors write next to a file while saving it: hidden swap files, backups ending
+//in ~, #autosaves# and the numbered files vim probes a directory with.
+static int is_editor_file(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || name[0] == '.' || name[0] == '#' || name[len - 1] == '~') return 1;
+    return strspn(name, "0123456789") == len;
+}
+
+static void add_watch(fortean_watch_t *watch, const char *path, int output, int recursive) {
+    int wd = inotify_add_watch(watch->fd, path, WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0) return;
+    //A directory listed twice keeps one entry that is both.
+    for (int i = 0; i < watch->count; i++) {
+        fortean_watch_dir_t *dir = &watch->dirs[i];
+        if (dir->wd != wd) continue;
+        dir->source    |= !output;
+        dir->output    |= output;
+        dir->recursive |= recursive;
+        return;
+    }
+    if (watch->count == watch->cap) {
+        int cap = watch->cap ? watch->cap * 2 : 64;
+        fortean_watch_dir_t *grown = realloc(watch->dirs, cap * sizeof(fortean_watch_dir_t));
+        if (!grown) return;
+        watch->dirs = grown;
+        watch->cap  = cap;
+    }
+    fortean_watch_dir_t *dir = &watch->dirs[watch->count];
+    dir->wd        = wd;
+    dir->source    = !output;
+    dir->output    = output;
+    dir->recursive = recursive;
+    dir->path      = strdup(path);
+    if (dir->path) watch->count++;
+}
+
+//Watch a directory and, for recursive watches, everything below it. Hidden directories
+//are skipped and output directories are watched as outputs.
+static void add_tree(fortean_watch_t *watch, const char *path, int output, int recursive) {
+    output = output || is_output(watch, path);
+    add_watch(watch, path, output, recursive);
+    if (!recursive) return;
+    DIR *dir = opendir(path);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char child[2048];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) add_tree(watch, child, output, recursive);
+    }
+    closedir(dir);
+}
+
+//The -I directories of a flag list, joined ("-Iinc") or separate ("-I", "inc"), watched
+//as sources. Frees the list.
+static void add_include_dirs(fortean_watch_t *watch, char **flags) {
+    for (int i = 0; flags && flags[i]; i++) {
+        if (strncmp(flags[i], "-I", 2) == 0 && (flags[i][2] || flags[i + 1])) {
+            add_tree(watch, flags[i][2] ? flags[i] + 2 : flags[i + 1], 0, 0);
+        }
+    }
+    for (int i = 0; flags && flags[i]; i++) free(flags[i]);
+    free(flags);
+}
+
+//The flags of [build] or a [profile.<name>] table and of its override entries. The
+//daemon answers builds of every profile, so all of them are watched.
+static void add_table_include_dirs(fortean_watch_t *watch, toml_table_t *tbl) {
+    if (!tbl) return;
+    add_include_dirs(watch, fortean_toml_table_get_array(tbl, "flags"));
+    add_include_dirs(watch, fortean_toml_table_get_array(tbl, "add"));
+    toml_array_t *overrides = toml_array_in(tbl, "override");
+    for (int i = 0; overrides && i < toml_array_nelem(overrides); i++) {
+        toml_table_t *entry = toml_table_at(overrides, i);
+        if (!entry) continue;
+        add_include_dirs(watch, fortean_toml_table_get_array(entry, "flags"));
+        add_include_dirs(watch, fortean_toml_table_get_array(entry, "add"));
+    }
+}
+
+static void add_output(char **outputs, int *count, const char *path) {
+    if (!path) return;
+    char *clean = clean_path(path);
+    if (clean) outputs[(*count)++] = clean;
+}
+
+int fortean_watch_open(fortean_watch_t *watch) {
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) return -1;
+
+    fortean_toml_t cfg = {0};
+    int have_cfg = fortean_toml_load("Fortean.toml", &cfg) == 0;
+
+    //The root holds Fortean.toml and the executables.
+    watch->outputs = calloc(8, sizeof(char *));
+    int output_count = 0;
+    if (watch->outputs) {
+        add_output(watch->outputs, &output_count, have_cfg ? fortean_toml_get_string(&cfg, "build.obj_dir") : NULL);
+        add_output(watch->outputs, &output_count, have_cfg ? fortean_toml_get_string(&cfg, "build.mod_dir") : NULL);
+        add_output(watch->outputs, &output_count, "lib");
+        add_output(watch->outputs, &output_count, ".cache");
+    }
+    add_watch(watch, ".", 1, 0);
+    for (int i = 0; i < output_count; i++) add_tree(watch, watch->outputs[i], 1, 1);
+
+    //Paths keep the spelling of Fortean.toml, which is how the scanner names the files.
+    const char *keys[] = {"search.deep", "search.shallow", "library.source-libs"};
+    for (int k = 0; have_cfg && k < 3; k++) {
+        char **list = fortean_toml_get_array(&cfg, keys[k]);
+        for (int i = 0; list && list[i]; i++) {
+            const char *path = list[i];
+            if (k == 2) {
+                //The directory of a library
+                char *slash = strrchr(list[i], '/');
+                if (slash) *slash = '\0';
+                path = slash ? list[i] : ".";
+            }
+            add_tree(watch, path, 0, k == 0);
+            free(list[i]);
+        }
+        free(list);
+    }
+    if (have_cfg) {
+        add_table_include_dirs(watch, toml_table_in(cfg.table, "build"));
+        toml_table_t *profiles = toml_table_in(cfg.table, "profile");
+        for (int i = 0; profiles && toml_key_in(profiles, i); i++) {
+            add_table_include_dirs(watch, toml_table_in(profiles, toml_key_in(profiles, i)));
+        }
+        fortean_toml_free(&cfg);
+    }
+    return 0;
+}
+
+static fortean_watch_dir_t *find_dir(fortean_watch_t *watch, int wd) {
+    for (int i = 0; i < watch->count; i++) {
+        if (watch->dirs[i].wd == wd) return &watch->dirs[i];
+    }
+    return NULL;
+}
+
+int fortean_watch_read(fortean_watch_t *watch, fortean_watch_fn fn, void *data) {
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changes = 0;
+    for (;;) {
+        ssize_t len = read(watch->fd, buf, sizeof(buf));
+        if (len <= 0) return changes;
+        for (char *p = buf; p < buf + len;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            fortean_watch_change_t change = {FORTEAN_WATCH_LOST, NULL, 1, 0};
+            if (ev->mask & IN_Q_OVERFLOW) {
+                fn(&change, data);
+                changes++;
+                continue;
+            }
+            fortean_watch_dir_t *dir = find_dir(watch, ev->wd);
+            if (!dir) continue;
+            if (ev->mask & IN_IGNORED) {
+                dir->wd = -1;
+                continue;
+            }
+            const char *name = ev->len ? ev->name : "";
+            if (ev->len && is_editor_file(name)) continue;
+
+            char path[2048];
+            snprintf(path, sizeof(path), "%s/%s", dir->path, name);
+            change.path   = path;
+            change.is_dir = (ev->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF)) != 0;
+            change.added_or_removed = (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                                   IN_DELETE_SELF | IN_MOVE_SELF)) != 0;
+            if (strcmp(dir->path, ".") == 0 && strcmp(name, "Fortean.toml") == 0) {
+                change.kind = FORTEAN_WATCH_CONFIG;
+            } else if (dir->source && (!dir->output || is_fortran_name(name))) {
+                change.kind = FORTEAN_WATCH_SOURCE;
+            } else {
+                change.kind = FORTEAN_WATCH_OUTPUT;
+            }
+            fn(&change, data);
+            changes++;
+
+            //New directories below a recursive watch are watched too.
+            if (dir->recursive && change.is_dir && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                add_tree(watch, path, dir->output && !dir->source, 1);
+            }
+        }
+    }
+}
+
+void fortean_watch_close(fortean_watch_t *watch) {
+    if (watch->fd >= 0) close(watch->fd);
+    watch->fd = -1;
+    for (int i = 0; i < watch->count; i++) free(watch->dirs[i].path);
+    free(watch->dirs);
+    watch->dirs  = NULL;
+    watch->count = 0;
+    watch->cap   = 0;
+    for (int i = 0; watch->outputs && watch->outputs[i]; i++) free(watch->outputs[i]);
+    free(watch->outputs);
+    watch->outputs = NULL;
+}
+
+//Files the scanner reads
+static int is_scanned(const char *path) {
+    const char *ext = strrchr(path, '.');
+    return ext && (strcasecmp(ext, ".f90") == 0 || strcasecmp(ext, ".for") == 0);
+}
+
+//Hash of what the scanner takes from a file: the modules it defines, the ones it uses
+//and whether it holds a program. 0 when it can't be read.
+static unsigned int graph_signature(const char *path) {
+    fortean_fscan_t scan;
+    if (fortean_fscan_file(path, &scan) != 0) return 0;
+    unsigned int hash = hash_str_fnv1a(scan.is_program ? "program" : "", FNV_SEED);
+    for (int i = 0; i < scan.module_count; i++) {
+        hash = hash_str_fnv1a(" module ", hash);
+        hash = hash_str_fnv1a(scan.modules[i], hash);
+    }
+    for (int i = 0; i < scan.use_count; i++) {
+        hash = hash_str_fnv1a(" use ", hash);
+        hash = hash_str_fnv1a(scan.uses[i], hash);
+    }
+    fortean_fscan_free(&scan);
+    return hash ? hash : 1;
+}
+
+//Signatures of every scanned file in the source directories
+static void record_signatures(const fortean_watch_t *watch, HashEntry *signatures[]) {
+    for (int i = 0; i < watch->count; i++) {
+        if (!watch->dirs[i].source || watch->dirs[i].wd < 0) continue;
+        DIR *dir = opendir(watch->dirs[i].path);
+        if (!dir) continue;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char path[2048];
+            snprintf(path, sizeof(path), "%s/%s", watch->dirs[i].path, entry->d_name);
+            if (is_scanned(path)) hash_entry_put(signatures, path, graph_signature(path));
+        }
+        closedir(dir);
+    }
+}
+
+//Changes since the last build that finished
+typedef struct {
+    char **paths;            // NULL-terminated
+    int count;
+    int cap;
+    int full;                // The module graph may have changed, scan everything
+    int config;              // Fortean.toml changed
+    int any;
+    double last;             // Wall time of the latest change
+} pending_t;
+
+static void pending_add(pending_t *pending, const char *path) {
+    for (int i = 0; i < pending->count; i++) {
+        if (strcmp(pending->paths[i], path) == 0) return;
+    }
+    if (pending->count + 1 >= pending->cap) {
+        int cap = pending->cap ? pending->cap * 2 : 32;
+        char **grown = realloc(pending->paths, cap * sizeof(char *));
+        if (!grown) {
+            pending->full = 1;
+            return;
+        }
+        pending->paths = grown;
+        pending->cap   = cap;
+    }
+    pending->paths[pending->count] = strdup(path);
+    if (!pending->paths[pending->count]) {
+        pending->full = 1;
+        return;
+    }
+    pending->paths[++pending->count] = NULL;
+}
+
+static void pending_clear(pending_t *pending) {
+    for (int i = 0; i < pending->count; i++) free(pending->paths[i]);
+    free(pending->paths);
+    memset(pending, 0, sizeof(*pending));
+}
+
+//A build that didn't finish or failed leaves its changes for the next one.
+static void pending_merge(pending_t *into, pending_t *from) {
+    for (int i = 0; i < from->count; i++) pending_add(into, from->paths[i]);
+    into->full   |= from->full;
+    into->config |= from->config;
+    into->any    |= from->any;
+    pending_clear(from);
+}
+
+static void on_change(const fortean_watch_change_t *change, void *data) {
+    pending_t *pending = data;
+    if (change->kind == FORTEAN_WATCH_OUTPUT) return;
+    if (change->kind == FORTEAN_WATCH_LOST) pending->full = 1;
+    if (change->kind == FORTEAN_WATCH_CONFIG) pending->config = 1;
+    if (change->kind == FORTEAN_WATCH_SOURCE) {
+        //Notes and data files next to the sources don't go into the build.
+        if (!change->is_dir && !is_fortran_name(change->path)) return;
+        pending_add(pending, change->path);
+        if (change->is_dir || (change->added_or_removed && is_scanned(change->path))) pending->full = 1;
+    }
+    pending->any  = 1;
+    pending->last = fortean_wall_time();
+}
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+//Build in a process group of its own, so a restart stops its compilers too, then run
+//command. done_fd reads end of file once the build has exited.
+static pid_t start_build(const fortean_build_opts_t *opts, char **changed, const char *command, int *done_fd) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) return -1;
+    fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        close(pipe_fds[0]);
+        int null = open("/dev/null", O_RDONLY);
+        if (null >= 0) dup2(null, STDIN_FILENO);
+        fortean_build_opts_t build = *opts;
+        build.changed = changed;
+        int res = fortean_build_project_incremental(&build);
+        fflush(stdout);
+        fflush(stderr);
+        if (res == 0 && command) {
+            execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+            _exit(127);
+        }
+        _exit(res == 0 ? 0 : 1);
+    }
+    setpgid(pid, pid);
+    close(pipe_fds[1]);
+    *done_fd = pipe_fds[0];
+    return pid;
+}
+
+static int finish_build(pid_t pid, int done_fd, int cancel) {
+    if (cancel) kill(-pid, SIGTERM);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    //The compilers of a cancelled build may still be on their way out.
+    if (cancel) kill(-pid, SIGKILL);
+    close(done_fd);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int fortean_watch_run(const fortean_build_opts_t *opts, const char *command) {
+    fortean_toml_t cfg = {0};
+    if (fortean_toml_load("Fortean.toml", &cfg) != 0) {
+        print_error("Failed to load Fortean.toml.");
+        return -1;
+    }
+    int debounce_ms = fortean_toml_get_int(&cfg, "watch.debounce", 100);
+    char *configured = NULL;
+    if (!command && fortean_toml_get_string(&cfg, "watch.command")) {
+        configured = strdup(fortean_toml_get_string(&cfg, "watch.command"));
+        command    = configured;
+    }
+    fortean_toml_free(&cfg);
+
+    fortean_watch_t watch;
+    if (fortean_watch_open(&watch) != 0) {
+        print_error("inotify is not available, fortean watch can't watch the project.");
+        free(configured);
+        return -1;
+    }
+    HashEntry *signatures[HASH_TABLE_SIZE] = {NULL};
+    record_signatures(&watch, signatures);
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Watching %d directories, stop with Ctrl-C.", watch.count);
+    print_info(msg);
+    fflush(stdout);
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    //The first build checks everything.
+    pending_t pending  = {0};
+    pending_t building = {0};
+    pending_t failed   = {0};  // Changes of a failed build, built again with the next change
+    pending.full = 1;
+    pending.any  = 1;
+    pid_t child  = -1;
+    int done_fd  = -1;
+
+    while (!interrupted) {
+        int timeout = -1;
+        if (child < 0 && pending.any) {
+            double wait_ms = debounce_ms - (fortean_wall_time() - pending.last) * 1000.0;
+            timeout = wait_ms > 0 ? (int)wait_ms + 1 : 0;
+        }
+        struct pollfd fds[2] = {{watch.fd, POLLIN, 0}, {done_fd, POLLIN, 0}};
+        int ready = poll(fds, child >= 0 ? 2 : 1, timeout);
+        if (ready < 0 && errno != EINTR) break;
+
+        if (ready > 0 && fds[0].revents) {
+            fortean_watch_read(&watch, on_change, &pending);
+
+            //Edits while it builds make the build stale, start again once they settle.
+            if (child >= 0 && pending.any) {
+                finish_build(child, done_fd, 1);
+                child = -1;
+                pending_merge(&pending, &building);
+                print_info("Sources changed, restarting the build.");
+                fflush(stdout);
+            }
+        }
+        if (child >= 0 && ready > 0 && fds[1].revents) {
+            int status = finish_build(child, done_fd, 0);
+            child = -1;
+            if (status == 0) pending_clear(&building);
+            else             pending_merge(&failed, &building);
+            print_info(status == 0 ? "Done, waiting for changes." : "Failed, waiting for changes.");
+            fflush(stdout);
+        }
+        if (child >= 0 || !pending.any) continue;
+        if ((fortean_wall_time() - pending.last) * 1000.0 < debounce_ms) continue;
+
+        //The files of a failed build are compiled again along with the new change.
+        pending_merge(&pending, &failed);
+
+        //A new Fortean.toml can search other directories.
+        if (pending.config) {
+            fortean_watch_close(&watch);
+            free_prev_hash_table(signatures);
+            if (fortean_watch_open(&watch) != 0) break;
+            record_signatures(&watch, signatures);
+            pending.full = 1;
+        }
+
+        //Only changes to module or use lines need the scanner.
+        for (int i = 0; i < pending.count; i++) {
+            if (!is_scanned(pending.paths[i])) continue;
+            unsigned int signature = graph_signature(pending.paths[i]);
+            HashEntry *before      = hash_entry_get(signatures, pending.paths[i]);
+            if (!before || before->file_hash != signature || signature == 0) pending.full = 1;
+            hash_entry_put(signatures, pending.paths[i], signature);
+        }
+
+        building = pending;
+        memset(&pending, 0, sizeof(pending));
+        child = start_build(opts, building.full ? NULL : building.paths, command, &done_fd);
+        if (child < 0) {
+            print_error("Failed to start the build.");
+            break;
+        }
+    }
+
+    if (child >= 0) finish_build(child, done_fd, 1);
+    pending_clear(&pending);
+    pending_clear(&building);
+    pending_clear(&failed);
+    free_prev_hash_table(signatures);
+    fortean_watch_close(&watch);
+    free(configured);
+    return 0;
+}
+
+#else
+
+int fortean_watch_open(fortean_watch_t *watch) {
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+    return -1;
+}
+
+int fortean_watch_read(fortean_watch_t *watch, fortean_watch_fn fn, void *data) {
+    (void)watch;
+    (void)fn;
+    (void)data;
+    return 0;
+}
+
+void fortean_watch_close(fortean_watch_t *watch) {
+    (void)watch;
+}
+
+int fortean_watch_run(const fortean_build_opts_t *opts, const char *command) {
+    (void)opts;
+    (void)command;
+    print_error("fortean watch needs inotify and is only available on Linux.");
+    return -1;
+}
+
+#endif
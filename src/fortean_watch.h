@@ -0,0 +1,56 @@
+#ifndef FORTEAN_WATCH_H
+#define FORTEAN_WATCH_H
+
+#include "fortean_build.h"
+
+//inotify watches on what the builds of Fortean.toml read and write: the root, the
+//search directories, the -I directories of [build], every profile and their overrides,
+//the directories of the source libraries and the object, module, library and .cache
+//directories. Used by fortean watch and the build daemon, only on Linux.
+
+typedef enum {
+    FORTEAN_WATCH_SOURCE,    // A file in a search, include or library directory
+    FORTEAN_WATCH_OUTPUT,    // Objects, modules, libraries, executables or .cache
+    FORTEAN_WATCH_CONFIG,    // Fortean.toml
+    FORTEAN_WATCH_LOST       // The queue overflowed, anything may have changed
+} fortean_watch_kind_t;
+
+typedef struct {
+    fortean_watch_kind_t kind;
+    const char *path;        // <dir>/<name> with dir spelled as in Fortean.toml, NULL when lost
+    int added_or_removed;    // Created, deleted or renamed
+    int is_dir;              // A directory, or the watched directory itself
+} fortean_watch_change_t;
+
+typedef struct {
+    int wd;
+    int source;
+    int output;              // An output directory, or the root with the executables
+    int recursive;           // New sub directories are watched too
+    char *path;
+} fortean_watch_dir_t;
+
+typedef struct {
+    int fd;                  // inotify, poll it for changes
+    fortean_watch_dir_t *dirs;
+    int count;
+    int cap;
+    char **outputs;          // Output directories, NULL-terminated
+} fortean_watch_t;
+
+typedef void (*fortean_watch_fn)(const fortean_watch_change_t *change, void *data);
+
+//Watch the project of Fortean.toml in the current directory. Returns -1 without inotify.
+int fortean_watch_open(fortean_watch_t *watch);
+
+//Hand every change that is waiting to fn, without blocking. Editor backup and swap
+//files are left out. Returns the number of changes.
+int fortean_watch_read(fortean_watch_t *watch, fortean_watch_fn fn, void *data);
+
+void fortean_watch_close(fortean_watch_t *watch);
+
+//fortean watch: build whenever a source or Fortean.toml changes, then run command
+//(NULL for none) after every build that succeeds. Runs until interrupted.
+int fortean_watch_run(const fortean_build_opts_t *opts, const char *command);
+
+#endif // FORTEAN_WATCH_H
@@ -0,0 +1,723 @@
+#include "fortean_worker.h"
+#include "fortean_net.h"
+#include "fortean_cmd.h"
+#include "fortean_compiler.h"
+#include "fortean_fscan.h"
+#include "fortean_threads.h"
+#include "fortean_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#define PATH_SEP '\\'
+#define MAKE_DIR(path) _mkdir(path)
+#define getpid _getpid
+#else
+#include <unistd.h>
+#define PATH_SEP '/'
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+#define WORKER_CONNECT_TIMEOUT_MS 2000
+#define WORKER_MAX_MEMBER (1LL << 30)
+
+//File part of a path
+static const char *base_name(const char *path) {
+    const char *name = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    return name;
+}
+
+//A file name without a directory, so a job can't write outside its directory
+static int plain_name(const char *name) {
+    return name[0] && name[0] != '.' && !strpbrk(name, "/\\:") && strlen(name) < 256;
+}
+
+//A worker takes jobs from anyone who can reach it, so it only takes the flags that
+//change how the source compiles: optimization, code generation, warnings, language
+//options and macros. Anything else (-c, -x, -I, -o, -B, @file, ...) and any flag naming
+//a path could run other programs or reach files outside the job, so the builds keep
+//those compiles local.
+static int worker_takes_flag(const char *flag) {
+    static const char *taken[]   = {"-O", "-f", "-D", "-U", "-std=", "-W", "-m", "-g"};
+    static const char *refused[] = {"-fplugin", "-fpass-plugin", "-fintrinsic-modules-path", "-fpp", "-Wa,",
+                                    "-Wp,", "-Wl,", "-mllvm", "-mmlir", "-module"};
+    if (strpbrk(flag, "/\\:\n") || strstr(flag, "..")) return 0;
+    for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+        if (strncmp(flag, refused[i], strlen(refused[i])) == 0) return 0;
+    }
+    for (size_t i = 0; i < sizeof(taken) / sizeof(taken[0]); i++) {
+        if (strncmp(flag, taken[i], strlen(taken[i])) == 0) return 1;
+    }
+    return strcmp(flag, "-nocpp") == 0 || strcmp(flag, "-w") == 0 || strcmp(flag, "-pedantic") == 0 ||
+           strcmp(flag, "-pthread") == 0;
+}
+
+//Sources the worker compiles: Fortran without the preprocessor, since #include and
+//macros could name any file, and nothing the compiler driver hands to another language.
+static int fortran_source_name(const char *name) {
+    static const char *exts[] = {".f", ".for", ".ftn", ".f77", ".f90", ".f95", ".f03", ".f08"};
+    const char *ext = strrchr(name, '.');
+    for (size_t i = 0; ext && i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (strcmp(ext, exts[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+//Whether an include line of text names anything but a plain file name, which the
+//compiler can only find in the job directory. Like the compiler, blanks inside the
+//keyword (fixed form) and "!$ include" lines (OpenMP) are taken.
+static int includes_outside_job(const char *text, size_t len) {
+    const char *end = text + len;
+    for (const char *p = text; p < end;) {
+        const char *eol = p;
+        while (eol < end && *eol != '\n' && *eol != '\r') eol++;
+        const char *q = p;
+        while (q < eol && (*q == ' ' || *q == '\t')) q++;
+        if (eol - q >= 2 && q[1] == '$' && (q[0] == '!' || (q == p && strchr("cC*", q[0])))) q += 2;
+        const char *word = "include";
+        while (*word && q < eol) {
+            if (*q == ' ' || *q == '\t') q++;
+            else if (tolower((unsigned char)*q) == *word) q++, word++;
+            else break;
+        }
+        while (q < eol && (*q == ' ' || *q == '\t')) q++;
+        if (!*word && q < eol && (*q == '\'' || *q == '"')) {
+            const char *close = memchr(q + 1, *q, (size_t)(eol - q - 1));
+            char name[300];
+            size_t n = close ? (size_t)(close - q - 1) : 0;
+            if (!close || n >= sizeof(name) || (close + 1 < eol && close[1] == *q)) return 1;
+            memcpy(name, q + 1, n);
+            name[n] = '\0';
+            if (strlen(name) != n || !plain_name(name)) return 1;
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    return 0;
+}
+
+static char *read_whole(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (data && fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (data) {
+        data[size] = '\0';
+        *len = (size_t)size;
+    }
+    return data;
+}
+
+static int write_whole(const char *path, const char *data, size_t len) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return -1;
+    int ok = fwrite(data, 1, len, fp) == len;
+    return fclose(fp) == 0 && ok ? 0 : -1;
+}
+
+//"<kind> <name> <size>\n" (no name when it is NULL) followed by the bytes
+static int send_member(fortean_socket_t sock, const char *kind, const char *name, const char *data, size_t len) {
+    char head[400];
+    int n = name ? snprintf(head, sizeof(head), "%s %s %lu\n", kind, name, (unsigned long)len)
+                 : snprintf(head, sizeof(head), "%s %lu\n", kind, (unsigned long)len);
+    if (n <= 0 || n >= (int)sizeof(head) || fortean_net_send_all(sock, head, (size_t)n) != 0) return -1;
+    return len > 0 ? fortean_net_send_all(sock, data, len) : 0;
+}
+
+static int send_file(fortean_socket_t sock, const char *kind, const char *name, const char *path) {
+    size_t len = 0;
+    char *data = read_whole(path, &len);
+    if (!data) return -1;
+    int res = send_member(sock, kind, name, data, len);
+    free(data);
+    return res;
+}
+
+//Read the bytes of a member whose header said size (caller must free)
+static char *recv_body(fortean_socket_t sock, long long size) {
+    if (size < 0 || size > WORKER_MAX_MEMBER) return NULL;
+    char *data = malloc((size_t)size + 1);
+    if (!data) return NULL;
+    if (size > 0 && fortean_net_recv_all(sock, data, (size_t)size) != 0) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+static void strip_newline(char *line) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+}
+
+//Find name in first_dir or one of the -I directories of the flags, like the compiler
+static int find_file(const char *name, const char *first_dir, char **flags, int flag_count, char *path, size_t size) {
+    struct stat st;
+    if (first_dir) {
+        snprintf(path, size, "%s%c%s", first_dir, PATH_SEP, name);
+        if (stat(path, &st) == 0) return 0;
+    }
+    for (int i = 0; i < flag_count; i++) {
+        if (strncmp(flags[i], "-I", 2) != 0) continue;
+        const char *dir = flags[i][2] ? flags[i] + 2 : (i + 1 < flag_count ? flags[i + 1] : "");
+        snprintf(path, size, "%s%c%s", dir, PATH_SEP, name);
+        if (stat(path, &st) == 0) return 0;
+    }
+    return -1;
+}
+
+static int is_cpp_flag(const char *flag) {
+    return strcmp(flag, "-cpp") == 0 || strcmp(flag, "-fpp") == 0 || strcmp(flag, "-Mpreprocess") == 0;
+}
+
+//Sources with an upper case extension, .fpp files and -cpp builds go through the preprocessor.
+static int needs_cpp(const char *src, char **flags, int flag_count) {
+    const char *ext = strrchr(base_name(src), '.');
+    if (ext && (ext[1] == 'F' || strcmp(ext, ".fpp") == 0)) return 1;
+    for (int i = 0; i < flag_count; i++) {
+        if (is_cpp_flag(flags[i])) return 1;
+    }
+    return 0;
+}
+
+//Flags that name directories or files here, or only matter to the preprocessor that
+//already ran, are not sent. Returns how many arguments to skip, 0 to send it.
+static int local_flag(const char *flag, int preprocessed) {
+    int dir_flag = strncmp(flag, "-I", 2) == 0 || strncmp(flag, "-J", 2) == 0;
+    int cpp_flag = preprocessed && (strncmp(flag, "-D", 2) == 0 || strncmp(flag, "-U", 2) == 0);
+    if (dir_flag || cpp_flag) return flag[2] ? 1 : 2;
+    if (strcmp(flag, "-module") == 0) return 2;
+    if (preprocessed && is_cpp_flag(flag)) return 1;
+    return 0;
+}
+
+int fortean_workers_open(fortean_workers_t *workers, fortean_toml_t *cfg, const char *compiler) {
+    memset(workers, 0, sizeof(*workers));
+    toml_array_t *arr = fortean_toml_get_table_array(cfg, "worker");
+    int n = arr ? toml_array_nelem(arr) : 0;
+    if (n == 0) return 0;
+    workers->list = calloc(n, sizeof(fortean_worker_t));
+    if (!workers->list) return 0;
+    workers->compiler    = compiler;
+    workers->fingerprint = fortean_compiler_fingerprint(compiler);
+
+    int total = 0;
+    for (int i = 0; i < n; i++) {
+        toml_table_t *tbl     = toml_table_at(arr, i);
+        toml_datum_t address  = toml_string_in(tbl, "address");
+        toml_datum_t slots    = toml_int_in(tbl, "slots");
+        toml_datum_t timeout  = toml_int_in(tbl, "timeout");
+        if (!address.ok) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "[[worker]] entry %d has no 'address', skipping it.", i + 1);
+            print_info(msg);
+            continue;
+        }
+        fortean_worker_t *worker = &workers->list[workers->count];
+        snprintf(worker->address, sizeof(worker->address), "%s", address.u.s);
+        free(address.u.s);
+        worker->timeout_ms = (timeout.ok && timeout.u.i > 0 ? (int)timeout.u.i : 600) * 1000;
+
+        //The worker says how many jobs it takes and whether it has the same compiler.
+        char line[300];
+        int offered = 0;
+        fortean_socket_t sock = fortean_net_connect(worker->address, WORKER_CONNECT_TIMEOUT_MS);
+        //A worker busy with another build answers once a slot is free.
+        if (sock != FORTEAN_NO_SOCKET) fortean_net_set_timeout(sock, 10000);
+        snprintf(line, sizeof(line), "hello %s %016llx\n", base_name(compiler), workers->fingerprint);
+        int answered = sock != FORTEAN_NO_SOCKET && fortean_net_send_all(sock, line, strlen(line)) == 0 &&
+                       fortean_net_recv_line(sock, line, sizeof(line)) > 0;
+        fortean_net_close(sock);
+        strip_newline(line);
+
+        char msg[700];
+        if (!answered) {
+            snprintf(msg, sizeof(msg), "Worker %s is not answering, compiling without it.", worker->address);
+            print_info(msg);
+            continue;
+        }
+        if (sscanf(line, "ok %d", &offered) != 1 || offered < 1) {
+            snprintf(msg, sizeof(msg), "Worker %s: %s", worker->address,
+                     strncmp(line, "error ", 6) == 0 ? line + 6 : "not a fortean worker");
+            print_info(msg);
+            continue;
+        }
+        worker->slots = slots.ok && slots.u.i > 0 && slots.u.i < offered ? (int)slots.u.i : offered;
+        total += worker->slots;
+        workers->count++;
+    }
+    if (total == 0) fortean_workers_close(workers);
+    return total;
+}
+
+void fortean_workers_close(fortean_workers_t *workers) {
+    for (int i = 0; i < workers->count; i++) {
+        const fortean_worker_t *worker = &workers->list[i];
+        if (worker->jobs == 0 && worker->retried == 0) continue;
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Worker %s: %d files in %.2f s, %d compiled locally instead", worker->address,
+                 worker->jobs, worker->seconds, worker->retried);
+        print_info(msg);
+    }
+    free(workers->list);
+    memset(workers, 0, sizeof(*workers));
+}
+
+//Run the preprocessor of the compiler on src (caller must free)
+static char *preprocess(const char *compiler, char **flags, int flag_count, const char *src, size_t *len) {
+    fortean_cmd_t cmd;
+    fortean_cmd_init(&cmd, compiler);
+    for (int i = 0; i < flag_count; i++) fortean_cmd_add(&cmd, flags[i]);
+    fortean_cmd_add(&cmd, "-E");
+    fortean_cmd_add(&cmd, src);
+    char *text = fortean_cmd_capture(&cmd);
+    fortean_cmd_free(&cmd);
+    if (text && !text[0]) {
+        free(text);
+        text = NULL;
+    }
+    if (text) *len = strlen(text);
+    return text;
+}
+
+//Send the job, everything but the "end" line. Returns -1 when it can't be sent, or
+//FORTEAN_WORKER_LOCAL when it names files the worker can't take and is compiled here.
+static int send_job(const fortean_workers_t *workers, fortean_socket_t sock, char **flags, int flag_count,
+                    const char *src, const char *mod_dir) {
+    int cpp = needs_cpp(src, flags, flag_count);
+    char name[300];
+    snprintf(name, sizeof(name), "%s", base_name(src));
+    if (!plain_name(name)) return FORTEAN_WORKER_LOCAL;
+
+    size_t len  = 0;
+    char *text  = cpp ? preprocess(workers->compiler, flags, flag_count, src, &len) : read_whole(src, &len);
+    if (!text) return -1;
+    //The worker compiles the preprocessed text without the preprocessor, .F90 -> .f90
+    //and .fpp -> .f (fixed form like the Intel compilers take it).
+    char *ext = strrchr(name, '.');
+    if (cpp && ext && strcmp(ext, ".fpp") == 0) snprintf(ext, sizeof(name) - (size_t)(ext - name), ".f");
+    else if (cpp && ext) for (char *p = ext; *p; p++) *p = (char)tolower((unsigned char)*p);
+    if (!fortran_source_name(name)) {
+        free(text);
+        return FORTEAN_WORKER_LOCAL;
+    }
+
+    char line[1100];
+    snprintf(line, sizeof(line), "job %s %016llx\n", base_name(workers->compiler), workers->fingerprint);
+    int res = fortean_net_send_all(sock, line, strlen(line));
+    for (int i = 0; res == 0 && i < flag_count; i++) {
+        int skip = local_flag(flags[i], cpp);
+        if (skip) {
+            i += skip - 1;
+            continue;
+        }
+        int n = snprintf(line, sizeof(line), "flag %s\n", flags[i]);
+        res = n > 0 && n < (int)sizeof(line) ? fortean_net_send_all(sock, line, (size_t)n) : -1;
+    }
+    if (res == 0) res = send_member(sock, "source", name, text, len);
+    free(text);
+    if (res != 0) return -1;
+
+    fortean_fscan_t scan;
+    if (fortean_fscan_file(src, &scan) != 0) return -1;
+    char src_dir[1024];
+    snprintf(src_dir, sizeof(src_dir), "%.*s", (int)(base_name(src) - src), src);
+    if (!src_dir[0]) snprintf(src_dir, sizeof(src_dir), ".");
+    char path[1400];
+    //Files that aren't found (system modules and the like) are left to the worker's compiler.
+    //The worker writes every file next to the source and refuses other paths, so
+    //include 'sub/x.inc' stays here.
+    for (int i = 0; res == 0 && i < scan.include_count; i++) {
+        if (!plain_name(scan.includes[i])) res = FORTEAN_WORKER_LOCAL;
+        else if (find_file(scan.includes[i], src_dir, flags, flag_count, path, sizeof(path)) == 0) {
+            res = send_file(sock, "include", scan.includes[i], path);
+        }
+    }
+    for (int i = 0; res == 0 && i < scan.use_count; i++) {
+        char mod[300];
+        snprintf(mod, sizeof(mod), "%s.mod", scan.uses[i]);
+        if (find_file(mod, mod_dir, flags, flag_count, path, sizeof(path)) != 0) continue;
+        res = send_file(sock, "mod", mod, path);
+    }
+    fortean_fscan_free(&scan);
+    return res;
+}
+
+//Write a module unless it is unchanged, so the files that use it keep their times
+static int write_module(const char *mod_dir, const char *name, const char *data, size_t len) {
+    char path[1400];
+    snprintf(path, sizeof(path), "%s%c%s", mod_dir, PATH_SEP, name);
+    size_t old_len = 0;
+    char *old = read_whole(path, &old_len);
+    int same  = old && old_len == len && memcmp(old, data, len) == 0;
+    free(old);
+    return same ? 0 : write_whole(path, data, len);
+}
+
+int fortean_worker_compile(const fortean_workers_t *workers, int w, char **flags, int flag_count,
+                           const char *src, const char *obj_path, const char *mod_dir) {
+    //Profile data and response files are files the worker doesn't have, and it only
+    //takes the flags of worker_takes_flag.
+    for (int i = 0; i < flag_count; i++) {
+        int skip = local_flag(flags[i], 0);
+        if (skip) {
+            i += skip - 1;
+            continue;
+        }
+        //The preprocessor runs here, see send_job.
+        if (is_cpp_flag(flags[i])) continue;
+        if (strncmp(flags[i], "-fprofile-use", 13) == 0 || strncmp(flags[i], "-prof-use", 9) == 0 ||
+            !worker_takes_flag(flags[i])) {
+            return FORTEAN_WORKER_LOCAL;
+        }
+    }
+
+    const fortean_worker_t *worker = &workers->list[w];
+    fortean_socket_t sock = fortean_net_connect(worker->address, WORKER_CONNECT_TIMEOUT_MS);
+    if (sock == FORTEAN_NO_SOCKET) return FORTEAN_WORKER_LOST;
+    fortean_net_set_timeout(sock, worker->timeout_ms);
+
+    int status = FORTEAN_WORKER_LOST;
+    char line[600];
+    int sent = send_job(workers, sock, flags, flag_count, src, mod_dir);
+    if (sent == FORTEAN_WORKER_LOCAL) {
+        status = FORTEAN_WORKER_LOCAL;
+        goto cleanup;
+    }
+    if (sent != 0 || fortean_net_send_all(sock, "end\n", 4) != 0 || fortean_net_recv_line(sock, line, sizeof(line)) <= 0) {
+        goto cleanup;
+    }
+    strip_newline(line);
+    int code = 0;
+    if (sscanf(line, "status %d", &code) != 1) {
+        char msg[1000];
+        snprintf(msg, sizeof(msg), "Worker %s: %s", worker->address, strncmp(line, "error ", 6) == 0 ? line + 6 : line);
+        print_info(msg);
+        goto cleanup;
+    }
+
+    //The compiler output, the object and the modules, then "end".
+    for (;;) {
+        if (fortean_net_recv_line(sock, line, sizeof(line)) <= 0) goto cleanup;
+        strip_newline(line);
+        if (strcmp(line, "end") == 0) break;
+        char kind[16], name[300];
+        long long size = -1;
+        char *data = NULL;
+        int ok = 0;
+        if (sscanf(line, "%15s %299s %lld", kind, name, &size) == 3 && strcmp(kind, "mod") == 0 && plain_name(name)) {
+            data = recv_body(sock, size);
+            ok   = data && write_module(mod_dir, name, data, (size_t)size) == 0;
+        } else if (sscanf(line, "%15s %lld", kind, &size) == 2 && strcmp(kind, "log") == 0) {
+            data = recv_body(sock, size);
+            ok   = data != NULL;
+            if (ok && size > 0) {
+                fwrite(data, 1, (size_t)size, stdout);
+                fflush(stdout);
+            }
+        } else if (sscanf(line, "%15s %lld", kind, &size) == 2 && strcmp(kind, "object") == 0) {
+            data = recv_body(sock, size);
+            ok   = data && write_whole(obj_path, data, (size_t)size) == 0;
+        }
+        free(data);
+        if (!ok) goto cleanup;
+    }
+    status = code;
+
+cleanup:
+    fortean_net_close(sock);
+    return status;
+}
+
+//The server side
+
+typedef struct {
+    char name[80];
+    unsigned long long fingerprint;
+} known_compiler_t;
+
+#define WORKER_MAX_COMPILERS 8
+
+//One of the slots of fortean worker, taking connections one after another
+typedef struct {
+    fortean_socket_t server;
+    int slot;
+    int slots;
+    char dir[1024];                   // Where the jobs of this slot are compiled
+    const known_compiler_t *known;    // The --compiler list, fingerprinted at the start
+    int known_count;
+} worker_slot_t;
+
+static const known_compiler_t *find_known(const worker_slot_t *ws, const char *compiler) {
+    for (int i = 0; i < ws->known_count; i++) {
+        if (strcmp(ws->known[i].name, compiler) == 0) return &ws->known[i];
+    }
+    return NULL;
+}
+
+//Compiler name and fingerprint of a hello or job line. Returns 0 when it is one of the
+//compilers the worker was started with, in the same version, otherwise the answer is sent.
+static int check_compiler(worker_slot_t *ws, fortean_socket_t sock, const char *compiler, const char *fingerprint) {
+    char answer[300];
+    const known_compiler_t *known = find_known(ws, compiler);
+    if (!known) {
+        snprintf(answer, sizeof(answer), "error %.80s is not one of the compilers of the worker\n", compiler);
+    } else if (strtoull(fingerprint, NULL, 16) != known->fingerprint) {
+        snprintf(answer, sizeof(answer), "error %s is another version or not installed on the worker\n", compiler);
+    } else {
+        return 0;
+    }
+    fortean_net_send_all(sock, answer, strlen(answer));
+    return -1;
+}
+
+//Names of the files a job wrote, removed when it is done
+typedef struct {
+    char paths[64][1400];
+    int count;
+} job_files_t;
+
+static void add_job_file(job_files_t *files, const char *path) {
+    if (files->count < 64) snprintf(files->paths[files->count++], sizeof(files->paths[0]), "%s", path);
+}
+
+static int run_job(worker_slot_t *ws, fortean_socket_t sock, const char *compiler) {
+    job_files_t *files = calloc(1, sizeof(job_files_t));
+    if (!files) return -1;
+    fortean_cmd_t cmd;
+    fortean_cmd_init(&cmd, compiler);
+    cmd.response_file = 1;
+    cmd.cwd           = ws->dir;
+
+    char source[300] = "";
+    char line[1100], path[1400];
+    int res = 0;
+    int refused = 0;
+    double start = fortean_wall_time();
+    for (;;) {
+        if (fortean_net_recv_line(sock, line, sizeof(line)) <= 0) {
+            res = -1;
+            break;
+        }
+        strip_newline(line);
+        if (strcmp(line, "end") == 0) break;
+        if (strncmp(line, "flag ", 5) == 0) {
+            if (!worker_takes_flag(line + 5)) {
+                char answer[1200];
+                snprintf(answer, sizeof(answer), "error the worker does not take the flag %s\n", line + 5);
+                fortean_net_send_all(sock, answer, strlen(answer));
+                refused = 1;
+                res     = -1;
+                break;
+            }
+            fortean_cmd_add(&cmd, line + 5);
+            continue;
+        }
+        char kind[16], name[300];
+        long long size = -1;
+        if (sscanf(line, "%15s %299s %lld", kind, name, &size) != 3 || !plain_name(name)) {
+            res = -1;
+            break;
+        }
+        char *data = recv_body(sock, size);
+        if (!data) {
+            res = -1;
+            break;
+        }
+        //Only the files of the job are read: no preprocessor and no include of another path.
+        const char *why = NULL;
+        if (strcmp(kind, "source") == 0 && !fortran_source_name(name)) why = "is not a Fortran source without the preprocessor";
+        else if (strcmp(kind, "mod") != 0 && includes_outside_job(data, (size_t)size)) why = "includes a file outside the job";
+        if (why) {
+            char answer[600];
+            snprintf(answer, sizeof(answer), "error %s %s\n", name, why);
+            fortean_net_send_all(sock, answer, strlen(answer));
+            free(data);
+            refused = 1;
+            res     = -1;
+            break;
+        }
+        if (strcmp(kind, "mod") == 0) snprintf(path, sizeof(path), "%s%cmod%c%s", ws->dir, PATH_SEP, PATH_SEP, name);
+        else                          snprintf(path, sizeof(path), "%s%c%s", ws->dir, PATH_SEP, name);
+        if (strcmp(kind, "source") == 0) snprintf(source, sizeof(source), "%s", name);
+        int written = write_whole(path, data, (size_t)size) == 0;
+        free(data);
+        if (!written) {
+            res = -1;
+            break;
+        }
+        add_job_file(files, path);
+    }
+
+    char log[1100], obj[1100];
+    snprintf(log, sizeof(log), "%s%cjob.log", ws->dir, PATH_SEP);
+    snprintf(obj, sizeof(obj), "%s%cjob.o", ws->dir, PATH_SEP);
+    if (res == 0 && source[0]) {
+        const fortean_compiler_t *cc = fortean_compiler_lookup(compiler);
+        fortean_compiler_add_module_dir(cc, &cmd, "mod");
+        fortean_cmd_add(&cmd, "-Imod");
+        fortean_cmd_add(&cmd, "-c");
+        fortean_cmd_add(&cmd, source);
+        fortean_cmd_add(&cmd, "-o");
+        fortean_cmd_add(&cmd, "job.o");
+        cmd.log = log;
+        add_job_file(files, log);
+        add_job_file(files, obj);
+        int status = fortean_cmd_run(&cmd);
+
+        snprintf(line, sizeof(line), "status %d\n", status);
+        res = fortean_net_send_all(sock, line, strlen(line));
+        if (res == 0) res = send_file(sock, "log", NULL, log);
+        if (res == 0 && status == 0) res = send_file(sock, "object", NULL, obj);
+
+        //The modules the source defines, also removed after a failed compile
+        fortean_fscan_t scan;
+        snprintf(path, sizeof(path), "%s%c%s", ws->dir, PATH_SEP, source);
+        if (fortean_fscan_file(path, &scan) == 0) {
+            for (int i = 0; i < scan.module_count; i++) {
+                char mod[300];
+                snprintf(mod, sizeof(mod), "%s.mod", scan.modules[i]);
+                snprintf(path, sizeof(path), "%s%cmod%c%s", ws->dir, PATH_SEP, PATH_SEP, mod);
+                add_job_file(files, path);
+                if (res == 0 && status == 0 && plain_name(mod)) res = send_file(sock, "mod", mod, path);
+            }
+            fortean_fscan_free(&scan);
+        }
+        if (res == 0) res = fortean_net_send_all(sock, "end\n", 4);
+
+        char msg[600];
+        snprintf(msg, sizeof(msg), "%s %s in %.2f s (slot %d)", status == 0 ? "Compiled" : "Failed to compile",
+                 source, fortean_wall_time() - start, ws->slot + 1);
+        if (status == 0) print_info(msg);
+        else             print_error(msg);
+        fflush(stdout);
+    } else if (!refused) {
+        fortean_net_send_all(sock, "error incomplete job\n", 21);
+    }
+
+    for (int i = 0; i < files->count; i++) remove(files->paths[i]);
+    fortean_cmd_free(&cmd);
+    free(files);
+    return res;
+}
+
+static void slot_worker(void *arg) {
+    worker_slot_t *ws = (worker_slot_t *)arg;
+    for (;;) {
+        //A client that stops sending is dropped after a minute.
+        fortean_socket_t sock = fortean_net_accept(ws->server, 60000);
+        if (sock == FORTEAN_NO_SOCKET) continue;
+        char line[300], command[16], compiler[80], fingerprint[32];
+        if (fortean_net_recv_line(sock, line, sizeof(line)) > 0 &&
+            sscanf(line, "%15s %79s %31s", command, compiler, fingerprint) == 3 &&
+            check_compiler(ws, sock, compiler, fingerprint) == 0) {
+            if (strcmp(command, "hello") == 0) {
+                snprintf(line, sizeof(line), "ok %d\n", ws->slots);
+                fortean_net_send_all(sock, line, strlen(line));
+            } else if (strcmp(command, "job") == 0) {
+                run_job(ws, sock, compiler);
+            }
+        }
+        fortean_net_close(sock);
+    }
+}
+
+int fortean_worker_serve(const char *address, int slots, const char *compilers) {
+    //Only the compilers given at the start are run, each fingerprinted once.
+    known_compiler_t known[WORKER_MAX_COMPILERS];
+    int known_count = 0;
+    char names[400] = "";
+    for (const char *p = compilers; *p;) {
+        size_t len = strcspn(p, ",");
+        char name[80];
+        snprintf(name, sizeof(name), "%.*s", (int)(len < sizeof(name) ? len : sizeof(name) - 1), p);
+        char *path = plain_name(name) && len < sizeof(name) ? fortean_find_program(name) : NULL;
+        char msg[300];
+        if (!path) {
+            snprintf(msg, sizeof(msg), "%s is not a compiler installed here, leaving it out.", name);
+            print_info(msg);
+        } else if (known_count < WORKER_MAX_COMPILERS) {
+            snprintf(known[known_count].name, sizeof(known[0].name), "%s", name);
+            known[known_count++].fingerprint = fortean_compiler_fingerprint(name);
+            snprintf(names + strlen(names), sizeof(names) - strlen(names), "%s%s", known_count > 1 ? ", " : "", name);
+        }
+        free(path);
+        p += len;
+        if (*p == ',') p++;
+    }
+    if (known_count == 0) {
+        print_error("No compiler to run. Syntax is \"fortean worker --compiler gfortran,ifx\"");
+        return -1;
+    }
+
+    fortean_socket_t server = fortean_net_listen(address);
+    if (server == FORTEAN_NO_SOCKET) {
+        char msg[400];
+        snprintf(msg, sizeof(msg), "Can't listen on %s.", address);
+        print_error(msg);
+        return -1;
+    }
+
+    const char *tmp = getenv("TMPDIR");
+#ifdef _WIN32
+    char tmp_buf[MAX_PATH];
+    if (GetTempPathA(sizeof(tmp_buf), tmp_buf) > 0) tmp = tmp_buf;
+#endif
+    if (!tmp || !tmp[0]) tmp = "/tmp";
+
+    worker_slot_t *ws = calloc(slots, sizeof(worker_slot_t));
+    thread_t *threads = calloc(slots, sizeof(thread_t));
+    if (!ws || !threads) {
+        print_error("Memory allocation error.");
+        free(ws);
+        free(threads);
+        fortean_net_close(server);
+        return -1;
+    }
+    for (int i = 0; i < slots; i++) {
+        ws[i].server = server;
+        ws[i].slot   = i;
+        ws[i].slots  = slots;
+        ws[i].known       = known;
+        ws[i].known_count = known_count;
+        snprintf(ws[i].dir, sizeof(ws[i].dir), "%s%cfortean-worker-%d-%d", tmp, PATH_SEP, (int)getpid(), i);
+        char mod[1100];
+        snprintf(mod, sizeof(mod), "%s%cmod", ws[i].dir, PATH_SEP);
+        MAKE_DIR(ws[i].dir);
+        MAKE_DIR(mod);
+    }
+
+    char msg[1000];
+    snprintf(msg, sizeof(msg), "Worker listening on %s with %d slots for %s", address, slots, names);
+    print_ok(msg);
+    fflush(stdout);
+
+    //Every slot waits for its own connections, so at most slots jobs run at once.
+    int started = 0;
+    for (; started < slots; started++) {
+        if (thread_create(&threads[started], slot_worker, &ws[started]) != 0) break;
+    }
+    if (started == 0) slot_worker(&ws[0]);
+    for (int i = 0; i < started; i++) thread_join(threads[i]);
+    free(ws);
+    free(threads);
+    fortean_net_close(server);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FORTEAN_WORKER_H
+#define FORTEAN_WORKER_H
+
+#include "fortean_toml.h"
+
+//Compiles sent to fortean worker daemons on other machines (or this one), one
+//connection per job. A job carries the source, run through the preprocessor here when
+//it needs one, the files it includes, the .mod files it uses, the flags and the
+//fingerprint of the compiler. The answer carries the exit code, the compiler output,
+//the object and the modules the source defines.
+
+//fortean_worker_compile couldn't get the job compiled there, so it runs locally
+#define FORTEAN_WORKER_LOST (-1000)
+
+//The job reads files only this machine has (profile data and the like), so it runs locally
+#define FORTEAN_WORKER_LOCAL (-1001)
+
+typedef struct {
+    char address[300];       // host:port or unix:/path
+    int slots;               // Jobs it compiles at once
+    int timeout_ms;          // For a whole job, the compile included
+    int down;                // Stopped answering, not sent more jobs this build
+    int jobs;                // Compiled there this build
+    int retried;             // Sent there but compiled locally
+    double seconds;
+} fortean_worker_t;
+
+typedef struct {
+    fortean_worker_t *list;
+    int count;
+    const char *compiler;
+    unsigned long long fingerprint;
+} fortean_workers_t;
+
+//Read the [[worker]] tables and ask each worker how many jobs it takes, leaving out
+//the ones that don't answer or run another compiler. Returns the number of worker
+//slots, 0 when none can be used (workers is then empty).
+int fortean_workers_open(fortean_workers_t *workers, fortean_toml_t *cfg, const char *compiler);
+
+//Print what every worker compiled and free them
+void fortean_workers_close(fortean_workers_t *workers);
+
+//Compile src into obj_path on worker w. The modules it uses are read from mod_dir or
+//the -I directories of flags and the ones it defines are written to mod_dir. Returns
+//the exit code of the compiler, or FORTEAN_WORKER_LOST or FORTEAN_WORKER_LOCAL when
+//it has to run locally.
+int fortean_worker_compile(const fortean_workers_t *workers, int w, char **flags, int flag_count,
+                           const char *src, const char *obj_path, const char *mod_dir);
+
+//fortean worker: compile the jobs received on address, up to slots at once, until stopped.
+//Only the compilers of the comma separated list are run. Returns -1 if it can't listen
+//or none of them is installed.
+int fortean_worker_serve(const char *address, int slots, const char *compilers);
+
+#endif // FORTEAN_WORKER_H